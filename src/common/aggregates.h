@@ -0,0 +1,281 @@
+/**
+ * Per-superblock aggregates of the results.
+ *
+ * For every superblock (2^20 tasks), the aggregates file holds the number
+ * of the tasks with a result, the sums of their checksums, user times and
+ * overflow counters, and the number of the tasks with the maximum value
+ * offset (the candidates of find-maxima). The server updates the aggregate
+ * together with the record of each returned result (the old values are
+ * subtracted, the new ones added), so the totals can be reported without
+ * reading the records. The sums wrap around modulo 2^64.
+ *
+ * The file starts with a header. The clean flag is cleared while a server
+ * has the file open for writing and set again once it has synced both the
+ * records and the aggregates; after a crash, the aggregates may be stale
+ * and have to be rebuilt from the records.
+ */
+
+#ifndef AGGREGATES_AGGREGATES_H_
+#define AGGREGATES_AGGREGATES_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "compat.h"
+
+#define AGGREGATES_MAGIC UINT64_C(0x41474752) /* "AGGR" */
+#define AGGREGATES_VERSION 1
+
+/* tasks per superblock */
+#define AGGREGATES_SB_LOG2 20
+
+struct aggregate {
+	uint64_t complete; /* tasks with a checksum */
+	uint64_t checksum; /* the sum of the checksums */
+	uint64_t timed; /* tasks with a user time */
+	uint64_t usertime; /* the sum of the user times */
+	uint64_t overflowed; /* tasks with some overflows */
+	uint64_t overflow; /* the sum of the overflow counters */
+	uint64_t mxoffsets; /* tasks with a maximum value offset */
+	uint64_t reserved;
+};
+
+struct aggregates_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t superblocks;
+	uint64_t clean;
+	uint64_t reserved[4];
+};
+
+struct aggregates {
+	int writable;
+	uint64_t superblocks;
+	struct aggregates_header *header;
+	struct aggregate *sbs;
+	unsigned char *dirty; /* in memory only, see aggregates_touch() */
+};
+
+#define AGGREGATES_SIZE(superblocks) (sizeof(struct aggregates_header) + (size_t)(superblocks) * sizeof(struct aggregate))
+
+/* the aggregates are fine */
+#define AGGREGATES_OK 0
+/* the file has been created (or it was invalid), all superblocks have to be rebuilt */
+#define AGGREGATES_NEW 1
+/* the server did not close the file, the aggregates may be stale */
+#define AGGREGATES_UNCLEAN 2
+
+/*
+ * Maps the file. Returns one of the values above, or -1 if the file cannot
+ * be used (when opened for reading, also if it is missing or invalid).
+ */
+UNUSED
+static int aggregates_open(struct aggregates *as, const char *path, uint64_t superblocks, int writable)
+{
+	size_t size = AGGREGATES_SIZE(superblocks);
+	struct stat st;
+	int fd;
+	void *ptr;
+	int r = AGGREGATES_OK;
+
+	as->writable = writable;
+	as->superblocks = superblocks;
+	as->header = NULL;
+	as->sbs = NULL;
+	as->dirty = NULL;
+
+	fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0600);
+
+	if (fd < 0) {
+		if (writable || errno != ENOENT) {
+			perror("open");
+		}
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.st_size != size) {
+		if (!writable) {
+			close(fd);
+			return -1;
+		}
+
+		/* the contents do not matter, everything is rebuilt */
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)size) < 0) {
+			perror("ftruncate");
+			close(fd);
+			return -1;
+		}
+	}
+
+	ptr = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (ptr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	as->header = ptr;
+	as->sbs = (struct aggregate *)(as->header + 1);
+
+	if (as->header->magic != AGGREGATES_MAGIC || as->header->version != AGGREGATES_VERSION || as->header->superblocks != superblocks) {
+		if (!writable) {
+			munmap(ptr, size);
+			return -1;
+		}
+
+		memset(ptr, 0, size);
+
+		as->header->magic = AGGREGATES_MAGIC;
+		as->header->version = AGGREGATES_VERSION;
+		as->header->superblocks = superblocks;
+
+		r = AGGREGATES_NEW;
+	} else if (writable && !as->header->clean) {
+		r = AGGREGATES_UNCLEAN;
+	}
+
+	if (writable) {
+		as->dirty = calloc((size_t)superblocks, 1);
+
+		if (as->dirty == NULL) {
+			munmap(ptr, size);
+			return -1;
+		}
+
+		/* until aggregates_close() */
+		as->header->clean = 0;
+		msync(ptr, size, MS_SYNC);
+	}
+
+	return r;
+}
+
+UNUSED
+static void aggregates_sync(struct aggregates *as)
+{
+	if (as->header != NULL) {
+		msync(as->header, AGGREGATES_SIZE(as->superblocks), MS_SYNC);
+	}
+}
+
+/* the records must be synced before, the aggregates are clean then */
+UNUSED
+static void aggregates_close(struct aggregates *as)
+{
+	if (as->header == NULL) {
+		return;
+	}
+
+	if (as->writable) {
+		aggregates_sync(as);
+		as->header->clean = 1;
+		aggregates_sync(as);
+	}
+
+	munmap(as->header, AGGREGATES_SIZE(as->superblocks));
+	free(as->dirty);
+
+	as->header = NULL;
+	as->sbs = NULL;
+	as->dirty = NULL;
+}
+
+/* the aggregate of the superblock of the task n */
+UNUSED
+static struct aggregate *aggregates_at(struct aggregates *as, uint64_t n)
+{
+	return as->sbs + (n >> AGGREGATES_SB_LOG2);
+}
+
+/* adds (sign > 0) or subtracts (sign < 0) the result */
+UNUSED
+static void aggregate_add(struct aggregate *a, uint64_t checksum, uint64_t usertime, uint64_t overflow, uint64_t mxoffset, int sign)
+{
+	uint64_t one = sign < 0 ? UINT64_MAX : 1; /* -1 modulo 2^64 */
+
+	a->complete += (checksum != 0) * one;
+	a->checksum += checksum * one;
+	a->timed += (usertime != 0) * one;
+	a->usertime += usertime * one;
+	a->overflowed += (overflow != 0) * one;
+	a->overflow += overflow * one;
+	a->mxoffsets += (mxoffset != 0) * one;
+}
+
+UNUSED
+static void aggregate_merge(struct aggregate *a, const struct aggregate *b)
+{
+	a->complete += b->complete;
+	a->checksum += b->checksum;
+	a->timed += b->timed;
+	a->usertime += b->usertime;
+	a->overflowed += b->overflowed;
+	a->overflow += b->overflow;
+	a->mxoffsets += b->mxoffsets;
+}
+
+UNUSED
+static int aggregate_equal(const struct aggregate *a, const struct aggregate *b)
+{
+	return a->complete == b->complete
+		&& a->checksum == b->checksum
+		&& a->timed == b->timed
+		&& a->usertime == b->usertime
+		&& a->overflowed == b->overflowed
+		&& a->overflow == b->overflow
+		&& a->mxoffsets == b->mxoffsets;
+}
+
+/* the totals of the superblocks [sb, end) */
+UNUSED
+static void aggregates_sum(const struct aggregates *as, uint64_t sb, uint64_t end, struct aggregate *total)
+{
+	memset(total, 0, sizeof(struct aggregate));
+
+	for (; sb < end && sb < as->superblocks; ++sb) {
+		aggregate_merge(total, as->sbs + sb);
+	}
+}
+
+/* the record of the task n has been changed behind the aggregates (e.g., by replaying a log) */
+UNUSED
+static void aggregates_touch(struct aggregates *as, uint64_t n)
+{
+	if (as->dirty != NULL) {
+		as->dirty[n >> AGGREGATES_SB_LOG2] = 1;
+	}
+}
+
+UNUSED
+static int aggregates_dirty(const struct aggregates *as, uint64_t sb)
+{
+	return as->dirty != NULL && as->dirty[sb];
+}
+
+/* the superblock has been rebuilt */
+UNUSED
+static void aggregates_set(struct aggregates *as, uint64_t sb, const struct aggregate *a)
+{
+	as->sbs[sb] = *a;
+
+	if (as->dirty != NULL) {
+		as->dirty[sb] = 0;
+	}
+}
+
+#endif /* AGGREGATES_AGGREGATES_H_ */
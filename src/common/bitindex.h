@@ -0,0 +1,169 @@
+/**
+ * Hierarchical index over a bitmap.
+ *
+ * The bitmap is addressed by bytes (bit n is the bit n&7 of the byte n>>3),
+ * which is the layout of the *.map files. Level 0 is the bitmap itself,
+ * read as 64-bit words. The bit w of the level l+1 is set if and only if
+ * the word w of the level l is all ones. Finding the first zero bit then
+ * takes a few word operations per level instead of a bit-by-bit scan.
+ */
+
+#ifndef BITINDEX_BITINDEX_H_
+#define BITINDEX_BITINDEX_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "compat.h"
+
+#define BITINDEX_MAX_LEVELS 8
+
+struct bitindex {
+	uint64_t size; /* in bits */
+	int levels;
+	uint64_t nwords[BITINDEX_MAX_LEVELS];
+	uint64_t *words[BITINDEX_MAX_LEVELS];
+};
+
+/* the map must be 8-byte aligned (e.g. mmapped) and padded to whole words */
+UNUSED
+static int bitindex_init(struct bitindex *bi, void *map, uint64_t size)
+{
+	uint64_t one = 1;
+	int l;
+
+	/* the byte layout matches the word layout on little-endian only */
+	assert(*(unsigned char *)&one == 1);
+
+	assert(bi != NULL);
+	assert(map != NULL);
+
+	bi->size = size;
+	bi->levels = 1;
+	bi->nwords[0] = (size + 63) >> 6;
+	bi->words[0] = map;
+
+	for (l = 1; bi->nwords[l - 1] > 1; ++l) {
+		uint64_t w;
+
+		assert(l < BITINDEX_MAX_LEVELS);
+
+		bi->nwords[l] = (bi->nwords[l - 1] + 63) >> 6;
+		bi->words[l] = calloc((size_t)bi->nwords[l], sizeof(uint64_t));
+
+		if (bi->words[l] == NULL) {
+			return -1;
+		}
+
+		bi->levels = l + 1;
+
+		for (w = 0; w < bi->nwords[l - 1]; ++w) {
+			if (bi->words[l - 1][w] == UINT64_MAX) {
+				bi->words[l][w >> 6] |= UINT64_C(1) << (w & 63);
+			}
+		}
+	}
+
+	return 0;
+}
+
+UNUSED
+static void bitindex_free(struct bitindex *bi)
+{
+	int l;
+
+	for (l = 1; l < bi->levels; ++l) {
+		free(bi->words[l]);
+	}
+
+	bi->levels = 1;
+}
+
+UNUSED
+static int bitindex_get(const struct bitindex *bi, uint64_t n)
+{
+	return (int)((bi->words[0][n >> 6] >> (n & 63)) & 1);
+}
+
+UNUSED
+static void bitindex_set(struct bitindex *bi, uint64_t n)
+{
+	int l;
+
+	for (l = 0; l < bi->levels; ++l) {
+		uint64_t *w = bi->words[l] + (n >> 6);
+
+		*w |= UINT64_C(1) << (n & 63);
+
+		/* the word is not full, nothing changes above */
+		if (*w != UINT64_MAX) {
+			break;
+		}
+
+		n >>= 6;
+	}
+}
+
+UNUSED
+static void bitindex_clear(struct bitindex *bi, uint64_t n)
+{
+	int l;
+
+	for (l = 0; l < bi->levels; ++l) {
+		uint64_t *w = bi->words[l] + (n >> 6);
+		uint64_t old = *w;
+
+		*w &= ~(UINT64_C(1) << (n & 63));
+
+		/* the word was not full, nothing changes above */
+		if (old != UINT64_MAX) {
+			break;
+		}
+
+		n >>= 6;
+	}
+}
+
+/* the first zero bit >= n at the level l, or the number of bits at that level */
+UNUSED
+static uint64_t bitindex_find_zero_level(const struct bitindex *bi, int l, uint64_t n)
+{
+	uint64_t nbits = bi->nwords[l] << 6;
+
+	while (n < nbits) {
+		uint64_t w = n >> 6;
+		uint64_t z = ~bi->words[l][w] & (UINT64_MAX << (n & 63));
+
+		if (z != 0) {
+			return (w << 6) + ctzu64(z);
+		}
+
+		/* skip the words that are all ones */
+		if (l + 1 < bi->levels) {
+			w = bitindex_find_zero_level(bi, l + 1, w + 1);
+		} else {
+			w = w + 1;
+		}
+
+		n = w << 6;
+	}
+
+	return nbits;
+}
+
+/* the first zero bit >= n, or the size of the bitmap if there is none */
+UNUSED
+static uint64_t bitindex_find_zero(const struct bitindex *bi, uint64_t n)
+{
+	uint64_t r;
+
+	if (n >= bi->size) {
+		return bi->size;
+	}
+
+	r = bitindex_find_zero_level(bi, 0, n);
+
+	return r < bi->size ? r : bi->size;
+}
+
+#endif /* BITINDEX_BITINDEX_H_ */
@@ -24,6 +24,15 @@ static int ctzu64(uint64_t n)
 	}
 }
 
+UNUSED
+static int popcountu64(uint64_t n)
+{
+	switch (sizeof(uint64_t)) {
+		case sizeof(unsigned long): return __builtin_popcountl((unsigned long)n);
+		default: __builtin_trap();
+	}
+}
+
 #include <stdlib.h>
 
 UNUSED
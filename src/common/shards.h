@@ -0,0 +1,68 @@
+/**
+ * The shards of a sharded server deployment.
+ *
+ * Each server process owns a disjoint range of the task IDs (the -s option
+ * of the server). The clients get the list of the shards from the
+ * SERVER_SHARDS environment variable, "host:port,host:port,...".
+ */
+
+#ifndef SHARDS_SHARDS_H_
+#define SHARDS_SHARDS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+
+#define SHARDS_MAX 64
+
+struct shard {
+	char name[256];
+	uint16_t port;
+};
+
+/* returns the number of the shards, or -1 if the list is malformed */
+UNUSED
+static int shards_parse(const char *list, struct shard shards[], uint16_t default_port)
+{
+	int n = 0;
+
+	while (*list != 0) {
+		const char *end = strchr(list, ',');
+		size_t len = end != NULL ? (size_t)(end - list) : strlen(list);
+		char *colon;
+
+		if (n == SHARDS_MAX || len == 0 || len >= sizeof(shards[n].name)) {
+			return -1;
+		}
+
+		memcpy(shards[n].name, list, len);
+		shards[n].name[len] = 0;
+		shards[n].port = default_port;
+
+		colon = strchr(shards[n].name, ':');
+
+		if (colon != NULL) {
+			unsigned long port = strtoul(colon + 1, NULL, 10);
+
+			if (port == 0 || port > 65535) {
+				return -1;
+			}
+
+			*colon = 0;
+			shards[n].port = (uint16_t)port;
+		}
+
+		n++;
+
+		list += len;
+
+		if (*list == ',') {
+			list++;
+		}
+	}
+
+	return n;
+}
+
+#endif /* SHARDS_SHARDS_H_ */
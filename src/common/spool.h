@@ -0,0 +1,300 @@
+/**
+ * A durable spool of the results not yet returned to the server.
+ *
+ * The client appends each result to the spool file before it tries to
+ * return it. A record is a header (SPOOL_MAGIC and the number of the
+ * words), the words, and the FNV-1a hash of both; it is written with a
+ * single write(2) and synced. Any number of the clients (also on other
+ * hosts sharing the file system) may append to the same spool.
+ *
+ * Flushing renames the spool to a unique name (so the appending goes on
+ * into a new file), sends the records of the taken file in batches, and
+ * removes the file once everything has been sent. Any client flushes all
+ * the taken files it finds (locking each of them while sending), so the
+ * files left by a client that died (e.g., at the end of its walltime) are
+ * picked up by the next client started on the same file system. The
+ * records may be sent more than once, the server ignores the duplicates.
+ */
+
+#ifndef SPOOL_SPOOL_H_
+#define SPOOL_SPOOL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "compat.h"
+
+#define SPOOL_MAGIC UINT64_C(0x53504f4f) /* "SPOO" */
+#define SPOOL_WORDS_MAX 16
+#define SPOOL_BATCH 256
+
+/* sends count records of nwords words each, returns 0 on success */
+typedef int (*spool_send_t)(int count, int nwords, const uint64_t records[], void *arg);
+
+UNUSED
+static uint64_t spool_hash(const uint64_t words[], int n)
+{
+	const unsigned char *p = (const unsigned char *)words;
+	uint64_t h = UINT64_C(14695981039346656037);
+	size_t i;
+
+	for (i = 0; i < sizeof(uint64_t) * (size_t)n; ++i) {
+		h ^= p[i];
+		h *= UINT64_C(1099511628211);
+	}
+
+	return h;
+}
+
+/* opens and locks the spool, unless it has been taken meanwhile */
+UNUSED
+static int spool_open_locked(const char *path)
+{
+	for (;;) {
+		struct stat fd_stat, path_stat;
+		int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+		if (fd < 0) {
+			return -1;
+		}
+
+		if (flock(fd, LOCK_EX) < 0 || fstat(fd, &fd_stat) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		if (stat(path, &path_stat) == 0 && path_stat.st_ino == fd_stat.st_ino && path_stat.st_dev == fd_stat.st_dev) {
+			return fd;
+		}
+
+		close(fd);
+	}
+}
+
+/* appends count records of nwords words each, returns once they are on the disk */
+UNUSED
+static int spool_append(const char *path, int count, int nwords, const uint64_t records[])
+{
+	uint64_t *buffer;
+	size_t size = sizeof(uint64_t) * (size_t)count * (size_t)(nwords + 2);
+	int fd;
+	int i;
+	int r = 0;
+
+	if (nwords < 1 || nwords > SPOOL_WORDS_MAX) {
+		return -1;
+	}
+
+	buffer = malloc(size);
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		uint64_t *record = buffer + (size_t)i * (nwords + 2);
+
+		record[0] = (SPOOL_MAGIC << 32) | (uint64_t)nwords;
+		memcpy(record + 1, records + (size_t)i * nwords, sizeof(uint64_t) * nwords);
+		record[nwords + 1] = spool_hash(record, nwords + 1);
+	}
+
+	fd = spool_open_locked(path);
+
+	if (fd < 0) {
+		free(buffer);
+		return -1;
+	}
+
+	if (write(fd, buffer, size) != (ssize_t)size || fsync(fd) < 0) {
+		r = -1;
+	}
+
+	close(fd);
+	free(buffer);
+
+	return r;
+}
+
+/*
+ * Sends the records of the taken file. Returns 0 if the file can be
+ * removed, -1 otherwise. The records behind a damaged one (e.g., torn by a
+ * crash) cannot be found; they are counted in *damaged as the bytes.
+ */
+UNUSED
+static int spool_send_file(int fd, int nwords, spool_send_t send, void *arg, size_t *sent, size_t *damaged)
+{
+	struct stat st;
+	uint64_t *words;
+	uint64_t *batch;
+	size_t len;
+	size_t pos = 0;
+	int count = 0;
+
+	if (fstat(fd, &st) < 0) {
+		return -1;
+	}
+
+	len = (size_t)st.st_size / sizeof(uint64_t);
+
+	words = malloc(sizeof(uint64_t) * (len + 1));
+	batch = malloc(sizeof(uint64_t) * SPOOL_BATCH * nwords);
+
+	if (words == NULL || batch == NULL || pread(fd, words, sizeof(uint64_t) * len, 0) != (ssize_t)(sizeof(uint64_t) * len)) {
+		free(words);
+		free(batch);
+		return -1;
+	}
+
+	while (pos < len) {
+		int n = (int)(words[pos] & 0xffffffff);
+
+		if (words[pos] >> 32 != SPOOL_MAGIC || n != nwords || pos + n + 2 > len || words[pos + n + 1] != spool_hash(words + pos, n + 1)) {
+			*damaged += (size_t)st.st_size - sizeof(uint64_t) * pos;
+			break;
+		}
+
+		memcpy(batch + (size_t)count * nwords, words + pos + 1, sizeof(uint64_t) * nwords);
+		count++;
+		pos += n + 2;
+
+		if (count == SPOOL_BATCH || pos >= len) {
+			if (send(count, nwords, batch, arg) < 0) {
+				free(words);
+				free(batch);
+				return -1;
+			}
+
+			*sent += count;
+			count = 0;
+		}
+	}
+
+	if (count > 0) {
+		if (send(count, nwords, batch, arg) < 0) {
+			free(words);
+			free(batch);
+			return -1;
+		}
+
+		*sent += count;
+	}
+
+	free(words);
+	free(batch);
+
+	return 0;
+}
+
+/*
+ * Takes the spool and sends all the taken files not locked by other
+ * clients (including those taken before). Returns the number of the
+ * records sent, or -1 if some of them could not be sent (they remain in
+ * the spool). The damaged bytes are reported in *damaged.
+ */
+UNUSED
+static long spool_flush(const char *path, int nwords, spool_send_t send, void *arg, size_t *damaged)
+{
+	char *dirc = strdup(path);
+	char *basec = strdup(path);
+	const char *dname;
+	const char *bname;
+	char taken[4096];
+	char hostname[256];
+	static unsigned long serial = 0;
+	struct stat st;
+	DIR *dir;
+	struct dirent *entry;
+	size_t sent = 0;
+	int r = 0;
+
+	*damaged = 0;
+
+	if (dirc == NULL || basec == NULL) {
+		free(dirc);
+		free(basec);
+		return -1;
+	}
+
+	dname = dirname(dirc);
+	bname = basename(basec);
+
+	if (gethostname(hostname, sizeof(hostname)) < 0) {
+		strcpy(hostname, "localhost");
+	}
+	hostname[sizeof(hostname) - 1] = 0;
+
+	/* take the spool, the appending goes on into a new one */
+	if (stat(path, &st) == 0 && st.st_size > 0) {
+		int fd = spool_open_locked(path);
+
+		if (fd >= 0) {
+			sprintf(taken, "%.3800s.%.64s.%ld.%lu", path, hostname, (long)getpid(), serial++);
+
+			if (rename(path, taken) < 0) {
+				r = -1;
+			}
+
+			close(fd);
+		}
+	}
+
+	dir = opendir(dname);
+
+	if (dir == NULL) {
+		free(dirc);
+		free(basec);
+		return -1;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strlen(bname);
+		int fd;
+
+		if (strncmp(entry->d_name, bname, len) != 0 || entry->d_name[len] != '.') {
+			continue;
+		}
+
+		sprintf(taken, "%.3800s/%.255s", dname, entry->d_name);
+
+		fd = open(taken, O_RDWR);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		/* being sent by another client, or removed meanwhile */
+		if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0 || st.st_nlink == 0) {
+			close(fd);
+			continue;
+		}
+
+		if (spool_send_file(fd, nwords, send, arg, &sent, damaged) < 0) {
+			r = -1;
+		} else {
+			unlink(taken);
+		}
+
+		close(fd);
+
+		if (r < 0) {
+			break;
+		}
+	}
+
+	closedir(dir);
+	free(dirc);
+	free(basec);
+
+	return r < 0 ? -1 : (long)sent;
+}
+
+#endif /* SPOOL_SPOOL_H_ */
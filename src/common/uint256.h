@@ -0,0 +1,258 @@
+/**
+ * Support for 256-bit integers.
+ *
+ * The maxima of the trajectories exceed 128 bits, but (for the starting
+ * values below 2^128) not 256 bits. The number is held in four 64-bit
+ * words, the least significant first. The operations that can overflow
+ * return nonzero if they did.
+ */
+
+#ifndef UINT256_UINT256_H_
+#define UINT256_UINT256_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "wideint.h"
+#include "compat.h"
+
+struct uint256 {
+	uint64_t w[4];
+};
+
+UNUSED
+static void uint256_set_u128(struct uint256 *r, uint128_t n)
+{
+	r->w[0] = (uint64_t)n;
+	r->w[1] = (uint64_t)(n >> 64);
+	r->w[2] = 0;
+	r->w[3] = 0;
+}
+
+/* the number fits 128 bits */
+UNUSED
+static int uint256_is_u128(const struct uint256 *n)
+{
+	return n->w[2] == 0 && n->w[3] == 0;
+}
+
+UNUSED
+static uint128_t uint256_get_u128(const struct uint256 *n)
+{
+	return ((uint128_t)n->w[1] << 64) | n->w[0];
+}
+
+UNUSED
+static int uint256_cmp(const struct uint256 *a, const struct uint256 *b)
+{
+	int i;
+
+	for (i = 3; i >= 0; --i) {
+		if (a->w[i] != b->w[i]) {
+			return a->w[i] < b->w[i] ? -1 : +1;
+		}
+	}
+
+	return 0;
+}
+
+UNUSED
+static int uint256_is_odd(const struct uint256 *n)
+{
+	return (int)(n->w[0] & 1);
+}
+
+UNUSED
+static int uint256_is_zero(const struct uint256 *n)
+{
+	return (n->w[0] | n->w[1] | n->w[2] | n->w[3]) == 0;
+}
+
+/* the number of the trailing zeros, 256 for zero */
+UNUSED
+static int uint256_ctz(const struct uint256 *n)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		if (n->w[i] != 0) {
+			return 64 * i + ctzu64(n->w[i]);
+		}
+	}
+
+	return 256;
+}
+
+/* the number of the significant bits, 0 for zero */
+UNUSED
+static int uint256_bitsize(const struct uint256 *n)
+{
+	int i;
+
+	for (i = 3; i >= 0; --i) {
+		if (n->w[i] != 0) {
+			return 64 * i + 64 - __builtin_clzl((unsigned long)n->w[i]);
+		}
+	}
+
+	return 0;
+}
+
+/* n >>= k, for k < 256 */
+UNUSED
+static void uint256_shr(struct uint256 *n, int k)
+{
+	int words = k / 64;
+	int bits = k % 64;
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		uint64_t lo = i + words < 4 ? n->w[i + words] : 0;
+		uint64_t hi = i + words + 1 < 4 ? n->w[i + words + 1] : 0;
+
+		n->w[i] = bits == 0 ? lo : (lo >> bits) | (hi << (64 - bits));
+	}
+}
+
+/* n = n * m + a */
+UNUSED
+static int uint256_mul_add_u64(struct uint256 *n, uint64_t m, uint64_t a)
+{
+	uint128_t carry = a;
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		uint128_t t = (uint128_t)n->w[i] * m + carry;
+
+		n->w[i] = (uint64_t)t;
+		carry = t >> 64;
+	}
+
+	return carry != 0;
+}
+
+/* n += a */
+UNUSED
+static int uint256_add_u64(struct uint256 *n, uint64_t a)
+{
+	return uint256_mul_add_u64(n, 1, a);
+}
+
+/* n -= a */
+UNUSED
+static int uint256_sub_u64(struct uint256 *n, uint64_t a)
+{
+	uint64_t borrow = a;
+	int i;
+
+	for (i = 0; i < 4 && borrow != 0; ++i) {
+		uint64_t w = n->w[i];
+
+		n->w[i] = w - borrow;
+		borrow = w < borrow;
+	}
+
+	return borrow != 0;
+}
+
+/* n /= d, returns the remainder */
+UNUSED
+static uint64_t uint256_div_u64(struct uint256 *n, uint64_t d)
+{
+	uint128_t r = 0;
+	int i;
+
+	for (i = 3; i >= 0; --i) {
+		uint128_t t = (r << 64) | n->w[i];
+
+		n->w[i] = (uint64_t)(t / d);
+		r = t % d;
+	}
+
+	return (uint64_t)r;
+}
+
+/* the decimal representation, the buffer must hold 78 characters + 1 */
+UNUSED
+static char *uint256_to_str(const struct uint256 *n, char *buff)
+{
+	struct uint256 t = *n;
+	char digits[80];
+	int len = 0;
+	int i;
+
+	do {
+		digits[len++] = (char)('0' + uint256_div_u64(&t, 10));
+	} while (!uint256_is_zero(&t));
+
+	for (i = 0; i < len; ++i) {
+		buff[i] = digits[len - 1 - i];
+	}
+
+	buff[len] = 0;
+
+	return buff;
+}
+
+/* the number of the trailing zeros of the nonzero n */
+UNUSED
+static int uint256_ctzu128(uint128_t n)
+{
+	uint64_t lo = (uint64_t)n;
+
+	return lo != 0 ? ctzu64(lo) : 64 + ctzu64((uint64_t)(n >> 64));
+}
+
+/*
+ * The maximum of the trajectory of n0 until it drops below n0. The steps
+ * are taken as (3n+1)/2^k at once, in 128 bits while 3n+1 fits.
+ */
+UNUSED
+static void uint256_get_maximum(struct uint256 *max, uint128_t n0)
+{
+	uint128_t n = n0;
+	uint128_t mx = n0;
+	struct uint256 wide;
+
+	while (n >= n0) {
+		if (n & 1) {
+			if (n > (UINT128_MAX - 1) / 3) {
+				goto wide;
+			}
+
+			n = 3 * n + 1;
+
+			if (n > mx) {
+				mx = n;
+			}
+		}
+
+		n >>= uint256_ctzu128(n);
+	}
+
+	uint256_set_u128(max, mx);
+
+	return;
+
+wide:
+	uint256_set_u128(max, mx);
+	uint256_set_u128(&wide, n);
+
+	while (!uint256_is_u128(&wide) || uint256_get_u128(&wide) >= n0) {
+		if (uint256_is_odd(&wide)) {
+			if (uint256_mul_add_u64(&wide, 3, 1)) {
+				fprintf(stderr, "the trajectory exceeds 256 bits!\n");
+				abort();
+			}
+
+			if (uint256_cmp(&wide, max) > 0) {
+				*max = wide;
+			}
+		}
+
+		uint256_shr(&wide, uint256_ctz(&wide));
+	}
+}
+
+#endif /* UINT256_UINT256_H_ */
@@ -192,35 +192,251 @@ const char *errcode_to_cstr(cl_int errcode)
 static int g_ocl_ver1 = 0;
 static int g_device_index = 0;
 
-int solve(uint64_t task_id, uint64_t task_size)
+/* directory for the compiled program binaries, NULL disables the cache */
+static const char *g_cache_dir = ".";
+
+static cl_device_id g_device;
+static cl_context g_context;
+static cl_command_queue g_command_queue;
+static cl_program g_program;
+static cl_kernel g_kernel;
+static cl_mem g_mem_obj_checksum_alpha;
+static cl_mem g_mem_obj_sieve;
+static cl_mem g_mem_obj_mxoffset;
+
+/* FNV-1a */
+uint64_t hash_update(uint64_t hash, const void *data, size_t size)
 {
-	uint64_t task_units = TASK_UNITS;
-	/* arrays */
-	uint64_t *checksum_alpha;
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		hash ^= (uint64_t)p[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+uint64_t hash_device_info(uint64_t hash, cl_device_id device, cl_device_info param)
+{
+	char info[1024];
+	size_t size = 0;
+
+	if (clGetDeviceInfo(device, param, sizeof(info), info, &size) != CL_SUCCESS) {
+		return hash;
+	}
+
+	return hash_update(hash, info, size);
+}
+
+/* the key covers the device, the driver, the build options, and the program source */
+uint64_t get_program_key(cl_device_id device, const char *options, const char *program_string, size_t program_length)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
 
-	cl_mem mem_obj_checksum_alpha;
+	hash = hash_device_info(hash, device, CL_DEVICE_NAME);
+	hash = hash_device_info(hash, device, CL_DEVICE_VERSION);
+	hash = hash_device_info(hash, device, CL_DRIVER_VERSION);
+	hash = hash_update(hash, options, strlen(options) + 1);
+	hash = hash_update(hash, program_string, program_length);
 
+	return hash;
+}
+
+cl_program load_program_binary(const char *path, const char *options)
+{
+	FILE *fp;
+	long size;
+	unsigned char *binary;
+	size_t length;
+	cl_int status;
 	cl_int ret;
-	cl_platform_id platform_id[64];
-	cl_uint num_platforms;
+	cl_program program;
 
-	cl_device_id *device_id = NULL;
-	cl_uint num_devices;
+	fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) < 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	binary = malloc((size_t)size);
+
+	if (binary == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+
+	length = fread(binary, 1, (size_t)size, fp);
+
+	fclose(fp);
 
-	cl_context context;
+	if (length != (size_t)size) {
+		free(binary);
+		return NULL;
+	}
+
+	program = clCreateProgramWithBinary(g_context, 1, &g_device, &length, (const unsigned char **)&binary, &status, &ret);
+
+	free(binary);
+
+	if (ret != CL_SUCCESS || status != CL_SUCCESS) {
+		printf("[DEBUG] clCreateProgramWithBinary failed with %s\n", errcode_to_cstr(ret != CL_SUCCESS ? ret : status));
+		return NULL;
+	}
 
-	cl_command_queue command_queue;
+	/* even a program created from a binary has to be built */
+	ret = clBuildProgram(program, 1, &g_device, options, NULL, NULL);
 
+	if (ret != CL_SUCCESS) {
+		printf("[DEBUG] clBuildProgram (binary) failed with %s\n", errcode_to_cstr(ret));
+		clReleaseProgram(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+int save_program_binary(cl_program program, const char *path)
+{
+	size_t size;
+	unsigned char *binary;
+	char temp[4096];
+	FILE *fp;
+	cl_int ret;
+
+	ret = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+
+	if (ret != CL_SUCCESS || size == 0) {
+		return -1;
+	}
+
+	binary = malloc(size);
+
+	if (binary == NULL) {
+		return -1;
+	}
+
+	ret = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binary, NULL);
+
+	if (ret != CL_SUCCESS) {
+		free(binary);
+		return -1;
+	}
+
+	/* several gpuworkers may share the cache, write into a private file and rename it */
+	sprintf(temp, "%s.%lu", path, (unsigned long)getpid());
+
+	fp = fopen(temp, "wb");
+
+	if (fp == NULL) {
+		free(binary);
+		return -1;
+	}
+
+	if (fwrite(binary, 1, size, fp) != size) {
+		fclose(fp);
+		remove(temp);
+		free(binary);
+		return -1;
+	}
+
+	free(binary);
+
+	if (fclose(fp) != 0 || rename(temp, path) != 0) {
+		remove(temp);
+		return -1;
+	}
+
+	return 0;
+}
+
+int build_program(const char *options)
+{
 	char *program_string;
 	size_t program_length;
+	char path[4096];
+	cl_int ret;
 
-	cl_program program;
+	program_string = load_source(&program_length);
 
-	cl_kernel kernel;
+	if (program_string == NULL) {
+		printf("[ERROR] load_source failed\n");
+		return -1;
+	}
 
-	size_t global_work_size;
+	if (g_cache_dir != NULL) {
+		sprintf(path, "%s/kernel-%016" PRIx64 ".bin", g_cache_dir, get_program_key(g_device, options, program_string, program_length));
 
-	size_t i;
+		g_program = load_program_binary(path, options);
+
+		if (g_program != NULL) {
+			printf("[DEBUG] program loaded from %s\n", path);
+			free(program_string);
+			return 0;
+		}
+	}
+
+	g_program = clCreateProgramWithSource(g_context, 1, (const char **)&program_string, (const size_t *)&program_length, &ret);
+
+	free(program_string);
+
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clCreateProgramWithSource failed\n");
+		return -1;
+	}
+
+	ret = clBuildProgram(g_program, 1, &g_device, options, NULL, NULL);
+
+	if (ret == CL_BUILD_PROGRAM_FAILURE) {
+		size_t log_size;
+		char *log;
+
+		clGetProgramBuildInfo(g_program, g_device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+
+		log = malloc(log_size);
+
+		if (log != NULL) {
+			clGetProgramBuildInfo(g_program, g_device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+
+			printf("%s\n", log);
+
+			free(log);
+		}
+	}
+
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clBuildProgram failed with %s\n", errcode_to_cstr(ret));
+		return -1;
+	}
+
+	if (g_cache_dir != NULL) {
+		if (save_program_binary(g_program, path) < 0) {
+			printf("[DEBUG] unable to save the program binary into %s\n", path);
+		} else {
+			printf("[DEBUG] program saved into %s\n", path);
+		}
+	}
+
+	return 0;
+}
+
+/* creates the context, the program, and the buffers that are shared by all tasks */
+int init_device(uint64_t task_size)
+{
+	uint64_t task_units = TASK_UNITS;
+
+	cl_int ret;
+	cl_platform_id platform_id[64];
+	cl_uint num_platforms;
+
+	cl_device_id *device_id = NULL;
+	cl_uint num_devices;
 
 	int platform_index = 0;
 	int device_index = g_device_index;
@@ -229,22 +445,10 @@ int solve(uint64_t task_id, uint64_t task_size)
 	char path[4096];
 	size_t k = SIEVE_LOGSIZE;
 	size_t map_size = SIEVE_SIZE;
-	cl_mem mem_obj_sieve;
-
-	uint64_t *mxoffset;
-	cl_mem mem_obj_mxoffset;
 
 	char options[4096];
-
-	assert((uint128_t)task_id <= (UINT128_MAX >> task_size));
-
-	/* informative */
-	printf("RANGE 0x%016" PRIx64 ":%016" PRIx64 " 0x%016" PRIx64 ":%016" PRIx64 "\n",
-		(uint64_t)(((uint128_t)(task_id + 0) << task_size) >> 64),
-		(uint64_t)(((uint128_t)(task_id + 0) << task_size)      ),
-		(uint64_t)(((uint128_t)(task_id + 1) << task_size) >> 64),
-		(uint64_t)(((uint128_t)(task_id + 1) << task_size)      )
-	);
+	const char *arg0;
+	const char *arg1;
 
 	ret = clGetPlatformIDs(0, NULL, &num_platforms);
 
@@ -304,16 +508,9 @@ next_platform:
 	}
 
 	for (; (cl_uint)device_index < num_devices; ++device_index) {
-#ifdef USE_ASYNC_CALL
-		cl_event finished;
-		cl_int info = CL_QUEUED;
-#endif
-		const char *arg0;
-		const char *arg1;
-
 		printf("[DEBUG] device_index = %i...\n", device_index);
 
-		context = clCreateContext(NULL, 1, &device_id[device_index], NULL, NULL, &ret);
+		g_context = clCreateContext(NULL, 1, &device_id[device_index], NULL, NULL, &ret);
 
 		if (ret == CL_INVALID_DEVICE) {
 			continue;
@@ -321,374 +518,463 @@ next_platform:
 
 		if (ret != CL_SUCCESS) {
 			printf("[ERROR] clCreateContext failed with %s\n", errcode_to_cstr(ret));
+			free(device_id);
 			return -1;
 		}
 
-		printf("[DEBUG] context created @ device_index = %i\n", device_index);
-
-#ifdef DEBUG
-		{
-			size_t size;
-			cl_uint uint;
-			cl_ulong ulong;
-
-			ret = clGetDeviceInfo(device_id[device_index], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &size, NULL);
-
-			if (ret != CL_SUCCESS) {
-				return -1;
-			}
+		break;
+	}
 
-			printf("[DEBUG] CL_DEVICE_MAX_WORK_GROUP_SIZE = %lu\n", (unsigned long)size);
+	if ((cl_uint)device_index == num_devices) {
+		printf("NO_GPU_FOUND\n");
+		free(device_id);
+		return -1;
+	}
 
-			ret = clGetDeviceInfo(device_id[device_index], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &uint, NULL);
+	g_device = device_id[device_index];
 
-			if (ret != CL_SUCCESS) {
-				return -1;
-			}
+	free(device_id);
 
-			printf("[DEBUG] CL_DEVICE_MAX_COMPUTE_UNITS = %u\n", (unsigned)uint);
+	printf("[DEBUG] context created @ device_index = %i\n", device_index);
 
-			ret = clGetDeviceInfo(device_id[device_index], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
+#ifdef DEBUG
+	{
+		size_t size;
+		cl_uint uint;
+		cl_ulong ulong;
 
-			if (ret != CL_SUCCESS) {
-				return -1;
-			}
+		ret = clGetDeviceInfo(g_device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &size, NULL);
 
-			printf("[DEBUG] CL_DEVICE_LOCAL_MEM_SIZE = %lu B\n", (unsigned long)ulong);
+		if (ret != CL_SUCCESS) {
+			return -1;
 		}
-#endif
 
-		command_queue = clCreateCommandQueue(context, device_id[device_index], 0, &ret);
+		printf("[DEBUG] CL_DEVICE_MAX_WORK_GROUP_SIZE = %lu\n", (unsigned long)size);
+
+		ret = clGetDeviceInfo(g_device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &uint, NULL);
 
 		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clCreateCommandQueue failed\n");
 			return -1;
 		}
 
-		assert(sizeof(cl_ulong) == sizeof(uint64_t));
+		printf("[DEBUG] CL_DEVICE_MAX_COMPUTE_UNITS = %u\n", (unsigned)uint);
 
-		mem_obj_checksum_alpha = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_ulong) << task_units, NULL, &ret);
+		ret = clGetDeviceInfo(g_device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
 
 		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clCreateBuffer failed\n");
 			return -1;
 		}
 
-		program_string = load_source(&program_length);
+		printf("[DEBUG] CL_DEVICE_LOCAL_MEM_SIZE = %lu B\n", (unsigned long)ulong);
+	}
+#endif
 
-		if (program_string == NULL) {
-			printf("[ERROR] load_source failed\n");
-			return -1;
-		}
+	g_command_queue = clCreateCommandQueue(g_context, g_device, 0, &ret);
+
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clCreateCommandQueue failed\n");
+		return -1;
+	}
 
-		program = clCreateProgramWithSource(context, 1, (const char **)&program_string, (const size_t *)&program_length, &ret);
+	assert(sizeof(cl_ulong) == sizeof(uint64_t));
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clCreateProgramWithSource failed\n");
-			return -1;
-		}
+	g_mem_obj_checksum_alpha = clCreateBuffer(g_context, CL_MEM_WRITE_ONLY, sizeof(cl_ulong) << task_units, NULL, &ret);
+
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clCreateBuffer failed\n");
+		return -1;
+	}
 
-		arg0 =
+	arg0 =
 #ifdef USE_SIEVE3
-			"-D USE_SIEVE3";
+		"-D USE_SIEVE3";
 #elif defined(USE_SIEVE9)
-			"-D USE_SIEVE9";
+		"-D USE_SIEVE9";
 #else
-			"";
+		"";
 #endif
 
-		arg1 =
+	arg1 =
 #ifdef USE_LUT50
-			"-D USE_LUT50";
+		"-D USE_LUT50";
 #else
-			"";
+		"";
 #endif
 
-		sprintf(options, "%s -D SIEVE_LOGSIZE=%i -D USE_LOCAL_SIEVE=%i %s %s",
-			g_ocl_ver1 ? "" : "-cl-std=CL2.0",
-			SIEVE_LOGSIZE,
-			SIEVE_LOGSIZE > 16 ? 0 : 1,
-			arg0,
-			arg1
-		);
+	sprintf(options, "%s -D SIEVE_LOGSIZE=%i -D USE_LOCAL_SIEVE=%i %s %s",
+		g_ocl_ver1 ? "" : "-cl-std=CL2.0",
+		SIEVE_LOGSIZE,
+		SIEVE_LOGSIZE > 16 ? 0 : 1,
+		arg0,
+		arg1
+	);
 
-		printf("[DEBUG] clBuildProgram options: %s\n", options);
+	printf("[DEBUG] clBuildProgram options: %s\n", options);
 
-		ret = clBuildProgram(program, 1, &device_id[device_index], options, NULL, NULL);
+	if (build_program(options) < 0) {
+		return -1;
+	}
 
-		if (ret == CL_BUILD_PROGRAM_FAILURE) {
-			size_t log_size;
-			char *log;
+	g_kernel = clCreateKernel(g_program, "worker", &ret);
 
-			clGetProgramBuildInfo(program, device_id[device_index], CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+	if (ret != CL_SUCCESS) {
+		return -1;
+	}
 
-			log = malloc(log_size);
+#ifdef DEBUG
+	{
+		size_t size;
+		cl_ulong ulong;
 
-			clGetProgramBuildInfo(program, device_id[device_index], CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		ret = clGetKernelWorkGroupInfo(g_kernel, g_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &size, NULL);
 
-			printf("%s\n", log);
+		if (ret != CL_SUCCESS) {
+			printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
+			return -1;
 		}
 
+		printf("[DEBUG] CL_KERNEL_WORK_GROUP_SIZE = %lu\n", (unsigned long)size);
+
+		ret = clGetKernelWorkGroupInfo(g_kernel, g_device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &size, NULL);
+
 		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clBuildProgram failed with %s\n", errcode_to_cstr(ret));
+			printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
 			return -1;
 		}
 
-		kernel = clCreateKernel(program, "worker", &ret);
+		printf("[DEBUG] CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE = %lu\n", (unsigned long)size);
+
+		ret = clGetKernelWorkGroupInfo(g_kernel, g_device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
 
 		if (ret != CL_SUCCESS) {
+			printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
 			return -1;
 		}
 
-#ifdef DEBUG
-		{
-			size_t size;
-			cl_ulong ulong;
+		printf("[DEBUG] CL_KERNEL_PRIVATE_MEM_SIZE = %lu\n", (unsigned long)ulong);
 
-			ret = clGetKernelWorkGroupInfo(kernel, device_id[device_index], CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &size, NULL);
+		ret = clGetKernelWorkGroupInfo(g_kernel, g_device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
 
-			if (ret != CL_SUCCESS) {
-				printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
-				return -1;
-			}
+		if (ret != CL_SUCCESS) {
+			printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
+			return -1;
+		}
 
-			printf("[DEBUG] CL_KERNEL_WORK_GROUP_SIZE = %lu\n", (unsigned long)size);
+		printf("[DEBUG] CL_KERNEL_LOCAL_MEM_SIZE = %lu\n", (unsigned long)ulong);
+	}
+#endif
 
-			ret = clGetKernelWorkGroupInfo(kernel, device_id[device_index], CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &size, NULL);
+	ret = clSetKernelArg(g_kernel, 0, sizeof(cl_mem), (void *)&g_mem_obj_checksum_alpha);
 
-			if (ret != CL_SUCCESS) {
-				printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
-				return -1;
-			}
+	if (ret != CL_SUCCESS) {
+		return -1;
+	}
 
-			printf("[DEBUG] CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE = %lu\n", (unsigned long)size);
+	ret = clSetKernelArg(g_kernel, 3, sizeof(cl_ulong), (void *)&task_units);
 
-			ret = clGetKernelWorkGroupInfo(kernel, device_id[device_index], CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
+	if (ret != CL_SUCCESS) {
+		return -1;
+	}
 
-			if (ret != CL_SUCCESS) {
-				printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
-				return -1;
-			}
+	assert(task_units + 2 <= task_size);
 
-			printf("[DEBUG] CL_KERNEL_PRIVATE_MEM_SIZE = %lu\n", (unsigned long)ulong);
+#ifdef USE_LUT50
+	sprintf(path, "esieve-%lu.lut50.map", (unsigned long)k);
+#else
+	sprintf(path, "esieve-%lu.map", (unsigned long)k);
+#endif
 
-			ret = clGetKernelWorkGroupInfo(kernel, device_id[device_index], CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &ulong, NULL);
+	/* allocate memory for sieve & load sieve */
+	g_map_sieve = open_map(path, map_size);
 
-			if (ret != CL_SUCCESS) {
-				printf("[ERROR] clGetKernelWorkGroupInfo failed\n");
-				return -1;
-			}
+	printf("SIEVE_LOGSIZE %lu\n", (unsigned long)SIEVE_LOGSIZE);
 
-			printf("[DEBUG] CL_KERNEL_LOCAL_MEM_SIZE = %lu\n", (unsigned long)ulong);
-		}
-#endif
+	/* create memobj */
+	g_mem_obj_sieve = clCreateBuffer(g_context, CL_MEM_READ_ONLY, SIEVE_SIZE, NULL, &ret);
 
-		ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&mem_obj_checksum_alpha);
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clCreateBuffer failed\n");
+		return -1;
+	}
 
-		if (ret != CL_SUCCESS) {
-			return -1;
-		}
+	/* transfer sieve to gpu */
+	ret = clEnqueueWriteBuffer(g_command_queue, g_mem_obj_sieve, CL_TRUE, 0, SIEVE_SIZE, g_map_sieve, 0, NULL, NULL);
 
-		assert(sizeof(cl_ulong) == sizeof(uint64_t));
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clEnqueueWriteBuffer() failed\n");
+		return -1;
+	}
 
-		ret = clSetKernelArg(kernel, 1, sizeof(cl_ulong), (void *)&task_id);
+	/* set kernel arg */
+	ret = clSetKernelArg(g_kernel, 4, sizeof(cl_mem), (void *)&g_mem_obj_sieve);
 
-		if (ret != CL_SUCCESS) {
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clSetKernelArg() failed\n");
+		return -1;
+	}
 
-		ret = clSetKernelArg(kernel, 2, sizeof(cl_ulong), (void *)&task_size);
+	g_mem_obj_mxoffset = clCreateBuffer(g_context, CL_MEM_WRITE_ONLY, sizeof(cl_ulong) << task_units, NULL, &ret);
 
-		if (ret != CL_SUCCESS) {
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clCreateBuffer failed\n");
+		return -1;
+	}
 
-		ret = clSetKernelArg(kernel, 3, sizeof(cl_ulong), (void *)&task_units);
+	ret = clSetKernelArg(g_kernel, 5, sizeof(cl_mem), (void *)&g_mem_obj_mxoffset);
 
-		if (ret != CL_SUCCESS) {
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clSetKernelArg() failed\n");
+		return -1;
+	}
 
-		global_work_size = (size_t)1 << task_units;
+	return 0;
+}
 
-		printf("[DEBUG] global_work_size = %lu\n", global_work_size);
+void release_device(void)
+{
+	clReleaseMemObject(g_mem_obj_checksum_alpha);
+	clReleaseMemObject(g_mem_obj_sieve);
+	clReleaseMemObject(g_mem_obj_mxoffset);
+	clReleaseKernel(g_kernel);
+	clReleaseProgram(g_program);
+	clReleaseCommandQueue(g_command_queue);
+	clReleaseContext(g_context);
+}
 
-		assert(task_units + 2 <= task_size);
+int solve(uint64_t task_id, uint64_t task_size)
+{
+	uint64_t task_units = TASK_UNITS;
+	/* arrays */
+	uint64_t *checksum_alpha;
+	uint64_t *mxoffset;
 
-#ifdef USE_LUT50
-		sprintf(path, "esieve-%lu.lut50.map", (unsigned long)k);
-#else
-		sprintf(path, "esieve-%lu.map", (unsigned long)k);
-#endif
+	cl_int ret;
 
-		/* allocate memory for sieve & load sieve */
-		g_map_sieve = open_map(path, map_size);
+	size_t global_work_size;
 
-		printf("SIEVE_LOGSIZE %lu\n", (unsigned long)SIEVE_LOGSIZE);
+	size_t i;
 
-		/* create memobj */
-		mem_obj_sieve = clCreateBuffer(context, CL_MEM_READ_ONLY, SIEVE_SIZE, NULL, &ret);
+#ifdef USE_ASYNC_CALL
+	cl_event finished;
+	cl_int info = CL_QUEUED;
+#endif
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clCreateBuffer failed\n");
-			return -1;
-		}
+	assert((uint128_t)task_id <= (UINT128_MAX >> task_size));
 
-		/* transfer sieve to gpu */
-		ret = clEnqueueWriteBuffer(command_queue, mem_obj_sieve, CL_TRUE, 0, SIEVE_SIZE, g_map_sieve, 0, NULL, NULL);
+	/* informative */
+	printf("RANGE 0x%016" PRIx64 ":%016" PRIx64 " 0x%016" PRIx64 ":%016" PRIx64 "\n",
+		(uint64_t)(((uint128_t)(task_id + 0) << task_size) >> 64),
+		(uint64_t)(((uint128_t)(task_id + 0) << task_size)      ),
+		(uint64_t)(((uint128_t)(task_id + 1) << task_size) >> 64),
+		(uint64_t)(((uint128_t)(task_id + 1) << task_size)      )
+	);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clEnqueueWriteBuffer() failed\n");
-			return -1;
-		}
+	assert(sizeof(cl_ulong) == sizeof(uint64_t));
 
-		/* set kernel arg */
-		ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), (void *)&mem_obj_sieve);
+	ret = clSetKernelArg(g_kernel, 1, sizeof(cl_ulong), (void *)&task_id);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clSetKernelArg() failed\n");
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		return -1;
+	}
 
-		mem_obj_mxoffset = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_ulong) << task_units, NULL, &ret);
+	ret = clSetKernelArg(g_kernel, 2, sizeof(cl_ulong), (void *)&task_size);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clCreateBuffer failed\n");
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		return -1;
+	}
 
-		ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), (void *)&mem_obj_mxoffset);
+	global_work_size = (size_t)1 << task_units;
+
+	printf("[DEBUG] global_work_size = %lu\n", global_work_size);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clSetKernelArg() failed\n");
-			return -1;
-		}
 #ifndef USE_ASYNC_CALL
-		ret = clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
+	ret = clEnqueueNDRangeKernel(g_command_queue, g_kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clEnqueueNDRangeKernel() failed\n");
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clEnqueueNDRangeKernel() failed\n");
+		return -1;
+	}
 
-		printf("[DEBUG] kernel enqueued\n");
+	printf("[DEBUG] kernel enqueued\n");
 #else
-		ret = clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global_work_size, NULL, 0, NULL, &finished);
+	ret = clEnqueueNDRangeKernel(g_command_queue, g_kernel, 1, NULL, &global_work_size, NULL, 0, NULL, &finished);
+
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clEnqueueNDRangeKernel() failed\n");
+		return -1;
+	}
+
+	printf("[DEBUG] kernel enqueued\n");
 
+	clFlush(g_command_queue);
+
+	while (info != CL_COMPLETE) {
+		/* sleep for 1/100 of a second */
+		usleep(10000);
+
+		ret = clGetEventInfo(finished, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &info, NULL);
 		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clEnqueueNDRangeKernel() failed\n");
+			printf("[ERROR] clGetEventInfo() failed\n");
 			return -1;
 		}
+	}
 
-		printf("[DEBUG] kernel enqueued\n");
+	clReleaseEvent(finished);
+#endif
+	/* allocate arrays */
+	checksum_alpha = malloc(sizeof(uint64_t) << task_units);
 
-		clFlush(command_queue);
+	if (checksum_alpha == NULL) {
+		return -1;
+	}
 
-		while (info != CL_COMPLETE) {
-			/* sleep for 1/100 of a second */
-			usleep(10000);
+	printf("[DEBUG] host buffers allocated\n");
 
-			ret = clGetEventInfo(finished, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &info, NULL);
-			if (ret != CL_SUCCESS) {
-				printf("[ERROR] clGetEventInfo() failed\n");
-				return -1;
-			}
-		}
+	ret = clEnqueueReadBuffer(g_command_queue, g_mem_obj_checksum_alpha, CL_TRUE, 0, sizeof(uint64_t) << task_units, checksum_alpha, 0, NULL, NULL);
 
-		clReleaseEvent(finished);
-#endif
-		/* allocate arrays */
-		checksum_alpha = malloc(sizeof(uint64_t) << task_units);
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clEnqueueReadBuffer failed with %s\n", errcode_to_cstr(ret));
+		return -1;
+	}
 
-		if (checksum_alpha == NULL) {
-			return -1;
-		}
+	mxoffset = malloc(sizeof(uint64_t) * global_work_size);
 
-		printf("[DEBUG] host buffers allocated\n");
+	if (mxoffset == NULL) {
+		return -1;
+	}
 
-		ret = clEnqueueReadBuffer(command_queue, mem_obj_checksum_alpha, CL_TRUE, 0, sizeof(uint64_t) << task_units, checksum_alpha, 0, NULL, NULL);
+	ret = clEnqueueReadBuffer(g_command_queue, g_mem_obj_mxoffset, CL_TRUE, 0, sizeof(uint64_t) << task_units, mxoffset, 0, NULL, NULL);
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clEnqueueReadBuffer failed with %s\n", errcode_to_cstr(ret));
-			return -1;
-		}
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clEnqueueReadBuffer failed with %s\n", errcode_to_cstr(ret));
+		return -1;
+	}
 
-		mxoffset = malloc(sizeof(uint64_t) * global_work_size);
+	printf("[DEBUG] buffers transferred\n");
 
-		if (mxoffset == NULL) {
-			return -1;
-		}
+	ret = clFlush(g_command_queue);
 
-		ret = clEnqueueReadBuffer(command_queue, mem_obj_mxoffset, CL_TRUE, 0, sizeof(uint64_t) << task_units, mxoffset, 0, NULL, NULL);
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clFlush failed with %s\n", errcode_to_cstr(ret));
+		return -1;
+	}
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clEnqueueReadBuffer failed with %s\n", errcode_to_cstr(ret));
-			return -1;
-		}
+	printf("[DEBUG] flushed\n");
 
-		printf("[DEBUG] buffers transferred\n");
+	ret = clFinish(g_command_queue);
 
-		ret = clFlush(command_queue);
+	if (ret != CL_SUCCESS) {
+		printf("[ERROR] clFinish failed with %s\n", errcode_to_cstr(ret));
+		return -1;
+	}
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clFlush failed with %s\n", errcode_to_cstr(ret));
-			return -1;
+	for (i = 0; i < global_work_size; ++i) {
+		if (checksum_alpha[i] == 0) {
+			printf("ABORTED_DUE_TO_OVERFLOW\n");
+			abort();
 		}
+	}
 
-		printf("[DEBUG] flushed\n");
+	for (i = 0; i < global_work_size; ++i) {
+		uint128_t max_n0 = mxoffset[i] + ((uint128_t)(task_id + 0) << task_size);
 
-		ret = clFinish(command_queue);
+		uint128_t max_n;
 
-		if (ret != CL_SUCCESS) {
-			printf("[ERROR] clFinish failed with %s\n", errcode_to_cstr(ret));
-			return -1;
-		}
+		max_n = get_max(max_n0);
 
-		ret = clReleaseKernel(kernel);
-		ret = clReleaseProgram(program);
-		ret = clReleaseCommandQueue(command_queue);
-		ret = clReleaseContext(context);
+		g_checksum_alpha += checksum_alpha[i];
 
-		for (i = 0; i < global_work_size; ++i) {
-			if (checksum_alpha[i] == 0) {
-				printf("ABORTED_DUE_TO_OVERFLOW\n");
-				abort();
-			}
+		if (max_n > g_max_n) {
+			g_max_n = max_n;
+			g_max_n0 = max_n0;
 		}
+	}
+
+	free(checksum_alpha);
+	free(mxoffset);
 
-		for (i = 0; i < global_work_size; ++i) {
-			uint128_t max_n0 = mxoffset[i] + ((uint128_t)(task_id + 0) << task_size);
+	return 0;
+}
 
-			uint128_t max_n;
+static unsigned long g_alarm_seconds = 0;
 
-			max_n = get_max(max_n0);
+static struct rusage g_start_usage;
+static uint64_t g_start_time;
 
-			g_checksum_alpha += checksum_alpha[i];
+uint64_t get_time(void)
+{
+	struct timespec ts;
 
-			if (max_n > g_max_n) {
-				g_max_n = max_n;
-				g_max_n0 = max_n0;
-			}
-		}
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		printf("[ERROR] clock_gettime\n");
+		abort();
+	}
+
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+uint64_t get_usage_usecs(const struct rusage *usage)
+{
+	/* may wrap around */
+	return usage->ru_utime.tv_sec * UINT64_C(1000000) + usage->ru_utime.tv_usec
+	     + usage->ru_stime.tv_sec * UINT64_C(1000000) + usage->ru_stime.tv_usec;
+}
+
+void report_prologue(uint64_t task_id, uint64_t task_size)
+{
+	printf("TASK_SIZE %" PRIu64 "\n", task_size);
+	printf("TASK_ID %" PRIu64 "\n", task_id);
+}
+
+void report_epilogue(uint64_t task_id, uint64_t task_size)
+{
+	struct rusage usage;
+	uint64_t stop_time;
 
-		free(checksum_alpha);
-		free(mxoffset);
+	assert(sizeof(uint64_t) >= sizeof(time_t));
+	assert(sizeof(uint64_t) >= sizeof(suseconds_t));
+	assert(sizeof(uint64_t) >= sizeof(time_t));
 
-		free(program_string);
+	/* user + system time, the device setup is included in the first task only */
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		/* errno is set appropriately. */
+		perror("getrusage");
+	} else {
+		uint64_t usecs = get_usage_usecs(&usage) - get_usage_usecs(&g_start_usage);
+		uint64_t secs = (usecs + 500000) / 1000000;
 
-		goto done;
+		printf("TIME %" PRIu64 " %" PRIu64 "\n", secs, usecs);
 	}
 
-	printf("NO_GPU_FOUND\n");
+	stop_time = get_time();
 
-	free(device_id);
+	printf("REALTIME %" PRIu64 " %" PRIu64 "\n", (stop_time - g_start_time + 500000000) / 1000000000, (stop_time - g_start_time + 500) / 1000);
 
-	return -1;
+	printf("OVERFLOW 128 %" PRIu64 "\n", UINT64_C(0));
 
-done:
-	free(device_id);
+	printf("CHECKSUM %" PRIu64 " %" PRIu64 "\n", g_checksum_alpha, g_checksum_beta);
 
-	return 0;
+	printf("MAXIMUM_OFFSET %" PRIu64 "\n", (uint64_t)(g_max_n0 - ((uint128_t)(task_id + 0) << task_size)));
+
+	printf("MAXIMUM_CYCLE_OFFSET %" PRIu64 "\n", UINT64_C(0));
+
+	printf("HALTED\n");
+}
+
+/* the next task starts with fresh counters */
+void reset_task(void)
+{
+	g_checksum_alpha = 0;
+	g_checksum_beta = 0;
+	g_max_n = 0;
+	g_max_n0 = 0;
+
+	if (getrusage(RUSAGE_SELF, &g_start_usage) < 0) {
+		perror("getrusage");
+		memset(&g_start_usage, 0, sizeof(struct rusage));
+	}
+
+	g_start_time = get_time();
 }
 
 int main(int argc, char *argv[])
@@ -696,28 +982,22 @@ int main(int argc, char *argv[])
 	uint64_t task_id = 0;
 	uint64_t task_size = TASK_SIZE;
 	int opt;
-	struct rusage usage;
-	struct timespec ts;
-	uint64_t start_time, stop_time;
+	int multi_task = 0;
 
 	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-		printf("[ERROR] clock_gettime\n");
-		abort();
-	}
+	memset(&g_start_usage, 0, sizeof(struct rusage));
 
-	start_time = ts.tv_sec * 1000000000 + ts.tv_nsec;
+	g_start_time = get_time();
 
-	while ((opt = getopt(argc, argv, "t:a:k:1d:")) != -1) {
+	while ((opt = getopt(argc, argv, "t:a:k:1d:mc:C")) != -1) {
 		switch (opt) {
-			unsigned long seconds;
 			case 't':
 				task_size = atou64(optarg);
 				break;
 			case 'a':
-				alarm(seconds = atoul(optarg));
-				printf("ALARM %lu\n", seconds);
+				alarm(g_alarm_seconds = atoul(optarg));
+				printf("ALARM %lu\n", g_alarm_seconds);
 				break;
 			case 'k':
 				kernel = strdup(optarg);
@@ -729,8 +1009,17 @@ int main(int argc, char *argv[])
 				g_device_index = atoi(optarg);
 				printf("[DEBUG] forcing device index = %i\n", g_device_index);
 				break;
+			case 'm':
+				multi_task = 1;
+				break;
+			case 'c':
+				g_cache_dir = optarg;
+				break;
+			case 'C':
+				g_cache_dir = NULL;
+				break;
 			default:
-				fprintf(stderr, "Usage: %s [-t task_size] task_id\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-t task_size] [-m] [-c cache_dir|-C] task_id\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -739,57 +1028,67 @@ int main(int argc, char *argv[])
 		kernel = default_kernel;
 	}
 
-	task_id = (optind < argc) ? atou64(argv[optind]) : 0;
-
-	printf("TASK_SIZE %" PRIu64 "\n", task_size);
-	printf("TASK_ID %" PRIu64 "\n", task_id);
-
 	init_lut();
 
-	if (solve(task_id, task_size)) {
-		printf("ERROR\n");
-		abort();
-	}
+	if (!multi_task) {
+		task_id = (optind < argc) ? atou64(argv[optind]) : 0;
 
-	if (kernel != default_kernel) {
-		free((void *)kernel);
-	}
+		report_prologue(task_id, task_size);
 
-	assert(sizeof(uint64_t) >= sizeof(time_t));
-	assert(sizeof(uint64_t) >= sizeof(suseconds_t));
-	assert(sizeof(uint64_t) >= sizeof(time_t));
+		if (init_device(task_size) || solve(task_id, task_size)) {
+			printf("ERROR\n");
+			abort();
+		}
 
-	/* user + system time */
-	if (getrusage(RUSAGE_SELF, &usage) < 0) {
-		/* errno is set appropriately. */
-		perror("getrusage");
+		report_epilogue(task_id, task_size);
 	} else {
-		/* may wrap around */
-		uint64_t usecs = usage.ru_utime.tv_sec * UINT64_C(1000000) + usage.ru_utime.tv_usec
-		               + usage.ru_stime.tv_sec * UINT64_C(1000000) + usage.ru_stime.tv_usec;
-		uint64_t secs = (usecs + 500000) / 1000000;
+		char line[4096];
 
-		printf("TIME %" PRIu64 " %" PRIu64 "\n", secs, usecs);
-	}
+		/* keep the context, the program, and the sieve resident, read task IDs from stdin */
+		if (init_device(task_size)) {
+			printf("ERROR\n");
+			abort();
+		}
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-		printf("[ERROR] clock_gettime\n");
-		abort();
-	}
+		/* a line is "task_id [alarm_seconds]", the alarm follows the estimate of the client */
+		while (fgets(line, sizeof(line), stdin) != NULL) {
+			unsigned long alarm_seconds;
+
+			switch (sscanf(line, "%" SCNu64 " %lu", &task_id, &alarm_seconds)) {
+				case 2:
+					g_alarm_seconds = alarm_seconds;
+					break;
+				case 1:
+					break;
+				default:
+					continue;
+			}
 
-	stop_time = ts.tv_sec * 1000000000 + ts.tv_nsec;
+			/* the alarm runs only while solving, not while waiting for the next task */
+			if (g_alarm_seconds) {
+				alarm(g_alarm_seconds);
+			}
 
-	printf("REALTIME %" PRIu64 " %" PRIu64 "\n", (stop_time - start_time + 500000000) / 1000000000, (stop_time - start_time + 500) / 1000);
+			report_prologue(task_id, task_size);
 
-	printf("OVERFLOW 128 %" PRIu64 "\n", UINT64_C(0));
+			if (solve(task_id, task_size)) {
+				printf("ERROR\n");
+				abort();
+			}
 
-	printf("CHECKSUM %" PRIu64 " %" PRIu64 "\n", g_checksum_alpha, g_checksum_beta);
+			report_epilogue(task_id, task_size);
 
-	printf("MAXIMUM_OFFSET %" PRIu64 "\n", (uint64_t)(g_max_n0 - ((uint128_t)(task_id + 0) << task_size)));
+			alarm(0);
 
-	printf("MAXIMUM_CYCLE_OFFSET %" PRIu64 "\n", UINT64_C(0));
+			reset_task();
+		}
+	}
 
-	printf("HALTED\n");
+	release_device();
+
+	if (kernel != default_kernel) {
+		free((void *)kernel);
+	}
 
 	return 0;
 }
@@ -0,0 +1 @@
+../common/compat.h
\ No newline at end of file
@@ -0,0 +1,908 @@
+/**
+ * Load generator for server and rs-server.
+ *
+ * Simulates many clients over the loopback, each of them repeats the cycle
+ * request (REQ or MRQ), think, and return (RET) or revoke (INT). Every
+ * message uses its own connection, the same as mclient and rs-client do.
+ * All the clients are driven by a single epoll loop. The latencies are
+ * measured from connect() to the end of the exchange (the server closes
+ * the connection).
+ *
+ * With -s, the server is started in a fresh temporary directory, which is
+ * removed at the end. Otherwise, the clients are spread over the shards in
+ * SERVER_SHARDS, if set.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <ftw.h>
+
+#include "compat.h"
+#include "shards.h"
+
+#define ERR "ERROR: "
+#define WARN "WARNING: "
+#define DBG "DEBUG: "
+#define INFO "INFO: "
+
+/* task size of the server */
+#define TASK_SIZE 40
+
+/* the server closes the idle connections after 10 seconds */
+#define OP_TIMEOUT_USECS (UINT64_C(10) * 1000000)
+
+/* maximal tasks per MRQ */
+#define MAX_BATCH 64
+
+#define OP_REQ 0
+#define OP_MRQ 1
+#define OP_RET 2
+#define OP_INT 3
+#define OP_DROP 4
+#define OPS 5
+
+static const char *op_names[OPS] = { "REQ", "MRQ", "RET", "INT", "DROP" };
+
+#define STATE_IDLE       0 /* thinking until wake */
+#define STATE_CONNECTING 1
+#define STATE_SENDING    2
+#define STATE_RECEIVING  3 /* expecting in_need bytes */
+#define STATE_CLOSING    4 /* waiting for the server to close */
+
+struct sim {
+	int fd;
+	int shard;
+	int state;
+	int op;
+	uint64_t clid;
+	uint64_t started;
+	uint64_t wake;
+	/* the assignments held */
+	uint64_t tasks[MAX_BATCH];
+	/* rs-server: the round of each task */
+	uint64_t targets[MAX_BATCH];
+	uint64_t log2s[MAX_BATCH];
+	int ntasks;
+	unsigned char out[4 + 8 + MAX_BATCH * (4 + 8 * 7)];
+	size_t out_len, out_pos;
+	unsigned char in[8 + MAX_BATCH * 24];
+	size_t in_len, in_need;
+	/* REQ of server: the client ID goes after the response */
+	int clid_pending;
+};
+
+/* latencies in microseconds */
+struct samples {
+	uint32_t *v;
+	size_t n, cap;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static const char *g_host = "127.0.0.1";
+static uint16_t g_port = 5006;
+static struct shard g_shards[SHARDS_MAX];
+static int g_shards_n = 0;
+static int g_rs = 0;
+static int g_batch = 0;
+static uint64_t g_think_usecs = 0;
+static unsigned g_fail_pct = 0;
+static unsigned g_drop_pct = 0;
+
+static struct samples g_samples[OPS];
+static uint64_t g_errors_connect = 0;
+static uint64_t g_errors_io = 0;
+static uint64_t g_errors_timeout = 0;
+static uint64_t g_errors_empty = 0;
+static uint64_t g_tasks_returned = 0;
+
+void signal_handler(int i)
+{
+	(void)i;
+
+	quit = 1;
+}
+
+int message(const char *format, ...)
+{
+	va_list ap;
+	time_t now = time(NULL);
+	char buf[26];
+	int n;
+
+	ctime_r(&now, buf);
+
+	buf[strlen(buf)-1] = 0;
+
+	n = printf("[%s] ", buf);
+
+	va_start(ap, format);
+	n += vprintf(format, ap);
+	va_end(ap);
+
+	fflush(stdout);
+
+	return n;
+}
+
+uint64_t get_usecs()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		perror("clock_gettime");
+		abort();
+	}
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* xorshift64*, good enough for the mix */
+static uint64_t g_rng_state = UINT64_C(88172645463325252);
+
+uint64_t rng()
+{
+	g_rng_state ^= g_rng_state >> 12;
+	g_rng_state ^= g_rng_state << 25;
+	g_rng_state ^= g_rng_state >> 27;
+
+	return g_rng_state * UINT64_C(2685821657736338717);
+}
+
+int chance(unsigned pct)
+{
+	return rng() % 100 < pct;
+}
+
+void samples_add(struct samples *s, uint64_t usecs)
+{
+	if (s->n == s->cap) {
+		size_t cap = s->cap ? 2 * s->cap : 4096;
+		uint32_t *v = realloc(s->v, cap * sizeof(uint32_t));
+
+		if (v == NULL) {
+			return;
+		}
+
+		s->v = v;
+		s->cap = cap;
+	}
+
+	s->v[s->n++] = usecs > UINT32_MAX ? UINT32_MAX : (uint32_t)usecs;
+}
+
+int cmp_uint32(const void *p1, const void *p2)
+{
+	uint32_t a = *(const uint32_t *)p1;
+	uint32_t b = *(const uint32_t *)p2;
+
+	return (a > b) - (a < b);
+}
+
+/* per mille */
+uint32_t samples_quantile(const struct samples *s, unsigned q)
+{
+	size_t i;
+
+	if (s->n == 0) {
+		return 0;
+	}
+
+	i = (size_t)((double)s->n * q / 1000);
+
+	return s->v[i < s->n ? i : s->n - 1];
+}
+
+void put_uint64(unsigned char *p, uint64_t n)
+{
+	uint32_t nh = htonl((uint32_t)(n >> 32));
+	uint32_t nl = htonl((uint32_t)(n));
+
+	memcpy(p + 0, &nh, 4);
+	memcpy(p + 4, &nl, 4);
+}
+
+uint64_t get_uint64(const unsigned char *p)
+{
+	uint32_t nh, nl;
+
+	memcpy(&nh, p + 0, 4);
+	memcpy(&nl, p + 4, 4);
+
+	return ((uint64_t)ntohl(nh) << 32) + ntohl(nl);
+}
+
+void out_msg(struct sim *s, const char *msg)
+{
+	memcpy(s->out + s->out_len, msg, 4);
+	s->out_len += 4;
+}
+
+void out_uint64(struct sim *s, uint64_t n)
+{
+	put_uint64(s->out + s->out_len, n);
+	s->out_len += 8;
+}
+
+/* a checksum which passes the filter of the server */
+uint64_t fake_checksum()
+{
+	return (UINT64_C(0x2134) << 24) + (rng() & 0xffffff);
+}
+
+/* builds the request of the op, returns the number of bytes of the response */
+size_t build_request(struct sim *s)
+{
+	int i;
+
+	s->out_len = 0;
+	s->out_pos = 0;
+	s->clid_pending = 0;
+
+	switch (s->op) {
+		case OP_REQ:
+			out_msg(s, "REQ");
+			if (g_rs) {
+				return 24;
+			}
+			s->clid_pending = 1;
+			return 16;
+		case OP_MRQ:
+			out_msg(s, "MRQ");
+			out_uint64(s, (uint64_t)g_batch);
+			if (g_rs) {
+				return (size_t)g_batch * 24;
+			}
+			for (i = 0; i < g_batch; ++i) {
+				out_uint64(s, s->clid);
+			}
+			return 8 + (size_t)g_batch * 8;
+		case OP_RET:
+			out_msg(s, "MUL");
+			out_uint64(s, (uint64_t)s->ntasks);
+			for (i = 0; i < s->ntasks; ++i) {
+				if (g_rs) {
+					out_msg(s, "RET");
+					out_uint64(s, s->targets[i]);
+					out_uint64(s, s->log2s[i]);
+					out_uint64(s, s->tasks[i]);
+					out_uint64(s, 0);
+					out_uint64(s, 1 + rng() % 1000);
+					out_uint64(s, fake_checksum());
+				} else {
+					out_msg(s, "RET\1");
+					out_uint64(s, s->tasks[i]);
+					out_uint64(s, TASK_SIZE);
+					out_uint64(s, 0);
+					out_uint64(s, 1 + rng() % 1000);
+					out_uint64(s, fake_checksum());
+					out_uint64(s, s->clid);
+					out_uint64(s, 1 + rng() % 1000);
+				}
+			}
+			return 0;
+		case OP_INT:
+			out_msg(s, "MUL");
+			out_uint64(s, (uint64_t)s->ntasks);
+			for (i = 0; i < s->ntasks; ++i) {
+				out_msg(s, "INT");
+				if (g_rs) {
+					out_uint64(s, s->targets[i]);
+					out_uint64(s, s->log2s[i]);
+					out_uint64(s, s->tasks[i]);
+				} else {
+					out_uint64(s, s->tasks[i]);
+					out_uint64(s, TASK_SIZE);
+					out_uint64(s, s->clid);
+				}
+			}
+			return 0;
+		case OP_DROP:
+			/* a half of MRQ, then the client dies */
+			out_msg(s, "MRQ");
+			return 0;
+	}
+
+	assert(0);
+
+	return 0;
+}
+
+/* parses the task IDs, returns -1 if the server is out of assignments */
+int parse_response(struct sim *s)
+{
+	int i;
+
+	s->ntasks = 0;
+
+	if (s->op == OP_REQ) {
+		uint64_t n = get_uint64(s->in + (g_rs ? 16 : 0));
+		uint64_t size = get_uint64(s->in + (g_rs ? 0 : 8));
+
+		if (size == 0) {
+			return -1;
+		}
+
+		if (g_rs) {
+			s->targets[0] = get_uint64(s->in + 0);
+			s->log2s[0] = get_uint64(s->in + 8);
+		}
+
+		s->tasks[s->ntasks++] = n;
+	} else if (s->op == OP_MRQ) {
+		for (i = 0; i < g_batch; ++i) {
+			if (g_rs) {
+				if (get_uint64(s->in + 24 * i) == 0) {
+					return -1;
+				}
+				s->targets[s->ntasks] = get_uint64(s->in + 24 * i);
+				s->log2s[s->ntasks] = get_uint64(s->in + 24 * i + 8);
+				s->tasks[s->ntasks++] = get_uint64(s->in + 24 * i + 16);
+			} else {
+				if (get_uint64(s->in) == 0) {
+					return -1;
+				}
+				s->tasks[s->ntasks++] = get_uint64(s->in + 8 + 8 * i);
+			}
+		}
+	}
+
+	return 0;
+}
+
+void sim_close(int epfd, struct sim *s)
+{
+	if (s->fd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+		close(s->fd);
+		s->fd = -1;
+	}
+}
+
+/* the next op after think time */
+void sim_next(struct sim *s, uint64_t now)
+{
+	if (s->ntasks == 0) {
+		s->op = g_batch > 0 ? OP_MRQ : OP_REQ;
+
+		if (chance(g_drop_pct)) {
+			s->op = OP_DROP;
+		}
+
+		s->wake = now;
+	} else {
+		s->op = chance(g_fail_pct) ? OP_INT : OP_RET;
+		s->wake = now + (g_think_usecs ? rng() % (2 * g_think_usecs) : 0);
+	}
+
+	s->state = STATE_IDLE;
+}
+
+void sim_fail(int epfd, struct sim *s, uint64_t *counter, uint64_t now)
+{
+	(*counter)++;
+
+	sim_close(epfd, s);
+
+	/* the assignments are lost, the server gets them back by the leases */
+	s->ntasks = 0;
+
+	sim_next(s, now);
+
+	/* do not hammer the server */
+	s->wake = now + 100000;
+}
+
+int sim_watch(int epfd, struct sim *s, uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = s;
+
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+void sim_start(int epfd, struct sim *s, const struct sockaddr_in *addr, uint64_t now)
+{
+	struct epoll_event ev;
+	int one = 1;
+
+	s->in_need = build_request(s);
+	s->in_len = 0;
+	s->started = now;
+
+	s->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (s->fd < 0) {
+		sim_fail(epfd, s, &g_errors_connect, now);
+		return;
+	}
+
+	setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof one);
+
+	if (fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK) < 0) {
+		sim_fail(epfd, s, &g_errors_connect, now);
+		return;
+	}
+
+	if (connect(s->fd, (const struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS) {
+		sim_fail(epfd, s, &g_errors_connect, now);
+		return;
+	}
+
+	s->state = STATE_CONNECTING;
+
+	ev.events = EPOLLOUT;
+	ev.data.ptr = s;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+		sim_fail(epfd, s, &g_errors_connect, now);
+	}
+}
+
+void sim_done(int epfd, struct sim *s, uint64_t now)
+{
+	sim_close(epfd, s);
+
+	samples_add(&g_samples[s->op], now - s->started);
+
+	if (s->op == OP_RET) {
+		g_tasks_returned += (uint64_t)s->ntasks;
+	}
+
+	if (s->op == OP_RET || s->op == OP_INT || s->op == OP_DROP) {
+		s->ntasks = 0;
+	}
+
+	sim_next(s, now);
+}
+
+void sim_handle(int epfd, struct sim *s, uint32_t events, uint64_t now)
+{
+	if (s->state == STATE_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof err;
+
+		if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, (void *)&err, &len) < 0 || err != 0) {
+			sim_fail(epfd, s, &g_errors_connect, now);
+			return;
+		}
+
+		s->state = STATE_SENDING;
+	}
+
+	if (s->state == STATE_SENDING) {
+		while (s->out_pos < s->out_len) {
+			ssize_t t = write(s->fd, s->out + s->out_pos, s->out_len - s->out_pos);
+
+			if (t < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+
+			if (t <= 0) {
+				sim_fail(epfd, s, &g_errors_io, now);
+				return;
+			}
+
+			s->out_pos += (size_t)t;
+		}
+
+		if (s->op == OP_DROP) {
+			sim_done(epfd, s, now);
+			return;
+		}
+
+		s->state = s->in_need > s->in_len ? STATE_RECEIVING : STATE_CLOSING;
+
+		if (sim_watch(epfd, s, EPOLLIN) < 0) {
+			sim_fail(epfd, s, &g_errors_io, now);
+		}
+
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		while (1) {
+			unsigned char buf[256];
+			ssize_t t;
+
+			if (s->state == STATE_RECEIVING) {
+				t = read(s->fd, s->in + s->in_len, s->in_need - s->in_len);
+			} else {
+				t = read(s->fd, buf, sizeof buf);
+			}
+
+			if (t < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+
+			if (t < 0) {
+				sim_fail(epfd, s, &g_errors_io, now);
+				return;
+			}
+
+			if (t == 0) {
+				if (s->state == STATE_CLOSING) {
+					sim_done(epfd, s, now);
+				} else {
+					sim_fail(epfd, s, &g_errors_io, now);
+				}
+				return;
+			}
+
+			if (s->state == STATE_CLOSING) {
+				/* unexpected data */
+				continue;
+			}
+
+			s->in_len += (size_t)t;
+
+			if (s->in_len == s->in_need) {
+				if (parse_response(s) < 0) {
+					sim_fail(epfd, s, &g_errors_empty, now);
+					return;
+				}
+
+				if (s->clid_pending) {
+					s->out_len = 0;
+					s->out_pos = 0;
+					s->clid_pending = 0;
+					out_uint64(s, s->clid);
+					s->state = STATE_SENDING;
+					s->in_need = 0;
+					s->in_len = 0;
+
+					if (sim_watch(epfd, s, EPOLLOUT) < 0) {
+						sim_fail(epfd, s, &g_errors_io, now);
+					}
+					return;
+				}
+
+				s->state = STATE_CLOSING;
+			}
+		}
+	}
+}
+
+/* starts the server in a temporary directory, returns its pid */
+/* the server listens on the port of the load */
+pid_t spawn_server(const char *path, char *dir, uint16_t port)
+{
+	pid_t pid;
+	char *abspath = realpath(path, NULL);
+	char portstr[8];
+
+	if (abspath == NULL) {
+		perror("realpath");
+		return -1;
+	}
+
+	strcpy(dir, "/tmp/loadgen.XXXXXX");
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		free(abspath);
+		return -1;
+	}
+
+	sprintf(portstr, "%u", (unsigned)port);
+
+	pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		free(abspath);
+		return -1;
+	}
+
+	if (pid == 0) {
+		if (chdir(dir) < 0 || freopen("server.log", "w", stdout) == NULL) {
+			_exit(EXIT_FAILURE);
+		}
+
+		execl(abspath, abspath, "-p", portstr, (char *)NULL);
+
+		_exit(EXIT_FAILURE);
+	}
+
+	free(abspath);
+
+	message(INFO "server %s started in %s (pid %i)\n", path, dir, (int)pid);
+
+	return pid;
+}
+
+int remove_entry(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	(void)sb;
+	(void)typeflag;
+	(void)ftwbuf;
+
+	return remove(path);
+}
+
+/* waits until the server accepts connections */
+int wait_for_server(const struct sockaddr_in *addr, int seconds)
+{
+	int i;
+
+	for (i = 0; i < 10 * seconds; ++i) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd >= 0 && connect(fd, (const struct sockaddr *)addr, sizeof(struct sockaddr_in)) == 0) {
+			/* PNG, so the server does not complain */
+			if (write(fd, "PNG", 4) == 4) {
+				close(fd);
+				return 0;
+			}
+		}
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		usleep(100000);
+	}
+
+	return -1;
+}
+
+int init_sockaddr(struct sockaddr_in *name, const char *hostname, uint16_t port)
+{
+	struct hostent *hostinfo;
+
+	memset(name, 0, sizeof(struct sockaddr_in));
+
+	name->sin_family = AF_INET;
+	name->sin_port = htons(port);
+
+	hostinfo = gethostbyname(hostname);
+
+	if (hostinfo == NULL) {
+		return -1;
+	}
+
+	name->sin_addr = *(struct in_addr *)hostinfo->h_addr_list[0];
+
+	return 0;
+}
+
+void report(uint64_t elapsed_usecs, int clients)
+{
+	double secs = elapsed_usecs / 1e6;
+	uint64_t total = 0;
+	int op;
+
+	for (op = 0; op < OPS; ++op) {
+		total += g_samples[op].n;
+	}
+
+	printf("clients %i, duration %.1f s\n", clients, secs);
+	printf("throughput %.0f requests/s, %.0f tasks/s returned\n", total / secs, g_tasks_returned / secs);
+	printf("%-5s %10s %10s %10s %10s %10s (usecs)\n", "op", "count", "p50", "p99", "p999", "max");
+
+	for (op = 0; op < OPS; ++op) {
+		struct samples *s = &g_samples[op];
+
+		if (s->n == 0) {
+			continue;
+		}
+
+		qsort(s->v, s->n, sizeof(uint32_t), cmp_uint32);
+
+		printf("%-5s %10lu %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", op_names[op], (unsigned long)s->n,
+			samples_quantile(s, 500), samples_quantile(s, 990), samples_quantile(s, 999), s->v[s->n - 1]);
+	}
+
+	printf("errors: connect %" PRIu64 ", io %" PRIu64 ", timeout %" PRIu64 ", out of assignments %" PRIu64 "\n",
+		g_errors_connect, g_errors_io, g_errors_timeout, g_errors_empty);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int clients = 1000;
+	uint64_t duration = 10;
+	const char *server_path = NULL;
+	char dir[32];
+	pid_t server_pid = -1;
+	struct sockaddr_in addrs[SHARDS_MAX];
+	struct sim *sims;
+	struct rlimit rlim;
+	int epfd;
+	uint64_t start, now, last_scan = 0;
+	int i;
+	int port_set = 0;
+
+	while ((opt = getopt(argc, argv, "c:d:t:b:f:x:rs:p:")) != -1) {
+		switch (opt) {
+			case 'c':
+				clients = atoi(optarg);
+				break;
+			case 'd':
+				duration = atou64(optarg);
+				break;
+			case 't':
+				g_think_usecs = atou64(optarg) * 1000;
+				break;
+			case 'b':
+				g_batch = atoi(optarg);
+				break;
+			case 'f':
+				g_fail_pct = (unsigned)atoul(optarg);
+				break;
+			case 'x':
+				g_drop_pct = (unsigned)atoul(optarg);
+				break;
+			case 'r':
+				g_rs = 1;
+				break;
+			case 's':
+				server_path = optarg;
+				break;
+			case 'p':
+				g_port = (uint16_t)atoul(optarg);
+				port_set = 1;
+				break;
+			default:
+				message(ERR "Usage: %s [-c clients] [-d seconds] [-t think_msecs] [-b mrq_batch] [-f revoke_pct] [-x drop_pct] [-r] [-s server_binary] [-p port]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (clients <= 0 || g_batch < 0 || g_batch > MAX_BATCH) {
+		message(ERR "invalid number of clients or batch size (at most %i)\n", MAX_BATCH);
+		return EXIT_FAILURE;
+	}
+
+	if (g_rs && !port_set) {
+		g_port = 5007;
+	}
+
+	if (getenv("SERVER_NAME")) {
+		g_host = getenv("SERVER_NAME");
+	}
+
+	/* thousands of sockets */
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	if (server_path == NULL && getenv("SERVER_SHARDS")) {
+		g_shards_n = shards_parse(getenv("SERVER_SHARDS"), g_shards, g_port);
+
+		if (g_shards_n <= 0) {
+			message(ERR "invalid SERVER_SHARDS, expected host:port,host:port,...\n");
+			return EXIT_FAILURE;
+		}
+	} else {
+		strncpy(g_shards[0].name, g_host, sizeof(g_shards[0].name) - 1);
+		g_shards[0].port = g_port;
+		g_shards_n = 1;
+	}
+
+	for (i = 0; i < g_shards_n; ++i) {
+		if (init_sockaddr(&addrs[i], g_shards[i].name, g_shards[i].port) < 0) {
+			message(ERR "invalid address %s\n", g_shards[i].name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (server_path != NULL) {
+		server_pid = spawn_server(server_path, dir, g_shards[0].port);
+
+		if (server_pid < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < g_shards_n; ++i) {
+		if (wait_for_server(&addrs[i], 60) < 0) {
+			message(ERR "server %s:%u does not respond\n", g_shards[i].name, (unsigned)g_shards[i].port);
+			quit = 1;
+		}
+	}
+
+	sims = malloc(sizeof(struct sim) * (size_t)clients);
+	epfd = epoll_create1(0);
+
+	if (sims == NULL || epfd < 0) {
+		message(ERR "unable to allocate the clients\n");
+		return EXIT_FAILURE;
+	}
+
+	start = get_usecs();
+
+	for (i = 0; i < clients; ++i) {
+		struct sim *s = &sims[i];
+
+		s->fd = -1;
+		s->shard = i % g_shards_n;
+		s->ntasks = 0;
+		s->clid = rng();
+
+		sim_next(s, start);
+
+		/* spread the start over the first second */
+		s->wake = start + rng() % 1000000;
+	}
+
+	message(INFO "%i clients against %s:%u (%s, %i shards), %" PRIu64 " seconds\n", clients, g_shards[0].name, (unsigned)g_shards[0].port, g_rs ? "rs-server" : "server", g_shards_n, duration);
+
+	while (!quit && (now = get_usecs()) - start < duration * 1000000) {
+		struct epoll_event events[1024];
+		int n = epoll_wait(epfd, events, 1024, 1);
+
+		now = get_usecs();
+
+		for (i = 0; i < n; ++i) {
+			sim_handle(epfd, events[i].data.ptr, events[i].events, now);
+		}
+
+		/* start the ops which are due, time out the stuck ones */
+		if (now - last_scan >= 1000) {
+			for (i = 0; i < clients; ++i) {
+				struct sim *s = &sims[i];
+
+				if (s->state == STATE_IDLE && s->wake <= now) {
+					sim_start(epfd, s, &addrs[s->shard], now);
+				} else if (s->state != STATE_IDLE && now - s->started > OP_TIMEOUT_USECS) {
+					sim_fail(epfd, s, &g_errors_timeout, now);
+				}
+			}
+
+			last_scan = now;
+		}
+	}
+
+	now = get_usecs();
+
+	for (i = 0; i < clients; ++i) {
+		sim_close(epfd, &sims[i]);
+	}
+
+	close(epfd);
+
+	report(now - start, clients);
+
+	if (server_pid > 0) {
+		kill(server_pid, SIGINT);
+		waitpid(server_pid, NULL, 0);
+
+		if (nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS) < 0) {
+			message(WARN "unable to remove %s\n", dir);
+		}
+	}
+
+	for (i = 0; i < OPS; ++i) {
+		free(g_samples[i].v);
+	}
+
+	free(sims);
+
+	return EXIT_SUCCESS;
+}
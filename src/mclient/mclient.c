@@ -20,14 +20,18 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 #include <inttypes.h>
 
 #include "compat.h"
+#include "shards.h"
+#include "topology.h"
+#include "spool.h"
 
 #define SLEEP_INTERVAL 10
 
 const char *servername = "localhost";
-const uint16_t serverport = 5006;
+uint16_t serverport = 5006;
 
 const char *taskpath_cpu = "../worker/worker";
 const char *taskpath_gpu = "../gpuworker/gpuworker";
@@ -36,6 +40,85 @@ static volatile sig_atomic_t quit = 0;
 
 static int g_force_device_index = 0;
 
+/* keep one gpuworker per thread running and feed it with task IDs */
+static int g_persistent_mode = 0;
+
+struct worker {
+	pid_t pid;
+	FILE *in;
+	FILE *out;
+};
+
+static struct worker *g_workers = NULL;
+
+/* session mode: a single connection kept open, the messages are prefixed by request IDs */
+static int g_session_fd = -1;
+static uint64_t g_session_id = 0;
+
+/* sharded server: all tasks of a round are requested from and returned to the current shard */
+static struct shard g_shards[SHARDS_MAX];
+static int g_shards_n = 0;
+static int g_shard = 0;
+
+/* queue mode: a task prefetched for a thread, and then its result */
+struct task {
+	uint64_t task_id;
+	uint64_t task_size;
+	uint64_t clientid;
+	int shard; /* the task has to be returned to the shard it came from, -1 for a spooled one */
+	uint64_t server; /* spooled: the address of the server it came from, IPv4 << 16 | port */
+	int failed; /* revoke instead of return */
+	uint64_t lease; /* seconds, to be renewed for */
+	uint64_t overflow;
+	uint64_t usertime;
+	uint64_t checksum;
+	uint64_t mxoffset;
+	uint64_t cycleoff;
+};
+
+/* a ring buffer of the tasks, guarded by the "queue" critical section */
+struct queue {
+	struct task *tasks;
+	int head;
+	int len;
+	int cap;
+};
+
+/* the number of the tasks queued for each thread, 0 disables the queue mode */
+static int g_queue_depth = 0;
+static struct queue *g_queues = NULL;
+/* the finished tasks waiting to be returned */
+static struct queue g_finished;
+/* the started tasks waiting for the renewal of their leases */
+static struct queue g_started;
+/* the number of the threads still running the tasks */
+static int g_running = 0;
+
+#define QUEUE_POLL_INTERVAL 100000 /* microseconds */
+
+/* placement: the thread i runs its workers on g_placement[i % g_placement_n] */
+static struct cpu_info *g_placement = NULL;
+static int g_placement_n = 0;
+static int g_numa = 0;
+
+#define SMT_BENCHMARK_SECONDS 0.25
+#define SMT_SPEEDUP_MIN 1.15
+
+#define ESTIMATE_SAMPLES 256
+#define ESTIMATE_SAMPLES_MIN 8
+#define ALARM_MIN 60 /* seconds */
+#define LEASE_MARGIN 600 /* seconds to return the result after the alarm */
+
+/* calibrated alarms: the wall-clock seconds of the last tasks on this node */
+static double g_alarm_factor = 0.; /* zero keeps the fixed alarm */
+static uint64_t g_task_seconds[ESTIMATE_SAMPLES];
+static int g_task_seconds_n = 0;
+
+/* the results are made durable in the spool before they are returned */
+static const char *g_spool = NULL;
+
+#define SPOOL_RECORD_WORDS 9
+
 void signal_handler(int i)
 {
 	(void)i;
@@ -199,10 +282,9 @@ int write_uint64(int fd, uint64_t n)
 	return 0;
 }
 
-int open_socket_to_server()
+int open_socket_to_sockaddr(const struct sockaddr_in *server_addr)
 {
 	int fd;
-	struct sockaddr_in server_addr;
 	int i = 1;
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -220,13 +302,7 @@ int open_socket_to_server()
 		return -1;
 	}
 
-	if (init_sockaddr(&server_addr, servername, serverport) < 0 ) {
-		message(ERR "init_sockaddr() failed\n");
-		close(fd);
-		return -1;
-	}
-
-	if (connect(fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+	if (connect(fd, (const struct sockaddr *) server_addr, sizeof(struct sockaddr_in)) < 0) {
 		/* errno is set appropriately */
 		message(ERR "connect() failed\n");
 		close(fd);
@@ -236,76 +312,57 @@ int open_socket_to_server()
 	return fd;
 }
 
-const char *get_task_path(int gpu_mode)
+int open_socket_to_server()
 {
-	return gpu_mode ? taskpath_gpu : taskpath_cpu;
+	struct sockaddr_in server_addr;
+
+	if (init_sockaddr(&server_addr, servername, serverport) < 0 ) {
+		message(ERR "init_sockaddr() failed\n");
+		return -1;
+	}
+
+	return open_socket_to_sockaddr(&server_addr);
 }
 
-int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_overflow, uint64_t *p_usertime, uint64_t *p_checksum, uint64_t *p_mxoffset, uint64_t *p_cycleoff, unsigned long alarm_seconds, int gpu_mode)
+/* the address of the server as a single word (IPv4 << 16 | port), zero if it cannot be resolved */
+uint64_t get_server_address(const char *hostname, uint16_t port)
 {
-	int r;
-	char buffer[4096];
-	char line[4096];
-	char ln_part[4][64];
-	FILE *output;
-	int success = 0;
-	const char *path = get_task_path(gpu_mode);
-	char *dirc = strdup(path);
-	char *basec = strdup(path);
-	char *dname;
-
-	buffer[0] = 0;
+	struct sockaddr_in server_addr;
 
-	/* basename */
-	if (1) {
-		char temp[4096];
-		if (sprintf(temp, "./%s", basename(basec)) < 0) {
-			return -1;
-		}
-		strcat(buffer, temp);
+	if (init_sockaddr(&server_addr, hostname, port) < 0) {
+		return 0;
 	}
 
-	/* alarm */
-	if (alarm_seconds) {
-		char temp[4096];
-		if (sprintf(temp, " -a %lu", alarm_seconds) < 0) {
-			return -1;
-		}
-		strcat(buffer, temp);
-	}
+	return (uint64_t)ntohl(server_addr.sin_addr.s_addr) << 16 | port;
+}
 
-	if (gpu_mode && g_force_device_index) {
-		char temp[4096];
-		if (sprintf(temp, " -d %i", tid) < 0) {
-			return -1;
-		}
-		strcat(buffer, temp);
-	}
+int open_socket_to_address(uint64_t address)
+{
+	struct sockaddr_in server_addr;
 
-	/* task_id */
-	if (1) {
-		char temp[4096];
-		if (sprintf(temp, " %" PRIu64, task_id) < 0) {
-			return -1;
-		}
-		strcat(buffer, temp);
-	}
+	bzero(&server_addr, sizeof(struct sockaddr_in));
 
-	dname = dirname(dirc);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons((uint16_t)(address & 0xffff));
+	server_addr.sin_addr.s_addr = htonl((uint32_t)(address >> 16));
 
-	if (chdir(dname) < 0) {
-		message(ERR "chdir failed\n");
-		return -1;
-	}
+	return open_socket_to_sockaddr(&server_addr);
+}
 
-	free(basec);
-	free(dirc);
+const char *get_task_path(int gpu_mode)
+{
+	return gpu_mode ? taskpath_gpu : taskpath_cpu;
+}
 
-	output = popen(buffer, "r");
+int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_overflow, uint64_t *p_usertime, uint64_t *p_checksum, uint64_t *p_mxoffset, uint64_t *p_cycleoff, unsigned long alarm_seconds, int gpu_mode);
 
-	if (output == NULL) {
-		return -1;
-	}
+/* parses the worker output up to the HALTED line (or EOF) */
+int parse_worker_output(FILE *output, int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_overflow, uint64_t *p_usertime, uint64_t *p_checksum, uint64_t *p_mxoffset, uint64_t *p_cycleoff, unsigned long alarm_seconds, int gpu_mode, int *p_success)
+{
+	char line[4096];
+	char ln_part[4][64];
+
+	*p_success = 0;
 
 	while (fgets(line, 4096, output)) {
 		int c;
@@ -387,7 +444,8 @@ int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_ov
 			*p_checksum = checksum;
 		} else if (c == 1 && strcmp(ln_part[0], "HALTED") == 0) {
 			/* this was expected */
-			success = 1;
+			*p_success = 1;
+			break;
 		} else if (c == 2 && strcmp(ln_part[0], "ALARM") == 0) {
 			unsigned long seconds = atoul(ln_part[1]);
 
@@ -432,18 +490,90 @@ int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_ov
 					message(ERR "even the CPU worker failed!\n");
 					return -1;
 				}
-				success = 1;
+				*p_success = 1;
 			}
 		} else if (c == 1 && strcmp(ln_part[0], "NO_GPU_FOUND") == 0) {
 			message(ERR "(gpu)worker reported that no GPU was found, exiting...\n");
 			quit = 1;
-			success = 0;
+			*p_success = 0;
 		} else {
 			/* other cases... */
 			message(WARN "worker printed unknown message: %s", line);
 		}
 	}
 
+	return 0;
+}
+
+int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_overflow, uint64_t *p_usertime, uint64_t *p_checksum, uint64_t *p_mxoffset, uint64_t *p_cycleoff, unsigned long alarm_seconds, int gpu_mode)
+{
+	int r;
+	char buffer[4096];
+	FILE *output;
+	int success = 0;
+	const char *path = get_task_path(gpu_mode);
+	char *dirc = strdup(path);
+	char *basec = strdup(path);
+	char *dname;
+
+	buffer[0] = 0;
+
+	/* basename */
+	if (1) {
+		char temp[4096];
+		if (sprintf(temp, "./%s", basename(basec)) < 0) {
+			return -1;
+		}
+		strcat(buffer, temp);
+	}
+
+	/* alarm */
+	if (alarm_seconds) {
+		char temp[4096];
+		if (sprintf(temp, " -a %lu", alarm_seconds) < 0) {
+			return -1;
+		}
+		strcat(buffer, temp);
+	}
+
+	if (gpu_mode && g_force_device_index) {
+		char temp[4096];
+		if (sprintf(temp, " -d %i", tid) < 0) {
+			return -1;
+		}
+		strcat(buffer, temp);
+	}
+
+	/* task_id */
+	if (1) {
+		char temp[4096];
+		if (sprintf(temp, " %" PRIu64, task_id) < 0) {
+			return -1;
+		}
+		strcat(buffer, temp);
+	}
+
+	dname = dirname(dirc);
+
+	if (chdir(dname) < 0) {
+		message(ERR "chdir failed\n");
+		return -1;
+	}
+
+	free(basec);
+	free(dirc);
+
+	output = popen(buffer, "r");
+
+	if (output == NULL) {
+		return -1;
+	}
+
+	if (parse_worker_output(output, tid, task_id, task_size, p_overflow, p_usertime, p_checksum, p_mxoffset, p_cycleoff, alarm_seconds, gpu_mode, &success) < 0) {
+		pclose(output);
+		return -1;
+	}
+
 	r = pclose(output);
 
 	if (!success) {
@@ -477,6 +607,168 @@ int run_assignment(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_ov
 	}
 }
 
+/* starts "gpuworker -m" with its stdin and stdout connected to the pipes */
+int spawn_worker(int tid, struct worker *worker, unsigned long alarm_seconds)
+{
+	char buffer[4096];
+	const char *path = get_task_path(1);
+	char *dirc = strdup(path);
+	char *basec = strdup(path);
+	char *dname;
+	int fd_in[2], fd_out[2];
+	pid_t pid;
+
+	if (dirc == NULL || basec == NULL || sprintf(buffer, "exec ./%s -m", basename(basec)) < 0) {
+		goto fail;
+	}
+
+	if (alarm_seconds) {
+		char temp[4096];
+		if (sprintf(temp, " -a %lu", alarm_seconds) < 0) {
+			goto fail;
+		}
+		strcat(buffer, temp);
+	}
+
+	if (g_force_device_index) {
+		char temp[4096];
+		if (sprintf(temp, " -d %i", tid) < 0) {
+			goto fail;
+		}
+		strcat(buffer, temp);
+	}
+
+	dname = dirname(dirc);
+
+	if (chdir(dname) < 0) {
+		message(ERR "chdir failed\n");
+		goto fail;
+	}
+
+	free(basec);
+	free(dirc);
+
+	/*
+	 * No end may leak into the workers spawned by other threads at the same
+	 * time, a leaked write end would hide the EOF when this worker dies. The
+	 * dup2() in the child clears the flag on its stdin and stdout.
+	 */
+	if (pipe2(fd_in, O_CLOEXEC) < 0) {
+		return -1;
+	}
+
+	if (pipe2(fd_out, O_CLOEXEC) < 0) {
+		close(fd_in[0]);
+		close(fd_in[1]);
+		return -1;
+	}
+
+	pid = fork();
+
+	if (pid < 0) {
+		close(fd_in[0]);
+		close(fd_in[1]);
+		close(fd_out[0]);
+		close(fd_out[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		dup2(fd_in[0], STDIN_FILENO);
+		dup2(fd_out[1], STDOUT_FILENO);
+		close(fd_in[0]);
+		close(fd_out[1]);
+		execl("/bin/sh", "sh", "-c", buffer, (char *)NULL);
+		_exit(127);
+	}
+
+	close(fd_in[0]);
+	close(fd_out[1]);
+
+	worker->pid = pid;
+	worker->in = fdopen(fd_in[1], "w");
+	worker->out = fdopen(fd_out[0], "r");
+
+	if (worker->in == NULL || worker->out == NULL) {
+		return -1;
+	}
+
+	message(INFO "thread %i: persistent gpuworker started (pid %li)\n", tid, (long)pid);
+
+	return 0;
+
+fail:
+	free(basec);
+	free(dirc);
+
+	return -1;
+}
+
+/* closing the stdin makes the worker finish */
+void stop_worker(int tid, struct worker *worker)
+{
+	int r;
+
+	if (worker->pid == 0) {
+		return;
+	}
+
+	if (worker->in != NULL) {
+		fclose(worker->in);
+	}
+
+	if (worker->out != NULL) {
+		fclose(worker->out);
+	}
+
+	if (waitpid(worker->pid, &r, 0) < 0) {
+		message(ERR "waitpid failed\n");
+	} else if (!WIFEXITED(r)) {
+		message(WARN "thread %i: persistent gpuworker terminated abnormally\n", tid);
+	}
+
+	worker->pid = 0;
+	worker->in = NULL;
+	worker->out = NULL;
+}
+
+int run_assignment_persistent(int tid, uint64_t task_id, uint64_t task_size, uint64_t *p_overflow, uint64_t *p_usertime, uint64_t *p_checksum, uint64_t *p_mxoffset, uint64_t *p_cycleoff, unsigned long alarm_seconds)
+{
+	struct worker *worker = g_workers + tid;
+	int success = 0;
+
+	if (worker->pid == 0 && spawn_worker(tid, worker, alarm_seconds) < 0) {
+		message(ERR "thread %i: unable to start the persistent gpuworker\n", tid);
+		stop_worker(tid, worker);
+		return -1;
+	}
+
+	/* the alarm goes with each task, the calibrated one changes after the spawn */
+	if (fprintf(worker->in, "%" PRIu64 " %lu\n", task_id, alarm_seconds) < 0 || fflush(worker->in) != 0) {
+		message(ERR "thread %i: unable to pass the task to the persistent gpuworker\n", tid);
+		stop_worker(tid, worker);
+		return -1;
+	}
+
+	if (parse_worker_output(worker->out, tid, task_id, task_size, p_overflow, p_usertime, p_checksum, p_mxoffset, p_cycleoff, alarm_seconds, 1, &success) < 0) {
+		stop_worker(tid, worker);
+		return -1;
+	}
+
+	/* the worker died (e.g. overflow, alarm), the next task starts a new one */
+	if (feof(worker->out) || ferror(worker->out)) {
+		message(WARN "thread %i: persistent gpuworker exited\n", tid);
+		stop_worker(tid, worker);
+	}
+
+	if (!success) {
+		message(WARN "worker terminated and did not print HALTED\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 int write_group_size(int fd, int threads)
 {
 	assert(threads > 0);
@@ -657,186 +949,1508 @@ int revoke_assignment(int fd, uint64_t n, uint64_t task_size, uint64_t clientid)
 	return 0;
 }
 
-int open_socket_and_revoke_multiple_assignments(int threads, uint64_t n[], uint64_t task_size[], uint64_t clientid[])
+/* gives back the tasks leased so far (INT), they would be held until their leases expire */
+void open_socket_and_revoke_range(int got, const uint64_t task_id[], const uint64_t task_size[], uint64_t clientid)
 {
 	int fd;
 	int tid;
 
+	if (got == 0) {
+		return;
+	}
+
 	fd = open_socket_to_server();
 
 	if (fd < 0) {
-		return -1;
+		message(ERR "unable to return %i leased tasks\n", got);
+		return;
 	}
 
-	if (multiple_requests(fd, threads) < 0) {
+	if (multiple_requests(fd, got) < 0) {
 		message(ERR "server does not implement the MUL command\n");
 		close(fd);
-		return -1;
+		return;
 	}
 
-	for (tid = 0; tid < threads; ++tid) {
-		if (revoke_assignment(fd, n[tid], task_size[tid], clientid[tid]) < 0) {
-			message(ERR "revoke_assignment failed (%i/%i)\n", tid, threads);
+	for (tid = 0; tid < got; ++tid) {
+		if (revoke_assignment(fd, task_id[tid], task_size[tid], clientid) < 0) {
+			message(ERR "revoke_assignment failed (%i/%i)\n", tid, got);
+			break;
+		}
+	}
+
+	close(fd);
+}
+
+/* leases the contiguous ranges of tasks (RRQ), usually a single one */
+int open_socket_and_request_range(int threads, uint64_t task_id[], uint64_t task_size[], uint64_t clientid)
+{
+	int got = 0;
+
+	while (got < threads) {
+		int fd;
+		uint64_t task_size_;
+		uint64_t start;
+		uint64_t count;
+		uint64_t i;
+
+		fd = open_socket_to_server();
+
+		if (fd < 0) {
+			message(ERR "open_socket_to_server() failed\n");
+			goto err;
+		}
+
+		if (write_(fd, "RRQ", 4) < 0 || write_uint64(fd, (uint64_t)(threads - got)) < 0 || write_uint64(fd, clientid) < 0) {
+			message(ERR "write_() failed\n");
+			close(fd);
+			goto err;
+		}
+
+		if (read_uint64(fd, &task_size_) < 0 || read_uint64(fd, &start) < 0 || read_uint64(fd, &count) < 0) {
+			message(ERR "server does not implement the RRQ command\n");
+			close(fd);
+			goto err;
+		}
+
+		close(fd);
+
+		if (task_size_ == 0 || count == 0 || count > (uint64_t)(threads - got)) {
+			message(ERR "invalid range %" PRIu64 "+%" PRIu64 "\n", start, count);
+			goto err;
+		}
+
+		for (i = 0; i < count; ++i) {
+			task_id[got] = start + i;
+			task_size[got] = task_size_;
+			got++;
+		}
+	}
+
+	return 0;
+err:
+	open_socket_and_revoke_range(got, task_id, task_size, clientid);
+
+	return -1;
+}
+
+/* the number of the contiguous runs of the task IDs */
+int count_runs(int threads, const uint64_t n[])
+{
+	int tid;
+	int runs = 1;
+
+	for (tid = 1; tid < threads; ++tid) {
+		if (n[tid] != n[tid - 1] + 1) {
+			runs++;
+		}
+	}
+
+	return runs;
+}
+
+/* writes RRT for the run starting at n[0], returns its length or -1 */
+int return_range(int fd, int threads, const uint64_t n[], const uint64_t task_size[], const uint64_t overflow[], const uint64_t usertime[], const uint64_t checksum[], const uint64_t mxoffset[], uint64_t clientid)
+{
+	int end = 1;
+	int i;
+
+	while (end < threads && n[end] == n[end - 1] + 1) {
+		end++;
+	}
+
+	if (write_(fd, "RRT", 4) < 0 || write_uint64(fd, n[0]) < 0 || write_uint64(fd, (uint64_t)end) < 0 || write_uint64(fd, task_size[0]) < 0 || write_uint64(fd, clientid) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < end; ++i) {
+		if (write_uint64(fd, overflow[i]) < 0 || write_uint64(fd, usertime[i]) < 0 || write_uint64(fd, checksum[i]) < 0 || write_uint64(fd, mxoffset[i]) < 0) {
+			return -1;
+		}
+	}
+
+	return end;
+}
+
+/* returns the results as contiguous ranges (RRT), all tasks must share the task size and the client ID */
+int open_socket_and_return_range(int threads, uint64_t n[], uint64_t task_size[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t clientid)
+{
+	int fd;
+	int tid;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (multiple_requests(fd, count_runs(threads, n)) < 0) {
+		message(ERR "server does not implement the MUL command\n");
+		close(fd);
+		return -1;
+	}
+
+	for (tid = 0; tid < threads; ) {
+		int r = return_range(fd, threads - tid, n + tid, task_size + tid, overflow + tid, usertime + tid, checksum + tid, mxoffset + tid, clientid);
+
+		if (r < 0) {
+			message(ERR "return_range failed (%i/%i)\n", tid, threads);
+			close(fd);
+			return -1;
+		}
+
+		tid += r;
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+int open_socket_and_revoke_multiple_assignments(int threads, uint64_t n[], uint64_t task_size[], uint64_t clientid[])
+{
+	int fd;
+	int tid;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (multiple_requests(fd, threads) < 0) {
+		message(ERR "server does not implement the MUL command\n");
+		close(fd);
+		return -1;
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		if (revoke_assignment(fd, n[tid], task_size[tid], clientid[tid]) < 0) {
+			message(ERR "revoke_assignment failed (%i/%i)\n", tid, threads);
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+int return_assignment(int fd, uint64_t n, uint64_t task_size, uint64_t overflow, uint64_t usertime, uint64_t checksum, uint64_t mxoffset, uint64_t cycleoff, uint64_t clientid)
+{
+	char protocol_version = 0;
+	char msg[4];
+
+	strcpy(msg, "RET");
+
+	if (mxoffset != 0) {
+		protocol_version = 1;
+	}
+
+	if (cycleoff != 0) {
+		protocol_version = 2;
+	}
+
+	msg[3] = protocol_version;
+
+	if (write_(fd, msg, 4) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, n) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, task_size) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, overflow) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, usertime) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, checksum) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, clientid) < 0) {
+		return -1;
+	}
+
+	if (protocol_version > 0) {
+		if (write_uint64(fd, mxoffset) < 0) {
+			return -1;
+		}
+	}
+
+	if (protocol_version > 1) {
+		if (write_uint64(fd, cycleoff) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int open_socket_and_return_multiple_assignments(int threads, uint64_t n[], uint64_t task_size[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t cycleoff[], uint64_t clientid[])
+{
+	int fd;
+	int tid;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (multiple_requests(fd, threads) < 0) {
+		message(ERR "server does not implement the MUL command\n");
+		close(fd);
+		return -1;
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		if (return_assignment(fd, n[tid], task_size[tid], overflow[tid], usertime[tid], checksum[tid], mxoffset[tid], cycleoff[tid], clientid[tid]) < 0) {
+			message(ERR "return_assignment failed (%i/%i)\n", tid, threads);
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+int session_open()
+{
+	uint64_t ack;
+
+	if (g_session_fd >= 0) {
+		return 0;
+	}
+
+	g_session_fd = open_socket_to_server();
+
+	if (g_session_fd < 0) {
+		return -1;
+	}
+
+	if (write_(g_session_fd, "SES", 4) < 0 || read_uint64(g_session_fd, &ack) < 0 || ack != 1) {
+		message(ERR "server does not implement the SES command\n");
+		close(g_session_fd);
+		g_session_fd = -1;
+		return -1;
+	}
+
+	message(INFO "session opened\n");
+
+	return 0;
+}
+
+void session_close()
+{
+	if (g_session_fd >= 0) {
+		close(g_session_fd);
+		g_session_fd = -1;
+	}
+}
+
+/* switches to the shard i (modulo the number of the shards), returns its index */
+int use_shard(int i)
+{
+	if (g_shards_n == 0) {
+		return 0;
+	}
+
+	g_shard = i % g_shards_n;
+
+	/* the session is bound to the previous shard */
+	session_close();
+
+	servername = g_shards[g_shard].name;
+	serverport = g_shards[g_shard].port;
+
+	message(INFO "shard to be used: %s:%u\n", servername, (unsigned)serverport);
+
+	return g_shard;
+}
+
+/* coalesce the small writes of the pipelined messages into few segments */
+void session_cork(int cork)
+{
+#ifdef TCP_CORK
+	setsockopt(g_session_fd, IPPROTO_TCP, TCP_CORK, (void *)&cork, sizeof cork);
+#else
+	(void)cork;
+#endif
+}
+
+/* reads one response, at most max words of it are stored */
+int session_read_response(uint64_t *id, uint64_t words[], uint64_t max, uint64_t *n)
+{
+	uint64_t i;
+
+	if (read_uint64(g_session_fd, id) < 0 || read_uint64(g_session_fd, n) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < *n; ++i) {
+		uint64_t word;
+
+		if (read_uint64(g_session_fd, &word) < 0) {
+			return -1;
+		}
+
+		if (i < max) {
+			words[i] = word;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the results (unless n is NULL) and requests the next assignments
+ * in a single round trip over the session connection. The responses are
+ * matched by the request IDs, so their order does not matter. On error,
+ * the session is closed and the caller is expected to retry.
+ */
+int session_return_and_request(int threads, int range_mode, const uint64_t n[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t cycleoff[],
+	uint64_t task_id[], uint64_t task_size[], const uint64_t clientid[])
+{
+	uint64_t *words;
+	uint64_t *next;
+	uint64_t first_id;
+	uint64_t request_id;
+	int pending = 0;
+	int got = 0;
+	int tid;
+
+	if (session_open() < 0) {
+		return -1;
+	}
+
+	words = malloc(sizeof(uint64_t) * (threads + 1));
+	/* the task IDs and sizes are updated only on success */
+	next = malloc(sizeof(uint64_t) * 2 * threads);
+
+	if (words == NULL || next == NULL) {
+		free(words);
+		free(next);
+		return -1;
+	}
+
+	session_cork(1);
+
+	first_id = g_session_id;
+
+	if (n != NULL) {
+		for (tid = 0; tid < threads; ) {
+			int r = 1;
+
+			if (write_uint64(g_session_fd, g_session_id++) < 0) {
+				goto err;
+			}
+
+			if (range_mode) {
+				r = return_range(g_session_fd, threads - tid, n + tid, task_size + tid, overflow + tid, usertime + tid, checksum + tid, mxoffset + tid, clientid[0]);
+			} else if (return_assignment(g_session_fd, n[tid], task_size[tid], overflow[tid], usertime[tid], checksum[tid], mxoffset[tid], cycleoff[tid], clientid[tid]) < 0) {
+				r = -1;
+			}
+
+			if (r < 0) {
+				goto err;
+			}
+
+			tid += r;
+			pending++;
+		}
+	}
+
+	while (got < threads) {
+		uint64_t id;
+		uint64_t count;
+
+		request_id = g_session_id++;
+
+		if (write_uint64(g_session_fd, request_id) < 0) {
+			goto err;
+		}
+
+		if (range_mode) {
+			if (write_(g_session_fd, "RRQ", 4) < 0 || write_uint64(g_session_fd, (uint64_t)(threads - got)) < 0 || write_uint64(g_session_fd, clientid[0]) < 0) {
+				goto err;
+			}
+		} else {
+			if (write_(g_session_fd, "MRQ", 4) < 0 || write_uint64(g_session_fd, (uint64_t)threads) < 0) {
+				goto err;
+			}
+
+			for (tid = 0; tid < threads; ++tid) {
+				if (write_uint64(g_session_fd, clientid[tid]) < 0) {
+					goto err;
+				}
+			}
+		}
+
+		session_cork(0);
+
+		pending++;
+
+		/* the acknowledgements of the returns and the response to the request */
+		for (; pending > 0; --pending) {
+			if (session_read_response(&id, words, (uint64_t)threads + 1, &count) < 0) {
+				goto err;
+			}
+
+			if (id != request_id) {
+				if (id < first_id || id >= request_id) {
+					message(ERR "unexpected response %" PRIu64 " in the session\n", id);
+					goto err;
+				}
+				continue;
+			}
+
+			if (range_mode) {
+				uint64_t i;
+
+				if (count != 3 || words[0] == 0 || words[2] == 0 || words[2] > (uint64_t)(threads - got)) {
+					message(ERR "invalid response to RRQ\n");
+					goto err;
+				}
+
+				for (i = 0; i < words[2]; ++i) {
+					next[got] = words[1] + i;
+					next[threads + got] = words[0];
+					got++;
+				}
+			} else {
+				/* the server has not enough tasks left */
+				if (count == 1 && words[0] == 0) {
+					message(WARN "no assignments available on the server\n");
+					goto err;
+				}
+
+				if (count != (uint64_t)threads + 1 || words[0] == 0) {
+					message(ERR "invalid response to MRQ\n");
+					goto err;
+				}
+
+				for (tid = 0; tid < threads; ++tid) {
+					next[tid] = words[1 + tid];
+					next[threads + tid] = words[0];
+				}
+
+				got = threads;
+			}
+		}
+	}
+
+	memcpy(task_id, next, sizeof(uint64_t) * threads);
+	memcpy(task_size, next + threads, sizeof(uint64_t) * threads);
+
+	free(words);
+	free(next);
+
+	return 0;
+err:
+	message(ERR "session failed\n");
+	free(words);
+	free(next);
+	session_close();
+	return -1;
+}
+
+int open_urandom_and_read_clientid(uint64_t *clientid)
+{
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	assert(clientid != NULL);
+
+	if (read_(fd, (char *)clientid, sizeof(uint64_t)) < 0) {
+		return -1;
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+double monotonic_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* the Collatz steps per second done by the calling thread */
+double smt_benchmark_run(double seconds)
+{
+	double start = monotonic_seconds();
+	double elapsed;
+	uint64_t n0 = 3;
+	uint64_t steps = 0;
+
+	do {
+		int i;
+
+		for (i = 0; i < 4096; ++i, n0 += 2) {
+			uint64_t n = n0;
+
+			while (n >= n0) {
+				n = (n & 1) ? (3 * n + 1) / 2 : n / 2;
+				steps++;
+			}
+		}
+
+		elapsed = monotonic_seconds() - start;
+	} while (elapsed < seconds);
+
+	return (double)steps / elapsed;
+}
+
+/* how many times more work the two siblings of a core do than a single thread, 0 if there is no SMT */
+double smt_benchmark(const struct cpu_info cpus[], int n)
+{
+	cpu_set_t saved;
+	double single;
+	double pair[2];
+	int a = -1;
+	int b = -1;
+	int i;
+
+	for (i = 0; i < n && b < 0; ++i) {
+		if (cpus[i].smt == 1) {
+			b = cpus[i].cpu;
+			for (a = 0; cpus[a].package != cpus[i].package || cpus[a].core != cpus[i].core; ++a)
+				;
+			a = cpus[a].cpu;
+		}
+	}
+
+	if (b < 0 || sched_getaffinity(0, sizeof(cpu_set_t), &saved) < 0) {
+		return 0.;
+	}
+
+	topology_pin(a);
+	single = smt_benchmark_run(SMT_BENCHMARK_SECONDS);
+
+	#pragma omp parallel num_threads(2)
+	{
+		int id = threads_get_thread_id();
+
+		topology_pin(id ? b : a);
+		pair[id] = smt_benchmark_run(SMT_BENCHMARK_SECONDS);
+		sched_setaffinity(0, sizeof(cpu_set_t), &saved);
+	}
+
+	return (pair[0] + pair[1]) / single;
+}
+
+/*
+ * Reads the topology and assigns the CPUs to the threads. The mode is
+ * "cores", "pairs", or "auto" (the SMT siblings are paired if they pay
+ * off, otherwise they are left idle and the threads are limited to the
+ * number of the cores).
+ */
+int placement_init(const char *mode, int *threads)
+{
+	int cores;
+	int order;
+	int tid;
+
+	if (strcmp(mode, "cores") == 0) {
+		order = TOPOLOGY_CORES;
+	} else if (strcmp(mode, "pairs") == 0 || strcmp(mode, "auto") == 0) {
+		order = TOPOLOGY_PAIRS;
+	} else {
+		message(ERR "unknown placement '%s', expected cores, pairs, or auto\n", mode);
+		return -1;
+	}
+
+	g_placement = malloc(sizeof(struct cpu_info) * TOPOLOGY_CPUS_MAX);
+
+	if (g_placement == NULL) {
+		return -1;
+	}
+
+	g_placement_n = topology_read(g_placement);
+
+	if (g_placement_n <= 0) {
+		message(WARN "unable to read the topology, the workers are not pinned\n");
+		g_placement_n = 0;
+		return 0;
+	}
+
+	cores = topology_cores(g_placement, g_placement_n);
+	g_numa = topology_nodes(g_placement, g_placement_n) > 1;
+
+	message(INFO "topology: %i cpus, %i cores, %i nodes\n", g_placement_n, cores, topology_nodes(g_placement, g_placement_n));
+
+	if (strcmp(mode, "auto") == 0) {
+		double speedup = smt_benchmark(g_placement, g_placement_n);
+
+		if (speedup > 0.) {
+			message(INFO "a pair of the SMT siblings does %.2f times the work of a single thread\n", speedup);
+		}
+
+		if (speedup < SMT_SPEEDUP_MIN) {
+			order = TOPOLOGY_CORES;
+
+			/* without SMT, there are no siblings to leave idle */
+			if (speedup > 0. && *threads > cores) {
+				message(INFO "SMT does not pay off, using %i threads instead of %i\n", cores, *threads);
+				*threads = cores;
+			}
+		}
+	}
+
+	topology_order(g_placement, g_placement_n, order);
+
+	if (*threads > g_placement_n) {
+		message(WARN "%i threads share %i cpus\n", *threads, g_placement_n);
+	}
+
+	for (tid = 0; tid < *threads; ++tid) {
+		const struct cpu_info *c = g_placement + tid % g_placement_n;
+
+		message(INFO "thread %i: cpu %i (package %i, core %i, thread %i, node %i)\n", tid, c->cpu, c->package, c->core, c->smt, c->node);
+	}
+
+	return 0;
+}
+
+/* the worker forked by the calling thread inherits the placement */
+void place_thread(int tid)
+{
+	const struct cpu_info *c;
+
+	if (g_placement_n == 0) {
+		return;
+	}
+
+	c = g_placement + tid % g_placement_n;
+
+	if (topology_pin(c->cpu) < 0) {
+		message(WARN "thread %i: unable to pin to cpu %i\n", tid, c->cpu);
+	}
+
+	if (g_numa && topology_prefer_node(c->node) < 0) {
+		message(WARN "thread %i: unable to set the memory policy for node %i\n", tid, c->node);
+	}
+}
+
+int compare_uint64(const void *l, const void *r)
+{
+	uint64_t a = *(const uint64_t *)l;
+	uint64_t b = *(const uint64_t *)r;
+
+	return a < b ? -1 : a > b;
+}
+
+/* a task took that many seconds (wall-clock) on this node */
+void estimate_add(uint64_t seconds)
+{
+	#pragma omp critical(estimate)
+	g_task_seconds[g_task_seconds_n++ % ESTIMATE_SAMPLES] = seconds;
+}
+
+/* the 99th percentile of the recent task times, or zero if there are too few of them */
+uint64_t estimate_p99()
+{
+	uint64_t samples[ESTIMATE_SAMPLES];
+	int n;
+
+	#pragma omp critical(estimate)
+	{
+		n = g_task_seconds_n < ESTIMATE_SAMPLES ? g_task_seconds_n : ESTIMATE_SAMPLES;
+		memcpy(samples, g_task_seconds, sizeof(uint64_t) * n);
+	}
+
+	if (n < ESTIMATE_SAMPLES_MIN) {
+		return 0;
+	}
+
+	qsort(samples, (size_t)n, sizeof(uint64_t), compare_uint64);
+
+	return samples[(n - 1) * 99 / 100];
+}
+
+/* the alarm for the next task, the fixed one (-a) until there is an estimate, and as the upper bound */
+unsigned long estimate_alarm(unsigned long fixed)
+{
+	uint64_t p99 = g_alarm_factor > 0. ? estimate_p99() : 0;
+	unsigned long alarm_seconds;
+
+	if (p99 == 0) {
+		return fixed;
+	}
+
+	alarm_seconds = (unsigned long)((double)p99 * g_alarm_factor + 0.5);
+
+	if (alarm_seconds < ALARM_MIN) {
+		alarm_seconds = ALARM_MIN;
+	}
+
+	if (fixed != 0 && alarm_seconds > fixed) {
+		alarm_seconds = fixed;
+	}
+
+	return alarm_seconds;
+}
+
+/*
+ * Feeds the estimate after the task. A task killed by the alarm counts
+ * twice its time, so that the alarm backs off on a node that got slower
+ * (e.g., throttled) instead of killing every task.
+ */
+void estimate_task(time_t start, uint64_t usertime, unsigned long alarm_seconds, int failed)
+{
+	uint64_t elapsed = (uint64_t)(time(NULL) - start);
+
+	if (g_alarm_factor == 0.) {
+		return;
+	}
+
+	if (!failed) {
+		estimate_add(elapsed > usertime ? elapsed : usertime);
+	} else if (alarm_seconds != 0 && elapsed >= alarm_seconds) {
+		estimate_add(2 * elapsed);
+	}
+}
+
+int run_assignments_in_parallel(int threads, const uint64_t task_id[], const uint64_t task_size[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t cycleoff[], unsigned long alarm_seconds, int gpu_mode)
+{
+	int *success;
+	int tid;
+
+	assert(threads > 0);
+
+	success = malloc(sizeof(int) * threads);
+
+	if (success == NULL) {
+		return -1;
+	}
+
+	#pragma omp parallel num_threads(threads)
+	{
+		int tid = threads_get_thread_id();
+		unsigned long alarm = estimate_alarm(alarm_seconds);
+		time_t start = time(NULL);
+
+		place_thread(tid);
+
+		message(INFO "thread %i: got assignment %" PRIu64 "\n", tid, task_id[tid]);
+
+		/* initialization, since the worker is not mandated to fill these */
+		overflow[tid] = 0;
+		usertime[tid] = 0;
+		checksum[tid] = 0;
+		mxoffset[tid] = 0;
+		cycleoff[tid] = 0;
+
+		if (gpu_mode && g_persistent_mode) {
+			success[tid] = run_assignment_persistent(tid, task_id[tid], task_size[tid], overflow+tid, usertime+tid, checksum+tid, mxoffset+tid, cycleoff+tid, alarm);
+		} else {
+			success[tid] = run_assignment(tid, task_id[tid], task_size[tid], overflow+tid, usertime+tid, checksum+tid, mxoffset+tid, cycleoff+tid, alarm, gpu_mode);
+		}
+
+		estimate_task(start, usertime[tid], alarm, success[tid] < 0);
+
+		if (success[tid] < 0) {
+			message(ERR "thread %i: run_assignment failed\n", tid);
+		}
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		if (success[tid] < 0) {
+			free(success);
+			return -1;
+		}
+	}
+
+	free(success);
+
+	return 0;
+}
+
+int queue_init(struct queue *queue, int cap)
+{
+	queue->tasks = malloc(sizeof(struct task) * cap);
+	queue->head = 0;
+	queue->len = 0;
+	queue->cap = cap;
+
+	return queue->tasks == NULL ? -1 : 0;
+}
+
+void queue_free(struct queue *queue)
+{
+	free(queue->tasks);
+	queue->tasks = NULL;
+}
+
+/* returns -1 if the queue is full */
+int queue_push(struct queue *queue, const struct task *task)
+{
+	if (queue->len == queue->cap) {
+		return -1;
+	}
+
+	queue->tasks[(queue->head + queue->len) % queue->cap] = *task;
+	queue->len++;
+
+	return 0;
+}
+
+/* returns -1 if the queue is empty */
+int queue_pop(struct queue *queue, struct task *task)
+{
+	if (queue->len == 0) {
+		return -1;
+	}
+
+	*task = queue->tasks[queue->head];
+	queue->head = (queue->head + 1) % queue->cap;
+	queue->len--;
+
+	return 0;
+}
+
+/* the spooled tasks go back to the server they came from, the others to the current shard */
+int open_socket_to_task_server(const struct task *task)
+{
+	return task->shard < 0 ? open_socket_to_address(task->server) : open_socket_to_server();
+}
+
+/* returns (or revokes) the tasks, all of them come from the same server */
+int open_socket_and_return_tasks(int count, const struct task tasks[])
+{
+	int fd;
+	int i;
+
+	fd = open_socket_to_task_server(tasks);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (multiple_requests(fd, count) < 0) {
+		message(ERR "server does not implement the MUL command\n");
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		const struct task *task = tasks + i;
+		int r;
+
+		if (task->failed) {
+			r = revoke_assignment(fd, task->task_id, task->task_size, task->clientid);
+		} else {
+			r = return_assignment(fd, task->task_id, task->task_size, task->overflow, task->usertime, task->checksum, task->mxoffset, task->cycleoff, task->clientid);
+		}
+
+		if (r < 0) {
+			message(ERR "return_assignment failed (%i/%i)\n", i, count);
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	message(INFO "%i assignments returned\n", count);
+
+	return 0;
+}
+
+/*
+ * Sends the tasks to the shards they came from, the tasks not sent remain
+ * in the array. The spooled tasks are sent to their servers directly, the
+ * current shard does not change.
+ */
+int send_tasks(int *count, struct task tasks[], int (*send)(int count, const struct task tasks[]))
+{
+	while (*count > 0) {
+		int shard = tasks[0].shard;
+		uint64_t server = tasks[0].server;
+		int k = 0;
+		int i;
+
+		/* move the tasks of the shard to the front */
+		for (i = 0; i < *count; ++i) {
+			if (tasks[i].shard == shard && (shard >= 0 || tasks[i].server == server)) {
+				struct task temp = tasks[k];
+				tasks[k] = tasks[i];
+				tasks[i] = temp;
+				k++;
+			}
+		}
+
+		if (g_shards_n > 0 && shard >= 0 && g_shard != shard) {
+			use_shard(shard);
+		}
+
+		if (send(k, tasks) < 0) {
+			return -1;
+		}
+
+		*count -= k;
+		memmove(tasks, tasks + k, sizeof(struct task) * *count);
+	}
+
+	return 0;
+}
+
+int return_tasks(int *count, struct task tasks[])
+{
+	return send_tasks(count, tasks, open_socket_and_return_tasks);
+}
+
+/* renews the leases of the tasks for their own lease times, all of them come from the current shard */
+int open_socket_and_renew_tasks(int count, const struct task tasks[])
+{
+	int fd;
+	int i;
+	char msg[4] = { 'L', 'R', 'N', 1 };
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (multiple_requests(fd, count) < 0) {
+		message(ERR "server does not implement the MUL command\n");
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (write_(fd, msg, 4) < 0 || write_uint64(fd, tasks[i].task_id) < 0 || write_uint64(fd, tasks[i].task_size) < 0 || write_uint64(fd, tasks[i].clientid) < 0 || write_uint64(fd, tasks[i].lease) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		uint64_t deadline;
+
+		if (read_uint64(fd, &deadline) < 0) {
+			message(ERR "server does not implement the LRN command\n");
 			close(fd);
 			return -1;
 		}
+
+		if (deadline == 0) {
+			message(WARN "lease of the assignment %" PRIu64 " not renewed\n", tasks[i].task_id);
+		}
 	}
 
 	close(fd);
 
-	return 0;
+	message(INFO "%i leases renewed for %" PRIu64 " seconds\n", count, tasks[0].lease);
+
+	return 0;
+}
+
+/* the leases of the group follow the estimate, a failure is not fatal */
+void renew_leases(int threads, const uint64_t n[], const uint64_t task_size[], const uint64_t clientid[], unsigned long alarm_seconds)
+{
+	unsigned long alarm = estimate_alarm(alarm_seconds);
+	struct task *tasks;
+	int tid;
+
+	if (g_alarm_factor == 0. || alarm == 0) {
+		return;
+	}
+
+	tasks = malloc(sizeof(struct task) * threads);
+
+	if (tasks == NULL) {
+		return;
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		tasks[tid].task_id = n[tid];
+		tasks[tid].task_size = task_size[tid];
+		tasks[tid].clientid = clientid[tid];
+		tasks[tid].shard = g_shard;
+		tasks[tid].server = 0;
+		tasks[tid].lease = alarm + LEASE_MARGIN;
+	}
+
+	if (send_tasks(&threads, tasks, open_socket_and_renew_tasks) < 0) {
+		message(WARN "unable to renew the leases\n");
+	}
+
+	free(tasks);
+}
+
+/*
+ * The spool is shared by the clients with other shard lists, so the record
+ * holds the address of the server, not the index of the shard.
+ */
+uint64_t get_task_server_address(const struct task *task)
+{
+	if (task->shard < 0) {
+		return task->server;
+	}
+
+	if (g_shards_n > 0) {
+		return get_server_address(g_shards[task->shard].name, g_shards[task->shard].port);
+	}
+
+	return get_server_address(servername, serverport);
+}
+
+/* the spool record of a task */
+void task_to_record(const struct task *task, uint64_t address, uint64_t record[])
+{
+	record[0] = task->task_id;
+	record[1] = task->task_size;
+	record[2] = task->overflow;
+	record[3] = task->usertime;
+	record[4] = task->checksum;
+	record[5] = task->mxoffset;
+	record[6] = task->cycleoff;
+	record[7] = task->clientid;
+	record[8] = address;
+}
+
+void record_to_task(const uint64_t record[], struct task *task)
+{
+	task->task_id = record[0];
+	task->task_size = record[1];
+	task->overflow = record[2];
+	task->usertime = record[3];
+	task->checksum = record[4];
+	task->mxoffset = record[5];
+	task->cycleoff = record[6];
+	task->clientid = record[7];
+	task->shard = -1;
+	task->server = record[8];
+	task->failed = 0;
 }
 
-int return_assignment(int fd, uint64_t n, uint64_t task_size, uint64_t overflow, uint64_t usertime, uint64_t checksum, uint64_t mxoffset, uint64_t cycleoff, uint64_t clientid)
+/* spool_send_t */
+int return_spooled_tasks(int count, int nwords, const uint64_t records[], void *arg)
 {
-	char protocol_version = 0;
-	char msg[4];
+	struct task *tasks = malloc(sizeof(struct task) * count);
+	int i;
+	int r;
 
-	strcpy(msg, "RET");
+	(void)arg;
 
-	if (mxoffset != 0) {
-		protocol_version = 1;
+	if (tasks == NULL) {
+		return -1;
 	}
 
-	if (cycleoff != 0) {
-		protocol_version = 2;
+	for (i = 0; i < count; ++i) {
+		record_to_task(records + (size_t)i * nwords, tasks + i);
 	}
 
-	msg[3] = protocol_version;
+	r = return_tasks(&count, tasks);
 
-	if (write_(fd, msg, 4) < 0) {
-		return -1;
-	}
+	free(tasks);
 
-	if (write_uint64(fd, n) < 0) {
-		return -1;
-	}
+	return r;
+}
 
-	if (write_uint64(fd, task_size) < 0) {
-		return -1;
-	}
+/* moves the finished (not failed) tasks into the spool, returns their number or -1 */
+int spool_tasks(int *count, struct task tasks[])
+{
+	uint64_t *records = malloc(sizeof(uint64_t) * SPOOL_RECORD_WORDS * *count);
+	int spooled = 0;
+	int i;
 
-	if (write_uint64(fd, overflow) < 0) {
+	if (records == NULL) {
 		return -1;
 	}
 
-	if (write_uint64(fd, usertime) < 0) {
-		return -1;
-	}
+	for (i = 0; i < *count; ++i) {
+		if (!tasks[i].failed) {
+			uint64_t address = get_task_server_address(tasks + i);
 
-	if (write_uint64(fd, checksum) < 0) {
-		return -1;
+			if (address == 0) {
+				message(ERR "unable to resolve the server of the assignment %" PRIu64 "\n", tasks[i].task_id);
+				free(records);
+				return -1;
+			}
+
+			task_to_record(tasks + i, address, records + (size_t)spooled * SPOOL_RECORD_WORDS);
+			spooled++;
+		}
 	}
 
-	if (write_uint64(fd, clientid) < 0) {
+	if (spooled > 0 && spool_append(g_spool, spooled, SPOOL_RECORD_WORDS, records) < 0) {
+		message(ERR "unable to append to the spool '%s'\n", g_spool);
+		free(records);
 		return -1;
 	}
 
-	if (protocol_version > 0) {
-		if (write_uint64(fd, mxoffset) < 0) {
-			return -1;
-		}
-	}
+	free(records);
 
-	if (protocol_version > 1) {
-		if (write_uint64(fd, cycleoff) < 0) {
-			return -1;
+	/* keep the failed ones, to be revoked */
+	for (i = 0, spooled = 0; i < *count; ++i) {
+		if (tasks[i].failed) {
+			tasks[spooled++] = tasks[i];
 		}
 	}
 
-	return 0;
+	spooled = *count - spooled;
+	*count -= spooled;
+
+	return spooled;
 }
 
-int open_socket_and_return_multiple_assignments(int threads, uint64_t n[], uint64_t task_size[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t cycleoff[], uint64_t clientid[])
+/* returns the spooled results (also those left by other clients) */
+int flush_spool()
 {
-	int fd;
-	int tid;
+	size_t damaged;
+	long r = spool_flush(g_spool, SPOOL_RECORD_WORDS, return_spooled_tasks, NULL, &damaged);
 
-	fd = open_socket_to_server();
+	if (damaged > 0) {
+		message(WARN "%lu damaged bytes dropped from the spool\n", (unsigned long)damaged);
+	}
 
-	if (fd < 0) {
+	if (r < 0) {
+		message(ERR "unable to flush the spool, to be retried\n");
 		return -1;
 	}
 
-	if (multiple_requests(fd, threads) < 0) {
-		message(ERR "server does not implement the MUL command\n");
-		close(fd);
+	if (r > 0) {
+		message(INFO "%li spooled results returned\n", r);
+	}
+
+	return 0;
+}
+
+/* spools the results of the group, returns -1 if they have to be returned directly */
+int spool_multiple_results(int threads, const uint64_t n[], const uint64_t task_size[], const uint64_t overflow[], const uint64_t usertime[], const uint64_t checksum[], const uint64_t mxoffset[], const uint64_t cycleoff[], const uint64_t clientid[])
+{
+	struct task *tasks = malloc(sizeof(struct task) * threads);
+	int tid;
+	int r;
+
+	if (tasks == NULL) {
 		return -1;
 	}
 
 	for (tid = 0; tid < threads; ++tid) {
-		if (return_assignment(fd, n[tid], task_size[tid], overflow[tid], usertime[tid], checksum[tid], mxoffset[tid], cycleoff[tid], clientid[tid]) < 0) {
-			message(ERR "return_assignment failed (%i/%i)\n", tid, threads);
-			close(fd);
-			return -1;
-		}
+		tasks[tid].task_id = n[tid];
+		tasks[tid].task_size = task_size[tid];
+		tasks[tid].clientid = clientid[tid];
+		tasks[tid].shard = g_shard;
+		tasks[tid].server = 0;
+		tasks[tid].failed = 0;
+		tasks[tid].overflow = overflow[tid];
+		tasks[tid].usertime = usertime[tid];
+		tasks[tid].checksum = checksum[tid];
+		tasks[tid].mxoffset = mxoffset[tid];
+		tasks[tid].cycleoff = cycleoff[tid];
 	}
 
-	close(fd);
+	r = spool_tasks(&threads, tasks);
 
-	return 0;
+	free(tasks);
+
+	return r < 0 ? -1 : 0;
 }
 
-int open_urandom_and_read_clientid(uint64_t *clientid)
+/* fills the queues of all threads in a single round trip, returns the number of the tasks received or -1 */
+int prefetch_tasks(int threads, int batch_mode, int request_lowest_incomplete, const uint64_t clientid[], uint64_t task_id[], uint64_t task_size[], uint64_t ids[], int owner[])
 {
-	int fd = open("/dev/urandom", O_RDONLY);
+	int tid;
+	int need = 0;
+	int i;
 
-	if (fd < 0) {
-		return -1;
+	#pragma omp critical(queue)
+	for (tid = 0; tid < threads; ++tid) {
+		for (i = g_queues[tid].len; i < g_queue_depth; ++i) {
+			ids[need] = clientid[tid];
+			owner[need] = tid;
+			need++;
+		}
 	}
 
-	assert(clientid != NULL);
+	if (need == 0) {
+		return 0;
+	}
 
-	if (read_(fd, (char *)clientid, sizeof(uint64_t)) < 0) {
+	if (open_socket_and_request_multiple_assignments_wrapper(batch_mode, need, request_lowest_incomplete, task_id, task_size, ids) < 0) {
 		return -1;
 	}
 
-	close(fd);
+	/* only this thread pushes into the queues, so there is room for them */
+	#pragma omp critical(queue)
+	for (i = 0; i < need; ++i) {
+		struct task task;
 
-	return 0;
+		task.task_id = task_id[i];
+		task.task_size = task_size[i];
+		task.clientid = ids[i];
+		task.shard = g_shard;
+		task.server = 0;
+		task.failed = 0;
+
+		queue_push(g_queues + owner[i], &task);
+	}
+
+	return need;
 }
 
-int run_assignments_in_parallel(int threads, const uint64_t task_id[], const uint64_t task_size[], uint64_t overflow[], uint64_t usertime[], uint64_t checksum[], uint64_t mxoffset[], uint64_t cycleoff[], unsigned long alarm_seconds, int gpu_mode)
+/* the last thread of the queue mode: keeps the queues full and returns the finished tasks */
+void feed_queues(int threads, int batch_mode, int request_lowest_incomplete, const uint64_t clientid[])
 {
-	int *success;
+	int cap = threads * (g_queue_depth + 1);
+	struct task *finished = malloc(sizeof(struct task) * cap);
+	struct task *renewed = malloc(sizeof(struct task) * threads);
+	uint64_t *task_id = malloc(sizeof(uint64_t) * threads * g_queue_depth);
+	uint64_t *task_size = malloc(sizeof(uint64_t) * threads * g_queue_depth);
+	uint64_t *ids = malloc(sizeof(uint64_t) * threads * g_queue_depth);
+	int *owner = malloc(sizeof(int) * threads * g_queue_depth);
+	int count = 0;
+	int first_shard = g_shard;
+	/* after a failure, the requests (or returns) are postponed, the rest goes on */
+	time_t request_after = 0;
+	time_t return_after = 0;
+	/* the spool may hold the results left by the previous clients */
+	int spooled = g_spool != NULL;
 	int tid;
 
-	assert(threads > 0);
+	if (finished == NULL || renewed == NULL || task_id == NULL || task_size == NULL || ids == NULL || owner == NULL) {
+		message(ERR "memory allocation failed!\n");
+		quit = 1;
+		goto end;
+	}
 
-	success = malloc(sizeof(int) * threads);
+	for (;;) {
+		int running;
+		int waiting;
+		int started = 0;
 
-	if (success == NULL) {
-		return -1;
+		#pragma omp critical(queue)
+		{
+			while (count < cap && queue_pop(&g_finished, finished + count) == 0) {
+				count++;
+			}
+
+			while (queue_pop(&g_started, renewed + started) == 0) {
+				started++;
+			}
+
+			running = g_running;
+			waiting = g_finished.len;
+		}
+
+		/* a lost renewal keeps the longer lease, so it is not retried */
+		if (started > 0 && send_tasks(&started, renewed, open_socket_and_renew_tasks) < 0) {
+			message(WARN "unable to renew the leases\n");
+		}
+
+		/* if the spool fails, the results are returned directly */
+		if (g_spool != NULL && count > 0 && spool_tasks(&count, finished) > 0) {
+			spooled = 1;
+		}
+
+		if (time(NULL) >= return_after) {
+			if (count > 0 && return_tasks(&count, finished) < 0) {
+				message(ERR "return_tasks failed\n");
+				return_after = time(NULL) + SLEEP_INTERVAL;
+			} else if (spooled && flush_spool() < 0) {
+				return_after = time(NULL) + SLEEP_INTERVAL;
+			} else {
+				spooled = 0;
+			}
+		}
+
+		if (quit) {
+			/* wait for the running tasks, and return them */
+			if (running == 0 && waiting == 0 && count == 0) {
+				break;
+			}
+		} else if (time(NULL) >= request_after) {
+			int r = prefetch_tasks(threads, batch_mode, request_lowest_incomplete, clientid, task_id, task_size, ids, owner);
+
+			if (r < 0) {
+				message(ERR "prefetch_tasks failed\n");
+				/* try the other shards before waiting */
+				if (use_shard(g_shard + 1) == first_shard) {
+					request_after = time(NULL) + SLEEP_INTERVAL;
+				}
+			} else if (r > 0) {
+				message(INFO "%i assignments prefetched\n", r);
+				first_shard = g_shard;
+			}
+		}
+
+		usleep(QUEUE_POLL_INTERVAL);
 	}
 
-	#pragma omp parallel num_threads(threads)
-	{
-		int tid = threads_get_thread_id();
+	/* revoke the tasks that have not been started */
+	#pragma omp critical(queue)
+	for (tid = 0; tid < threads; ++tid) {
+		while (queue_pop(g_queues + tid, finished + count) == 0) {
+			finished[count++].failed = 1;
+		}
+	}
 
-		message(INFO "thread %i: got assignment %" PRIu64 "\n", tid, task_id[tid]);
+	while (return_tasks(&count, finished) < 0) {
+		message(ERR "return_tasks failed\n");
+		sleep(SLEEP_INTERVAL);
+	}
+
+	/* the results in the spool are safe, a single attempt is enough */
+	if (spooled) {
+		flush_spool();
+	}
+
+end:
+	free(finished);
+	free(renewed);
+	free(task_id);
+	free(task_size);
+	free(ids);
+	free(owner);
+}
+
+/* a thread of the queue mode: runs the tasks of its queue one after another */
+void run_queued_tasks(int tid, unsigned long alarm_seconds, int gpu_mode)
+{
+	place_thread(tid);
+
+	while (!quit) {
+		struct task task;
+		unsigned long alarm;
+		time_t start;
+		int r;
+
+		#pragma omp critical(queue)
+		r = queue_pop(g_queues + tid, &task);
+
+		if (r < 0) {
+			usleep(QUEUE_POLL_INTERVAL);
+			continue;
+		}
+
+		message(INFO "thread %i: got assignment %" PRIu64 "\n", tid, task.task_id);
 
 		/* initialization, since the worker is not mandated to fill these */
-		overflow[tid] = 0;
-		usertime[tid] = 0;
-		checksum[tid] = 0;
-		mxoffset[tid] = 0;
-		cycleoff[tid] = 0;
+		task.overflow = 0;
+		task.usertime = 0;
+		task.checksum = 0;
+		task.mxoffset = 0;
+		task.cycleoff = 0;
 
-		success[tid] = run_assignment(tid, task_id[tid], task_size[tid], overflow+tid, usertime+tid, checksum+tid, mxoffset+tid, cycleoff+tid, alarm_seconds, gpu_mode);
+		alarm = estimate_alarm(alarm_seconds);
+		start = time(NULL);
 
-		if (success[tid] < 0) {
+		/* the next round of the feeder shortens the lease to the estimate */
+		if (alarm != 0 && g_alarm_factor > 0.) {
+			task.lease = alarm + LEASE_MARGIN;
+
+			#pragma omp critical(queue)
+			queue_push(&g_started, &task);
+		}
+
+		if (gpu_mode && g_persistent_mode) {
+			r = run_assignment_persistent(tid, task.task_id, task.task_size, &task.overflow, &task.usertime, &task.checksum, &task.mxoffset, &task.cycleoff, alarm);
+		} else {
+			r = run_assignment(tid, task.task_id, task.task_size, &task.overflow, &task.usertime, &task.checksum, &task.mxoffset, &task.cycleoff, alarm, gpu_mode);
+		}
+
+		estimate_task(start, task.usertime, alarm, r < 0);
+
+		if (r < 0) {
 			message(ERR "thread %i: run_assignment failed\n", tid);
 		}
+
+		task.failed = (r < 0);
+
+		for (;;) {
+			#pragma omp critical(queue)
+			r = queue_push(&g_finished, &task);
+
+			if (r == 0) {
+				break;
+			}
+
+			usleep(QUEUE_POLL_INTERVAL);
+		}
+
+		if (task.failed && !quit) {
+			/* give others a chance to pick up the revoked assignment */
+			sleep(SLEEP_INTERVAL);
+		}
+	}
+
+	#pragma omp atomic
+	g_running--;
+}
+
+/*
+ * The queue mode: each thread has its own queue of the prefetched tasks and
+ * starts the next one as soon as its worker exits. An extra thread refills
+ * the queues and returns the results in the background. Returns on quit.
+ */
+int run_queue_mode(int threads, int batch_mode, int request_lowest_incomplete, const uint64_t clientid[], unsigned long alarm_seconds, int gpu_mode)
+{
+	int tid;
+
+	g_queues = malloc(sizeof(struct queue) * threads);
+
+	if (g_queues == NULL) {
+		return -1;
 	}
 
 	for (tid = 0; tid < threads; ++tid) {
-		if (success[tid] < 0) {
-			free(success);
+		if (queue_init(g_queues + tid, g_queue_depth) < 0) {
 			return -1;
 		}
 	}
 
-	free(success);
+	if (queue_init(&g_finished, threads * (g_queue_depth + 1)) < 0) {
+		return -1;
+	}
+
+	if (queue_init(&g_started, threads) < 0) {
+		return -1;
+	}
+
+	g_running = threads;
+
+	#pragma omp parallel num_threads(threads + 1)
+	{
+		int id = threads_get_thread_id();
+
+		if (id < threads) {
+			run_queued_tasks(id, alarm_seconds, gpu_mode);
+		} else {
+			feed_queues(threads, batch_mode, request_lowest_incomplete, clientid);
+		}
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		queue_free(g_queues + tid);
+	}
+
+	queue_free(&g_finished);
+	queue_free(&g_started);
+	free(g_queues);
 
 	return 0;
 }
@@ -859,14 +2473,30 @@ int main(int argc, char *argv[])
 	unsigned long alarm_seconds = 0;
 	int gpu_mode = 0;
 	int batch_mode = 0;
+	int range_mode = 0;
+	int session_mode = 0;
+	int have_tasks = 0;
+	int first_shard;
+	const char *placement = NULL;
 
 	if (getenv("SERVER_NAME")) {
 		servername = getenv("SERVER_NAME");
 	}
 
-	message(INFO "server to be used: %s\n", servername);
+	if (getenv("SERVER_SHARDS")) {
+		g_shards_n = shards_parse(getenv("SERVER_SHARDS"), g_shards, serverport);
+
+		if (g_shards_n <= 0) {
+			message(ERR "invalid SERVER_SHARDS, expected host:port,host:port,...\n");
+			return EXIT_FAILURE;
+		}
+
+		message(INFO "server to be used: %i shards\n", g_shards_n);
+	} else {
+		message(INFO "server to be used: %s\n", servername);
+	}
 
-	while ((opt = getopt(argc, argv, "1la:b:gdB")) != -1) {
+	while ((opt = getopt(argc, argv, "1la:A:b:gdBmRSq:P:s:")) != -1) {
 		switch (opt) {
 			unsigned long seconds;
 			case '1':
@@ -878,6 +2508,10 @@ int main(int argc, char *argv[])
 			case 'a':
 				alarm_seconds = atoul(optarg);
 				break;
+			case 'A':
+				g_alarm_factor = atof(optarg);
+				message(INFO "alarms calibrated at %.2f times the task time!\n", g_alarm_factor);
+				break;
 			case 'b':
 				alarm(seconds = atoul(optarg));
 				message(DBG "MCLIENT ALARM %lu\n", seconds);
@@ -894,8 +2528,31 @@ int main(int argc, char *argv[])
 				batch_mode = 1;
 				message(INFO "batch mode activated!\n");
 				break;
+			case 'm':
+				g_persistent_mode = 1;
+				message(INFO "persistent gpuworker mode activated!\n");
+				break;
+			case 'R':
+				range_mode = 1;
+				message(INFO "range mode activated!\n");
+				break;
+			case 'S':
+				session_mode = 1;
+				message(INFO "session mode activated!\n");
+				break;
+			case 'q':
+				g_queue_depth = atoi(optarg);
+				message(INFO "queue mode activated, %i tasks queued per thread!\n", g_queue_depth);
+				break;
+			case 'P':
+				placement = optarg;
+				break;
+			case 's':
+				g_spool = optarg;
+				message(INFO "results spooled in '%s'!\n", g_spool);
+				break;
 			default:
-				message(ERR "Usage: %s [-1] num_threads\n", argv[0]);
+				message(ERR "Usage: %s [-1] [-a seconds] [-A factor] [-q depth] [-P cores|pairs|auto] [-s spool] num_threads\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -904,10 +2561,29 @@ int main(int argc, char *argv[])
 
 	assert(threads > 0);
 
+	if (placement != NULL && placement_init(placement, &threads) < 0) {
+		return EXIT_FAILURE;
+	}
+
 	if (one_shot) {
 		message(INFO "one shot mode activated!\n");
 	}
 
+	if (g_queue_depth < 0 || (g_queue_depth > 0 && (one_shot || range_mode || session_mode))) {
+		message(ERR "the queue mode cannot be combined with -1, -R, or -S\n");
+		return EXIT_FAILURE;
+	}
+
+	if (g_alarm_factor < 0.) {
+		message(ERR "the alarm factor must not be negative\n");
+		return EXIT_FAILURE;
+	}
+
+	if (g_spool != NULL && (range_mode || session_mode)) {
+		message(ERR "the spool cannot be combined with -R or -S\n");
+		return EXIT_FAILURE;
+	}
+
 	if (alarm_seconds) {
 		message(INFO "a signal to be delivered to workers in %lu seconds!\n", alarm_seconds);
 	}
@@ -926,12 +2602,35 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (g_persistent_mode) {
+		g_workers = malloc(sizeof(struct worker) * threads);
+
+		if (g_workers == NULL) {
+			message(ERR "memory allocation failed!\n");
+			return EXIT_FAILURE;
+		}
+
+		for (tid = 0; tid < threads; ++tid) {
+			g_workers[tid].pid = 0;
+			g_workers[tid].in = NULL;
+			g_workers[tid].out = NULL;
+		}
+
+		/* a dead worker must not kill the client */
+		signal(SIGPIPE, SIG_IGN);
+	}
+
 	for (tid = 0; tid < threads; ++tid) {
 		clientid[tid] = 0;
 
 		if (open_urandom_and_read_clientid(clientid+tid) < 0) {
 			message(WARN "unable to generate random client ID");
 		}
+
+		/* a range is leased to a single client ID */
+		if (range_mode) {
+			clientid[tid] = clientid[0];
+		}
 	}
 
 	signal(SIGINT, signal_handler);
@@ -940,14 +2639,41 @@ int main(int argc, char *argv[])
 	signal(SIGUSR1, signal_handler);
 	signal(SIGUSR2, signal_handler);
 
+	/* spread the clients over the shards */
+	if (g_shards_n > 0) {
+		use_shard((int)(clientid[0] % (uint64_t)g_shards_n));
+	}
+
+	/* returns once the client is asked to quit */
+	if (g_queue_depth > 0 && run_queue_mode(threads, batch_mode, request_lowest_incomplete, clientid, alarm_seconds, gpu_mode) < 0) {
+		message(ERR "memory allocation failed!\n");
+		return EXIT_FAILURE;
+	}
+
+	/* pick up the results left by the previous clients */
+	if (g_spool != NULL && g_queue_depth == 0) {
+		flush_spool();
+	}
+
 	while (!quit) {
-		while (open_socket_and_request_multiple_assignments_wrapper(batch_mode, threads, request_lowest_incomplete, task_id, task_size, clientid) < 0) {
+		first_shard = g_shard;
+
+		/* in the session mode, the next assignments come with the return of the previous ones */
+		while (!have_tasks && (session_mode ? session_return_and_request(threads, range_mode, NULL, NULL, NULL, NULL, NULL, NULL, task_id, task_size, clientid)
+		                    : range_mode ? open_socket_and_request_range(threads, task_id, task_size, clientid[0])
+		                    : open_socket_and_request_multiple_assignments_wrapper(batch_mode, threads, request_lowest_incomplete, task_id, task_size, clientid)) < 0) {
 			message(ERR "open_socket_and_request_multiple_assignments_wrapper failed\n");
 			if (quit)
 				goto end;
-			sleep(SLEEP_INTERVAL);
+			/* try the other shards before sleeping */
+			if (use_shard(g_shard + 1) == first_shard)
+				sleep(SLEEP_INTERVAL);
 		}
 
+		have_tasks = 0;
+
+		renew_leases(threads, task_id, task_size, clientid, alarm_seconds);
+
 		if (run_assignments_in_parallel(threads, task_id, task_size, overflow, usertime, checksum, mxoffset, cycleoff, alarm_seconds, gpu_mode) < 0) {
 			while (open_socket_and_revoke_multiple_assignments(threads, task_id, task_size, clientid) < 0) {
 				message(ERR "open_socket_and_revoke_multiple_assignments failed\n");
@@ -964,7 +2690,28 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		while (open_socket_and_return_multiple_assignments(threads, task_id, task_size, overflow, usertime, checksum, mxoffset, cycleoff, clientid) < 0) {
+		/* once in the spool, the results survive the client; a failed flush is retried after the next group */
+		if (g_spool != NULL && spool_multiple_results(threads, task_id, task_size, overflow, usertime, checksum, mxoffset, cycleoff, clientid) == 0) {
+			flush_spool();
+
+			if (one_shot)
+				break;
+
+			continue;
+		}
+
+		if (session_mode && !one_shot && !quit) {
+			if (session_return_and_request(threads, range_mode, task_id, overflow, usertime, checksum, mxoffset, cycleoff, task_id, task_size, clientid) == 0) {
+				message(INFO "all assignments returned\n");
+				have_tasks = 1;
+				continue;
+			}
+
+			message(ERR "session_return_and_request failed, returning without the session\n");
+		}
+
+		while ((range_mode ? open_socket_and_return_range(threads, task_id, task_size, overflow, usertime, checksum, mxoffset, clientid[0])
+		                   : open_socket_and_return_multiple_assignments(threads, task_id, task_size, overflow, usertime, checksum, mxoffset, cycleoff, clientid)) < 0) {
 			message(ERR "open_socket_and_return_multiple_assignments failed\n");
 			sleep(SLEEP_INTERVAL);
 		}
@@ -978,6 +2725,27 @@ int main(int argc, char *argv[])
 			;
 	}
 
+	if (have_tasks) {
+		while (open_socket_and_revoke_multiple_assignments(threads, task_id, task_size, clientid) < 0) {
+			message(ERR "open_socket_and_revoke_multiple_assignments failed\n");
+			sleep(SLEEP_INTERVAL);
+		}
+	}
+
+	if (g_spool != NULL && g_queue_depth == 0) {
+		flush_spool();
+	}
+
+	session_close();
+
+	if (g_persistent_mode) {
+		for (tid = 0; tid < threads; ++tid) {
+			stop_worker(tid, g_workers + tid);
+		}
+
+		free(g_workers);
+	}
+
 	free(task_id);
 	free(task_size);
 	free(clientid);
@@ -986,6 +2754,7 @@ int main(int argc, char *argv[])
 	free(checksum);
 	free(mxoffset);
 	free(cycleoff);
+	free(g_placement);
 
 	message(INFO "client has been halted\n");
 
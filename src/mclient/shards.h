@@ -0,0 +1 @@
+../common/shards.h
\ No newline at end of file
@@ -0,0 +1,261 @@
+/**
+ * The placement of the worker processes.
+ *
+ * The CPUs the client is allowed to run on (its affinity mask, which also
+ * reflects the cpuset) are described by sysfs: the package, the core and
+ * the NUMA node of each of them. A thread of the client pins itself to a
+ * CPU and prefers the memory of its node; the worker it forks inherits
+ * both. The CPUs are ordered so that the consecutive threads either take
+ * whole cores first (the SMT siblings are used last), or share the cores
+ * in pairs of the siblings. The nodes are taken in turns.
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "compat.h"
+
+#define TOPOLOGY_CPUS_MAX CPU_SETSIZE
+
+#define TOPOLOGY_CORES 0 /* one thread per core, then the siblings */
+#define TOPOLOGY_PAIRS 1 /* the siblings next to each other */
+
+#ifndef MPOL_PREFERRED
+#	define MPOL_PREFERRED 1
+#endif
+
+struct cpu_info {
+	int cpu;
+	int package;
+	int core;
+	int node;
+	int smt; /* 0 for the first hardware thread of the core, 1 for its sibling, ... */
+	int rank; /* of the core within the node */
+};
+
+UNUSED
+static int topology_read_int(const char *path, int fallback)
+{
+	FILE *stream = fopen(path, "r");
+	int value;
+
+	if (stream == NULL) {
+		return fallback;
+	}
+
+	if (fscanf(stream, "%i", &value) != 1) {
+		value = fallback;
+	}
+
+	fclose(stream);
+
+	return value;
+}
+
+/* the cpuN directory contains the nodeM link */
+UNUSED
+static int topology_read_node(int cpu)
+{
+	char path[4096];
+	DIR *dir;
+	struct dirent *entry;
+	int node = 0;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%i", cpu);
+
+	dir = opendir(path);
+
+	if (dir == NULL) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) == 0 && sscanf(entry->d_name + 4, "%i", &node) == 1) {
+			break;
+		}
+	}
+
+	closedir(dir);
+
+	return node;
+}
+
+/* returns the number of the allowed CPUs, or -1 */
+UNUSED
+static int topology_read(struct cpu_info cpus[])
+{
+	cpu_set_t set;
+	int cpu;
+	int n = 0;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &set) < 0) {
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		char path[4096];
+
+		if (!CPU_ISSET(cpu, &set)) {
+			continue;
+		}
+
+		cpus[n].cpu = cpu;
+
+		sprintf(path, "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", cpu);
+		cpus[n].package = topology_read_int(path, 0);
+
+		sprintf(path, "/sys/devices/system/cpu/cpu%i/topology/core_id", cpu);
+		cpus[n].core = topology_read_int(path, cpu);
+
+		cpus[n].node = topology_read_node(cpu);
+		cpus[n].smt = 0;
+		cpus[n].rank = 0;
+
+		/* the siblings of the core seen so far, and the cores of the node */
+		for (i = 0; i < n; ++i) {
+			if (cpus[i].package == cpus[n].package && cpus[i].core == cpus[n].core) {
+				cpus[n].smt++;
+			}
+		}
+
+		if (cpus[n].smt == 0) {
+			for (i = 0; i < n; ++i) {
+				if (cpus[i].node == cpus[n].node && cpus[i].smt == 0) {
+					cpus[n].rank++;
+				}
+			}
+		} else {
+			for (i = 0; i < n; ++i) {
+				if (cpus[i].package == cpus[n].package && cpus[i].core == cpus[n].core) {
+					cpus[n].rank = cpus[i].rank;
+					break;
+				}
+			}
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+/* the key of topology_compare() */
+static int topology_mode UNUSED;
+
+UNUSED
+static int topology_compare(const void *l, const void *r)
+{
+	const struct cpu_info *a = l;
+	const struct cpu_info *b = r;
+	int keys_a[3];
+	int keys_b[3];
+	int i;
+
+	if (topology_mode == TOPOLOGY_PAIRS) {
+		keys_a[0] = a->rank;
+		keys_a[1] = a->node;
+		keys_a[2] = a->smt;
+		keys_b[0] = b->rank;
+		keys_b[1] = b->node;
+		keys_b[2] = b->smt;
+	} else {
+		keys_a[0] = a->smt;
+		keys_a[1] = a->rank;
+		keys_a[2] = a->node;
+		keys_b[0] = b->smt;
+		keys_b[1] = b->rank;
+		keys_b[2] = b->node;
+	}
+
+	for (i = 0; i < 3; ++i) {
+		if (keys_a[i] != keys_b[i]) {
+			return keys_a[i] < keys_b[i] ? -1 : +1;
+		}
+	}
+
+	return a->cpu < b->cpu ? -1 : a->cpu > b->cpu;
+}
+
+/* the thread i is to be placed on cpus[i % n] */
+UNUSED
+static void topology_order(struct cpu_info cpus[], int n, int mode)
+{
+	topology_mode = mode;
+
+	qsort(cpus, (size_t)n, sizeof(struct cpu_info), topology_compare);
+}
+
+/* the number of the physical cores */
+UNUSED
+static int topology_cores(const struct cpu_info cpus[], int n)
+{
+	int cores = 0;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		if (cpus[i].smt == 0) {
+			cores++;
+		}
+	}
+
+	return cores;
+}
+
+/* the number of the NUMA nodes */
+UNUSED
+static int topology_nodes(const struct cpu_info cpus[], int n)
+{
+	int nodes = 0;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		if (cpus[i].node + 1 > nodes) {
+			nodes = cpus[i].node + 1;
+		}
+	}
+
+	return nodes;
+}
+
+/* pins the calling thread */
+UNUSED
+static int topology_pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+/* the calling thread allocates from the node, unless it is full */
+UNUSED
+static int topology_prefer_node(int node)
+{
+#ifdef SYS_set_mempolicy
+	unsigned long mask[16];
+
+	if (node < 0 || node >= (int)(sizeof(mask) * 8)) {
+		return -1;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+	return (int)syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1);
+#else
+	(void)node;
+	return -1;
+#endif
+}
+
+#endif /* TOPOLOGY_H_ */
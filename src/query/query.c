@@ -19,9 +19,14 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/tcp.h>
+#include "shards.h"
 
 const char *servername = "localhost";
-const uint16_t serverport = 5006;
+uint16_t serverport = 5006;
+
+/* SERVER_SHARDS, or just the server above */
+static struct shard g_shards[SHARDS_MAX];
+static int g_shards_n = 0;
 
 #define ERR "ERROR: "
 #define WARN "WARNING: "
@@ -172,6 +177,24 @@ int query_ping(int fd)
 	return 0;
 }
 
+int query_stats(int fd)
+{
+	if (write_(fd, "STA", 4) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int query_shard(int fd)
+{
+	if (write_(fd, "SHD", 4) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
 int open_socket_to_server()
 {
 	int fd;
@@ -290,18 +313,162 @@ int open_socket_and_ping()
 	return 0;
 }
 
+/* the range of the tasks [lo, hi) owned by the server */
+int open_socket_and_query_shard(uint64_t *lo, uint64_t *hi)
+{
+	int fd;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (query_shard(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (read_uint64(fd, lo) < 0 || read_uint64(fd, hi) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+#define STATS_MAX 64
+
+/* returns the number of the words read into stats[] */
+int open_socket_and_query_stats(uint64_t stats[])
+{
+	int fd;
+	uint64_t n;
+	uint64_t i;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (query_stats(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (read_uint64(fd, &n) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < n; ++i) {
+		uint64_t word;
+
+		if (read_uint64(fd, &word) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		if (i < STATS_MAX) {
+			stats[i] = word;
+		}
+	}
+
+	close(fd);
+
+	return n < STATS_MAX ? (int)n : STATS_MAX;
+}
+
+void print_stats(const uint64_t stats[], int n)
+{
+	int i;
+
+	if (n < 9) {
+		message(ERR "incomplete statistics\n");
+		return;
+	}
+
+	printf("uptime %" PRIu64 " s\n", stats[0]);
+	printf("assigned %" PRIu64 " tasks/hour\n", stats[1]);
+	printf("completed %" PRIu64 " tasks/hour\n", stats[2]);
+	printf("overflows %" PRIu64 " tasks/hour (%.2f %%)\n", stats[3], stats[2] ? 100. * stats[3] / stats[2] : 0.);
+	printf("active leases %" PRIu64 "\n", stats[4]);
+	printf("median usertime %" PRIu64 " s\n", stats[5]);
+	printf("lowest incomplete %" PRIu64 "\n", stats[6]);
+	printf("highest requested %" PRIu64 "\n", stats[7]);
+	printf("gap %" PRIu64 "\n", stats[7] > stats[6] ? stats[7] - stats[6] : 0);
+	printf("clients %" PRIu64 "\n", stats[8]);
+
+	for (i = 9; i + 1 < n; i += 2) {
+		printf("client %" PRIu64 ".%" PRIu64 ".%" PRIu64 ".%" PRIu64 " %" PRIu64 " tasks (this and previous hour)\n",
+			stats[i] >> 24 & 255, stats[i] >> 16 & 255, stats[i] >> 8 & 255, stats[i] & 255, stats[i + 1]);
+	}
+}
+
+void use_shard(int i)
+{
+	servername = g_shards[i].name;
+	serverport = g_shards[i].port;
+}
+
+/*
+ * The lowest incomplete assignment over all shards. Each shard reports its
+ * own one (or the end of its range if it is complete), the smallest of them
+ * is the global one as long as the shards cover the task space.
+ */
+int query_lowest_incomplete_all(uint64_t *n, uint64_t *task_size)
+{
+	int i;
+
+	for (i = 0; i < g_shards_n; ++i) {
+		uint64_t shard_n;
+
+		use_shard(i);
+
+		if (open_socket_and_query_lowest_incomplete(&shard_n, task_size) < 0) {
+			message(ERR "shard %s:%u does not respond\n", servername, (unsigned)serverport);
+			return -1;
+		}
+
+		if (i == 0 || shard_n < *n) {
+			*n = shard_n;
+		}
+	}
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int opt;
 	int query = 0;
+	int i;
 
 	if (getenv("SERVER_NAME")) {
 		servername = getenv("SERVER_NAME");
 	}
 
-	message(INFO "server to be used: %s\n", servername);
+	if (getenv("SERVER_SHARDS")) {
+		g_shards_n = shards_parse(getenv("SERVER_SHARDS"), g_shards, serverport);
+
+		if (g_shards_n <= 0) {
+			message(ERR "invalid SERVER_SHARDS, expected host:port,host:port,...\n");
+			return EXIT_FAILURE;
+		}
+
+		message(INFO "server to be used: %i shards\n", g_shards_n);
+	} else {
+		strncpy(g_shards[0].name, servername, sizeof(g_shards[0].name) - 1);
+		g_shards[0].port = serverport;
+		g_shards_n = 1;
+
+		message(INFO "server to be used: %s\n", servername);
+	}
 
-	while ((opt = getopt(argc, argv, "lhp")) != -1) {
+	while ((opt = getopt(argc, argv, "lhps")) != -1) {
 		switch (opt) {
 			case 'l':
 				query = opt;
@@ -312,8 +479,11 @@ int main(int argc, char *argv[])
 			case 'p':
 				query = opt;
 				break;
+			case 's':
+				query = opt;
+				break;
 			default:
-				message(ERR "Usage: %s [-l|-h]\n", argv[0]);
+				message(ERR "Usage: %s [-l|-h|-p|-s]\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -321,12 +491,15 @@ int main(int argc, char *argv[])
 	switch (query) {
 			uint64_t n;
 			uint64_t task_size;
+			uint64_t lo, hi;
 			struct timespec ts;
 			uint64_t start_time;
 			uint64_t stop_time;
+			uint64_t stats[STATS_MAX];
+			int count;
 
 		case 'l':
-			if (open_socket_and_query_lowest_incomplete(&n, &task_size) < 0) {
+			if (query_lowest_incomplete_all(&n, &task_size) < 0) {
 				message(ERR "open_socket_and_query_lowest_incomplete failed\n");
 			} else {
 				printf("%" PRIu64 " %" PRIu64 "\n", n, task_size);
@@ -334,36 +507,67 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'h':
-			if (open_socket_and_query_highest_requested(&n, &task_size) < 0) {
-				message(ERR "open_socket_and_query_highest_requested failed\n");
-			} else {
-				printf("%" PRIu64 " %" PRIu64 "\n", n, task_size);
+			/* one line per shard */
+			for (i = 0; i < g_shards_n; ++i) {
+				use_shard(i);
+
+				if (open_socket_and_query_highest_requested(&n, &task_size) < 0) {
+					message(ERR "open_socket_and_query_highest_requested failed\n");
+				} else {
+					printf("%" PRIu64 " %" PRIu64 "\n", n, task_size);
+				}
 			}
 			break;
 
-		case 'p':
-			while (1) {
-				int status;
+		case 's':
+			for (i = 0; i < g_shards_n; ++i) {
+				use_shard(i);
 
-				if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-					message(ERR "clock_gettime failed\n");
-					abort();
-				}
-				start_time = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+				if (g_shards_n > 1) {
+					if (open_socket_and_query_shard(&lo, &hi) < 0) {
+						message(ERR "open_socket_and_query_shard failed\n");
+						continue;
+					}
 
-				status = open_socket_and_ping();
-				if (status < 0) {
-					message(ERR "open_socket_and_ping failed\n");
+					printf("shard %s:%u tasks %" PRIu64 " to %" PRIu64 "\n", servername, (unsigned)serverport, lo, hi);
 				}
 
-				if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-					message(ERR "clock_gettime failed\n");
-					abort();
+				count = open_socket_and_query_stats(stats);
+				if (count < 0) {
+					message(ERR "open_socket_and_query_stats failed\n");
+				} else {
+					print_stats(stats, count);
 				}
-				stop_time = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+			}
+			break;
 
-				if (status >= 0) {
-					message(INFO "ping time = %.2f msec\n", (stop_time - start_time) / 1e6f);
+		case 'p':
+			while (1) {
+				for (i = 0; i < g_shards_n; ++i) {
+					int status;
+
+					use_shard(i);
+
+					if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+						message(ERR "clock_gettime failed\n");
+						abort();
+					}
+					start_time = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+
+					status = open_socket_and_ping();
+					if (status < 0) {
+						message(ERR "open_socket_and_ping failed\n");
+					}
+
+					if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+						message(ERR "clock_gettime failed\n");
+						abort();
+					}
+					stop_time = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+
+					if (status >= 0) {
+						message(INFO "ping time = %.2f msec (%s:%u)\n", (stop_time - start_time) / 1e6f, servername, (unsigned)serverport);
+					}
 				}
 
 				sleep(1);
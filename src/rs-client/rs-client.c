@@ -23,6 +23,7 @@
 #include <inttypes.h>
 
 #include "compat.h"
+#include "spool.h"
 
 #define SLEEP_INTERVAL 10
 
@@ -35,6 +36,11 @@ static volatile sig_atomic_t quit = 0;
 
 static int g_force_device_index = 0;
 
+/* the results are made durable in the spool before they are returned */
+static const char *g_spool = NULL;
+
+#define SPOOL_RECORD_WORDS 6
+
 void signal_handler(int i)
 {
 	(void)i;
@@ -699,6 +705,88 @@ int open_socket_and_return_multiple_assignments(int threads, uint64_t target[],
 	return 0;
 }
 
+/* spool_send_t, the records are [target][log2_no_procs][task_id][overflow][realtime][checksum] */
+int return_spooled_results(int count, int nwords, const uint64_t records[], void *arg)
+{
+	uint64_t *fields = malloc(sizeof(uint64_t) * SPOOL_RECORD_WORDS * count);
+	int i, k;
+	int r;
+
+	(void)arg;
+
+	if (fields == NULL) {
+		return -1;
+	}
+
+	/* the k-th field of all records is at fields + k * count */
+	for (i = 0; i < count; ++i) {
+		for (k = 0; k < SPOOL_RECORD_WORDS; ++k) {
+			fields[k * count + i] = records[(size_t)i * nwords + k];
+		}
+	}
+
+	r = open_socket_and_return_multiple_assignments(count, fields, fields + count, fields + 2 * count, fields + 3 * count, fields + 4 * count, fields + 5 * count);
+
+	free(fields);
+
+	return r;
+}
+
+/* returns -1 if the results have to be returned directly */
+int spool_multiple_results(int threads, const uint64_t target[], const uint64_t log2_no_procs[], const uint64_t task_id[], const uint64_t overflow[], const uint64_t realtime[], const uint64_t checksum[])
+{
+	uint64_t *records = malloc(sizeof(uint64_t) * SPOOL_RECORD_WORDS * threads);
+	int tid;
+	int r;
+
+	if (records == NULL) {
+		return -1;
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		uint64_t *record = records + (size_t)tid * SPOOL_RECORD_WORDS;
+
+		record[0] = target[tid];
+		record[1] = log2_no_procs[tid];
+		record[2] = task_id[tid];
+		record[3] = overflow[tid];
+		record[4] = realtime[tid];
+		record[5] = checksum[tid];
+	}
+
+	r = spool_append(g_spool, threads, SPOOL_RECORD_WORDS, records);
+
+	if (r < 0) {
+		message(ERR "unable to append to the spool '%s'\n", g_spool);
+	}
+
+	free(records);
+
+	return r;
+}
+
+/* returns the spooled results (also those left by other clients) */
+int flush_spool(void)
+{
+	size_t damaged;
+	long r = spool_flush(g_spool, SPOOL_RECORD_WORDS, return_spooled_results, NULL, &damaged);
+
+	if (damaged > 0) {
+		message(WARN "%lu damaged bytes dropped from the spool\n", (unsigned long)damaged);
+	}
+
+	if (r < 0) {
+		message(ERR "unable to flush the spool, to be retried\n");
+		return -1;
+	}
+
+	if (r > 0) {
+		message(INFO "%li spooled results returned\n", r);
+	}
+
+	return 0;
+}
+
 int run_assignments_in_parallel(int threads, const uint64_t target[], const uint64_t log2_no_procs[], const uint64_t task_id[], uint64_t overflow[], uint64_t realtime[], uint64_t checksum[], uint64_t sieve_logsize[], unsigned long alarm_seconds)
 {
 	int *success;
@@ -771,7 +859,7 @@ int main(int argc, char *argv[])
 
 	message(INFO "server to be used: %s\n", servername);
 
-	while ((opt = getopt(argc, argv, "1la:b:dB")) != -1) {
+	while ((opt = getopt(argc, argv, "1la:b:dBs:")) != -1) {
 		switch (opt) {
 			unsigned long seconds;
 			case '1':
@@ -795,8 +883,12 @@ int main(int argc, char *argv[])
 				batch_mode = 1;
 				message(INFO "batch mode activated!\n");
 				break;
+			case 's':
+				g_spool = optarg;
+				message(INFO "results spooled in '%s'!\n", g_spool);
+				break;
 			default:
-				message(ERR "Usage: %s [-1] num_threads\n", argv[0]);
+				message(ERR "Usage: %s [-1] [-s spool] num_threads\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -832,6 +924,11 @@ int main(int argc, char *argv[])
 	signal(SIGUSR1, signal_handler);
 	signal(SIGUSR2, signal_handler);
 
+	/* pick up the results left by the previous clients */
+	if (g_spool != NULL) {
+		flush_spool();
+	}
+
 	while (!quit) {
 		while (open_socket_and_request_multiple_assignments_wrapper(batch_mode, threads, request_lowest_incomplete, target, log2_no_procs, task_id) < 0) {
 			message(ERR "open_socket_and_request_multiple_assignments_wrapper failed\n");
@@ -856,6 +953,16 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
+		/* once in the spool, the results survive the client; a failed flush is retried after the next group */
+		if (g_spool != NULL && spool_multiple_results(threads, target, log2_no_procs, task_id, overflow, realtime, checksum) == 0) {
+			flush_spool();
+
+			if (one_shot)
+				break;
+
+			continue;
+		}
+
 		while (open_socket_and_return_multiple_assignments(threads, target, log2_no_procs, task_id, overflow, realtime, checksum) < 0) {
 			message(ERR "open_socket_and_return_multiple_assignments failed\n");
 			sleep(SLEEP_INTERVAL);
@@ -870,6 +977,10 @@ int main(int argc, char *argv[])
 			;
 	}
 
+	if (g_spool != NULL) {
+		flush_spool();
+	}
+
 	free(target);
 	free(log2_no_procs);
 	free(task_id);
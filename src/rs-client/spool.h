@@ -0,0 +1 @@
+../common/spool.h
\ No newline at end of file
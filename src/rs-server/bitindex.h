@@ -0,0 +1 @@
+../common/bitindex.h
\ No newline at end of file
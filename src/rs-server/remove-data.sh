@@ -1,5 +1,6 @@
 #!/bin/bash
 
 rm -f -- *.dat *.map *.log
+rm -rf -- round-*/
 
 make clean
@@ -1,3 +1,4 @@
+/* the first round unless -t and -d are given to rs-server, and the round of the data without the round file */
 #define TARGET 40
 #define DELTA 28
 #define LOG2_NO_PROCS ((TARGET) - (DELTA))
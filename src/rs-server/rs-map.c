@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -9,10 +10,15 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include "wideint.h"
+#include "compat.h"
 
-#include "rs-config.h"
+#include "rs-round.h"
 
-#define ASSIGNMENTS_NO (UINT64_C(1) << (LOG2_NO_PROCS))
+/* of the round */
+uint64_t g_target;
+uint64_t g_log2_no_procs;
+
+#define ASSIGNMENTS_NO (UINT64_C(1) << g_log2_no_procs)
 
 #define MAP_SIZE ((ASSIGNMENTS_NO + 7) >> 3)
 
@@ -44,16 +50,40 @@ const void *open_map(const char *path)
 	return (const uint64_t *)ptr;
 }
 
-int main(void)
+/* usage: rs-map [round_directory] */
+int main(int argc, char *argv[])
 {
 	uint64_t n;
 	uint64_t completed = 0;
 	uint64_t active = 0;
 
+	if (argc > 1 && chdir(argv[1]) < 0) {
+		perror("chdir");
+		return EXIT_FAILURE;
+	}
+
+	if (round_read(".", &g_target, &g_log2_no_procs) < 0) {
+		fprintf(stderr, "invalid %s file\n", ROUND_FILE);
+		return EXIT_FAILURE;
+	}
+
+	printf("TARGET = %" PRIu64 "\n", g_target);
+
 	g_map_assigned = open_map("assigned.map");
 	g_map_complete = open_map("complete.map");
 
-	for (n = 0; n < ASSIGNMENTS_NO; ++n) {
+	/* by words, the bytes of the maps are little-endian words */
+	for (n = 0; n + 64 <= ASSIGNMENTS_NO; n += 64) {
+		uint64_t assigned, complete;
+
+		memcpy(&assigned, g_map_assigned + (n >> 3), sizeof(uint64_t));
+		memcpy(&complete, g_map_complete + (n >> 3), sizeof(uint64_t));
+
+		completed += popcountu64(complete);
+		active += popcountu64(assigned & ~complete);
+	}
+
+	for (; n < ASSIGNMENTS_NO; ++n) {
 		if (IS_COMPLETE(n)) {
 			completed++;
 		}
@@ -169,6 +169,15 @@ int query_ping(int fd)
 	return 0;
 }
 
+int query_rounds(int fd)
+{
+	if (write_(fd, "RND", 4) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
 int open_socket_to_server(void)
 {
 	int fd;
@@ -265,6 +274,41 @@ int open_socket_and_query_highest_requested(uint64_t *target, uint64_t *log2_no_
 	return 0;
 }
 
+/* prints the rounds in progress */
+int open_socket_and_query_rounds(void)
+{
+	int fd;
+	uint64_t n;
+	uint64_t i;
+
+	fd = open_socket_to_server();
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (query_rounds(fd) < 0 || read_uint64(fd, &n) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < n; ++i) {
+		uint64_t target, log2_no_procs, lowest_incomplete, lowest_unassigned;
+
+		if (read_uint64(fd, &target) < 0 || read_uint64(fd, &log2_no_procs) < 0 || read_uint64(fd, &lowest_incomplete) < 0 || read_uint64(fd, &lowest_unassigned) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		printf("TARGET=%" PRIu64 ": incomplete %" PRIu64 "/%" PRIu64 ", unassigned %" PRIu64 "/%" PRIu64 "\n", target,
+			lowest_incomplete, (UINT64_C(1) << log2_no_procs) - 1, lowest_unassigned, (UINT64_C(1) << log2_no_procs) - 1);
+	}
+
+	close(fd);
+
+	return 0;
+}
+
 int open_socket_and_ping(void)
 {
 	int fd;
@@ -308,7 +352,7 @@ int main(int argc, char *argv[])
 
 	message(INFO "server to be used: %s\n", servername);
 
-	while ((opt = getopt(argc, argv, "lhp")) != -1) {
+	while ((opt = getopt(argc, argv, "lhpr")) != -1) {
 		switch (opt) {
 			case 'l':
 				query = opt;
@@ -319,8 +363,11 @@ int main(int argc, char *argv[])
 			case 'p':
 				query = opt;
 				break;
+			case 'r':
+				query = opt;
+				break;
 			default:
-				message(ERR "Usage: %s [-l|-h]\n", argv[0]);
+				message(ERR "Usage: %s [-l|-h|-p|-r]\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -349,6 +396,12 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'r':
+			if (open_socket_and_query_rounds() < 0) {
+				message(ERR "open_socket_and_query_rounds failed\n");
+			}
+			break;
+
 		case 'p':
 			while (1) {
 				int status;
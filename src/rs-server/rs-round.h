@@ -0,0 +1,67 @@
+/**
+ * The rounds of rs-server.
+ *
+ * Each TARGET is verified in its own round. The maps and the records of
+ * the round are kept in the directory round-<TARGET>, together with the
+ * file "round" which holds the TARGET and LOG2_NO_PROCS of the round. A
+ * directory without this file (the data of the older servers, which kept
+ * everything in the working directory) has the values of rs-config.h.
+ */
+
+#ifndef RS_ROUND_H_
+#define RS_ROUND_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "compat.h"
+#include "rs-config.h"
+
+#define ROUND_DIR_FORMAT "round-%" PRIu64
+#define ROUND_FILE "round"
+
+/* returns 0 if the file exists, 1 if the defaults are used, -1 on error */
+UNUSED
+static int round_read(const char *dir, uint64_t *target, uint64_t *log2_no_procs)
+{
+	char path[4096];
+	FILE *stream;
+	int r;
+
+	sprintf(path, "%s/%s", dir, ROUND_FILE);
+
+	stream = fopen(path, "r");
+
+	if (stream == NULL) {
+		*target = TARGET;
+		*log2_no_procs = LOG2_NO_PROCS;
+		return 1;
+	}
+
+	r = fscanf(stream, "%" SCNu64 " %" SCNu64, target, log2_no_procs);
+
+	fclose(stream);
+
+	return r == 2 ? 0 : -1;
+}
+
+UNUSED
+static int round_write(const char *dir, uint64_t target, uint64_t log2_no_procs)
+{
+	char path[4096];
+	FILE *stream;
+
+	sprintf(path, "%s/%s", dir, ROUND_FILE);
+
+	stream = fopen(path, "w");
+
+	if (stream == NULL) {
+		return -1;
+	}
+
+	fprintf(stream, "%" PRIu64 " %" PRIu64 "\n", target, log2_no_procs);
+
+	return fclose(stream);
+}
+
+#endif /* RS_ROUND_H_ */
@@ -22,9 +22,12 @@
 #include <netinet/tcp.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <dirent.h>
 #include "compat.h"
+#include "bitindex.h"
+#include "aggregates.h"
 
-const uint16_t serverport = 5007;
+uint16_t serverport = 5007;
 
 static volatile sig_atomic_t quit = 0;
 
@@ -173,166 +176,419 @@ int write_uint64(int fd, uint64_t n)
 	return 0;
 }
 
-#include "rs-config.h"
+#include "rs-round.h"
 
-#define ASSIGNMENTS_NO (UINT64_C(1) << (LOG2_NO_PROCS))
+/* the rounds in progress, the oldest first */
+#define ROUNDS_MAX 16
 
-#define MAP_SIZE ((ASSIGNMENTS_NO + 7) >> 3)
-#define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+struct round {
+	uint64_t target;
+	uint64_t log2_no_procs;
+	uint64_t no; /* assignments */
 
-#define IS_ASSIGNED(n) ( ( g_map_assigned[ (n)>>3 ] >> ((n)&7) ) & 1 )
-#define IS_COMPLETE(n) ( ( g_map_complete[ (n)>>3 ] >> ((n)&7) ) & 1 )
+	uint64_t lowest_unassigned; /* bit index, not byte */
+	uint64_t lowest_incomplete;
 
-#define SET_ASSIGNED(n)   ( g_map_assigned[(n)>>3] |= (1<<((n)&7)) )
-#define SET_UNASSIGNED(n) ( g_map_assigned[(n)>>3] &= UCHAR_MAX ^ (1<<((n)&7)) )
-#define SET_COMPLETE(n)   ( g_map_complete[(n)>>3] |= (1<<((n)&7)) )
-#define SET_INCOMPLETE(n) ( g_map_complete[(n)>>3] &= UCHAR_MAX ^ (1<<((n)&7)) )
+	unsigned char *map_assigned;
+	unsigned char *map_complete;
 
-uint64_t g_lowest_unassigned = 0; /* bit index, not byte */
-uint64_t g_lowest_incomplete = 0;
+	/* summaries of the maps above */
+	struct bitindex index_assigned;
+	struct bitindex index_complete;
 
-unsigned char *g_map_assigned;
-unsigned char *g_map_complete;
+	uint64_t *checksums;
+	uint64_t *usertimes;
+	uint64_t *overflows;
 
-uint64_t *g_checksums;
-uint64_t *g_usertimes;
-uint64_t *g_overflows;
+	/* the totals of the records above per superblock */
+	struct aggregates aggregates;
+};
 
-int set_complete(uint64_t n)
+#define MAP_SIZE(r) (((r)->no + 7) >> 3)
+#define RECORDS_SIZE(r) ((r)->no * 8)
+#define SUPERBLOCKS(r) (((r)->no + (UINT64_C(1) << AGGREGATES_SB_LOG2) - 1) >> AGGREGATES_SB_LOG2)
+
+#define IS_ASSIGNED(r, n) bitindex_get(&(r)->index_assigned, (n))
+#define IS_COMPLETE(r, n) bitindex_get(&(r)->index_complete, (n))
+
+#define SET_ASSIGNED(r, n)   bitindex_set(&(r)->index_assigned, (n))
+#define SET_UNASSIGNED(r, n) bitindex_clear(&(r)->index_assigned, (n))
+#define SET_COMPLETE(r, n)   bitindex_set(&(r)->index_complete, (n))
+#define SET_INCOMPLETE(r, n) bitindex_clear(&(r)->index_complete, (n))
+
+struct round g_rounds[ROUNDS_MAX];
+int g_rounds_n = 0;
+
+/* LOG2_NO_PROCS = TARGET - DELTA for the new rounds, see the -d option */
+uint64_t g_delta = DELTA;
+
+/* the next round is opened when the newest one has fewer unassigned tasks than this, see the -a option */
+uint64_t g_ahead = 0;
+
+int set_complete(struct round *r, uint64_t n)
 {
-	if (IS_COMPLETE(n)) {
+	if (IS_COMPLETE(r, n)) {
 		message(INFO "assignment %" PRIu64 " was already complete (duplicate result)\n", n);
 	}
 
-	if (!IS_ASSIGNED(n)) {
+	if (!IS_ASSIGNED(r, n)) {
 		message(ERR "assignment %" PRIu64 " was not assigned, discarting the result!\n", n);
 		return -1;
 	}
 
-	SET_COMPLETE(n);
+	SET_COMPLETE(r, n);
 
-	/* advance g_lowest_incomplete pointer */
-	if (n == g_lowest_incomplete) {
-		for (; g_lowest_incomplete < ASSIGNMENTS_NO && IS_COMPLETE(g_lowest_incomplete); ++g_lowest_incomplete)
-			;
+	/* advance lowest_incomplete pointer */
+	if (n == r->lowest_incomplete) {
+		r->lowest_incomplete = bitindex_find_zero(&r->index_complete, r->lowest_incomplete);
 	}
 
 	return 0;
 }
 
-uint64_t get_assignment(void)
+void unset_assignment(struct round *r, uint64_t n)
 {
-	uint64_t n = g_lowest_unassigned;
-
-	if (n == (UINT64_C(1) << LOG2_NO_PROCS)) {
-		return n;
+	if (IS_COMPLETE(r, n)) {
+		message(WARN "assignment %" PRIu64 " is already complete, invalid interrupt request!\n", n);
 	}
 
-	SET_ASSIGNED(n);
-
-	/* advance g_lowest_unassigned */
-	for (; g_lowest_unassigned < ASSIGNMENTS_NO && IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-		;
+	SET_UNASSIGNED(r, n);
 
-	return n;
+	if (r->lowest_unassigned > n) {
+		r->lowest_unassigned = n;
+	}
 }
 
-void unset_assignment(uint64_t n)
+void *open_map(const char *path, size_t size)
 {
-	if (n == (UINT64_C(1) << LOG2_NO_PROCS)) {
-		return;
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	void *ptr;
+
+	if (fd < 0) {
+		perror("open");
+		abort();
 	}
 
-	if (IS_COMPLETE(n)) {
-		message(WARN "assignment %" PRIu64 " is already complete, invalid interrupt request!\n", n);
+	if (ftruncate(fd, (off_t)size) < 0) {
+		perror("ftruncate");
+		abort();
 	}
 
-	SET_UNASSIGNED(n);
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-	if (g_lowest_unassigned > n) {
-		g_lowest_unassigned = n;
+	if (ptr == MAP_FAILED) {
+		perror("mmap");
+		abort();
 	}
+
+	close(fd);
+
+	return ptr;
 }
 
-uint64_t get_missed_assignment(int thread_id)
+/* recomputes the aggregates of the round from its records */
+void rebuild_aggregates(struct round *r)
 {
-	uint64_t n = g_lowest_incomplete;
-	int t;
+	uint64_t sb;
+
+	for (sb = 0; sb < SUPERBLOCKS(r); ++sb) {
+		struct aggregate a;
+		uint64_t n;
 
-	for (t = 0; t < thread_id; ++t) {
-		n++;
-		while (n < ASSIGNMENTS_NO && IS_COMPLETE(n)) {
-			n++;
+		memset(&a, 0, sizeof(struct aggregate));
+
+		for (n = sb << AGGREGATES_SB_LOG2; n < r->no && n < (sb + 1) << AGGREGATES_SB_LOG2; ++n) {
+			aggregate_add(&a, r->checksums[n], r->usertimes[n], r->overflows[n], 0, +1);
 		}
-	}
 
-	if (n == (UINT64_C(1) << LOG2_NO_PROCS)) {
-		return n;
+		aggregates_set(&r->aggregates, sb, &a);
 	}
+}
 
-	SET_ASSIGNED(n);
+/* the round of the target, or NULL */
+struct round *find_round(uint64_t target, uint64_t log2_no_procs)
+{
+	int i;
 
-	/* advance g_lowest_unassigned */
-	if (n == g_lowest_unassigned) {
-		for (; IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-			;
+	for (i = 0; i < g_rounds_n; ++i) {
+		if (g_rounds[i].target == target) {
+			return g_rounds[i].log2_no_procs == log2_no_procs ? &g_rounds[i] : NULL;
+		}
 	}
 
-	return n;
+	return NULL;
 }
 
-void *open_map(const char *path)
+/* maps the files of the round in its directory, creating them if needed */
+struct round *open_round(uint64_t target, uint64_t log2_no_procs)
 {
-	int fd = open(path, O_RDWR | O_CREAT, 0600);
-	void *ptr;
+	struct round *r;
+	char dir[64];
+	char path[4096];
+	int i;
+	int state;
+
+	if (g_rounds_n == ROUNDS_MAX) {
+		message(ERR "too many rounds in progress\n");
+		return NULL;
+	}
 
-	if (fd < 0) {
-		perror("open");
-		abort();
+	if (log2_no_procs > 40) {
+		message(ERR "TARGET %" PRIu64 ": too many assignments (2^%" PRIu64 ")\n", target, log2_no_procs);
+		return NULL;
 	}
 
-	if (ftruncate(fd, (off_t)MAP_SIZE) < 0) {
-		perror("ftruncate");
+	sprintf(dir, ROUND_DIR_FORMAT, target);
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		perror("mkdir");
+		return NULL;
+	}
+
+	if (round_write(dir, target, log2_no_procs) < 0) {
+		message(ERR "unable to write %s/%s\n", dir, ROUND_FILE);
+		return NULL;
+	}
+
+	/* keep the rounds sorted by the target */
+	for (i = g_rounds_n; i > 0 && g_rounds[i - 1].target > target; --i) {
+		g_rounds[i] = g_rounds[i - 1];
+	}
+
+	r = &g_rounds[i];
+	g_rounds_n++;
+
+	r->target = target;
+	r->log2_no_procs = log2_no_procs;
+	r->no = UINT64_C(1) << log2_no_procs;
+
+	sprintf(path, "%s/assigned.map", dir);
+	r->map_assigned = open_map(path, (size_t)MAP_SIZE(r));
+	sprintf(path, "%s/complete.map", dir);
+	r->map_complete = open_map(path, (size_t)MAP_SIZE(r));
+
+	if (bitindex_init(&r->index_assigned, r->map_assigned, r->no) < 0 || bitindex_init(&r->index_complete, r->map_complete, r->no) < 0) {
+		message(ERR "unable to build the map index\n");
 		abort();
 	}
 
-	ptr = mmap(NULL, (size_t)MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	sprintf(path, "%s/checksums.dat", dir);
+	r->checksums = open_map(path, (size_t)RECORDS_SIZE(r));
+	sprintf(path, "%s/usertimes.dat", dir);
+	r->usertimes = open_map(path, (size_t)RECORDS_SIZE(r));
+	sprintf(path, "%s/overflows.dat", dir);
+	r->overflows = open_map(path, (size_t)RECORDS_SIZE(r));
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
+	sprintf(path, "%s/aggregates.dat", dir);
+	state = aggregates_open(&r->aggregates, path, SUPERBLOCKS(r), 1);
+
+	if (state < 0) {
+		message(ERR "unable to open %s\n", path);
 		abort();
 	}
 
-	close(fd);
+	/* there is no log, the whole round is rebuilt after a crash */
+	if (state != AGGREGATES_OK) {
+		message(WARN "TARGET %" PRIu64 ": rebuilding the aggregates...\n", r->target);
 
-	return ptr;
+		rebuild_aggregates(r);
+	}
+
+	r->lowest_unassigned = bitindex_find_zero(&r->index_assigned, 0);
+	r->lowest_incomplete = bitindex_find_zero(&r->index_complete, 0);
+
+	message(INFO "TARGET = %" PRIu64 ", assignments %" PRIu64 ", lowest incomplete %" PRIu64 "\n", r->target, r->no, r->lowest_incomplete);
+
+	return r;
 }
 
-uint64_t *open_records(const char *path)
+void sync_round(struct round *r)
 {
-	int fd = open(path, O_RDWR | O_CREAT, 0600);
-	void *ptr;
+	msync(r->map_assigned, (size_t)MAP_SIZE(r), MS_SYNC);
+	msync(r->map_complete, (size_t)MAP_SIZE(r), MS_SYNC);
+	msync(r->checksums, (size_t)RECORDS_SIZE(r), MS_SYNC);
+	msync(r->usertimes, (size_t)RECORDS_SIZE(r), MS_SYNC);
+	msync(r->overflows, (size_t)RECORDS_SIZE(r), MS_SYNC);
+	aggregates_sync(&r->aggregates);
+}
 
-	if (fd < 0) {
-		perror("open");
-		abort();
+void close_round(struct round *r)
+{
+	int i;
+
+	sync_round(r);
+
+	aggregates_close(&r->aggregates);
+
+	bitindex_free(&r->index_assigned);
+	bitindex_free(&r->index_complete);
+
+	munmap(r->map_assigned, (size_t)MAP_SIZE(r));
+	munmap(r->map_complete, (size_t)MAP_SIZE(r));
+	munmap(r->checksums, (size_t)RECORDS_SIZE(r));
+	munmap(r->usertimes, (size_t)RECORDS_SIZE(r));
+	munmap(r->overflows, (size_t)RECORDS_SIZE(r));
+
+	for (i = (int)(r - g_rounds); i + 1 < g_rounds_n; ++i) {
+		g_rounds[i] = g_rounds[i + 1];
 	}
 
-	if (ftruncate(fd, (off_t)RECORDS_SIZE) < 0) {
-		perror("ftruncate");
-		abort();
+	g_rounds_n--;
+}
+
+int round_complete(const struct round *r)
+{
+	return r->lowest_incomplete == r->no;
+}
+
+/* the complete rounds are no longer needed, except the newest one (the next target follows it) */
+void retire_complete_rounds(void)
+{
+	int i;
+
+	for (i = 0; i + 1 < g_rounds_n; ) {
+		if (round_complete(&g_rounds[i])) {
+			char path[4096];
+			FILE *stream;
+
+			message(INFO "*** TARGET %" PRIu64 " is complete ***\n", g_rounds[i].target);
+
+			/* not to be loaded again */
+			sprintf(path, ROUND_DIR_FORMAT "/complete", g_rounds[i].target);
+
+			stream = fopen(path, "w");
+
+			if (stream != NULL) {
+				fclose(stream);
+			}
+
+			close_round(&g_rounds[i]);
+		} else {
+			++i;
+		}
 	}
+}
 
-	ptr = mmap(NULL, (size_t)RECORDS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+/* opens the round following the newest one if it is running out of the unassigned tasks */
+void open_next_round_if_due(void)
+{
+	struct round *newest = &g_rounds[g_rounds_n - 1];
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
-		abort();
+	if (newest->no - newest->lowest_unassigned > g_ahead) {
+		return;
 	}
 
-	close(fd);
+	if (newest->target + 1 < g_delta) {
+		return;
+	}
+
+	if (g_rounds_n < ROUNDS_MAX) {
+		message(INFO "opening the next round\n");
+
+		open_round(newest->target + 1, newest->target + 1 - g_delta);
+	}
+}
+
+/* the lowest unassigned task of the oldest round which has some */
+uint64_t get_assignment(struct round **pr)
+{
+	int i;
+
+	open_next_round_if_due();
+
+	for (i = 0; i < g_rounds_n; ++i) {
+		struct round *r = &g_rounds[i];
+		uint64_t n = r->lowest_unassigned;
+
+		if (n == r->no) {
+			continue;
+		}
 
-	return (uint64_t *)ptr;
+		SET_ASSIGNED(r, n);
+
+		/* advance lowest_unassigned */
+		r->lowest_unassigned = bitindex_find_zero(&r->index_assigned, r->lowest_unassigned);
+
+		*pr = r;
+
+		return n;
+	}
+
+	*pr = NULL;
+
+	return 0;
+}
+
+/* the lowest incomplete tasks of the oldest incomplete round */
+uint64_t get_missed_assignment(int thread_id, struct round **pr)
+{
+	int i;
+
+	for (i = 0; i < g_rounds_n; ++i) {
+		struct round *r = &g_rounds[i];
+		uint64_t n = r->lowest_incomplete;
+		int t;
+
+		if (round_complete(r)) {
+			continue;
+		}
+
+		for (t = 0; t < thread_id; ++t) {
+			/* skip the complete ones */
+			n = bitindex_find_zero(&r->index_complete, n + 1);
+		}
+
+		if (n == r->no) {
+			break;
+		}
+
+		SET_ASSIGNED(r, n);
+
+		/* advance lowest_unassigned */
+		if (n == r->lowest_unassigned) {
+			r->lowest_unassigned = bitindex_find_zero(&r->index_assigned, r->lowest_unassigned);
+		}
+
+		*pr = r;
+
+		return n;
+	}
+
+	*pr = NULL;
+
+	return 0;
+}
+
+/* the oldest incomplete round, or the newest one if everything is complete */
+struct round *lowest_round(void)
+{
+	int i;
+
+	for (i = 0; i < g_rounds_n; ++i) {
+		if (!round_complete(&g_rounds[i])) {
+			return &g_rounds[i];
+		}
+	}
+
+	return &g_rounds[g_rounds_n - 1];
+}
+
+/* writes [target][log2_no_procs][task_id], all zero if r is NULL (out of assignments) */
+int write_assignment(int fd, const struct round *r, uint64_t task_id)
+{
+	if (write_uint64(fd, r ? r->target : 0) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, r ? r->log2_no_procs : 0) < 0) {
+		return -1;
+	}
+
+	if (write_uint64(fd, r ? task_id : 0) < 0) {
+		return -1;
+	}
+
+	return 0;
 }
 
 int read_message(int fd, int thread_id, const char *ipv4)
@@ -375,48 +631,23 @@ int read_message(int fd, int thread_id, const char *ipv4)
 		}
 	} else if (strcmp(msg, "REQ") == 0) {
 		/* requested assignment */
+		struct round *r;
 		uint64_t task_id;
 
-		task_id = get_assignment();
+		task_id = get_assignment(&r);
 
-		if (task_id >= (UINT64_C(1) << LOG2_NO_PROCS)) {
+		if (r == NULL) {
 			message(WARN "out of assignments, serving empty assignment!\n");
-
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			goto REQ_end;
-		}
-
-		message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 "\n", task_id, ASSIGNMENTS_NO - 1);
-
-		if (write_uint64(fd, (uint64_t)TARGET) < 0) {
-			return -1;
-		}
-
-		if (write_uint64(fd, (uint64_t)LOG2_NO_PROCS) < 0) {
-			return -1;
+		} else {
+			message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 " (TARGET %" PRIu64 ")\n", task_id, r->no - 1, r->target);
 		}
 
-		if (write_uint64(fd, task_id) < 0) {
+		if (write_assignment(fd, r, task_id) < 0) {
 			return -1;
 		}
-
-		REQ_end:
-			;
 	} else if (strcmp(msg, "MRQ") == 0) {
 		uint64_t threads;
 		int tid;
-		uint64_t task_id;
 
 		/* request */
 
@@ -432,44 +663,21 @@ int read_message(int fd, int thread_id, const char *ipv4)
 		/* response */
 
 		for (tid = 0; tid < (int)threads; ++tid) {
-			task_id = get_assignment();
-
-			if (task_id >= (UINT64_C(1) << LOG2_NO_PROCS)) {
-				message(WARN "out of assignments, serving empty assignment!\n");
-
-				if (write_uint64(fd, 0) < 0) {
-					return -1;
-				}
-
-				if (write_uint64(fd, 0) < 0) {
-					return -1;
-				}
+			struct round *r;
+			uint64_t task_id;
 
-				if (write_uint64(fd, 0) < 0) {
-					return -1;
-				}
-
-				goto MRQ_end;
-			}
-
-			message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 " (MRQ)\n", task_id, ASSIGNMENTS_NO - 1);
-
-			if (write_uint64(fd, (uint64_t)TARGET) < 0) {
-				return -1;
-			}
+			task_id = get_assignment(&r);
 
-			if (write_uint64(fd, (uint64_t)LOG2_NO_PROCS) < 0) {
-				return -1;
+			if (r == NULL) {
+				message(WARN "out of assignments, serving empty assignment!\n");
+			} else {
+				message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 " (TARGET %" PRIu64 ", MRQ)\n", task_id, r->no - 1, r->target);
 			}
 
-			/* write task_id */
-			if (write_uint64(fd, task_id) < 0) {
+			if (write_assignment(fd, r, task_id) < 0) {
 				message(ERR "unable to write task ID\n");
 				return -1;
 			}
-
-			MRQ_end:
-				;
 		}
 	} else if (strcmp(msg, "RET") == 0) {
 		/* returning assignment */
@@ -479,6 +687,7 @@ int read_message(int fd, int thread_id, const char *ipv4)
 		uint64_t overflow = 0;
 		uint64_t realtime = 0;
 		uint64_t checksum = 0;
+		struct round *r;
 
 		if (read_uint64(fd, &target) < 0) {
 			return -1;
@@ -517,84 +726,72 @@ int read_message(int fd, int thread_id, const char *ipv4)
 			return -1;
 		}
 
-		if (target != TARGET) {
-			message(ERR "wrong target, discarting the result!\n");
-			return -1;
+		r = find_round(target, log2_no_procs);
+
+		if (r == NULL && g_rounds_n > 0 && target < g_rounds[0].target) {
+			message(WARN "TARGET %" PRIu64 " is already complete, ignoring the result\n", target);
+			/* this can be part of MUL request, so do not return -1 */
+			return 0;
 		}
 
-		if (log2_no_procs != LOG2_NO_PROCS) {
-			message(ERR "wrong number of processes, discarting the result!\n");
+		if (r == NULL) {
+			message(ERR "wrong target or number of processes, discarting the result!\n");
 			return -1;
 		}
 
-		if (task_id >= (UINT64_C(1) << LOG2_NO_PROCS)) {
+		if (task_id >= r->no) {
 			message(ERR "wrong task_id, discarting the result!\n");
 			return -1;
 		}
-	
-		message(INFO "assignment returned: %" PRIu64 " / %" PRIu64 " (%" PRIu64 " overflows, time %" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ", checksum 0x%016" PRIx64 ")\n",
-			task_id, (UINT64_C(1) << LOG2_NO_PROCS) - 1, overflow, ((realtime + 500)/1000)/60/60, ((realtime + 500)/1000)/60%60, ((realtime + 500)/1000)%60, checksum);
 
-		if (set_complete(task_id) < 0) {
+		message(INFO "assignment returned: %" PRIu64 " / %" PRIu64 " (TARGET %" PRIu64 ", %" PRIu64 " overflows, time %" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ", checksum 0x%016" PRIx64 ")\n",
+			task_id, r->no - 1, target, overflow, ((realtime + 500)/1000)/60/60, ((realtime + 500)/1000)/60%60, ((realtime + 500)/1000)%60, checksum);
+
+		if (set_complete(r, task_id) < 0) {
 			message(ERR "result rejected!\n");
 			/* this can however be part of MUL request, so do not return -1 */
 			return 0;
 		}
 
-		if (g_checksums[task_id] != 0 && g_checksums[task_id] != checksum) {
-			message(ERR "checksums do not match! (the other checksum was %" PRIu64 ", 0x%016" PRIx64 ")\n", g_checksums[task_id], g_checksums[task_id]);
+		if (r->checksums[task_id] != 0 && r->checksums[task_id] != checksum) {
+			message(ERR "checksums do not match! (the other checksum was %" PRIu64 ", 0x%016" PRIx64 ")\n", r->checksums[task_id], r->checksums[task_id]);
 		}
 
-		g_checksums[task_id] = checksum;
+		aggregate_add(aggregates_at(&r->aggregates, task_id), r->checksums[task_id], r->usertimes[task_id], r->overflows[task_id], 0, -1);
 
-		g_usertimes[task_id] = realtime;
+		r->checksums[task_id] = checksum;
 
-		g_overflows[task_id] = overflow;
-	} else if (strcmp(msg, "req") == 0) {
-		/* requested lowest incomplete assignment */
-		uint64_t task_id;
+		r->usertimes[task_id] = realtime;
 
-		task_id = get_missed_assignment(thread_id);
+		r->overflows[task_id] = overflow;
 
-		if (task_id >= (UINT64_C(1) << LOG2_NO_PROCS)) {
-			message(WARN "out of assignments, serving empty assignment!\n");
+		aggregate_add(aggregates_at(&r->aggregates, task_id), checksum, realtime, overflow, 0, +1);
 
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			if (write_uint64(fd, 0) < 0) {
-				return -1;
-			}
-
-			goto req_end;
+		if (round_complete(r)) {
+			retire_complete_rounds();
 		}
+	} else if (strcmp(msg, "req") == 0) {
+		/* requested lowest incomplete assignment */
+		struct round *r;
+		uint64_t task_id;
 
-		message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 " (lowest incomplete +%i)\n", task_id, ASSIGNMENTS_NO - 1, thread_id);
-
-		if (write_uint64(fd, (uint64_t)TARGET) < 0) {
-			return -1;
-		}
+		task_id = get_missed_assignment(thread_id, &r);
 
-		if (write_uint64(fd, (uint64_t)LOG2_NO_PROCS) < 0) {
-			return -1;
+		if (r == NULL) {
+			message(WARN "out of assignments, serving empty assignment!\n");
+		} else {
+			message(INFO "assignment requested: %" PRIu64 " / %" PRIu64 " (TARGET %" PRIu64 ", lowest incomplete +%i)\n", task_id, r->no - 1, r->target, thread_id);
 		}
 
-		if (write_uint64(fd, task_id) < 0) {
+		if (write_assignment(fd, r, task_id) < 0) {
 			return -1;
 		}
-
-		req_end:
-			;
 	} else if (strcmp(msg, "INT") == 0) {
 		/* interrupted or unable to solve, unreserve the assignment */
 		uint64_t target = 0;
 		uint64_t log2_no_procs = 0;
 		uint64_t task_id = 0;
+		struct round *r;
 
 		if (read_uint64(fd, &target) < 0) {
 			return -1;
@@ -608,47 +805,54 @@ int read_message(int fd, int thread_id, const char *ipv4)
 			return -1;
 		}
 
-		if (target != TARGET) {
-			message(ERR "wrong target, discarting the result!\n");
-			return -1;
+		r = find_round(target, log2_no_procs);
+
+		if (r == NULL && g_rounds_n > 0 && target < g_rounds[0].target) {
+			message(WARN "TARGET %" PRIu64 " is already complete, ignoring the interruption\n", target);
+			/* this can be part of MUL request, so do not return -1 */
+			return 0;
 		}
 
-		if (log2_no_procs != LOG2_NO_PROCS) {
-			message(ERR "wrong number of processes, discarting the result!\n");
+		if (r == NULL) {
+			message(ERR "wrong target or number of processes, discarting the result!\n");
 			return -1;
 		}
 
-		if (task_id >= (UINT64_C(1) << LOG2_NO_PROCS)) {
+		if (task_id >= r->no) {
 			message(ERR "wrong task_id, discarting the result!\n");
 			return -1;
 		}
 
-		message(INFO "assignment interrupted: %" PRIu64 " / %" PRIu64 "\n", task_id, ASSIGNMENTS_NO - 1);
+		message(INFO "assignment interrupted: %" PRIu64 " / %" PRIu64 " (TARGET %" PRIu64 ")\n", task_id, r->no - 1, target);
 
-		unset_assignment(task_id);
+		unset_assignment(r, task_id);
 	} else if (strcmp(msg, "LOI") == 0) {
-		if (write_uint64(fd, (uint64_t)TARGET) < 0) {
-			return -1;
-		}
-
-		if (write_uint64(fd, (uint64_t)LOG2_NO_PROCS) < 0) {
-			return -1;
-		}
+		/* of the oldest round in progress */
+		struct round *r = lowest_round();
 
-		if (write_uint64(fd, g_lowest_incomplete) < 0) {
+		if (write_assignment(fd, r, r->lowest_incomplete) < 0) {
 			return -1;
 		}
 	} else if (strcmp(msg, "HIR") == 0) {
-		if (write_uint64(fd, (uint64_t)TARGET) < 0) {
+		/* of the newest round */
+		struct round *r = &g_rounds[g_rounds_n - 1];
+
+		if (write_assignment(fd, r, r->lowest_unassigned) < 0) {
 			return -1;
 		}
+	} else if (strcmp(msg, "RND") == 0) {
+		int i;
 
-		if (write_uint64(fd, (uint64_t)LOG2_NO_PROCS) < 0) {
+		if (write_uint64(fd, (uint64_t)g_rounds_n) < 0) {
 			return -1;
 		}
 
-		if (write_uint64(fd, g_lowest_unassigned) < 0) {
-			return -1;
+		for (i = 0; i < g_rounds_n; ++i) {
+			struct round *r = &g_rounds[i];
+
+			if (write_assignment(fd, r, r->lowest_incomplete) < 0 || write_uint64(fd, r->lowest_unassigned) < 0) {
+				return -1;
+			}
 		}
 	} else if (strcmp(msg, "PNG") == 0) {
 		if (write_uint64(fd, 0) < 0) {
@@ -662,6 +866,91 @@ int read_message(int fd, int thread_id, const char *ipv4)
 	return 0;
 }
 
+/* the data of the older servers (a single round in the working directory) */
+void import_legacy_round(void)
+{
+	const char *files[5] = { "assigned.map", "complete.map", "checksums.dat", "usertimes.dat", "overflows.dat" };
+	char dir[64];
+	char path[4096];
+	int i;
+
+	if (access("assigned.map", F_OK) < 0) {
+		return;
+	}
+
+	sprintf(dir, ROUND_DIR_FORMAT, (uint64_t)TARGET);
+
+	if (mkdir(dir, 0700) < 0) {
+		message(ERR "%s: legacy data found, but the round already exists, remove one of them\n", dir);
+		abort();
+	}
+
+	for (i = 0; i < 5; ++i) {
+		sprintf(path, "%s/%s", dir, files[i]);
+
+		if (access(files[i], F_OK) == 0 && rename(files[i], path) < 0) {
+			perror("rename");
+			abort();
+		}
+	}
+
+	if (round_write(dir, TARGET, LOG2_NO_PROCS) < 0) {
+		abort();
+	}
+
+	message(WARN "legacy data moved into %s\n", dir);
+}
+
+/* opens the rounds in progress, or the round of the first_target if there are none */
+void load_rounds(uint64_t first_target)
+{
+	DIR *d = opendir(".");
+	struct dirent *entry;
+	uint64_t next_target = first_target;
+
+	if (d == NULL) {
+		perror("opendir");
+		abort();
+	}
+
+	while ((entry = readdir(d)) != NULL) {
+		uint64_t target, log2_no_procs;
+		char path[4096];
+
+		if (sscanf(entry->d_name, "round-%" SCNu64, &target) != 1) {
+			continue;
+		}
+
+		if (round_read(entry->d_name, &target, &log2_no_procs) != 0) {
+			message(WARN "%s: no round file, skipping\n", entry->d_name);
+			continue;
+		}
+
+		if (target + 1 > next_target) {
+			next_target = target + 1;
+		}
+
+		sprintf(path, "%s/complete", entry->d_name);
+
+		if (access(path, F_OK) == 0) {
+			continue;
+		}
+
+		if (open_round(target, log2_no_procs) == NULL) {
+			abort();
+		}
+	}
+
+	closedir(d);
+
+	if (g_rounds_n == 0) {
+		if (next_target < g_delta || open_round(next_target, next_target - g_delta) == NULL) {
+			message(ERR "unable to open the round of TARGET %" PRIu64 "\n", next_target);
+			abort();
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_in server_addr;
@@ -672,12 +961,14 @@ int main(int argc, char *argv[])
 	int clear_incomplete_assigned = 0;
 	int fix_records = 0;
 	int invalidate_overflows = 0;
+	uint64_t first_target = TARGET;
+	int i;
 
 	assert(LOG2_NO_PROCS >= 0);
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
 
-	while ((opt = getopt(argc, argv, "cfizr:m")) != -1) {
+	while ((opt = getopt(argc, argv, "cfizr:mt:d:a:p:")) != -1) {
 		switch (opt) {
 			case 'c':
 				clear_incomplete_assigned = 1;
@@ -688,8 +979,20 @@ int main(int argc, char *argv[])
 			case 'i':
 				invalidate_overflows = 1;
 				break;
+			case 't':
+				first_target = atou64(optarg);
+				break;
+			case 'd':
+				g_delta = atou64(optarg);
+				break;
+			case 'a':
+				g_ahead = atou64(optarg);
+				break;
+			case 'p':
+				serverport = (uint16_t)atoul(optarg);
+				break;
 			default:
-				message(ERR "Usage: %s [-c] [-f] [-i] [-z] [-r]\n", argv[0]);
+				message(ERR "Usage: %s [-c] [-f] [-i] [-t first_target] [-d delta] [-a tasks_ahead] [-p port]\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
@@ -705,77 +1008,77 @@ int main(int argc, char *argv[])
 
 	message(INFO "starting server...\n");
 
-	message(INFO "TARGET = %i, assignments %" PRIu64 "\n", TARGET, UINT64_C(1) << LOG2_NO_PROCS);
+	import_legacy_round();
 
-	g_map_assigned = open_map("assigned.map");
-	g_map_complete = open_map("complete.map");
-	g_checksums = open_records("checksums.dat");
-	g_usertimes = open_records("usertimes.dat");
-	g_overflows = open_records("overflows.dat");
+	load_rounds(first_target);
 
-	if (invalidate_overflows) {
-		uint64_t n;
+	for (i = 0; i < g_rounds_n; ++i) {
+		struct round *r = &g_rounds[i];
 
-		message(WARN "Invalidating overflows...\n");
+		if (invalidate_overflows) {
+			uint64_t n;
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t overflow = g_overflows[n];
+			message(WARN "Invalidating overflows (TARGET %" PRIu64 ")...\n", r->target);
 
-			if (overflow != 0) {
-				printf("- resetting the assignment %" PRIu64 " due to overflow\n", n);
+			for (n = 0; n < r->no; ++n) {
+				uint64_t overflow = r->overflows[n];
 
-				SET_UNASSIGNED(n);
-				SET_INCOMPLETE(n);
+				if (overflow != 0) {
+					printf("- resetting the assignment %" PRIu64 " due to overflow\n", n);
+
+					SET_UNASSIGNED(r, n);
+					SET_INCOMPLETE(r, n);
+				}
 			}
 		}
-	}
 
-	/* fix records the *.map and *.dat */
-	if (fix_records) {
-		uint64_t n;
-		uint64_t c0 = 0, c1 = 0, c2 = 0;
+		/* fix records the *.map and *.dat */
+		if (fix_records) {
+			uint64_t n;
+			uint64_t c0 = 0, c1 = 0, c2 = 0;
 
-		message(WARN "Processing the records...\n");
+			message(WARN "Processing the records (TARGET %" PRIu64 ")...\n", r->target);
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			/* complete ==> assigned */
-			if (IS_COMPLETE(n) && !IS_ASSIGNED(n)) {
-				SET_ASSIGNED(n);
-				c0++;
-			}
+			for (n = 0; n < r->no; ++n) {
+				/* complete ==> assigned */
+				if (IS_COMPLETE(r, n) && !IS_ASSIGNED(r, n)) {
+					SET_ASSIGNED(r, n);
+					c0++;
+				}
 
-			if (IS_COMPLETE(n) && g_checksums[n] == 0) {
-				SET_INCOMPLETE(n);
-				c1++;
+				if (IS_COMPLETE(r, n) && r->checksums[n] == 0) {
+					SET_INCOMPLETE(r, n);
+					c1++;
+				}
 			}
-		}
 
-		message(WARN "These corrections have been made: %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", c0, c1, c2);
-	}
+			message(WARN "These corrections have been made: %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", c0, c1, c2);
+		}
 
-	for (g_lowest_unassigned = 0; g_lowest_unassigned < ASSIGNMENTS_NO && IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-		;
+		r->lowest_unassigned = bitindex_find_zero(&r->index_assigned, 0);
 
-	for (g_lowest_incomplete = 0; g_lowest_incomplete < ASSIGNMENTS_NO && IS_COMPLETE(g_lowest_incomplete); ++g_lowest_incomplete)
-		;
+		r->lowest_incomplete = bitindex_find_zero(&r->index_complete, 0);
 
-	if (clear_incomplete_assigned) {
-		message(WARN "incomplete assignments will be cleared...\n");
+		if (clear_incomplete_assigned) {
+			message(WARN "incomplete assignments will be cleared...\n");
 
-		while (g_lowest_unassigned > g_lowest_incomplete) {
-			g_lowest_unassigned--;
-			if (IS_ASSIGNED(g_lowest_unassigned) && !IS_COMPLETE(g_lowest_unassigned)) {
-				SET_UNASSIGNED(g_lowest_unassigned);
+			while (r->lowest_unassigned > r->lowest_incomplete) {
+				r->lowest_unassigned--;
+				if (IS_ASSIGNED(r, r->lowest_unassigned) && !IS_COMPLETE(r, r->lowest_unassigned)) {
+					SET_UNASSIGNED(r, r->lowest_unassigned);
+				}
 			}
+
+			message(WARN "incomplete assignments have been cleared!\n");
 		}
 
-		message(WARN "incomplete assignments have been cleared!\n");
-	}
+		message(INFO "TARGET %" PRIu64 ": lowest unassigned = %" PRIu64 "\n", r->target, r->lowest_unassigned);
+		message(INFO "TARGET %" PRIu64 ": lowest incomplete = %" PRIu64 "\n", r->target, r->lowest_incomplete);
 
-	message(INFO "lowest unassigned = %" PRIu64 "\n", g_lowest_unassigned);
-	message(INFO "lowest incomplete = %" PRIu64 "\n", g_lowest_incomplete);
+		message(INFO "*** TARGET %" PRIu64 ": all assignments below %" PRIu64 " are convergent ***\n", r->target, r->lowest_incomplete);
+	}
 
-	message(INFO "*** all assignments below %" PRIu64 " are convergent ***\n", g_lowest_incomplete);
+	retire_complete_rounds();
 
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
@@ -852,17 +1155,9 @@ int main(int argc, char *argv[])
 
 	close(fd);
 
-	msync(g_map_assigned, MAP_SIZE, MS_SYNC);
-	msync(g_map_complete, MAP_SIZE, MS_SYNC);
-	msync(g_checksums, RECORDS_SIZE, MS_SYNC);
-	msync(g_usertimes, RECORDS_SIZE, MS_SYNC);
-	msync(g_overflows, RECORDS_SIZE, MS_SYNC);
-
-	munmap(g_map_assigned, MAP_SIZE);
-	munmap(g_map_complete, MAP_SIZE);
-	munmap(g_checksums, RECORDS_SIZE);
-	munmap(g_usertimes, RECORDS_SIZE);
-	munmap(g_overflows, RECORDS_SIZE);
+	while (g_rounds_n > 0) {
+		close_round(&g_rounds[g_rounds_n - 1]);
+	}
 
 	return 0;
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 #ifdef _USE_GMP
 #	include <gmp.h>
@@ -13,14 +14,20 @@
 #include <math.h>
 #include "wideint.h"
 #include "compat.h"
+#include "aggregates.h"
 
 #include <assert.h>
 
-#include "rs-config.h"
+#include "rs-round.h"
 
-#define ASSIGNMENTS_NO (UINT64_C(1) << (LOG2_NO_PROCS))
+/* of the round */
+uint64_t g_target;
+uint64_t g_log2_no_procs;
+
+#define ASSIGNMENTS_NO (UINT64_C(1) << g_log2_no_procs)
 
 #define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+#define SUPERBLOCKS ((ASSIGNMENTS_NO + (UINT64_C(1) << AGGREGATES_SB_LOG2) - 1) >> AGGREGATES_SB_LOG2)
 
 uint128_t g_pow3[64];
 
@@ -105,6 +112,43 @@ const uint64_t *g_checksums = 0;
 const uint64_t *g_usertimes = 0;
 const uint64_t *g_overflows = 0;
 
+/* maintained by rs-server */
+struct aggregates g_aggregates;
+
+/* the totals computed from the records, compared with the aggregates if verify is set */
+int scan_records(struct aggregate *total, int verify)
+{
+	uint64_t sb;
+	uint64_t mismatches = 0;
+
+	g_checksums = open_records("checksums.dat");
+	g_usertimes = open_records("usertimes.dat");
+	g_overflows = open_records("overflows.dat");
+
+	memset(total, 0, sizeof(struct aggregate));
+
+	for (sb = 0; sb < SUPERBLOCKS; ++sb) {
+		struct aggregate a;
+		uint64_t task_id;
+
+		memset(&a, 0, sizeof(struct aggregate));
+
+		for (task_id = sb << AGGREGATES_SB_LOG2; task_id < ASSIGNMENTS_NO && task_id < (sb + 1) << AGGREGATES_SB_LOG2; ++task_id) {
+			aggregate_add(&a, g_checksums[task_id], g_usertimes[task_id], g_overflows[task_id], 0, +1);
+		}
+
+		if (verify && !aggregate_equal(&a, g_aggregates.sbs + sb)) {
+			printf("superblock %" PRIu64 " does not match the records: %" PRIu64 " results, checksums %" PRIu64 " (the records: %" PRIu64 " results, checksums %" PRIu64 ")\n",
+				sb, g_aggregates.sbs[sb].complete, g_aggregates.sbs[sb].checksum, a.complete, a.checksum);
+			mismatches++;
+		}
+
+		aggregate_merge(total, &a);
+	}
+
+	return mismatches == 0 ? 0 : -1;
+}
+
 #ifdef _USE_GMP
 void mpz_init_set_u128(mpz_t rop, uint128_t op)
 {
@@ -119,14 +163,18 @@ void mpz_init_set_u128(mpz_t rop, uint128_t op)
 }
 #endif
 
-/*int argc, char *argv[]*/
-int main(void)
+/* usage: rs-summary [-V] [round_directory] */
+int main(int argc, char *argv[])
 {
-	uint64_t task_id;
+	struct aggregate total;
+	int verify = 0;
+	int have_aggregates;
+	int opt;
+	int r = 0;
 	uint64_t checksum = 0;
 	uint64_t usertime = 0;
 	uint64_t overflow = 0;
-	int complete = 1;
+	int complete;
 	uint64_t num_complete = 0;
 	uint64_t num_time = 0;
 	uint64_t hours;
@@ -135,39 +183,66 @@ int main(void)
 
 	pow3_init();
 
-	printf("TARGET = %i\n", TARGET);
-	printf("ASSIGNMENTS_NO = %" PRIu64 "\n", ASSIGNMENTS_NO);
-	printf("LOG2_NO_PROCS = %i\n", LOG2_NO_PROCS);
+	while ((opt = getopt(argc, argv, "V")) != -1) {
+		switch (opt) {
+			case 'V':
+				verify = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-V] [round_directory]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
 
-	g_checksums = open_records("checksums.dat");
-	g_usertimes = open_records("usertimes.dat");
-	g_overflows = open_records("overflows.dat");
+	if (optind < argc && chdir(argv[optind]) < 0) {
+		perror("chdir");
+		return EXIT_FAILURE;
+	}
+
+	if (round_read(".", &g_target, &g_log2_no_procs) < 0) {
+		fprintf(stderr, "invalid %s file\n", ROUND_FILE);
+		return EXIT_FAILURE;
+	}
 
-	for (task_id = 0; task_id < ASSIGNMENTS_NO; ++task_id) {
-		uint64_t checksum_ = g_checksums[task_id];
-		uint64_t usertime_ = g_usertimes[task_id];
-		uint64_t overflow_ = g_overflows[task_id];
+	assert(g_target + 1 < 64);
 
-		checksum += checksum_;
-		usertime += usertime_;
-		overflow += overflow_;
+	printf("TARGET = %" PRIu64 "\n", g_target);
+	printf("ASSIGNMENTS_NO = %" PRIu64 "\n", ASSIGNMENTS_NO);
+	printf("LOG2_NO_PROCS = %" PRIu64 "\n", g_log2_no_procs);
 
-		if (!checksum_) {
-			complete = 0;
-		} else {
-			num_complete++;
-		}
+	have_aggregates = aggregates_open(&g_aggregates, "aggregates.dat", SUPERBLOCKS, 0) == AGGREGATES_OK;
+
+	if (verify && !have_aggregates) {
+		fprintf(stderr, "no valid aggregates.dat file\n");
+		return EXIT_FAILURE;
+	}
 
-		if (usertime_) {
-			num_time++;
+	if (have_aggregates) {
+		aggregates_sum(&g_aggregates, 0, SUPERBLOCKS, &total);
+	}
+
+	/* the records are read only if there are no aggregates, or to verify them */
+	if (!have_aggregates || verify) {
+		if (scan_records(&total, verify) < 0) {
+			printf("the aggregates do not match the records!\n");
+			r = EXIT_FAILURE;
+		} else if (verify) {
+			printf("the aggregates match the records\n");
 		}
 	}
 
+	checksum = total.checksum;
+	usertime = total.usertime;
+	overflow = total.overflow;
+	num_complete = total.complete;
+	num_time = total.timed;
+	complete = num_complete == ASSIGNMENTS_NO;
+
 	printf("OLD LIMIT (all numbers below this must be already verified) ");
-	print(4 * g_pow3[TARGET + 0] + 2);
+	print(4 * g_pow3[g_target + 0] + 2);
 
 	printf("NEW LIMIT (all numbers below this are now verified) ");
-	print(4 * g_pow3[TARGET + 1] + 2);
+	print(4 * g_pow3[g_target + 1] + 2);
 #ifdef _USE_GMP
 	{
 		mpz_t x;
@@ -177,7 +252,7 @@ int main(void)
 		int exp;
 		mpf_t res, mpf_x;
 
-		mpz_init_set_u128(x, 4 * g_pow3[TARGET + 1] + 2);
+		mpz_init_set_u128(x, 4 * g_pow3[g_target + 1] + 2);
 
 		di = mpz_get_d_2exp(&ex, x);
 		log_x = log(di) + log(2) * (double)ex;
@@ -226,5 +301,5 @@ int main(void)
 	printf("all assignments are complete: %s\n", complete ? "yes" : "no");
 	printf("number of completed assignments: %" PRIu64 "\n", num_complete);
 
-	return 0;
+	return r;
 }
@@ -14,9 +14,13 @@
 #include "wideint.h"
 #include "compat.h"
 
-#include "rs-config.h"
+#include "rs-round.h"
 
-#define ASSIGNMENTS_NO (UINT64_C(1) << (LOG2_NO_PROCS))
+/* of the round */
+uint64_t g_target;
+uint64_t g_log2_no_procs;
+
+#define ASSIGNMENTS_NO (UINT64_C(1) << g_log2_no_procs)
 
 #define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
 
@@ -46,6 +50,7 @@ const uint64_t *g_checksums = 0;
 const uint64_t *g_usertimes = 0;
 const uint64_t *g_overflows = 0;
 
+/* usage: rs-verify-result task_id [round_directory] */
 int main(int argc, char *argv[])
 {
 	uint64_t task_id = (argc > 1) ? atou64(argv[1]) : 0;
@@ -53,6 +58,17 @@ int main(int argc, char *argv[])
 	uint64_t usertime;
 	uint64_t overflow;
 
+	if (argc > 2 && chdir(argv[2]) < 0) {
+		perror("chdir");
+		return EXIT_FAILURE;
+	}
+
+	if (round_read(".", &g_target, &g_log2_no_procs) < 0) {
+		fprintf(stderr, "invalid %s file\n", ROUND_FILE);
+		return EXIT_FAILURE;
+	}
+
+	printf("TARGET %" PRIu64 "\n", g_target);
 	printf("TASK_ID %" PRIu64 "\n", task_id);
 	assert(task_id < ASSIGNMENTS_NO);
 
@@ -0,0 +1 @@
+../common/aggregates.h
\ No newline at end of file
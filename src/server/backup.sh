@@ -15,6 +15,12 @@ MAPS=( assigned.map complete.map )
 
 for F in ${MAPS[@]}; do backup $F; done
 
-DATS=( clientids.dat checksums.dat mxoffsets.dat overflows.dat usertimes.dat )
+# the record store, only the superblocks that have been written
+if test -d records; then
+	echo "Backing up directory records..."
+	test -d records.000 && rm -rf -- records.001 && mv -f -- records.000 records.001
+	cp -r --sparse=always -- records records.000
+fi
 
-for F in ${DATS[@]}; do backup $F; done
+# records not yet checkpointed into the files above
+test -e server.wal && backup server.wal
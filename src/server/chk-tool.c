@@ -2,49 +2,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
 #include "wideint.h"
+#include "records.h"
 
 /* 2^32 assignments (tasks) */
 #define ASSIGNMENTS_NO (UINT64_C(1) << 32)
 
-#define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+struct records g_records;
 
-const uint64_t *open_records(const char *path)
-{
-	int fd = open(path, O_RDONLY, 0600);
-	const void *ptr;
+/* maintained by the server */
+struct aggregates g_aggregates;
 
-	if (fd < 0) {
-		perror("open");
-		abort();
-	}
+/* the aggregates computed by the pass, for the verification (-V) */
+struct aggregate *g_scanned = NULL;
+
+#define MIN(a, b) ( ((a) < (b)) ? (a): (b) )
+#define MAX(a, b) ( ((a) > (b)) ? (a): (b) )
 
-	ptr = mmap(NULL, (size_t)RECORDS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+/* the longer user times are not valid */
+#define USERTIME_MAX (2 * 60 * 60)
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
-		abort();
-	}
+/* the missing checksums are reported from this assignment on */
+#define MISSING_FROM 91226112
+#define MISSING_MAX 4
 
-	close(fd);
+#define DEVICE_NONE 0
+#define DEVICE_CPU 1
+#define DEVICE_GPU 2
 
-	return (const uint64_t *)ptr;
-}
+/* the workers are told apart by the top bits of their checksums */
+struct class {
+	const char *name;
+	uint64_t mask;
+	int shift;
+	int device;
+};
 
-const uint64_t *g_checksums = 0;
-const uint64_t *g_usertimes = 0;
-const uint64_t *g_overflows = 0;
-const uint64_t *g_clientids = 0;
-const uint64_t *g_mxoffsets = 0;
+static const struct class g_classes[] = {
+	{ "sieve-2^2", 0x17f0f, 24, DEVICE_NONE },
+	{ "sieve-2^16", 0xa0ed, 24, DEVICE_GPU },
+	{ "esieve-2^16", 0x83b, 28, DEVICE_GPU },
+	{ "esieve-2^24", 0x5ae, 28, DEVICE_GPU },
+	{ "esieve-2^24 sieve-3^1", 0x3c96, 24, DEVICE_GPU },
+	{ "sieve-2^32", 0x4cfe, 24, DEVICE_CPU },
+	{ "sieve-2^32 sieve-3^1", 0x3354, 24, DEVICE_CPU },
+	{ "esieve-2^32 sieve-3^1", 0x2a27, 24, DEVICE_CPU },
+	{ "esieve-2^34 sieve-3^1", 0x27d8, 24, DEVICE_CPU },
+	{ "esieve-2^34 sieve-3^2", 0x2134, 24, DEVICE_CPU },
+	{ "h-esieve-2^34 sieve-3^2", 0x1ac, 28, DEVICE_CPU },
+	{ "h-esieve-2^24 sieve-3^1", 0x3238, 24, DEVICE_GPU },
+	{ "h2-esieve-2^34 sieve-3^2", 0x1785, 24, DEVICE_CPU },
+	{ "h2-esieve-2^24 sieve-3^1", 0x2e0, 28, DEVICE_GPU }
+};
 
-#define MIN(a, b) ( ((a) < (b)) ? (a): (b) )
-#define MAX(a, b) ( ((a) > (b)) ? (a): (b) )
+#define CLASSES (int)(sizeof(g_classes) / sizeof(g_classes[0]))
+
+/* the groups of the time records: the classes, then all, CPU and GPU records */
+#define GROUP_ALL CLASSES
+#define GROUP_CPU (CLASSES + 1)
+#define GROUP_GPU (CLASSES + 2)
+#define GROUPS (CLASSES + 3)
+
+struct group {
+	/* checksums */
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	/* user times */
+	uint128_t time_total;
+	uint64_t time_count;
+	uint64_t time_hist[USERTIME_MAX + 1]; /* per second */
+};
+
+/* the accumulators of a thread, merged at the end of the pass */
+struct stats {
+	struct group groups[GROUPS];
+	uint64_t overflow_count;
+	uint64_t overflow_sum;
+	uint64_t clientid_count;
+	uint64_t mxoffset_count;
+	uint64_t incomplete; /* checksum without mxoffset */
+	uint64_t end; /* the highest populated task + 1 */
+	uint64_t missing[MISSING_MAX]; /* the lowest ones, sorted */
+	int missing_n;
+	uint64_t *invalid_times; /* the tasks with the usertime above USERTIME_MAX */
+	size_t invalid_times_n;
+	size_t invalid_times_cap;
+};
 
 static uint64_t round_div_ul(uint64_t n, uint64_t d)
 {
@@ -64,6 +118,312 @@ static uint128_t round_div_ull(uint128_t n, uint128_t d)
 	return (n + d / 2) / d;
 }
 
+struct stats *stats_create()
+{
+	struct stats *st = malloc(sizeof(struct stats));
+	int g;
+
+	if (st == NULL) {
+		return NULL;
+	}
+
+	memset(st, 0, sizeof(struct stats));
+
+	for (g = 0; g < GROUPS; ++g) {
+		st->groups[g].min = UINT64_MAX;
+	}
+
+	return st;
+}
+
+void stats_destroy(struct stats *st)
+{
+	free(st->invalid_times);
+	free(st);
+}
+
+/* the class of the checksum, or -1 */
+int classify(uint64_t checksum)
+{
+	int i;
+
+	for (i = 0; i < CLASSES; ++i) {
+		if ((checksum >> g_classes[i].shift) == g_classes[i].mask) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void stats_missing(struct stats *st, uint64_t n)
+{
+	int i;
+
+	if (n < MISSING_FROM || (st->missing_n == MISSING_MAX && n >= st->missing[MISSING_MAX - 1])) {
+		return;
+	}
+
+	if (st->missing_n < MISSING_MAX) {
+		st->missing_n++;
+	}
+
+	/* insert, the largest one falls out */
+	for (i = st->missing_n - 1; i > 0 && st->missing[i - 1] > n; --i) {
+		st->missing[i] = st->missing[i - 1];
+	}
+
+	st->missing[i] = n;
+}
+
+/* the tasks [n, end) have no records */
+void stats_missing_range(struct stats *st, uint64_t n, uint64_t end)
+{
+	int i;
+
+	n = MAX(n, MISSING_FROM);
+
+	for (i = 0; i < MISSING_MAX && n < end; ++i, ++n) {
+		stats_missing(st, n);
+	}
+}
+
+void group_add_time(struct group *group, uint64_t usertime)
+{
+	group->time_total += usertime;
+	group->time_count++;
+	group->time_hist[usertime]++;
+}
+
+void stats_add(struct stats *st, uint64_t n, const struct record *record)
+{
+	uint64_t checksum = record->checksum;
+	uint64_t usertime = record->usertime;
+	int c;
+
+	if (checksum == 0) {
+		stats_missing(st, n);
+	}
+
+	if (checksum != 0 || usertime != 0 || record->clientid != 0) {
+		st->end = MAX(st->end, n + 1);
+	}
+
+	if (record->overflow != 0) {
+		st->overflow_count++;
+		st->overflow_sum += record->overflow;
+	}
+
+	if (record->clientid != 0) {
+		st->clientid_count++;
+	}
+
+	if (record->mxoffset != 0) {
+		st->mxoffset_count++;
+	}
+
+	if (checksum == 0) {
+		if (usertime == 0) {
+			return;
+		}
+		c = -1;
+	} else {
+		if (record->mxoffset == 0) {
+			st->incomplete++;
+		}
+
+		c = classify(checksum);
+
+		if (c >= 0) {
+			struct group *group = st->groups + c;
+
+			group->count++;
+			group->min = MIN(group->min, checksum);
+			group->max = MAX(group->max, checksum);
+		}
+	}
+
+	if (usertime > USERTIME_MAX) {
+		if (st->invalid_times_n == st->invalid_times_cap) {
+			size_t cap = st->invalid_times_cap ? 2 * st->invalid_times_cap : 1024;
+			uint64_t *p = realloc(st->invalid_times, sizeof(uint64_t) * cap);
+
+			if (p == NULL) {
+				perror("realloc");
+				abort();
+			}
+
+			st->invalid_times = p;
+			st->invalid_times_cap = cap;
+		}
+
+		st->invalid_times[st->invalid_times_n++] = n;
+		return;
+	}
+
+	if (usertime == 0) {
+		return;
+	}
+
+	group_add_time(st->groups + GROUP_ALL, usertime);
+
+	if (c >= 0) {
+		group_add_time(st->groups + c, usertime);
+
+		if (g_classes[c].device == DEVICE_CPU) {
+			group_add_time(st->groups + GROUP_CPU, usertime);
+		}
+
+		if (g_classes[c].device == DEVICE_GPU) {
+			group_add_time(st->groups + GROUP_GPU, usertime);
+		}
+	}
+}
+
+/* the data of the chunk are read in the blocks of the file, the holes are skipped */
+void stats_add_chunk(struct stats *st, uint64_t c)
+{
+	uint64_t n = c << RECORDS_CHUNK_LOG2;
+	uint64_t end = n + RECORDS_CHUNK_NO;
+	int fd;
+
+	if (!records_present(&g_records, c)) {
+		stats_missing_range(st, n, end);
+		return;
+	}
+
+	fd = records_chunk_fd(&g_records, c);
+
+	while (n < end) {
+		/* rounded down, the tasks below n are done */
+		uint64_t data = MAX(records_seek(fd, c, n, SEEK_DATA), n);
+		uint64_t hole;
+		const struct record *record;
+
+		if (data > n) {
+			stats_missing_range(st, n, data);
+		}
+
+		if (data >= end) {
+			break;
+		}
+
+		hole = records_seek(fd, c, data, SEEK_HOLE);
+
+		if (hole <= data) {
+			hole = MIN(data + 64, end);
+		}
+
+		record = records_get(&g_records, data);
+
+		for (n = data; n < hole; ++n, ++record) {
+			stats_add(st, n, record);
+
+			if (g_scanned != NULL) {
+				aggregate_add(g_scanned + c, record->checksum, record->usertime, record->overflow, record->mxoffset, +1);
+			}
+		}
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void stats_merge(struct stats *st, const struct stats *other)
+{
+	int g;
+	int i;
+	uint64_t t;
+
+	for (g = 0; g < GROUPS; ++g) {
+		struct group *group = st->groups + g;
+		const struct group *other_group = other->groups + g;
+
+		group->count += other_group->count;
+		group->min = MIN(group->min, other_group->min);
+		group->max = MAX(group->max, other_group->max);
+		group->time_total += other_group->time_total;
+		group->time_count += other_group->time_count;
+
+		for (t = 0; t <= USERTIME_MAX; ++t) {
+			group->time_hist[t] += other_group->time_hist[t];
+		}
+	}
+
+	st->overflow_count += other->overflow_count;
+	st->overflow_sum += other->overflow_sum;
+	st->clientid_count += other->clientid_count;
+	st->mxoffset_count += other->mxoffset_count;
+	st->incomplete += other->incomplete;
+	st->end = MAX(st->end, other->end);
+
+	for (i = 0; i < other->missing_n; ++i) {
+		stats_missing(st, other->missing[i]);
+	}
+
+	if (other->invalid_times_n > 0) {
+		uint64_t *p = realloc(st->invalid_times, sizeof(uint64_t) * (st->invalid_times_n + other->invalid_times_n));
+
+		if (p == NULL) {
+			perror("realloc");
+			abort();
+		}
+
+		memcpy(p + st->invalid_times_n, other->invalid_times, sizeof(uint64_t) * other->invalid_times_n);
+		st->invalid_times = p;
+		st->invalid_times_n += other->invalid_times_n;
+		st->invalid_times_cap = st->invalid_times_n;
+	}
+}
+
+/* a single pass over all records, the chunks are shared among the threads */
+struct stats *analyze()
+{
+	struct stats *st = stats_create();
+	int64_t chunks = (int64_t)(records_end(&g_records) >> RECORDS_CHUNK_LOG2);
+
+	if (st == NULL) {
+		return NULL;
+	}
+
+	#pragma omp parallel
+	{
+		struct stats *local = stats_create();
+		int64_t c;
+
+		if (local == NULL) {
+			perror("malloc");
+			abort();
+		}
+
+		#pragma omp for schedule(dynamic, 1)
+		for (c = 0; c < chunks; ++c) {
+			stats_add_chunk(local, (uint64_t)c);
+		}
+
+		#pragma omp critical
+		stats_merge(st, local);
+
+		stats_destroy(local);
+	}
+
+	/* the tasks above the last chunk have no records either */
+	if (st->missing_n < MISSING_MAX) {
+		stats_missing_range(st, records_end(&g_records), ASSIGNMENTS_NO);
+	}
+
+	return st;
+}
+
+int compare_uint64(const void *l, const void *r)
+{
+	uint64_t a = *(const uint64_t *)l;
+	uint64_t b = *(const uint64_t *)r;
+
+	return a < b ? -1 : a > b;
+}
+
 uint64_t avg_and_print_usertime(uint128_t total, uint64_t count)
 {
 	uint64_t average = (uint64_t)round_div_ull(total, count);
@@ -76,81 +436,152 @@ uint64_t avg_and_print_usertime(uint128_t total, uint64_t count)
 	);
 	printf("- average time: %" PRIu64 ":%02" PRIu64 ":%02" PRIu64 " (h:m:s)\n", (uint64_t)(average/60/60), (uint64_t)(average/60%60), (uint64_t)(average%60));
 
-	printf("\n");
-
 	return average;
 }
 
-uint64_t print_checksum_stats_ex(uint64_t mask, size_t shift)
+/* the smallest time such that at least permille/1000 of the records are not longer */
+uint64_t percentile(const struct group *group, uint64_t permille)
 {
-	uint64_t n;
-	uint64_t min = UINT64_MAX, max = 0;
-	uint64_t count = 0;
+	uint64_t rank = (group->time_count * permille + 999) / 1000;
+	uint64_t sum = 0;
+	uint64_t t;
 
-	for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-		uint64_t checksum = g_checksums[n];
+	for (t = 0; t <= USERTIME_MAX; ++t) {
+		sum += group->time_hist[t];
 
-		if ((checksum>>shift) != mask) {
-			continue; /* other type */
+		if (sum >= rank && sum > 0) {
+			return t;
 		}
+	}
+
+	return 0;
+}
+
+void print_usertime(const struct group *group)
+{
+	uint64_t max = 0;
+	uint64_t t;
+
+	avg_and_print_usertime(group->time_total, group->time_count);
 
-		if (checksum != 0) {
-			min = MIN(min, checksum);
-			max = MAX(max, checksum);
-			count++;
+	for (t = 0; t <= USERTIME_MAX; ++t) {
+		if (group->time_hist[t] != 0) {
+			max = t;
 		}
 	}
 
-	printf("- count = %" PRIu64 " (%" PRIu64 "M)\n", count, round_div_ul(count, 1000000));
+	if (group->time_count != 0) {
+		printf("- percentiles: p50 = %" PRIu64 " s, p90 = %" PRIu64 " s, p99 = %" PRIu64 " s, p99.9 = %" PRIu64 " s, max = %" PRIu64 " s\n",
+			percentile(group, 500), percentile(group, 900), percentile(group, 990), percentile(group, 999), max);
+	}
+
+	printf("\n");
+}
+
+/* the counts of the time records in [2^k, 2^(k+1)) seconds */
+void print_histogram(const struct group *group)
+{
+	uint64_t lo;
+
+	for (lo = 1; lo <= USERTIME_MAX; lo *= 2) {
+		uint64_t hi = MIN(2 * lo, USERTIME_MAX + 1);
+		uint64_t count = 0;
+		uint64_t t;
+
+		for (t = lo; t < hi; ++t) {
+			count += group->time_hist[t];
+		}
+
+		printf("- [%5" PRIu64 ", %5" PRIu64 ") s: %" PRIu64 "\n", lo, hi, count);
+	}
+
+	printf("\n");
+}
+
+void print_checksum_stats(const struct group *group)
+{
+	printf("- count = %" PRIu64 " (%" PRIu64 "M)\n", group->count, round_div_ul(group->count, 1000000));
 
 	printf(
 		"- min = %" PRIu64 " (0x%" PRIx64 "); "
 		"min>>24 = %" PRIu64 " (0x%" PRIx64 "); "
 		"min>>23 = %" PRIu64 " (0x%" PRIx64 ")\n",
-		min, min,
-		min>>24, min>>24,
-		min>>23, min>>23
+		group->min, group->min,
+		group->min>>24, group->min>>24,
+		group->min>>23, group->min>>23
 	);
 
 	printf(
 		"- max = %" PRIu64 " (0x%" PRIx64 "); "
 		"max>>24 = %" PRIu64 " (0x%" PRIx64 "); "
 		"max>>23 = %" PRIu64 " (0x%" PRIx64 ")\n",
-		max, max,
-		max>>24, max>>24,
-		max>>23, max>>23
+		group->max, group->max,
+		group->max>>24, group->max>>24,
+		group->max>>23, group->max>>23
 	);
 
 	printf("\n");
-
-	return count;
 }
 
-uint64_t print_checksum_stats(uint64_t mask)
+/* the totals of the superblocks, without reading the records */
+void print_aggregates(void)
 {
-	return print_checksum_stats_ex(mask, 24);
+	struct aggregate total;
+	uint64_t sb;
+	uint64_t present = 0;
+	uint64_t full = 0;
+
+	aggregates_sum(&g_aggregates, 0, RECORDS_CHUNKS, &total);
+
+	for (sb = 0; sb < RECORDS_CHUNKS; ++sb) {
+		const struct aggregate *a = g_aggregates.sbs + sb;
+
+		present += a->complete != 0;
+		full += a->complete == RECORDS_CHUNK_NO;
+	}
+
+	printf("aggregates (%" PRIu64 " superblocks with results, %" PRIu64 " of them complete):\n", present, full);
+	printf("- results: %" PRIu64 " (%" PRIu64 "M)\n", total.complete, round_div_ul(total.complete, 1000000));
+	printf("- sum of the checksums: 0x%016" PRIx64 "\n", total.checksum);
+	avg_and_print_usertime(total.usertime, total.timed);
+	printf("- overflows: %" PRIu64 " assignments, %" PRIu64 " overflows\n", total.overflowed, total.overflow);
+	printf("- maximum value offsets: %" PRIu64 "\n", total.mxoffsets);
+	printf("\n");
 }
 
-void init()
+/* compares the aggregates with those computed by the pass */
+int verify_aggregates(void)
 {
-	g_checksums = open_records("checksums.dat");
-	g_usertimes = open_records("usertimes.dat");
-	g_overflows = open_records("overflows.dat");
-	g_clientids = open_records("clientids.dat");
-	g_mxoffsets = open_records("mxoffsets.dat");
-}
+	uint64_t sb;
+	uint64_t mismatches = 0;
 
-struct timerec {
-	uint128_t total;
-	uint64_t count;
-	uint64_t avg;
-};
+	printf("verifying aggregates...\n");
 
-struct timerec timerec_create()
-{
-	struct timerec timerec = { 0, 0, 0 };
+	for (sb = 0; sb < RECORDS_CHUNKS; ++sb) {
+		const struct aggregate *a = g_aggregates.sbs + sb;
+		const struct aggregate *b = g_scanned + sb;
 
-	return timerec;
+		if (aggregate_equal(a, b)) {
+			continue;
+		}
+
+		printf("- superblock %" PRIu64 ": %" PRIu64 " results, checksums 0x%016" PRIx64 " (the records: %" PRIu64 " results, checksums 0x%016" PRIx64 ")\n",
+			sb, a->complete, a->checksum, b->complete, b->checksum);
+
+		mismatches++;
+	}
+
+	printf("%" PRIu64 " superblocks do not match the records\n", mismatches);
+	printf("\n");
+
+	return mismatches == 0 ? 0 : -1;
+}
+
+void init()
+{
+	if (records_open(&g_records, "records", 0) < 0) {
+		abort();
+	}
 }
 
 int main(int argc, char *argv[])
@@ -161,9 +592,15 @@ int main(int argc, char *argv[])
 	int show_overflows = 0;
 	int show_clientids = 0;
 	int show_mxoffsets = 0;
+	int show_aggregates = 0;
+	int verify = 0;
+	int have_aggregates;
 	int opt;
+	struct stats *st = NULL;
+	int r = 0;
+	int i;
 
-	while ((opt = getopt(argc, argv, "sxtoimc")) != -1) {
+	while ((opt = getopt(argc, argv, "sxtoimcaV")) != -1) {
 		switch (opt) {
 			case 's':
 				show_checksums = 1;
@@ -183,6 +620,12 @@ int main(int argc, char *argv[])
 			case 'm':
 				show_mxoffsets = 1;
 				break;
+			case 'a':
+				show_aggregates = 1;
+				break;
+			case 'V':
+				verify = 1;
+				break;
 			default:
 				printf("[ERROR] Usage: %s [options]\n", argv[0]);
 				return EXIT_FAILURE;
@@ -191,365 +634,159 @@ int main(int argc, char *argv[])
 
 	init();
 
-#if 0
-	/* find holes in mxoffset[] */
-	if (1) {
-		int state = 0; /* zero/hole */
-		uint64_t n;
-		uint64_t n0 = 0;
-
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t mxoffset = g_mxoffsets[n];
-
-			if (state == 0) {
-				if (mxoffset == 0) {
-					/* ok, still hole :/ */
-				} else {
-					/* transition hole -> nonzero mxoffset :) */
-					state = 1;
-					if (n0 != 0) {
-						printf("hole: [%lu .. %lu) of size %lu\n", n0, n, n - n0);
-					}
-					n0 = n;
-				}
-			} else {
-				if (mxoffset == 0) {
-					/* transition nonzero mxoffset -> hole :( */
-					state = 0;
-#					if 0
-					printf("fill: [%lu .. %lu) of size %lu\n", n0, n, n - n0);
-#					endif
-					n0 = n;
-				} else {
-					/* ok, still sequence of nonzero mxoffsets :) */
-				}
-			}
-		}
+	have_aggregates = aggregates_open(&g_aggregates, "aggregates.dat", RECORDS_CHUNKS, 0) == AGGREGATES_OK;
 
-		printf("\n");
+	if ((show_aggregates || verify) && !have_aggregates) {
+		printf("[ERROR] no valid aggregates (aggregates.dat)\n");
+		return EXIT_FAILURE;
 	}
-#endif
-
-	/* checksums */
-	if (show_checksums) {
-		uint64_t cpu_count = 0, gpu_count = 0;
 
-		printf("analyzing checksums...\n");
-
-		printf("sieve-2^2 checksums:\n");
-		(void)print_checksum_stats(0x17f0f);
-
-		printf("sieve-2^16 checksums:\n");
-		gpu_count += print_checksum_stats(0xa0ed);
-
-		printf("esieve-2^16 checksums:\n");
-		gpu_count += print_checksum_stats_ex(0x83b, 28);
+	if (show_aggregates) {
+		print_aggregates();
+	}
 
-		printf("esieve-2^24 checksums:\n");
-		gpu_count += print_checksum_stats_ex(0x5ae, 28);
+	if (verify) {
+		g_scanned = calloc((size_t)RECORDS_CHUNKS, sizeof(struct aggregate));
 
-		printf("esieve-2^24 sieve-3^1 checksums:\n");
-		gpu_count += print_checksum_stats(0x3c96);
+		if (g_scanned == NULL) {
+			perror("calloc");
+			return EXIT_FAILURE;
+		}
+	}
 
-		printf("sieve-2^32 checksums:\n");
-		cpu_count += print_checksum_stats(0x4cfe);
+	/* the overflows are in the aggregates, the rest needs the records */
+	if (show_checksums || show_missing_checksums || show_usertimes || show_clientids || show_mxoffsets || verify || (show_overflows && !have_aggregates)) {
+		/* everything is computed at once, the options select what is printed */
+		st = analyze();
 
-		printf("sieve-2^32 sieve-3^1 checksums:\n");
-		cpu_count += print_checksum_stats(0x3354);
+		if (st == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
 
-		printf("esieve-2^32 sieve-3^1 checksums:\n");
-		cpu_count += print_checksum_stats(0x2a27);
+		printf("highest populated assignment: %" PRIu64 "\n", st->end ? st->end - 1 : 0);
+		printf("\n");
+	}
 
-		printf("esieve-2^34 sieve-3^1 checksums:\n");
-		cpu_count += print_checksum_stats(0x27d8);
+	if (verify && verify_aggregates() < 0) {
+		r = EXIT_FAILURE;
+	}
 
-		printf("esieve-2^34 sieve-3^2 checksums:\n");
-		cpu_count += print_checksum_stats(0x2134);
+	/* checksums */
+	if (show_checksums) {
+		uint64_t cpu_count = 0, gpu_count = 0;
 
-		printf("h-esieve-2^34 sieve-3^2 checksums:\n");
-		cpu_count += print_checksum_stats_ex(0x1ac, 28);
+		printf("analyzing checksums...\n");
 
-		printf("h-esieve-2^24 sieve-3^1 checksums:\n");
-		gpu_count += print_checksum_stats(0x3238);
+		for (i = 0; i < CLASSES; ++i) {
+			printf("%s checksums:\n", g_classes[i].name);
+			print_checksum_stats(st->groups + i);
 
-		printf("h2-esieve-2^34 sieve-3^2 checksums:\n");
-		cpu_count += print_checksum_stats(0x1785);
+			if (g_classes[i].device == DEVICE_CPU) {
+				cpu_count += st->groups[i].count;
+			}
 
-		printf("h2-esieve-2^24 sieve-3^1 checksums:\n");
-		gpu_count += print_checksum_stats_ex(0x2e0, 28);
+			if (g_classes[i].device == DEVICE_GPU) {
+				gpu_count += st->groups[i].count;
+			}
+		}
 
 		printf("Results: %" PRIu64 " work units on CPU, %" PRIu64 " work units on GPU, %" PRIu64 " work units in total\n", cpu_count, gpu_count, cpu_count + gpu_count);
 	}
 
 	/* missing checksums */
 	if (show_missing_checksums) {
-		uint64_t n;
-		int c = 0;
-
 		printf("missing checksums:\n");
-		for (n = 91226112; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t checksum = g_checksums[n];
 
-			if (checksum == 0) {
-				printf("- missing checksum on the assignment %" PRIu64 " (below %" PRIu64 " x 2^60)\n", n, (n >> 20) + 1);
+		for (i = 0; i < st->missing_n; ++i) {
+			uint64_t n = st->missing[i];
 
-				if (++c == 4) {
-					break;
-				}
-			}
+			printf("- missing checksum on the assignment %" PRIu64 " (below %" PRIu64 " x 2^60)\n", n, (n >> 20) + 1);
 		}
+
 		printf("\n");
 	}
 
 	/* usertime records */
 	if (show_usertimes) {
-#		define ADD_TIME(tr, time) do { (tr).total += (time); (tr).count++; } while (0)
-		uint64_t n;
-
-		struct timerec tr_all = timerec_create();
-		struct timerec tr_mod_2_2 = timerec_create();
-		struct timerec tr_mod_2_16 = timerec_create(); /* gpu */
-		struct timerec tr_mod_2_16_e = timerec_create(); /* gpu */
-		struct timerec tr_mod_2_24_e = timerec_create(); /* gpu */
-		struct timerec tr_mod_2_24_3_1_e = timerec_create(); /* gpu */
-		struct timerec tr_mod_2_32 = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_32_3_1 = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_32_3_1_e = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_34_3_1_e = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_34_3_2_e = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_34_3_2_h_e = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_34_3_2_h2_e = timerec_create(); /* cpu */
-		struct timerec tr_mod_2_24_3_1_h_e = timerec_create(); /* gpu */
-		struct timerec tr_mod_2_24_3_1_h2_e = timerec_create(); /* gpu */
-		struct timerec tr_cpu = timerec_create();
-		struct timerec tr_gpu = timerec_create();
+		size_t k;
 
 		printf("analyzing time records...\n");
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t usertime = g_usertimes[n];
-			uint64_t checksum = g_checksums[n];
-
-			if (usertime > 2 * 60 * 60) {
-#if 1
-				printf("%" PRIu64 ": %" PRIu64 " (0x%" PRIx64 ")\n", n, usertime, checksum >> 24);
-#endif
-				continue;
-			}
-
-			if (usertime != 0) {
-				ADD_TIME(tr_all, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x17f0f) {
-				ADD_TIME(tr_mod_2_2, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0xa0ed) {
-				ADD_TIME(tr_mod_2_16, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 28) == 0x83b) {
-				ADD_TIME(tr_mod_2_16_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x4cfe) {
-				ADD_TIME(tr_mod_2_32, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x3354) {
-				ADD_TIME(tr_mod_2_32_3_1, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x2a27) {
-				ADD_TIME(tr_mod_2_32_3_1_e, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x27d8) {
-				ADD_TIME(tr_mod_2_34_3_1_e, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x5ae2) {
-				ADD_TIME(tr_mod_2_24_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x5ae1) {
-				ADD_TIME(tr_mod_2_24_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
+		qsort(st->invalid_times, st->invalid_times_n, sizeof(uint64_t), compare_uint64);
 
-			if (usertime != 0 && (checksum >> 24) == 0x3c96) {
-				ADD_TIME(tr_mod_2_24_3_1_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
+		for (k = 0; k < st->invalid_times_n; ++k) {
+			uint64_t n = st->invalid_times[k];
+			const struct record *record = records_get(&g_records, n);
 
-			if (usertime != 0 && (checksum >> 24) == 0x2134) {
-				ADD_TIME(tr_mod_2_34_3_2_e, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 28) == 0x1ac) {
-				ADD_TIME(tr_mod_2_34_3_2_h_e, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x3238) {
-				ADD_TIME(tr_mod_2_24_3_1_h_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 24) == 0x1785) {
-				ADD_TIME(tr_mod_2_34_3_2_h2_e, usertime);
-				ADD_TIME(tr_cpu, usertime);
-			}
-
-			if (usertime != 0 && (checksum >> 28) == 0x2e0) {
-				ADD_TIME(tr_mod_2_24_3_1_h2_e, usertime);
-				ADD_TIME(tr_gpu, usertime);
-			}
+			printf("%" PRIu64 ": %" PRIu64 " (0x%" PRIx64 ")\n", n, record->usertime, record->checksum >> 24);
 		}
 
 		printf("all user time records:\n");
-		avg_and_print_usertime(tr_all.total, tr_all.count);
+		print_usertime(st->groups + GROUP_ALL);
+
+		printf("all user time records, histogram:\n");
+		print_histogram(st->groups + GROUP_ALL);
 
 		printf("GPU user time records:\n");
-		avg_and_print_usertime(tr_gpu.total, tr_gpu.count);
+		print_usertime(st->groups + GROUP_GPU);
 
 		printf("CPU user time records:\n");
-		avg_and_print_usertime(tr_cpu.total, tr_cpu.count);
-
-		printf("sieve-2^2 user time records:\n");
-		tr_mod_2_2.avg = avg_and_print_usertime(tr_mod_2_2.total, tr_mod_2_2.count);
-
-		printf("sieve-2^16 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_16.total, tr_mod_2_16.count);
+		print_usertime(st->groups + GROUP_CPU);
 
-		printf("esieve-2^16 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_16_e.total, tr_mod_2_16_e.count);
-
-		printf("esieve-2^24 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_24_e.total, tr_mod_2_24_e.count);
-
-		printf("esieve-2^24 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_24_3_1_e.total, tr_mod_2_24_3_1_e.count);
-
-		printf("h-esieve-2^24 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_24_3_1_h_e.total, tr_mod_2_24_3_1_h_e.count);
-
-		printf("h2-esieve-2^24 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_24_3_1_h2_e.total, tr_mod_2_24_3_1_h2_e.count);
-
-		printf("sieve-2^32 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_32.total, tr_mod_2_32.count);
-
-		printf("sieve-2^32 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_32_3_1.total, tr_mod_2_32_3_1.count);
-
-		printf("esieve-2^32 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_32_3_1_e.total, tr_mod_2_32_3_1_e.count);
-
-		printf("esieve-2^34 sieve-3^1 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_34_3_1_e.total, tr_mod_2_34_3_1_e.count);
-
-		printf("esieve-2^34 sieve-3^2 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_34_3_2_e.total, tr_mod_2_34_3_2_e.count);
-
-		printf("h-esieve-2^34 sieve-3^2 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_34_3_2_h_e.total, tr_mod_2_34_3_2_h_e.count);
-
-		printf("h2-esieve-2^34 sieve-3^2 user time records:\n");
-		avg_and_print_usertime(tr_mod_2_34_3_2_h2_e.total, tr_mod_2_34_3_2_h2_e.count);
+		/* the GPU classes first */
+		for (i = 0; i < CLASSES; ++i) {
+			if (g_classes[i].device != DEVICE_CPU) {
+				printf("%s user time records:\n", g_classes[i].name);
+				print_usertime(st->groups + i);
+			}
+		}
 
-#		undef ADD_TIME
+		for (i = 0; i < CLASSES; ++i) {
+			if (g_classes[i].device == DEVICE_CPU) {
+				printf("%s user time records:\n", g_classes[i].name);
+				print_usertime(st->groups + i);
+			}
+		}
 	}
 
 	/* overflows */
 	if (show_overflows) {
-		uint64_t n;
-		uint64_t overflow_count = 0;
-		uint64_t overflow_sum = 0;
-#if 0
-		int c = 0;
-#endif
-
 		printf("analyzing overflows...\n");
+		printf("\n");
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t overflow = g_overflows[n];
+		if (st != NULL) {
+			printf("overflows found: %" PRIu64 " assignments, %" PRIu64 " overflows\n", st->overflow_count, st->overflow_sum);
+		} else {
+			struct aggregate total;
 
-			if (overflow != 0) {
-				overflow_count++;
-				overflow_sum += overflow;
+			aggregates_sum(&g_aggregates, 0, RECORDS_CHUNKS, &total);
 
-#if 0
-				if (++c < 48) {
-					printf("- #%2i: found %" PRIu64 " overflows on the assignment %9" PRIu64 " (below %3" PRIu64 " x 2^60)\n", c, overflow, n, (n >> 20) + 1);
-				}
-#endif
-			}
+			printf("overflows found: %" PRIu64 " assignments, %" PRIu64 " overflows\n", total.overflowed, total.overflow);
 		}
 		printf("\n");
-
-		printf("overflows found: %" PRIu64 " assignments, %" PRIu64 " overflows\n", overflow_count, overflow_sum);
-		printf("\n");
 	}
 
 	/* clientids */
 	if (show_clientids) {
-		uint64_t n;
-		uint64_t clientid_count = 0;
-
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t clientid = g_clientids[n];
-
-			if (clientid != 0) {
-				clientid_count++;
-			}
-		}
-
-		printf("found %" PRIu64 " active assignments (client IDs)\n", clientid_count);
+		printf("found %" PRIu64 " active assignments (client IDs)\n", st->clientid_count);
 		printf("\n");
 	}
 
 	/* mxoffsets */
 	if (show_mxoffsets) {
-		uint64_t n;
-		int c = 0;
-		uint64_t mxoffset_count = 0;
-
-		/* find records that have incomplete mxoffset */
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t checksum = g_checksums[n];
-			uint64_t mxoffset = g_mxoffsets[n];
-
-			if (checksum) {
-				if (!mxoffset) {
-					c++;
-				}
-			}
-		}
-
-		printf("*** found %i incomplete records ***\n", c);
+		printf("*** found %" PRIu64 " incomplete records ***\n", st->incomplete);
 		printf("\n");
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t mxoffset = g_mxoffsets[n];
-
-			if (mxoffset != 0) {
-				mxoffset_count++;
-			}
-		}
-
-		printf("found %" PRIu64 " (%" PRIu64 "M) maximum value offset records (mxoffsets)\n", mxoffset_count, round_div_ul(mxoffset_count, 1000000));
+		printf("found %" PRIu64 " (%" PRIu64 "M) maximum value offset records (mxoffsets)\n", st->mxoffset_count, round_div_ul(st->mxoffset_count, 1000000));
 		printf("\n");
 	}
 
-	return 0;
+	if (st != NULL) {
+		stats_destroy(st);
+	}
+
+	free(g_scanned);
+
+	return r;
 }
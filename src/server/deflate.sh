@@ -10,11 +10,11 @@ case ${answer:0:1} in
 	;;
 esac
 
-du -sh *.map *.dat
+du -sh *.map records/*.rec
 
 echo Deflating...
-for f in *.map *.dat; do
+for f in *.map records/*.rec; do
 	fallocate -d $f
 done
 
-du -sh *.map *.dat
+du -sh *.map records/*.rec
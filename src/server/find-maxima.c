@@ -9,145 +9,288 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <assert.h>
-#ifdef _USE_GMP
-#	include <gmp.h>
-#endif
 #include "wideint.h"
+#include "uint256.h"
+#include "records.h"
 
 #define TASK_SIZE 40
 
 /* 2^32 assignments (tasks) */
 #define ASSIGNMENTS_NO (UINT64_C(1) << 32)
 
-#define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+#define MIN(a, b) ( ((a) < (b)) ? (a): (b) )
 
-const uint64_t *open_records(const char *path)
-{
-	int fd = open(path, O_RDONLY, 0600);
-	const void *ptr;
+/* the tasks of the new maxima, appended */
+#define REPORT_FILE "max-assignments.txt"
+
+/* the watermark and the current maximum */
+#define STATE_FILE "find-maxima.state"
+
+/* the tasks processed by a thread at once */
+#define BLOCK_SIZE (UINT64_C(1) << 16)
+
+/* the state is saved after this many tasks */
+#define STEP_SIZE (UINT64_C(1) << 26)
+
+struct records g_records;
+
+/* to skip the superblocks without candidates, if maintained by the server */
+struct aggregates g_aggregates;
+int g_have_aggregates = 0;
 
-	if (fd < 0) {
-		perror("open");
+/* all tasks below the watermark have been processed */
+uint64_t g_watermark = 0;
+
+/* the highest maximum found so far, and its starting value */
+struct uint256 g_max;
+uint128_t g_max_n0 = 0;
+
+/* a maximum higher than all of the preceding ones within a block */
+struct maximum {
+	uint64_t n; /* task */
+	uint128_t n0;
+	struct uint256 max;
+};
+
+struct block {
+	struct maximum *maxima;
+	size_t count;
+	size_t cap;
+};
+
+void init()
+{
+	if (records_open(&g_records, "records", 0) < 0) {
 		abort();
 	}
 
-	ptr = mmap(NULL, (size_t)RECORDS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	g_have_aggregates = aggregates_open(&g_aggregates, "aggregates.dat", RECORDS_CHUNKS, 0) == AGGREGATES_OK;
+}
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
-		abort();
+int load_state(void)
+{
+	FILE *stream = fopen(STATE_FILE, "r");
+	uint64_t n0[2];
+	int r;
+
+	if (stream == NULL) {
+		return -1;
 	}
 
-	close(fd);
+	r = fscanf(stream, "%" SCNu64 " %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64,
+		&g_watermark, &n0[1], &n0[0], &g_max.w[3], &g_max.w[2], &g_max.w[1], &g_max.w[0]);
+
+	fclose(stream);
+
+	if (r != 7) {
+		return -1;
+	}
 
-	return (const uint64_t *)ptr;
+	g_max_n0 = ((uint128_t)n0[1] << 64) | n0[0];
+
+	return 0;
 }
 
-const uint64_t *g_mxoffsets = 0;
+/* replaces the state atomically */
+int save_state(void)
+{
+	FILE *stream = fopen(STATE_FILE ".tmp", "w");
 
-void init()
+	if (stream == NULL) {
+		return -1;
+	}
+
+	fprintf(stream, "%" PRIu64 " %016" PRIx64 " %016" PRIx64 " %016" PRIx64 " %016" PRIx64 " %016" PRIx64 " %016" PRIx64 "\n",
+		g_watermark, (uint64_t)(g_max_n0 >> 64), (uint64_t)g_max_n0, g_max.w[3], g_max.w[2], g_max.w[1], g_max.w[0]);
+
+	if (fflush(stream) != 0 || fsync(fileno(stream)) < 0) {
+		fclose(stream);
+		return -1;
+	}
+
+	if (fclose(stream) != 0) {
+		return -1;
+	}
+
+	return rename(STATE_FILE ".tmp", STATE_FILE);
+}
+
+/* the lowest task at or above n without a result */
+uint64_t find_incomplete(uint64_t n)
 {
-	g_mxoffsets = open_records("mxoffsets.dat");
+	while (n < ASSIGNMENTS_NO) {
+		uint64_t sb = n >> RECORDS_CHUNK_LOG2;
+
+		if (g_have_aggregates && g_aggregates.sbs[sb].complete == RECORDS_CHUNK_NO) {
+			n = (sb + 1) << RECORDS_CHUNK_LOG2;
+			continue;
+		}
+
+		if (records_get(&g_records, n)->checksum == 0) {
+			break;
+		}
+
+		n++;
+	}
+
+	return n;
 }
 
-#ifdef _USE_GMP
-static void mpz_init_set_u128(mpz_t rop, uint128_t op)
+void block_push(struct block *block, uint64_t n, uint128_t n0, const struct uint256 *max)
 {
-	uint64_t nh = (uint64_t)(op>>64);
-	uint64_t nl = (uint64_t)(op);
+	if (block->count == block->cap) {
+		size_t cap = block->cap ? 2 * block->cap : 16;
+		struct maximum *p = realloc(block->maxima, sizeof(struct maximum) * cap);
 
-	assert(sizeof(unsigned long) == sizeof(uint64_t));
+		if (p == NULL) {
+			perror("realloc");
+			abort();
+		}
+
+		block->maxima = p;
+		block->cap = cap;
+	}
 
-	mpz_init_set_ui(rop, (unsigned long)nh);
-	mpz_mul_2exp(rop, rop, (mp_bitcnt_t)64);
-	mpz_add_ui(rop, rop, (unsigned long)nl);
+	block->maxima[block->count].n = n;
+	block->maxima[block->count].n0 = n0;
+	block->maxima[block->count].max = *max;
+	block->count++;
 }
-#endif
 
-#ifdef _USE_GMP
-void mpz_get_maximum(mpz_t max, uint128_t n0_)
+/*
+ * The blocks of the tasks [lo, hi) are processed in parallel. A new maximum
+ * must be higher than all of the preceding ones in its block, so only these
+ * are kept, and then compared with the maximum in the order of the blocks.
+ */
+void process_range(uint64_t lo, uint64_t hi, FILE *report)
 {
-	mpz_t n0;
-	mpz_t n;
-
-	mpz_init_set_u128(n0, n0_);
-	mpz_init_set(n, n0);
-
-	while (mpz_cmp(n, n0) >= 0) {
-		if (mpz_congruent_ui_p(n, 1UL, 2UL)) {
-			/* odd step */
-			mpz_mul_ui(n, n, 3UL);
-			mpz_add_ui(n, n, 1UL);
-		} else {
-			/* even step */
-			mpz_fdiv_q_ui(n, n, 2UL);
+	uint64_t blocks_no = (hi - lo + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	struct block *blocks = calloc((size_t)blocks_no, sizeof(struct block));
+	uint64_t b;
+
+	if (blocks == NULL) {
+		perror("calloc");
+		abort();
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (b = 0; b < blocks_no; ++b) {
+		uint64_t n = lo + b * BLOCK_SIZE;
+		uint64_t end = MIN(hi, n + BLOCK_SIZE);
+		struct uint256 block_max;
+
+		/* no candidates in the superblock */
+		if (g_have_aggregates && g_aggregates.sbs[n >> RECORDS_CHUNK_LOG2].mxoffsets == 0) {
+			continue;
 		}
 
-		if (mpz_cmp(n, max) > 0) {
-			mpz_set(max, n);
+		uint256_set_u128(&block_max, 0);
+
+		for (; n < end; ++n) {
+			uint64_t mxoffset = records_get(&g_records, n)->mxoffset;
+			uint128_t n0;
+			struct uint256 max;
+
+			if (mxoffset == 0) {
+				continue;
+			}
+
+			n0 = mxoffset + ((uint128_t)n << TASK_SIZE);
+
+			uint256_get_maximum(&max, n0);
+
+			if (uint256_cmp(&max, &block_max) > 0) {
+				block_max = max;
+				block_push(&blocks[b], n, n0, &max);
+			}
 		}
 	}
 
-	mpz_clear(n0);
-	mpz_clear(n);
-}
-#endif
+	for (b = 0; b < blocks_no; ++b) {
+		size_t i;
+
+		for (i = 0; i < blocks[b].count; ++i) {
+			const struct maximum *m = &blocks[b].maxima[i];
+
+			if (uint256_cmp(&m->max, &g_max) > 0) {
+				struct uint256 t_n0;
+				char n0_str[80];
+				char max_str[80];
 
-#ifdef _USE_GMP
-mpz_t g_max;
-#endif
-uint128_t g_max_n0;
+				g_max = m->max;
+				g_max_n0 = m->n0;
 
-int main()
+				uint256_set_u128(&t_n0, g_max_n0);
+
+				printf("new maximum: superblock %3" PRIu64 ", assignment %9" PRIu64 ", n0 = %21s, max = %s (bitsize %i)\n",
+					m->n >> 20, m->n, uint256_to_str(&t_n0, n0_str), uint256_to_str(&g_max, max_str), uint256_bitsize(&g_max));
+
+				fprintf(report, "%" PRIu64 "\n", m->n);
+			}
+		}
+
+		free(blocks[b].maxima);
+	}
+
+	free(blocks);
+}
+
+/* usage: find-maxima [-r] */
+int main(int argc, char *argv[])
 {
-	uint64_t n;
-#ifdef _USE_GMP
-	mpz_t max;
-#endif
 	FILE *stream;
+	int restart = 0;
+	int opt;
+	uint64_t end;
+
+	while ((opt = getopt(argc, argv, "r")) != -1) {
+		switch (opt) {
+			case 'r':
+				restart = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-r]\n", argv[0]);
+				return 1;
+		}
+	}
 
 	init();
 
-	stream = fopen("max-assignments.txt", "w");
+	uint256_set_u128(&g_max, 0);
+
+	/* without the state, everything is processed again */
+	if (restart || load_state() < 0) {
+		g_watermark = 0;
+		g_max_n0 = 0;
+		uint256_set_u128(&g_max, 0);
+
+		stream = fopen(REPORT_FILE, "w");
+	} else {
+		stream = fopen(REPORT_FILE, "a");
+	}
 
 	if (stream == NULL) {
 		fprintf(stderr, "Unable to open output file!\n");
 		return 1;
 	}
 
-#ifdef _USE_GMP
-	mpz_init_set_ui(g_max, 0);
-	mpz_init(max);
-#endif
-
-	for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-		uint64_t mxoffset = g_mxoffsets[n];
+	/* only the tasks below the lowest incomplete one, the maxima depend on all of the lower ones */
+	end = find_incomplete(g_watermark);
 
-		if (mxoffset != 0) {
-			uint128_t n0 = mxoffset + ((uint128_t)n << TASK_SIZE);
+	printf("processing the assignments %" PRIu64 " to %" PRIu64 " (exclusive)\n", g_watermark, end);
 
-#ifdef _USE_GMP
-			mpz_get_maximum(max, n0);
+	while (g_watermark < end) {
+		uint64_t step_end = MIN(end, g_watermark + STEP_SIZE);
 
-			if (mpz_cmp(max, g_max) > 0) {
-				mpz_t t_n0;
+		process_range(g_watermark, step_end, stream);
 
-				mpz_set(g_max, max);
-				g_max_n0 = n0;
+		g_watermark = step_end;
 
-				mpz_init_set_u128(t_n0, g_max_n0);
-
-				gmp_printf("new maximum: superblock %3" PRIu64 ", assignment %9" PRIu64 ", n0 = %21Zi, max = %Zi (bitsize %lu)\n",
-					n >> 20, n, t_n0, g_max, (unsigned long)mpz_sizeinbase(g_max, 2));
-
-				mpz_clear(t_n0);
-
-				fprintf(stream, "%" PRIu64 "\n", n);
-			}
-#else
-			(void)n0;
-			abort();
-#endif
+		/* the report first, the state can be behind it but not ahead */
+		if (fflush(stream) != 0 || fsync(fileno(stream)) < 0 || save_state() < 0) {
+			fprintf(stderr, "Unable to save the state!\n");
+			fclose(stream);
+			return 1;
 		}
 	}
 
@@ -0,0 +1,113 @@
+/**
+ * Expiry queue of the assignment leases.
+ *
+ * A binary min-heap ordered by the deadline. The entries are never removed
+ * when the assignment is returned, interrupted or renewed, the caller
+ * checks the popped entry against the record instead (the deadline stored
+ * there is authoritative).
+ */
+
+#ifndef LEASES_H_
+#define LEASES_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "compat.h"
+
+/* the tasks [n, n + count) */
+struct lease {
+	uint64_t deadline;
+	uint64_t n;
+	uint64_t count;
+};
+
+struct leases {
+	struct lease *heap;
+	size_t size;
+	size_t cap;
+};
+
+UNUSED
+static int leases_push(struct leases *ls, uint64_t deadline, uint64_t n, uint64_t count)
+{
+	size_t i;
+
+	if (ls->size == ls->cap) {
+		size_t cap = ls->cap ? 2 * ls->cap : 4096;
+		struct lease *heap = realloc(ls->heap, cap * sizeof(struct lease));
+
+		if (heap == NULL) {
+			return -1;
+		}
+
+		ls->heap = heap;
+		ls->cap = cap;
+	}
+
+	/* sift up */
+	for (i = ls->size++; i > 0 && ls->heap[(i - 1) / 2].deadline > deadline; i = (i - 1) / 2) {
+		ls->heap[i] = ls->heap[(i - 1) / 2];
+	}
+
+	ls->heap[i].deadline = deadline;
+	ls->heap[i].n = n;
+	ls->heap[i].count = count;
+
+	return 0;
+}
+
+/* the earliest deadline, the queue must not be empty */
+UNUSED
+static const struct lease *leases_top(const struct leases *ls)
+{
+	assert(ls->size > 0);
+
+	return &ls->heap[0];
+}
+
+UNUSED
+static struct lease leases_pop(struct leases *ls)
+{
+	struct lease top, last;
+	size_t i = 0;
+
+	assert(ls->size > 0);
+
+	top = ls->heap[0];
+	last = ls->heap[--ls->size];
+
+	/* sift down */
+	while (2 * i + 1 < ls->size) {
+		size_t child = 2 * i + 1;
+
+		if (child + 1 < ls->size && ls->heap[child + 1].deadline < ls->heap[child].deadline) {
+			child++;
+		}
+
+		if (last.deadline <= ls->heap[child].deadline) {
+			break;
+		}
+
+		ls->heap[i] = ls->heap[child];
+		i = child;
+	}
+
+	if (ls->size > 0) {
+		ls->heap[i] = last;
+	}
+
+	return top;
+}
+
+UNUSED
+static void leases_free(struct leases *ls)
+{
+	free(ls->heap);
+
+	ls->heap = NULL;
+	ls->size = 0;
+	ls->cap = 0;
+}
+
+#endif /* LEASES_H_ */
@@ -0,0 +1,315 @@
+/**
+ * Live counters of the server.
+ *
+ * Everything is kept in memory: the assigned, completed and overflowed
+ * tasks per minute over the last hour, the user times of the last returned
+ * tasks (fixed-size tables), and the completed tasks per client address in
+ * the current and the previous hour (a hash table, doubled whenever it gets
+ * half full). Updating and querying costs constant time (amortized), nothing
+ * touches the disk.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "compat.h"
+
+#define METRICS_MINUTES 60
+#define METRICS_USERTIMES 1024
+#define METRICS_CLIENTS 1024 /* the initial size of the table of the clients */
+#define METRICS_TOP 8
+
+struct metrics_client {
+	char ipv4[16]; /* empty if the slot is free */
+	uint64_t hour;
+	uint64_t completed; /* in the hour above */
+	uint64_t prev; /* in the hour before */
+};
+
+struct metrics {
+	uint64_t start;
+	/* per-minute buckets, minute[i] tells which minute the bucket i holds */
+	uint64_t minute[METRICS_MINUTES];
+	uint64_t assigned[METRICS_MINUTES];
+	uint64_t completed[METRICS_MINUTES];
+	uint64_t overflows[METRICS_MINUTES];
+	/* assigned and not complete */
+	uint64_t active;
+	/* the ring of the last user times */
+	uint64_t usertimes[METRICS_USERTIMES];
+	uint64_t usertimes_n;
+	struct metrics_client *clients;
+	uint64_t clients_cap;
+	uint64_t clients_n;
+};
+
+UNUSED
+static void metrics_init(struct metrics *m, uint64_t now)
+{
+	memset(m, 0, sizeof(struct metrics));
+
+	m->start = now;
+
+	/* without the table, the clients are not counted */
+	m->clients = calloc(METRICS_CLIENTS, sizeof(struct metrics_client));
+	m->clients_cap = m->clients != NULL ? METRICS_CLIENTS : 0;
+}
+
+UNUSED
+static void metrics_free(struct metrics *m)
+{
+	free(m->clients);
+	m->clients = NULL;
+	m->clients_cap = 0;
+	m->clients_n = 0;
+}
+
+/* the bucket of the current minute, emptied if it holds an older one */
+UNUSED
+static int metrics_bucket(struct metrics *m, uint64_t now)
+{
+	uint64_t minute = now / 60;
+	int i = (int)(minute % METRICS_MINUTES);
+
+	if (m->minute[i] != minute) {
+		m->minute[i] = minute;
+		m->assigned[i] = 0;
+		m->completed[i] = 0;
+		m->overflows[i] = 0;
+	}
+
+	return i;
+}
+
+/* the sum over the buckets of the last hour */
+UNUSED
+static uint64_t metrics_sum(const struct metrics *m, const uint64_t *buckets, uint64_t now)
+{
+	uint64_t minute = now / 60;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < METRICS_MINUTES; ++i) {
+		if (m->minute[i] + METRICS_MINUTES > minute) {
+			sum += buckets[i];
+		}
+	}
+
+	return sum;
+}
+
+/* count tasks assigned, of them active were not assigned before */
+UNUSED
+static void metrics_assigned(struct metrics *m, uint64_t now, uint64_t count, uint64_t active)
+{
+	m->assigned[metrics_bucket(m, now)] += count;
+	m->active += active;
+}
+
+/* the assignment has been completed or returned to the pool */
+UNUSED
+static void metrics_released(struct metrics *m)
+{
+	if (m->active > 0) {
+		m->active--;
+	}
+}
+
+/* FNV-1a */
+UNUSED
+static uint64_t metrics_hash(const char *s)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+
+	for (; *s; ++s) {
+		hash ^= (unsigned char)*s;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+/* the free slot for the address, or its own one */
+UNUSED
+static struct metrics_client *metrics_probe(struct metrics_client *clients, uint64_t cap, const char *ipv4)
+{
+	uint64_t h = metrics_hash(ipv4);
+	uint64_t i;
+
+	for (i = 0; i < cap; ++i) {
+		struct metrics_client *client = &clients[(h + i) % cap];
+
+		if (client->ipv4[0] == 0 || strcmp(client->ipv4, ipv4) == 0) {
+			return client;
+		}
+	}
+
+	return NULL;
+}
+
+/* doubles the table, returns -1 if it cannot be allocated */
+UNUSED
+static int metrics_grow(struct metrics *m)
+{
+	uint64_t cap = 2 * m->clients_cap;
+	struct metrics_client *clients = calloc((size_t)cap, sizeof(struct metrics_client));
+	uint64_t i;
+
+	if (clients == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < m->clients_cap; ++i) {
+		if (m->clients[i].ipv4[0] != 0) {
+			*metrics_probe(clients, cap, m->clients[i].ipv4) = m->clients[i];
+		}
+	}
+
+	free(m->clients);
+	m->clients = clients;
+	m->clients_cap = cap;
+
+	return 0;
+}
+
+/* the slot of the address (open addressing), or NULL if the table cannot grow */
+UNUSED
+static struct metrics_client *metrics_client(struct metrics *m, const char *ipv4)
+{
+	struct metrics_client *client;
+
+	if (m->clients_cap == 0) {
+		return NULL;
+	}
+
+	client = metrics_probe(m->clients, m->clients_cap, ipv4);
+
+	if (client->ipv4[0] != 0) {
+		return client;
+	}
+
+	/* keep the load factor below 1/2, the probes stay short */
+	if (2 * (m->clients_n + 1) > m->clients_cap) {
+		if (metrics_grow(m) < 0) {
+			return NULL;
+		}
+
+		client = metrics_probe(m->clients, m->clients_cap, ipv4);
+	}
+
+	strncpy(client->ipv4, ipv4, sizeof(client->ipv4) - 1);
+	m->clients_n++;
+
+	return client;
+}
+
+/* rolls the hourly counters of the client */
+UNUSED
+static void metrics_client_roll(struct metrics_client *client, uint64_t now)
+{
+	uint64_t hour = now / 3600;
+
+	if (client->hour != hour) {
+		client->prev = (client->hour + 1 == hour) ? client->completed : 0;
+		client->completed = 0;
+		client->hour = hour;
+	}
+}
+
+UNUSED
+static void metrics_completed(struct metrics *m, uint64_t now, uint64_t usertime, uint64_t overflow, const char *ipv4)
+{
+	int i = metrics_bucket(m, now);
+	struct metrics_client *client = metrics_client(m, ipv4);
+
+	m->completed[i]++;
+
+	if (overflow != 0) {
+		m->overflows[i]++;
+	}
+
+	m->usertimes[m->usertimes_n++ % METRICS_USERTIMES] = usertime;
+
+	if (client != NULL) {
+		metrics_client_roll(client, now);
+		client->completed++;
+	}
+}
+
+UNUSED
+static int metrics_cmp_uint64(const void *p1, const void *p2)
+{
+	uint64_t a = *(const uint64_t *)p1;
+	uint64_t b = *(const uint64_t *)p2;
+
+	return (a > b) - (a < b);
+}
+
+/* of the last METRICS_USERTIMES returned tasks */
+UNUSED
+static uint64_t metrics_median_usertime(const struct metrics *m)
+{
+	uint64_t copy[METRICS_USERTIMES];
+	size_t n = m->usertimes_n < METRICS_USERTIMES ? (size_t)m->usertimes_n : METRICS_USERTIMES;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	memcpy(copy, m->usertimes, n * sizeof(uint64_t));
+
+	qsort(copy, n, sizeof(uint64_t), metrics_cmp_uint64);
+
+	return copy[n / 2];
+}
+
+/*
+ * Fills up to METRICS_TOP pairs (address in host order, tasks completed in
+ * the current and the previous hour), the most productive first. Returns
+ * the number of the pairs.
+ */
+UNUSED
+static int metrics_top_clients(struct metrics *m, uint64_t now, uint64_t *pairs)
+{
+	int n = 0;
+	uint64_t i;
+
+	for (i = 0; i < m->clients_cap; ++i) {
+		struct metrics_client *client = &m->clients[i];
+		uint64_t completed;
+		int j;
+
+		if (client->ipv4[0] == 0) {
+			continue;
+		}
+
+		metrics_client_roll(client, now);
+
+		completed = client->completed + client->prev;
+
+		if (completed == 0) {
+			continue;
+		}
+
+		/* insertion into the sorted top list */
+		for (j = n < METRICS_TOP ? n++ : METRICS_TOP; j > 0 && pairs[2 * (j - 1) + 1] < completed; --j) {
+			if (j < METRICS_TOP) {
+				pairs[2 * j + 0] = pairs[2 * (j - 1) + 0];
+				pairs[2 * j + 1] = pairs[2 * (j - 1) + 1];
+			}
+		}
+
+		if (j < METRICS_TOP) {
+			pairs[2 * j + 0] = ntohl(inet_addr(client->ipv4));
+			pairs[2 * j + 1] = completed;
+		}
+	}
+
+	return n;
+}
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,384 @@
+/**
+ * Sparse record store.
+ *
+ * The records of all fields of a task are stored together (64 bytes per
+ * task). The 2^32 tasks are split into superblocks of 2^20 tasks, each
+ * superblock is stored in its own file (records/XXXXX.rec) which is created
+ * on the first write. The superblocks that have never been written cost
+ * nothing, neither on disk nor in the scans.
+ */
+
+#ifndef RECORDS_H_
+#define RECORDS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "compat.h"
+#include "aggregates.h"
+
+/* 2^32 assignments (tasks) */
+#define RECORDS_NO (UINT64_C(1) << 32)
+
+#define RECORDS_CHUNK_LOG2 20
+#define RECORDS_CHUNK_NO (UINT64_C(1) << RECORDS_CHUNK_LOG2)
+#define RECORDS_CHUNKS (RECORDS_NO >> RECORDS_CHUNK_LOG2)
+
+struct record {
+	uint64_t checksum;
+	uint64_t usertime;
+	uint64_t overflow;
+	uint64_t clientid;
+	uint64_t mxoffset;
+	uint64_t deadline; /* of the lease (Unix time), while assigned */
+	uint64_t doneby; /* the client ID of the result, for the audits (zero if unknown) */
+	uint64_t reserved;
+};
+
+#define RECORDS_CHUNK_SIZE (RECORDS_CHUNK_NO * sizeof(struct record))
+
+struct records {
+	const char *dir;
+	int writable;
+	uint64_t end; /* the highest present chunk + 1 */
+	struct record *chunks[RECORDS_CHUNKS];
+};
+
+/* returned for the tasks in the missing chunks */
+UNUSED
+static const struct record g_zero_record;
+
+UNUSED
+static void records_chunk_path(const struct records *rs, uint64_t c, char *path)
+{
+	sprintf(path, "%s/%05" PRIu64 ".rec", rs->dir, c);
+}
+
+UNUSED
+static struct record *records_map_chunk(struct records *rs, uint64_t c, int create)
+{
+	char path[4096];
+	int fd;
+	void *ptr;
+
+	records_chunk_path(rs, c, path);
+
+	fd = open(path, rs->writable ? (O_RDWR | (create ? O_CREAT : 0)) : O_RDONLY, 0600);
+
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			perror("open");
+			abort();
+		}
+		return NULL;
+	}
+
+	if (rs->writable && ftruncate(fd, (off_t)RECORDS_CHUNK_SIZE) < 0) {
+		perror("ftruncate");
+		abort();
+	}
+
+	ptr = mmap(NULL, (size_t)RECORDS_CHUNK_SIZE, rs->writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+	if (ptr == MAP_FAILED) {
+		perror("mmap");
+		abort();
+	}
+
+	close(fd);
+
+	rs->chunks[c] = ptr;
+
+	if (c + 1 > rs->end) {
+		rs->end = c + 1;
+	}
+
+	return rs->chunks[c];
+}
+
+UNUSED
+static int records_open(struct records *rs, const char *dir, int writable)
+{
+	uint64_t c;
+
+	rs->dir = dir;
+	rs->writable = writable;
+	rs->end = 0;
+
+	if (writable && mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		perror("mkdir");
+		return -1;
+	}
+
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		rs->chunks[c] = NULL;
+
+		records_map_chunk(rs, c, 0);
+	}
+
+	return 0;
+}
+
+/* for reading */
+UNUSED
+static const struct record *records_get(const struct records *rs, uint64_t n)
+{
+	const struct record *chunk = rs->chunks[n >> RECORDS_CHUNK_LOG2];
+
+	if (chunk == NULL) {
+		return &g_zero_record;
+	}
+
+	return chunk + (n & (RECORDS_CHUNK_NO - 1));
+}
+
+/* for writing, the chunk is created if needed */
+UNUSED
+static struct record *records_at(struct records *rs, uint64_t n)
+{
+	uint64_t c = n >> RECORDS_CHUNK_LOG2;
+
+	if (rs->chunks[c] == NULL) {
+		assert(rs->writable);
+
+		records_map_chunk(rs, c, 1);
+	}
+
+	return rs->chunks[c] + (n & (RECORDS_CHUNK_NO - 1));
+}
+
+/* the tasks beyond this have no records */
+UNUSED
+static uint64_t records_end(const struct records *rs)
+{
+	return rs->end << RECORDS_CHUNK_LOG2;
+}
+
+UNUSED
+static int records_present(const struct records *rs, uint64_t c)
+{
+	return rs->chunks[c] != NULL;
+}
+
+UNUSED
+static void records_sync(struct records *rs)
+{
+	uint64_t c;
+
+	for (c = 0; c < rs->end; ++c) {
+		if (rs->chunks[c] != NULL) {
+			msync(rs->chunks[c], (size_t)RECORDS_CHUNK_SIZE, MS_SYNC);
+		}
+	}
+}
+
+UNUSED
+static void records_close(struct records *rs)
+{
+	uint64_t c;
+
+	for (c = 0; c < rs->end; ++c) {
+		if (rs->chunks[c] != NULL) {
+			munmap(rs->chunks[c], (size_t)RECORDS_CHUNK_SIZE);
+			rs->chunks[c] = NULL;
+		}
+	}
+
+	rs->end = 0;
+}
+
+/* does the file contain any data in [offset, offset + size) */
+UNUSED
+static int records_has_data(int fd, off_t offset, off_t size)
+{
+#ifdef SEEK_DATA
+	off_t data = lseek(fd, offset, SEEK_DATA);
+
+	if (data < 0) {
+		/* ENXIO: no data beyond the offset; other errors: do not know */
+		return errno == ENXIO ? 0 : 1;
+	}
+
+	return data < offset + size;
+#else
+	(void)fd;
+	(void)offset;
+	(void)size;
+
+	return 1;
+#endif
+}
+
+/* opens the file of the chunk c for records_seek */
+UNUSED
+static int records_chunk_fd(const struct records *rs, uint64_t c)
+{
+	char path[4096];
+
+	records_chunk_path(rs, c, path);
+
+	return open(path, O_RDONLY);
+}
+
+/*
+ * The first task >= n of the chunk c which is stored in the data (whence is
+ * SEEK_DATA) or in a hole (SEEK_HOLE) of the chunk file, or the end of the
+ * chunk. The result is rounded to 64 tasks (the blocks of the file are
+ * multiples of 4 KiB anyway). Without SEEK_DATA, or if the file cannot be
+ * opened (fd < 0), everything is data.
+ */
+UNUSED
+static uint64_t records_seek(int fd, uint64_t c, uint64_t n, int whence)
+{
+	uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
+#ifdef SEEK_DATA
+	off_t offset = (off_t)((n & (RECORDS_CHUNK_NO - 1)) * sizeof(struct record));
+
+	/* the file cannot be read, the whole chunk is treated as data */
+	if (fd < 0) {
+		return whence == SEEK_HOLE ? end : (n < end ? n : end);
+	}
+
+	if (n < end) {
+		offset = lseek(fd, offset, whence);
+
+		if (offset < 0) {
+			/* ENXIO: no more data */
+			return errno == ENXIO ? end : (whence == SEEK_DATA ? n & ~UINT64_C(63) : end);
+		}
+
+		n = (c << RECORDS_CHUNK_LOG2) + (uint64_t)offset / sizeof(struct record);
+
+		n = whence == SEEK_DATA ? n & ~UINT64_C(63) : (n + 63) & ~UINT64_C(63);
+	}
+
+	return n < end ? n : end;
+#else
+	(void)fd;
+
+	return whence == SEEK_DATA ? n & ~UINT64_C(63) : end;
+#endif
+}
+
+/* the aggregate of the chunk c, computed from its records */
+UNUSED
+static void records_aggregate(const struct records *rs, uint64_t c, struct aggregate *a)
+{
+	uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
+	uint64_t n = c << RECORDS_CHUNK_LOG2;
+	int fd;
+
+	memset(a, 0, sizeof(struct aggregate));
+
+	if (!records_present(rs, c)) {
+		return;
+	}
+
+	fd = records_chunk_fd(rs, c);
+
+	while ((n = records_seek(fd, c, n, SEEK_DATA)) < end) {
+		uint64_t e = records_seek(fd, c, n, SEEK_HOLE);
+
+		for (; n < e; ++n) {
+			const struct record *r = records_get(rs, n);
+
+			aggregate_add(a, r->checksum, r->usertime, r->overflow, r->mxoffset, +1);
+		}
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+/*
+ * Imports the five legacy 32 GiB files (checksums.dat, usertimes.dat,
+ * overflows.dat, clientids.dat, mxoffsets.dat). Holes in the files are
+ * skipped, only the superblocks with some non-zero value are created.
+ */
+UNUSED
+static int records_import_legacy(struct records *rs)
+{
+	const char *paths[5] = { "checksums.dat", "usertimes.dat", "overflows.dat", "clientids.dat", "mxoffsets.dat" };
+	const uint64_t *legacy[5];
+	int fds[5];
+	uint64_t c;
+	int i;
+
+	for (i = 0; i < 5; ++i) {
+		void *ptr;
+
+		legacy[i] = NULL;
+		fds[i] = open(paths[i], O_RDONLY);
+
+		if (fds[i] < 0) {
+			continue;
+		}
+
+		ptr = mmap(NULL, (size_t)(RECORDS_NO * 8), PROT_READ, MAP_SHARED, fds[i], 0);
+
+		if (ptr == MAP_FAILED) {
+			perror("mmap");
+			return -1;
+		}
+
+		legacy[i] = ptr;
+	}
+
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		uint64_t n;
+		int data = 0;
+
+		for (i = 0; i < 5; ++i) {
+			if (fds[i] >= 0 && records_has_data(fds[i], (off_t)(c << RECORDS_CHUNK_LOG2) * 8, (off_t)RECORDS_CHUNK_NO * 8)) {
+				data = 1;
+			}
+		}
+
+		if (!data) {
+			continue;
+		}
+
+		for (n = c << RECORDS_CHUNK_LOG2; n < (c + 1) << RECORDS_CHUNK_LOG2; ++n) {
+			uint64_t v[5];
+
+			for (i = 0; i < 5; ++i) {
+				v[i] = legacy[i] ? legacy[i][n] : 0;
+			}
+
+			if (v[0] | v[1] | v[2] | v[3] | v[4]) {
+				struct record *r = records_at(rs, n);
+
+				r->checksum = v[0];
+				r->usertime = v[1];
+				r->overflow = v[2];
+				r->clientid = v[3];
+				r->mxoffset = v[4];
+			}
+		}
+	}
+
+	for (i = 0; i < 5; ++i) {
+		if (legacy[i] != NULL) {
+			munmap((void *)legacy[i], (size_t)(RECORDS_NO * 8));
+		}
+		if (fds[i] >= 0) {
+			close(fds[i]);
+		}
+	}
+
+	records_sync(rs);
+
+	return 0;
+}
+
+#endif /* RECORDS_H_ */
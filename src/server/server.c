@@ -22,9 +22,16 @@
 #include <netinet/tcp.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/epoll.h>
 #include "compat.h"
+#include "bitindex.h"
+#include "wal.h"
+#include "records.h"
+#include "aggregates.h"
+#include "leases.h"
+#include "metrics.h"
 
-const uint16_t serverport = 5006;
+uint16_t serverport = 5006;
 
 static volatile sig_atomic_t quit = 0;
 
@@ -82,155 +89,211 @@ int init_sockaddr(struct sockaddr_in *name, uint16_t port)
 	return 0;
 }
 
-ssize_t write_(int fd, const char *buf, size_t count)
-{
-	ssize_t written = 0;
+#define TASK_SIZE 40
 
-	while ((size_t)written < count) {
-		ssize_t t = write(fd, buf+written, count - written);
+/* 2^32 assignments (tasks) */
+#define ASSIGNMENTS_NO (UINT64_C(1) << 32)
 
-		if (t < 0) {
-			/* errno is set appropriately */
-			return -1;
-		}
-		if (t == 0 && (size_t)(written + t) != count) {
-			/* zero indicates nothing was written */
-			return -1;
-		}
+#define MAP_SIZE (ASSIGNMENTS_NO >> 3)
 
-		written += t;
-	}
+#define IS_ASSIGNED(n) bitindex_get(&g_index_assigned, (n))
+#define IS_COMPLETE(n) bitindex_get(&g_index_complete, (n))
 
-	return written;
-}
+#define SET_ASSIGNED(n)   bitindex_set(&g_index_assigned, (n))
+#define SET_UNASSIGNED(n) bitindex_clear(&g_index_assigned, (n))
+#define SET_COMPLETE(n)   bitindex_set(&g_index_complete, (n))
+#define SET_INCOMPLETE(n) bitindex_clear(&g_index_complete, (n))
 
-ssize_t read_(int fd, char *buf, size_t count)
-{
-	/* I known this isn't a word in English, but "read" was already taken. */
-	ssize_t readen = 0;
+uint64_t g_lowest_unassigned = 0; /* bit index, not byte */
+uint64_t g_lowest_incomplete = 0;
 
-	while ((size_t)readen < count) {
-		ssize_t t = read(fd, buf + readen, count - readen);
+/* the tasks [g_shard_lo, g_shard_hi) owned by this server, see the -s option */
+uint64_t g_shard_lo = 0;
+uint64_t g_shard_hi = ASSIGNMENTS_NO;
 
-		if (t < 0) {
-			/*  errno is set appropriately */
-			return -1;
-		}
-		if (t == 0 && (size_t)(readen + t) != count) {
-			/* zero indicates end of file */
-			return -1;
-		}
+#define IN_SHARD(n) ((n) >= g_shard_lo && (n) < g_shard_hi)
 
-		readen += t;
-	}
+unsigned char *g_map_assigned;
+unsigned char *g_map_complete;
 
-	return readen;
-}
+/* summaries of the maps above */
+struct bitindex g_index_assigned;
+struct bitindex g_index_complete;
 
-int read_uint64(int fd, uint64_t *nptr)
-{
-	uint32_t nh, nl;
-	uint64_t n;
+/* checksums, user times, overflows, client IDs, and mxoffsets */
+struct records g_records;
 
-	if (read_(fd, (void *)&nh, 4) < 0) {
-		return -1;
-	}
+/* the totals of the records per superblock */
+struct aggregates g_aggregates;
 
-	if (read_(fd, (void *)&nl, 4) < 0) {
-		return -1;
-	}
+/* every change below is logged before it is applied */
+struct wal g_wal = { -1, 0, 0, 0 };
 
-	nh = ntohl(nh);
-	nl = ntohl(nl);
+/* checkpoint at least this often (seconds) */
+#define CHECKPOINT_INTERVAL 600
 
-	n = ((uint64_t)nh << 32) + nl;
+/* default lease time (seconds), see the -L option */
+#define LEASE_TIME (6 * 60 * 60)
 
-	assert(nptr != NULL);
+/* the shortest lease a client can ask for (seconds) */
+#define LEASE_TIME_MIN 60
 
-	*nptr = n;
+/* zero means no leases */
+uint64_t g_lease_time = LEASE_TIME;
 
-	return 0;
+/* deadlines of the assigned tasks */
+struct leases g_leases = { NULL, 0, 0 };
+
+/* for the STA query */
+struct metrics g_metrics;
+
+void wal_log(uint32_t type, uint64_t n, uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e)
+{
+	if (wal_append(&g_wal, type, n, a, b, c, d, e) < 0) {
+		message(ERR "unable to write into the log!\n");
+	}
 }
 
-int write_uint64(int fd, uint64_t n)
+/* at most this many tasks in a range lease (RRQ, RRT) */
+#define RANGE_MAX 65536
+
+/* at most this many threads of a client (MRQ, MUL), this bounds the input buffered per connection */
+#define THREADS_MAX 65536
+
+void set_assigned_range(uint64_t n, uint64_t count, uint64_t clid, uint64_t deadline)
 {
-	uint32_t nh, nl;
+	uint64_t i;
 
-	nh = (uint32_t)(n >> 32);
-	nl = (uint32_t)(n);
+	for (i = 0; i < count; ++i) {
+		struct record *record = records_at(&g_records, n + i);
 
-	nh = htonl(nh);
-	nl = ntohl(nl);
+		SET_ASSIGNED(n + i);
 
-	if (write_(fd, (void *)&nh, 4) < 0) {
-		return -1;
+		record->clientid = clid;
+		record->deadline = deadline;
 	}
+}
 
-	if (write_(fd, (void *)&nl, 4) < 0) {
-		return -1;
+void apply_wal_record(const struct wal_record *record)
+{
+	uint64_t n = record->n;
+
+	if (n >= ASSIGNMENTS_NO) {
+		message(ERR "invalid assignment %" PRIu64 " in the log\n", n);
+		return;
 	}
 
-	return 0;
+	switch (record->type) {
+		case WAL_SET_ASSIGNED:
+			SET_ASSIGNED(n);
+			break;
+		case WAL_SET_UNASSIGNED:
+			SET_UNASSIGNED(n);
+			break;
+		case WAL_SET_COMPLETE:
+			SET_COMPLETE(n);
+			break;
+		case WAL_SET_INCOMPLETE:
+			SET_INCOMPLETE(n);
+			break;
+		case WAL_SET_CLIENTID:
+			records_at(&g_records, n)->clientid = record->a;
+			break;
+		case WAL_SET_RESULT: {
+			struct record *r = records_at(&g_records, n);
+
+			SET_COMPLETE(n);
+
+			r->checksum = record->a;
+			r->usertime = record->b;
+			r->overflow = record->c;
+			r->mxoffset = record->d;
+			r->doneby = record->e;
+			r->clientid = 0;
+
+			/* rebuilt after the replay */
+			aggregates_touch(&g_aggregates, n);
+			break;
+		}
+		case WAL_SET_DEADLINE:
+			records_at(&g_records, n)->deadline = record->a;
+			break;
+		case WAL_SET_RANGE:
+			if (record->a > ASSIGNMENTS_NO - n) {
+				message(ERR "invalid range %" PRIu64 "+%" PRIu64 " in the log\n", n, record->a);
+				return;
+			}
+			set_assigned_range(n, record->a, record->b, record->c);
+			break;
+		default:
+			message(ERR "unknown record type %" PRIu32 " in the log\n", record->type);
+	}
 }
 
-#define TASK_SIZE 40
+void set_clientid_logged(uint64_t n, uint64_t clid)
+{
+	wal_log(WAL_SET_CLIENTID, n, clid, 0, 0, 0, 0);
 
-/* 2^32 assignments (tasks) */
-#define ASSIGNMENTS_NO (UINT64_C(1) << 32)
+	records_at(&g_records, n)->clientid = clid;
+}
 
-#define MAP_SIZE (ASSIGNMENTS_NO >> 3)
-#define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+/* the assignment returns to the pool unless it is returned or renewed until the deadline */
+uint64_t set_lease(uint64_t n, uint64_t lease_time)
+{
+	uint64_t deadline;
 
-#define IS_ASSIGNED(n) ( ( g_map_assigned[ (n)>>3 ] >> ((n)&7) ) & 1 )
-#define IS_COMPLETE(n) ( ( g_map_complete[ (n)>>3 ] >> ((n)&7) ) & 1 )
+	if (g_lease_time == 0) {
+		return 0;
+	}
 
-#define SET_ASSIGNED(n)   ( g_map_assigned[(n)>>3] |= (1<<((n)&7)) )
-#define SET_UNASSIGNED(n) ( g_map_assigned[(n)>>3] &= UCHAR_MAX ^ (1<<((n)&7)) )
-#define SET_COMPLETE(n)   ( g_map_complete[(n)>>3] |= (1<<((n)&7)) )
-#define SET_INCOMPLETE(n) ( g_map_complete[(n)>>3] &= UCHAR_MAX ^ (1<<((n)&7)) )
+	deadline = (uint64_t)time(NULL) + lease_time;
 
-uint64_t g_lowest_unassigned = 0; /* bit index, not byte */
-uint64_t g_lowest_incomplete = 0;
+	wal_log(WAL_SET_DEADLINE, n, deadline, 0, 0, 0, 0);
 
-unsigned char *g_map_assigned;
-unsigned char *g_map_complete;
-uint64_t *g_checksums;
-uint64_t *g_usertimes;
-uint64_t *g_overflows;
-uint64_t *g_clientids;
-uint64_t *g_mxoffsets;
+	records_at(&g_records, n)->deadline = deadline;
 
-int set_complete(uint64_t n)
-{
-	if (IS_COMPLETE(n)) {
-		message(INFO "assignment %" PRIu64 " was already complete (duplicate result)\n", n);
+	if (leases_push(&g_leases, deadline, n, 1) < 0) {
+		message(ERR "unable to allocate memory for the lease\n");
 	}
 
-	if (!IS_ASSIGNED(n)) {
-		message(ERR "assignment %" PRIu64 " was not assigned, discarting the result!\n", n);
-		return -1;
+	return deadline;
+}
+
+/* the result has been logged (WAL_SET_RESULT completes the task on replay) */
+void set_complete(uint64_t n)
+{
+	if (!IS_COMPLETE(n)) {
+		metrics_released(&g_metrics);
 	}
 
 	SET_COMPLETE(n);
 
 	/* advance g_lowest_incomplete pointer */
 	if (n == g_lowest_incomplete) {
-		for (; IS_COMPLETE(g_lowest_incomplete); ++g_lowest_incomplete)
-			;
+		g_lowest_incomplete = bitindex_find_zero(&g_index_complete, g_lowest_incomplete);
 	}
+}
 
-	return 0;
+/* all tasks of the shard have been handed out */
+int shard_exhausted(void)
+{
+	return g_lowest_unassigned >= g_shard_hi;
 }
 
 uint64_t get_assignment()
 {
 	uint64_t n = g_lowest_unassigned;
 
+	wal_log(WAL_SET_ASSIGNED, n, 0, 0, 0, 0, 0);
+
+	metrics_assigned(&g_metrics, (uint64_t)time(NULL), 1, 1);
+
 	SET_ASSIGNED(n);
 
+	set_lease(n, g_lease_time);
+
 	/* advance g_lowest_unassigned */
-	for (; IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-		;
+	g_lowest_unassigned = bitindex_find_zero(&g_index_assigned, g_lowest_unassigned);
 
 	return n;
 }
@@ -241,6 +304,12 @@ void unset_assignment(uint64_t n)
 		message(WARN "assignment %" PRIu64 " is already complete, invalid interrupt request!\n", n);
 	}
 
+	wal_log(WAL_SET_UNASSIGNED, n, 0, 0, 0, 0, 0);
+
+	if (IS_ASSIGNED(n) && !IS_COMPLETE(n)) {
+		metrics_released(&g_metrics);
+	}
+
 	SET_UNASSIGNED(n);
 
 	if (g_lowest_unassigned > n) {
@@ -248,24 +317,65 @@ void unset_assignment(uint64_t n)
 	}
 }
 
+/* leases up to k unassigned tasks starting at g_lowest_unassigned, returns their number */
+uint64_t get_assignment_range(uint64_t k, uint64_t clid, uint64_t *start)
+{
+	uint64_t n = g_lowest_unassigned;
+	uint64_t count = 0;
+	uint64_t deadline = g_lease_time ? (uint64_t)time(NULL) + g_lease_time : 0;
+
+	*start = n;
+
+	while (count < k && n + count < g_shard_hi && !IS_ASSIGNED(n + count)) {
+		count++;
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	wal_log(WAL_SET_RANGE, n, count, clid, deadline, 0, 0);
+
+	metrics_assigned(&g_metrics, (uint64_t)time(NULL), count, count);
+
+	set_assigned_range(n, count, clid, deadline);
+
+	if (deadline != 0 && leases_push(&g_leases, deadline, n, count) < 0) {
+		message(ERR "unable to allocate memory for the lease\n");
+	}
+
+	/* advance g_lowest_unassigned */
+	g_lowest_unassigned = bitindex_find_zero(&g_index_assigned, n + count);
+
+	return count;
+}
+
 uint64_t get_missed_assignment(int thread_id)
 {
 	uint64_t n = g_lowest_incomplete;
 	int t;
 
 	for (t = 0; t < thread_id; ++t) {
-		n++;
-		while (IS_COMPLETE(n)) {
-			n++;
-		}
+		/* skip the complete ones */
+		n = bitindex_find_zero(&g_index_complete, n + 1);
+	}
+
+	/* the shard is complete */
+	if (n >= g_shard_hi) {
+		return g_shard_hi;
 	}
 
+	wal_log(WAL_SET_ASSIGNED, n, 0, 0, 0, 0, 0);
+
+	metrics_assigned(&g_metrics, (uint64_t)time(NULL), 1, !IS_ASSIGNED(n));
+
 	SET_ASSIGNED(n);
 
+	set_lease(n, g_lease_time);
+
 	/* advance g_lowest_unassigned */
 	if (n == g_lowest_unassigned) {
-		for (; IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-			;
+		g_lowest_unassigned = bitindex_find_zero(&g_index_assigned, g_lowest_unassigned);
 	}
 
 	return n;
@@ -298,404 +408,1502 @@ void *open_map(const char *path)
 	return ptr;
 }
 
-uint64_t *open_records(const char *path)
+/* per-connection idle timeout (seconds) */
+#define CONN_TIMEOUT 10
+
+/* idle timeout of the session connections (seconds) */
+#define SESSION_TIMEOUT 900
+
+/* what the connection waits for */
+#define STATE_MESSAGE 0 /* next message (opcode and its payload) */
+#define STATE_CLID    1 /* client ID following the REQ/req response */
+
+struct conn {
+	int fd;
+	char ipv4[16];
+	time_t last_activity;
+	int state;
+	int done; /* the top-level message has been processed */
+	int events;
+	/* the assignment which waits for the client ID */
+	uint64_t pending_n;
+	int pending_lowest;
+	/* MUL request */
+	int in_mul;
+	uint64_t mul_remaining;
+	int mul_tid;
+	/* SES request, the connection stays open and the messages are framed by request IDs */
+	int session;
+	unsigned char *in;
+	size_t in_pos, in_len, in_cap;
+	unsigned char *out;
+	size_t out_pos, out_len, out_cap;
+	struct conn *prev, *next;
+};
+
+static struct conn *g_conns = NULL;
+
+uint64_t get_uint64(const unsigned char *p)
 {
-	int fd = open(path, O_RDWR | O_CREAT, 0600);
-	void *ptr;
+	uint32_t nh, nl;
 
-	if (fd < 0) {
-		perror("open");
-		abort();
-	}
+	memcpy(&nh, p + 0, 4);
+	memcpy(&nl, p + 4, 4);
 
-	if (ftruncate(fd, (off_t)RECORDS_SIZE) < 0) {
-		perror("ftruncate");
-		abort();
-	}
+	nh = ntohl(nh);
+	nl = ntohl(nl);
 
-	ptr = mmap(NULL, (size_t)RECORDS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	return ((uint64_t)nh << 32) + nl;
+}
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
-		abort();
-	}
+/* overwrites the already buffered output at the offset */
+void put_uint64_at(struct conn *c, size_t offset, uint64_t n)
+{
+	uint32_t nh = htonl((uint32_t)(n >> 32));
+	uint32_t nl = htonl((uint32_t)(n));
 
-	close(fd);
+	assert(offset + 8 <= c->out_len);
 
-	return (uint64_t *)ptr;
+	memcpy(c->out + offset + 0, &nh, 4);
+	memcpy(c->out + offset + 4, &nl, 4);
 }
 
-int read_message(int fd, int thread_id, const char *ipv4)
+int put_uint64(struct conn *c, uint64_t n)
 {
-	char protocol_version;
-	char msg[4];
+	uint32_t nh, nl;
 
-	if (read_(fd, msg, 4) < 0) {
-		return -1;
-	}
+	if (c->out_len + 8 > c->out_cap) {
+		size_t cap = c->out_cap ? 2 * c->out_cap : 4096;
+		unsigned char *out;
 
-	protocol_version = msg[3];
+		while (c->out_len + 8 > cap) {
+			cap *= 2;
+		}
 
-	/* unsupported protocol */
-	if (protocol_version > 2) {
-		message(ERR "unsupported protocol version\n");
-		return -1;
+		out = realloc(c->out, cap);
+
+		if (out == NULL) {
+			message(ERR "unable to allocate memory\n");
+			return -1;
+		}
+
+		c->out = out;
+		c->out_cap = cap;
 	}
 
-	msg[3] = 0;
+	nh = htonl((uint32_t)(n >> 32));
+	nl = htonl((uint32_t)(n));
 
-	if (strcmp(msg, "MUL") == 0) {
-		uint64_t threads;
-		int tid;
+	memcpy(c->out + c->out_len + 0, &nh, 4);
+	memcpy(c->out + c->out_len + 4, &nl, 4);
 
-		if (read_uint64(fd, &threads) < 0) {
-			message(ERR "unable to read number of threads\n");
-			return -1;
+	c->out_len += 8;
+
+	return 0;
+}
+
+void set_clientid(uint64_t n, uint64_t clid, int lowest)
+{
+	if (records_get(&g_records, n)->clientid != 0) {
+		if (lowest) {
+			message(WARN "re-assigning the assignment\n");
+		} else {
+			message(WARN "assignment %" PRIu64 " was already assigned to another client, re-assigning\n", n);
 		}
+	}
 
-		message(INFO "received multiple requests for %" PRIu64 " threads from address %s\n", threads, ipv4);
+	set_clientid_logged(n, clid);
+}
 
-		assert(threads < INT_MAX);
+/* at least k unassigned tasks are left in the shard */
+int shard_has_unassigned(uint64_t k)
+{
+	uint64_t n;
 
-		for (tid = 0; tid < (int)threads; ++tid) {
-			if (read_message(fd, tid, ipv4) < 0) {
-				message(ERR "cannot completely process the MUL request\n");
-				return -1;
-			}
-		}
-	} else if (strcmp(msg, "REQ") == 0) {
-		/* requested assignment */
-		uint64_t n;
-		uint64_t clid = 0;
+	/* jump between the free tasks, not over the assigned ones */
+	for (n = bitindex_find_zero(&g_index_assigned, g_lowest_unassigned); k > 0 && n < g_shard_hi; n = bitindex_find_zero(&g_index_assigned, n + 1)) {
+		k--;
+	}
 
-		n = get_assignment();
+	return k == 0;
+}
 
-		message(INFO "assignment requested: %" PRIu64 "\n", n);
+int handle_mrq(struct conn *c, uint64_t threads, const unsigned char *p)
+{
+	uint64_t tid;
 
-		if (write_uint64(fd, n) < 0) {
-			return -1;
-		}
+	/* response */
 
-		if (write_uint64(fd, TASK_SIZE) < 0) {
-			message(ERR "unable to write task size, update the client!\n");
-			return -1;
-		}
+	/* all tasks or none, the zero task size tells the client there are none */
+	if (!shard_has_unassigned(threads)) {
+		message(WARN "fewer than %" PRIu64 " unassigned tasks left in the shard\n", threads);
 
-		if (read_uint64(fd, &clid) < 0) {
-			message(ERR "client does not send client ID\n");
-			unset_assignment(n);
+		if (put_uint64(c, 0) < 0) {
 			return -1;
 		}
 
-		if (g_clientids[n] != 0) {
+		return 0;
+	}
+
+	/* write task_size */
+	if (put_uint64(c, TASK_SIZE) < 0) {
+		message(ERR "unable to write the task size\n");
+		return -1;
+	}
+
+	for (tid = 0; tid < threads; ++tid) {
+		uint64_t n = get_assignment();
+
+		message(INFO "assignment requested: %" PRIu64 " (MRQ)\n", n);
+
+		if (records_get(&g_records, n)->clientid != 0) {
 			message(WARN "assignment %" PRIu64 " was already assigned to another client, re-assigning\n", n);
 		}
 
-		g_clientids[n] = clid;
-	} else if (strcmp(msg, "MRQ") == 0) {
-		uint64_t threads;
-		int tid;
-		uint64_t *clientids;
-		uint64_t n;
-
-		/* request */
+		set_clientid_logged(n, get_uint64(p + 8 * tid));
 
-		if (read_uint64(fd, &threads) < 0) {
-			message(ERR "unable to read number of threads\n");
+		/* write task_id */
+		if (put_uint64(c, n) < 0) {
+			message(ERR "unable to write task ID\n");
 			return -1;
 		}
+	}
 
-		message(INFO "received multiple requests (MRQ) for %" PRIu64 " threads from address %s\n", threads, ipv4);
+	return 0;
+}
 
-		clientids = malloc(sizeof(uint64_t) * threads);
+/* returns 1 if the result has been accepted, 0 if it has been ignored, -1 on error (a broken client) */
+int return_assignment(uint64_t n, uint64_t overflow_counter, uint64_t user_time, uint64_t checksum, uint64_t clid, uint64_t mxoffset, int verbose, const char *ipv4)
+{
+	struct record *record;
 
-		if (clientids == NULL) {
-			message(ERR "unable to allocate memory\n");
-			return -1;
-		}
+	if (records_get(&g_records, n)->clientid != clid) {
+		message(WARN "assignment %" PRIu64 " was assigned to another client, ignoring the result! (done in %" PRIu64 " secs)\n", n, user_time);
+		/* this can however be part of MUL request, so do not return -1 */
+		return 0;
+	}
 
-		assert(threads < INT_MAX);
+	if (clid == 42) {
+		message(WARN "client ID is 42 :(\n");
+	}
 
-		for (tid = 0; tid < (int)threads; ++tid) {
-			if (read_uint64(fd, &clientids[tid]) < 0) {
-				message(ERR "unable to read client ID in MRQ request\n");
-				return -1;
-			}
-		}
+	if (user_time == 0 && checksum == 0) {
+		message(ERR "broken client, discarting the result!\n");
+		return -1;
+	}
+
+	if (checksum == 0) {
+		message(ERR "zero checksum is invalid! (assignment %" PRIu64 ")\n", n);
+		return -1;
+	}
 
-		/* response */
+	if ((checksum>>23) != 196126 &&
+	    (checksum>>24) != 0xa0ed &&
+	    (checksum>>24) != 0x4cfe &&
+	    (checksum>>24) != 0x3354 &&
+	    (checksum>>28) != 0x83b  &&
+	    (checksum>>24) != 0x2a27 &&
+	    (checksum>>24) != 0x5ae2 &&
+	    (checksum>>24) != 0x5ae1 &&
+	    (checksum>>24) != 0x3c96 &&
+	    (checksum>>28) != 0x1ac  && /* 2^34 h-e-sieve 3^2 */
+	    (checksum>>24) != 0x3238 && /* 2^24 h-e-sieve 3^1 */
+	    (checksum>>24) != 0x1785 && /* 2^34 h2-e-sieve 3^2 */
+	    (checksum>>24) != 0x2e0e && /* 2^24 h2-e-sieve 3^1 */
+	    (checksum>>24) != 0x2e0f && /* 2^24 h2-e-sieve 3^1 */
+	    (checksum>>24) != 0x27d8 &&
+	    (checksum>>24) != 0x2134) {
+		message(ERR "suspicious checksum (%" PRIu64 ", 0x%" PRIx64 "), done in %" PRIu64 " secs, rejecting the result! (assignment %" PRIu64 ")\n",
+			checksum, checksum, user_time, n);
+		unset_assignment(n);
+		return 0;
+	}
 
-		/* write task_size */
-		if (write_uint64(fd, TASK_SIZE) < 0) {
-			message(ERR "unable to write the task size\n");
-			return -1;
+	if (verbose) {
+		message(INFO "assignment returned: %" PRIu64 " (%" PRIu64 " overflows, time %" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ", checksum 0x%016" PRIx64 ")\n",
+			n, overflow_counter, user_time/60/60, user_time/60%60, user_time%60, checksum);
+	}
+
+	if (IS_COMPLETE(n)) {
+		message(INFO "assignment %" PRIu64 " was already complete (duplicate result)\n", n);
+	}
+
+	if (!IS_ASSIGNED(n)) {
+		message(ERR "assignment %" PRIu64 " was not assigned, discarting the result!\n", n);
+		message(ERR "result rejected!\n");
+		/* this can however be part of MUL request, so do not return -1 */
+		return 0;
+	}
+
+	metrics_completed(&g_metrics, (uint64_t)time(NULL), user_time, overflow_counter, ipv4);
+
+	record = records_at(&g_records, n);
+
+	if (record->checksum != 0 && record->checksum != checksum) {
+		message(ERR "checksums do not match! (the other checksum was %" PRIu64 ", 0x%016" PRIx64 ")\n", record->checksum, record->checksum);
+	}
+
+	if (record->mxoffset != 0 && record->mxoffset != mxoffset) {
+		message(ERR "mxoffsets do not match! (the other mxoffset was +%" PRIu64 ")\n", record->mxoffset);
+	}
+
+	/* the completion, the result and its client at once; the client is remembered for the audits */
+	wal_log(WAL_SET_RESULT, n, checksum, user_time, overflow_counter, mxoffset, clid);
+
+	set_complete(n);
+
+	aggregate_add(aggregates_at(&g_aggregates, n), record->checksum, record->usertime, record->overflow, record->mxoffset, -1);
+
+	record->checksum = checksum;
+
+	record->usertime = user_time;
+
+	record->overflow = overflow_counter;
+
+	record->mxoffset = mxoffset;
+
+	aggregate_add(aggregates_at(&g_aggregates, n), checksum, user_time, overflow_counter, mxoffset, +1);
+
+	/* the assignment is no longer the client's */
+	record->doneby = clid;
+	record->clientid = 0;
+
+	return 1;
+}
+
+int handle_ret(int protocol_version, const unsigned char *p, const char *ipv4)
+{
+	/* returning assignment */
+	uint64_t n = get_uint64(p + 0);
+	uint64_t task_size = get_uint64(p + 8);
+	uint64_t overflow_counter = get_uint64(p + 16);
+	uint64_t user_time = get_uint64(p + 24);
+	uint64_t checksum = get_uint64(p + 32);
+	uint64_t clid = get_uint64(p + 40);
+	uint64_t mxoffset = 0;
+	uint64_t cycleoff = 0;
+
+	if (protocol_version > 0) {
+		mxoffset = get_uint64(p + 48);
+	}
+
+	if (protocol_version > 1) {
+		cycleoff = get_uint64(p + 56);
+	}
+
+	(void)cycleoff;
+
+	if (task_size != TASK_SIZE) {
+		message(ERR "TASK_SIZE mismatch! (client sent %" PRIu64 ")\n", task_size);
+		return -1;
+	}
+
+	if (!IN_SHARD(n)) {
+		message(ERR "assignment %" PRIu64 " is out of range!\n", n);
+		return -1;
+	}
+
+	return return_assignment(n, overflow_counter, user_time, checksum, clid, mxoffset, 1, ipv4) < 0 ? -1 : 0;
+}
+
+int handle_rrq(struct conn *c, const unsigned char *p)
+{
+	uint64_t k = get_uint64(p + 0);
+	uint64_t clid = get_uint64(p + 8);
+	uint64_t start;
+	uint64_t count;
+
+	if (k == 0 || k > RANGE_MAX) {
+		message(ERR "invalid range size %" PRIu64 "\n", k);
+		return -1;
+	}
+
+	count = get_assignment_range(k, clid, &start);
+
+	message(INFO "assignments requested: %" PRIu64 "+%" PRIu64 " (range of %" PRIu64 ")\n", start, count, k);
+
+	if (put_uint64(c, TASK_SIZE) < 0 || put_uint64(c, start) < 0 || put_uint64(c, count) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the results of the tasks [n, n + count) */
+int handle_rrt(const unsigned char *p, const char *ipv4)
+{
+	uint64_t n = get_uint64(p + 0);
+	uint64_t count = get_uint64(p + 8);
+	uint64_t task_size = get_uint64(p + 16);
+	uint64_t clid = get_uint64(p + 24);
+	uint64_t i;
+	uint64_t accepted = 0;
+
+	if (task_size != TASK_SIZE) {
+		message(ERR "TASK_SIZE mismatch! (client sent %" PRIu64 ")\n", task_size);
+		return -1;
+	}
+
+	if (!IN_SHARD(n) || count > g_shard_hi - n) {
+		message(ERR "assignments %" PRIu64 "+%" PRIu64 " are out of range!\n", n, count);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		const unsigned char *q = p + 32 + 32 * i;
+		int r = return_assignment(n + i, get_uint64(q + 0), get_uint64(q + 8), get_uint64(q + 16), clid, get_uint64(q + 24), 0, ipv4);
+
+		if (r < 0) {
+			return -1;
+		}
+
+		accepted += (uint64_t)r;
+	}
+
+	message(INFO "assignments returned: %" PRIu64 "+%" PRIu64 " (%" PRIu64 " accepted)\n", n, count, accepted);
+
+	return 0;
+}
+
+int handle_int(const unsigned char *p)
+{
+	/* interrupted or unable to solve, unreserve the assignment */
+	uint64_t n = get_uint64(p + 0);
+	uint64_t task_size = get_uint64(p + 8);
+	uint64_t clid = get_uint64(p + 16);
+
+	if (!IN_SHARD(n)) {
+		message(ERR "assignment %" PRIu64 " is out of range!\n", n);
+		return -1;
+	}
+
+	if (records_get(&g_records, n)->clientid != clid) {
+		message(WARN "invalid request, assignment was assigned to another client, ignoring the request!\n");
+		/* this can be part of MUL request, so do not return -1 */
+		return 0;
+	}
+
+	if (task_size != TASK_SIZE) {
+		message(ERR "TASK_SIZE mismatch!\n");
+		return -1;
+	}
+
+	message(INFO "assignment interrupted: %" PRIu64 "\n", n);
+
+	unset_assignment(n);
+
+	set_clientid_logged(n, 0);
+
+	return 0;
+}
+
+/* returns the new deadline, or zero if the client does not hold the lease */
+uint64_t handle_lrn(int protocol_version, const unsigned char *p)
+{
+	uint64_t n = get_uint64(p + 0);
+	uint64_t task_size = get_uint64(p + 8);
+	uint64_t clid = get_uint64(p + 16);
+	/* the client may ask for a shorter lease, from its own estimate of the task time */
+	uint64_t lease_time = protocol_version > 0 ? get_uint64(p + 24) : 0;
+
+	if (lease_time == 0 || lease_time > g_lease_time) {
+		lease_time = g_lease_time;
+	} else if (lease_time < LEASE_TIME_MIN) {
+		lease_time = LEASE_TIME_MIN < g_lease_time ? LEASE_TIME_MIN : g_lease_time;
+	}
+
+	if (!IN_SHARD(n) || task_size != TASK_SIZE) {
+		message(ERR "invalid lease renewal request!\n");
+		return 0;
+	}
+
+	if (!IS_ASSIGNED(n) || IS_COMPLETE(n) || records_get(&g_records, n)->clientid != clid) {
+		message(WARN "lease of the assignment %" PRIu64 " is not held by the client, not renewing\n", n);
+		return 0;
+	}
+
+	return set_lease(n, lease_time);
+}
+
+/* the live counters, see PROTOCOL.md */
+int handle_sta(struct conn *c)
+{
+	uint64_t now = (uint64_t)time(NULL);
+	uint64_t words[9 + 2 * METRICS_TOP];
+	int top;
+	int i;
+
+	words[0] = now - g_metrics.start;
+	words[1] = metrics_sum(&g_metrics, g_metrics.assigned, now);
+	words[2] = metrics_sum(&g_metrics, g_metrics.completed, now);
+	words[3] = metrics_sum(&g_metrics, g_metrics.overflows, now);
+	words[4] = g_metrics.active;
+	words[5] = metrics_median_usertime(&g_metrics);
+	words[6] = g_lowest_incomplete;
+	words[7] = g_lowest_unassigned;
+	words[8] = g_metrics.clients_n;
+
+	top = metrics_top_clients(&g_metrics, now, words + 9);
+
+	if (put_uint64(c, (uint64_t)(9 + 2 * top)) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < 9 + 2 * top; ++i) {
+		if (put_uint64(c, words[i]) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* the top-level message (or one of the MUL sub-requests) has been processed */
+void message_done(struct conn *c)
+{
+	if (c->in_mul) {
+		c->mul_remaining--;
+		c->mul_tid++;
+
+		if (c->mul_remaining == 0) {
+			c->done = 1;
+		}
+	} else {
+		c->done = 1;
+	}
+}
+
+/* returns 1 and the length of the message when it is completely buffered, 0 if more data is needed, -1 on error */
+int get_message_length(const unsigned char *p, size_t avail, size_t *len)
+{
+	char msg[4];
+	int protocol_version;
+
+	if (avail < 4) {
+		return 0;
+	}
+
+	memcpy(msg, p, 4);
+
+	protocol_version = msg[3];
+
+	/* unsupported protocol */
+	if (protocol_version > 2) {
+		message(ERR "unsupported protocol version\n");
+		return -1;
+	}
+
+	msg[3] = 0;
+
+	if (strcmp(msg, "MUL") == 0) {
+		*len = 4 + 8;
+	} else if (strcmp(msg, "REQ") == 0 || strcmp(msg, "req") == 0) {
+		/* the client ID comes after the response */
+		*len = 4;
+	} else if (strcmp(msg, "MRQ") == 0) {
+		uint64_t threads;
+
+		if (avail < 4 + 8) {
+			return 0;
+		}
+
+		threads = get_uint64(p + 4);
+
+		if (threads > THREADS_MAX) {
+			message(ERR "too many threads in MRQ request (%" PRIu64 ")\n", threads);
+			return -1;
+		}
+
+		*len = 4 + 8 + 8 * (size_t)threads;
+	} else if (strcmp(msg, "RET") == 0) {
+		*len = 4 + 8 * (6 + protocol_version);
+	} else if (strcmp(msg, "INT") == 0) {
+		*len = 4 + 8 * 3;
+	} else if (strcmp(msg, "LRN") == 0) {
+		if (protocol_version > 1) {
+			message(ERR "unsupported protocol version of LRN\n");
+			return -1;
+		}
+
+		*len = 4 + 8 * (3 + protocol_version);
+	} else if (strcmp(msg, "RRQ") == 0) {
+		*len = 4 + 8 * 2;
+	} else if (strcmp(msg, "RRT") == 0) {
+		uint64_t count;
+
+		if (avail < 4 + 8 * 4) {
+			return 0;
+		}
+
+		count = get_uint64(p + 4 + 8);
+
+		if (count > RANGE_MAX) {
+			message(ERR "too many results in RRT request\n");
+			return -1;
+		}
+
+		*len = 4 + 8 * 4 + 8 * 4 * (size_t)count;
+	} else if (strcmp(msg, "LOI") == 0 || strcmp(msg, "HIR") == 0 || strcmp(msg, "PNG") == 0 || strcmp(msg, "SES") == 0 || strcmp(msg, "STA") == 0 || strcmp(msg, "SHD") == 0) {
+		*len = 4;
+	} else {
+		message(ERR "%s: unknown client message!\n", msg);
+		return -1;
+	}
+
+	return avail >= *len;
+}
+
+/* p points to the completely buffered message */
+int handle_message(struct conn *c, const unsigned char *p)
+{
+	char msg[4];
+	int protocol_version;
+	int thread_id = c->in_mul ? c->mul_tid : 0;
+
+	memcpy(msg, p, 4);
+
+	protocol_version = msg[3];
+
+	msg[3] = 0;
+
+	if (strcmp(msg, "MUL") == 0) {
+		uint64_t threads = get_uint64(p + 4);
+
+		if (c->in_mul) {
+			message(ERR "nested MUL requests are not supported\n");
+			return -1;
+		}
+
+		message(INFO "received multiple requests for %" PRIu64 " threads from address %s\n", threads, c->ipv4);
+
+		if (threads > THREADS_MAX) {
+			message(ERR "too many threads in MUL request\n");
+			return -1;
+		}
+
+		c->in_mul = 1;
+		c->mul_remaining = threads;
+		c->mul_tid = 0;
+
+		if (threads == 0) {
+			c->done = 1;
+		}
+
+		return 0;
+	} else if (strcmp(msg, "SES") == 0) {
+		if (c->in_mul) {
+			message(ERR "SES request within MUL request\n");
+			return -1;
+		}
+
+		message(INFO "session opened from address %s\n", c->ipv4);
+
+		c->session = 1;
+
+		/* acknowledge, the older servers close the connection instead */
+		if (put_uint64(c, 1) < 0) {
+			return -1;
+		}
+
+		/* the session is never done */
+		return 0;
+	} else if (strcmp(msg, "REQ") == 0) {
+		/* requested assignment */
+		uint64_t n;
+
+		if (shard_exhausted()) {
+			message(WARN "no unassigned tasks left in the shard\n");
+			return -1;
+		}
+
+		n = get_assignment();
+
+		message(INFO "assignment requested: %" PRIu64 "\n", n);
+
+		c->pending_n = n;
+		c->pending_lowest = 0;
+		c->state = STATE_CLID;
+
+		if (put_uint64(c, n) < 0) {
+			return -1;
+		}
+
+		if (put_uint64(c, TASK_SIZE) < 0) {
+			message(ERR "unable to write task size, update the client!\n");
+			return -1;
+		}
+
+		/* the message is not done until the client ID arrives */
+		return 0;
+	} else if (strcmp(msg, "req") == 0) {
+		/* requested lowest incomplete assignment */
+		uint64_t n;
+
+		n = get_missed_assignment(thread_id);
+
+		if (n >= g_shard_hi) {
+			message(WARN "no incomplete tasks left in the shard\n");
+			return -1;
+		}
+
+		message(INFO "assignment requested: %" PRIu64 " (lowest incomplete +%i)\n", n, thread_id);
+
+		c->pending_n = n;
+		c->pending_lowest = 1;
+		c->state = STATE_CLID;
+
+		if (put_uint64(c, n) < 0) {
+			return -1;
+		}
+
+		if (put_uint64(c, TASK_SIZE) < 0) {
+			message(ERR "unable to write task size, update the client!\n");
+			return -1;
+		}
+
+		return 0;
+	} else if (strcmp(msg, "MRQ") == 0) {
+		uint64_t threads = get_uint64(p + 4);
+
+		message(INFO "received multiple requests (MRQ) for %" PRIu64 " threads from address %s\n", threads, c->ipv4);
+
+		if (handle_mrq(c, threads, p + 12) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "RET") == 0) {
+		if (handle_ret(protocol_version, p + 4, c->ipv4) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "INT") == 0) {
+		if (handle_int(p + 4) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "RRQ") == 0) {
+		if (handle_rrq(c, p + 4) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "RRT") == 0) {
+		if (handle_rrt(p + 4, c->ipv4) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "LRN") == 0) {
+		if (put_uint64(c, handle_lrn(protocol_version, p + 4)) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "LOI") == 0) {
+		if (put_uint64(c, g_lowest_incomplete) < 0) {
+			return -1;
+		}
+
+		if (put_uint64(c, TASK_SIZE) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "HIR") == 0) {
+		if (put_uint64(c, g_lowest_unassigned) < 0) {
+			return -1;
+		}
+
+		if (put_uint64(c, TASK_SIZE) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "PNG") == 0) {
+		if (put_uint64(c, 0) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "STA") == 0) {
+		if (handle_sta(c) < 0) {
+			return -1;
+		}
+	} else if (strcmp(msg, "SHD") == 0) {
+		if (put_uint64(c, g_shard_lo) < 0) {
+			return -1;
+		}
+
+		if (put_uint64(c, g_shard_hi) < 0) {
+			return -1;
+		}
+	} else {
+		message(ERR "%s: unknown client message!\n", msg);
+		return -1;
+	}
+
+	message_done(c);
+
+	return 0;
+}
+
+/* processes everything that is completely buffered */
+int process_input(struct conn *c)
+{
+	while (!c->done) {
+		const unsigned char *p = c->in + c->in_pos;
+		size_t avail = c->in_len - c->in_pos;
+		size_t len;
+		int r;
+
+		if (c->state == STATE_CLID) {
+			if (avail < 8) {
+				break;
+			}
+
+			set_clientid(c->pending_n, get_uint64(p), c->pending_lowest);
+
+			c->in_pos += 8;
+			c->state = STATE_MESSAGE;
+
+			message_done(c);
+
+			continue;
+		}
+
+		if (c->session) {
+			uint64_t id;
+			size_t header;
+
+			/* [request ID][message] */
+			if (avail < 8 + 4) {
+				break;
+			}
+
+			/* these need the response to be read before the rest is sent */
+			if (memcmp(p + 8, "REQ", 3) == 0 || memcmp(p + 8, "req", 3) == 0 || memcmp(p + 8, "MUL", 3) == 0 || memcmp(p + 8, "SES", 3) == 0) {
+				message(ERR "%.3s request is not allowed in the session\n", (const char *)p + 8);
+				return -1;
+			}
+
+			r = get_message_length(p + 8, avail - 8, &len);
+
+			if (r < 0) {
+				return -1;
+			}
+
+			if (r == 0) {
+				break;
+			}
+
+			id = get_uint64(p);
+
+			/* [request ID][number of words][response], the number is filled in below */
+			header = c->out_len;
+
+			if (put_uint64(c, id) < 0 || put_uint64(c, 0) < 0) {
+				return -1;
+			}
+
+			if (handle_message(c, p + 8) < 0) {
+				return -1;
+			}
+
+			put_uint64_at(c, header + 8, (uint64_t)(c->out_len - header - 16) / 8);
+
+			c->done = 0;
+			c->in_pos += 8 + len;
+
+			continue;
+		}
+
+		r = get_message_length(p, avail, &len);
+
+		if (r < 0) {
+			if (c->in_mul) {
+				message(ERR "cannot completely process the MUL request\n");
+			}
+			return -1;
+		}
+
+		if (r == 0) {
+			break;
+		}
+
+		if (handle_message(c, p) < 0) {
+			if (c->in_mul) {
+				message(ERR "cannot completely process the MUL request\n");
+			}
+			return -1;
+		}
+
+		c->in_pos += len;
+	}
+
+	/* compact the input buffer */
+	if (c->in_pos > 0) {
+		memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+		c->in_len -= c->in_pos;
+		c->in_pos = 0;
+	}
+
+	return 0;
+}
+
+/* returns -1 on error, 1 on end of file, 0 otherwise */
+int conn_read(struct conn *c)
+{
+	while (1) {
+		ssize_t t;
+
+		if (c->in_cap - c->in_len < 4096) {
+			size_t cap = c->in_cap ? 2 * c->in_cap : 4096;
+			unsigned char *in = realloc(c->in, cap);
+
+			if (in == NULL) {
+				message(ERR "unable to allocate memory\n");
+				return -1;
+			}
+
+			c->in = in;
+			c->in_cap = cap;
+		}
+
+		t = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+
+		if (t < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return -1;
+		}
+
+		if (t == 0) {
+			/* zero indicates end of file */
+			return 1;
+		}
+
+		c->in_len += (size_t)t;
+	}
+}
+
+/* returns -1 on error, 0 otherwise */
+int conn_write(struct conn *c)
+{
+	while (c->out_pos < c->out_len) {
+		ssize_t t = write(c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+
+		if (t < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return -1;
+		}
+
+		c->out_pos += (size_t)t;
+	}
+
+	c->out_pos = 0;
+	c->out_len = 0;
+
+	return 0;
+}
+
+struct conn *conn_open(int cl_fd, const char *ipv4)
+{
+	struct conn *c = malloc(sizeof(struct conn));
+
+	if (c == NULL) {
+		return NULL;
+	}
+
+	memset(c, 0, sizeof(struct conn));
+
+	c->fd = cl_fd;
+	strncpy(c->ipv4, ipv4, sizeof(c->ipv4) - 1);
+	c->last_activity = time(NULL);
+	c->state = STATE_MESSAGE;
+
+	c->next = g_conns;
+	if (g_conns != NULL) {
+		g_conns->prev = c;
+	}
+	g_conns = c;
+
+	return c;
+}
+
+void conn_close(struct conn *c)
+{
+	if (c->state == STATE_CLID && !c->pending_lowest) {
+		message(ERR "client does not send client ID\n");
+		unset_assignment(c->pending_n);
+	}
+
+	close(c->fd);
+
+	if (c->prev != NULL) {
+		c->prev->next = c->next;
+	} else {
+		g_conns = c->next;
+	}
+	if (c->next != NULL) {
+		c->next->prev = c->prev;
+	}
+
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+/* waits for input, or for output if there is something pending */
+int conn_update_events(int epfd, struct conn *c)
+{
+	struct epoll_event ev;
+	int events = (c->out_len > c->out_pos) ? EPOLLOUT : EPOLLIN;
+
+	if (events == c->events) {
+		return 0;
+	}
+
+	ev.events = events;
+	ev.data.ptr = c;
+
+	if (epoll_ctl(epfd, c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+
+	c->events = events;
+
+	return 0;
+}
+
+/* returns -1 if the connection should be closed, 1 if it is finished, 0 otherwise */
+int conn_handle(struct conn *c, uint32_t events)
+{
+	int eof = 0;
+
+	c->last_activity = time(NULL);
+
+	if (events & EPOLLIN) {
+		int r = conn_read(c);
+
+		if (r < 0) {
+			return -1;
+		}
+
+		eof = r;
+
+		if (process_input(c) < 0) {
+			return -1;
+		}
+	}
+
+	if (conn_write(c) < 0) {
+		return -1;
+	}
+
+	if (c->done && c->out_len == 0) {
+		return 1;
+	}
+
+	/* the client has closed the session between the messages */
+	if (eof && c->session && c->in_len == 0 && c->out_len == 0) {
+		return 1;
+	}
+
+	if (eof || (events & (EPOLLERR | EPOLLHUP))) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void accept_connections(int epfd)
+{
+	while (1) {
+		struct sockaddr_in sockaddr_in;
+		socklen_t sockaddr_len = sizeof sockaddr_in;
+		int cl_fd = accept(fd, (struct sockaddr *)&sockaddr_in, &sockaddr_len);
+		const char *ipv4 = "(unknown)";
+		struct conn *c;
+
+		if (-1 == cl_fd) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK && !quit) {
+				message(ERR "cannot accept a connection on a socket!\n");
+			}
+
+			return;
+		}
+
+		if (fcntl(cl_fd, F_SETFL, fcntl(cl_fd, F_GETFL) | O_NONBLOCK) < 0) {
+			perror("fcntl");
+			close(cl_fd);
+			continue;
+		}
+
+		if (sockaddr_len >= sizeof sockaddr_in && sockaddr_in.sin_family == AF_INET) {
+			ipv4 = inet_ntoa(sockaddr_in.sin_addr);
+		}
+
+		c = conn_open(cl_fd, ipv4);
+
+		if (c == NULL) {
+			message(ERR "unable to allocate memory\n");
+			close(cl_fd);
+			continue;
+		}
+
+		if (conn_update_events(epfd, c) < 0) {
+			conn_close(c);
+		}
+	}
+}
+
+/* closes the connections idle for more than CONN_TIMEOUT seconds */
+void expire_connections(time_t now)
+{
+	struct conn *c = g_conns;
+
+	while (c != NULL) {
+		struct conn *next = c->next;
+
+		if (now - c->last_activity > (c->session ? SESSION_TIMEOUT : CONN_TIMEOUT)) {
+			/* an idle session is normal, a stalled request less so, neither is an error */
+			if (c->session) {
+				message(INFO "session from %s timed out\n", c->ipv4);
+			} else {
+				message(WARN "connection from %s timed out\n", c->ipv4);
+			}
+			conn_close(c);
+		}
+
+		c = next;
+	}
+}
+
+/* returns the assignments with the expired leases into the pool */
+void expire_leases(uint64_t now)
+{
+	while (g_leases.size > 0 && leases_top(&g_leases)->deadline <= now) {
+		struct lease lease = leases_pop(&g_leases);
+		uint64_t n;
+		uint64_t expired = 0;
+
+		for (n = lease.n; n < lease.n + lease.count; ++n) {
+			const struct record *record = records_get(&g_records, n);
+
+			/* returned, interrupted or renewed in the meantime */
+			if (record->deadline != lease.deadline || !IS_ASSIGNED(n) || IS_COMPLETE(n)) {
+				continue;
+			}
+
+			if (lease.count == 1) {
+				message(WARN "lease of the assignment %" PRIu64 " expired (client ID 0x%016" PRIx64 ")\n", n, record->clientid);
+			}
+
+			unset_assignment(n);
+
+			set_clientid_logged(n, 0);
+
+			expired++;
+		}
+
+		if (lease.count > 1 && expired > 0) {
+			message(WARN "lease of the assignments %" PRIu64 "+%" PRIu64 " expired (%" PRIu64 " tasks)\n", lease.n, lease.count, expired);
+		}
+	}
+}
+
+/* assigned, but not complete */
+uint64_t count_active_assignments(void)
+{
+	uint64_t w;
+	uint64_t count = 0;
+
+	for (w = g_lowest_incomplete >> 6; w < g_index_assigned.nwords[0]; ++w) {
+		count += popcountu64(g_index_assigned.words[0][w] & ~g_index_complete.words[0][w]);
+	}
+
+	return count;
+}
+
+/* builds the lease queue, the assignments without a deadline get a new lease */
+void load_leases(void)
+{
+	uint64_t w;
+	uint64_t now = (uint64_t)time(NULL);
+	uint64_t count = 0;
+
+	for (w = g_lowest_incomplete >> 6; w < g_index_assigned.nwords[0]; ++w) {
+		uint64_t mask = g_index_assigned.words[0][w] & ~g_index_complete.words[0][w];
+
+		for (; mask != 0; mask &= mask - 1) {
+			uint64_t n = (w << 6) + ctzu64(mask);
+			struct record *record = records_at(&g_records, n);
+
+			if (record->deadline == 0) {
+				record->deadline = now + g_lease_time;
+			}
+
+			if (leases_push(&g_leases, record->deadline, n, 1) < 0) {
+				message(ERR "unable to allocate memory for the lease\n");
+				abort();
+			}
+
+			count++;
+		}
+	}
+
+	message(INFO "loaded %" PRIu64 " leases\n", count);
+}
+
+void set_incomplete_superblock(uint64_t sb)
+{
+	uint64_t n;
+	uint64_t c = 0;
+
+	for (n = 0; n < (sb + 1) << 20; ++n) {
+		uint64_t checksum;
+
+		assert(n < ASSIGNMENTS_NO);
+
+		checksum = records_get(&g_records, n)->checksum;
+
+		if (!checksum) {
+#if 0
+			printf("- resetting the assignment %" PRIu64 " due to user request\n", n);
+#endif
+#if 1
+			SET_UNASSIGNED(n);
+			SET_INCOMPLETE(n);
+#endif
+			c++;
+		}
+	}
+
+	message(WARN "reset %" PRIu64 " assignments (superblock %" PRIu64 ")\n", c, sb);
+}
+
+/* makes the mmapped files durable, the log is no longer needed then */
+void checkpoint(void)
+{
+	if (wal_commit(&g_wal) < 0) {
+		message(ERR "unable to commit the log!\n");
+	}
+
+	msync(g_map_assigned, MAP_SIZE, MS_SYNC);
+	msync(g_map_complete, MAP_SIZE, MS_SYNC);
+	records_sync(&g_records);
+	aggregates_sync(&g_aggregates);
+
+	if (g_wal.fd >= 0 && wal_truncate(&g_wal) < 0) {
+		message(ERR "unable to truncate the log!\n");
+	}
+}
+
+/*
+ * The maintenance passes below run over the superblocks in parallel. Only
+ * the superblocks present in the record store are visited, and only the
+ * parts of their files that are not holes. The records are tested in blocks
+ * of 64 (one word of the maps), the block is skipped if no task matches.
+ * The changes of the maps are rare, so these are serialized.
+ */
+void report_pass_progress(const char *name, uint64_t *done, uint64_t total)
+{
+	#pragma omp critical(pass)
+	{
+		++*done;
+
+		/* every 10 % */
+		if (*done * 10 / total != (*done - 1) * 10 / total) {
+			message(INFO "%s: %" PRIu64 "/%" PRIu64 " superblocks\n", name, *done, total);
+		}
+	}
+}
+
+uint64_t select_overflow(const struct record *r)
+{
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < 64; ++i) {
+		mask |= (uint64_t)(r[i].overflow != 0) << i;
+	}
+
+	return mask;
+}
+
+uint64_t select_incomplete_record(const struct record *r)
+{
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < 64; ++i) {
+		mask |= (uint64_t)(r[i].checksum != 0 && (r[i].usertime == 0 || r[i].mxoffset == 0)) << i;
+	}
+
+	return mask;
+}
+
+uint64_t select_invalid_time(const struct record *r)
+{
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < 64; ++i) {
+		mask |= (uint64_t)(r[i].usertime > 60 * 60) << i;
+	}
+
+	return mask;
+}
+
+/* resets the assignments selected by the function, returns their number */
+uint64_t invalidate_records(const char *reason, uint64_t (*select)(const struct record *))
+{
+	uint64_t c;
+	uint64_t count = 0;
+	uint64_t done = 0;
+	uint64_t total = 0;
+
+	for (c = 0; c < g_records.end; ++c) {
+		total += records_present(&g_records, c);
+	}
+
+	#pragma omp parallel for schedule(dynamic) reduction(+:count)
+	for (c = 0; c < g_records.end; ++c) {
+		uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
+		uint64_t n = c << RECORDS_CHUNK_LOG2;
+		int fd;
+
+		if (!records_present(&g_records, c)) {
+			continue;
 		}
 
-		for (tid = 0; tid < (int)threads; ++tid) {
-			n = get_assignment();
+		fd = records_chunk_fd(&g_records, c);
 
-			message(INFO "assignment requested: %" PRIu64 " (MRQ)\n", n);
+		while ((n = records_seek(fd, c, n, SEEK_DATA)) < end) {
+			uint64_t e = records_seek(fd, c, n, SEEK_HOLE);
 
-			if (g_clientids[n] != 0) {
-				message(WARN "assignment %" PRIu64 " was already assigned to another client, re-assigning\n", n);
-			}
+			for (; n < e; n += 64) {
+				uint64_t mask = select(records_get(&g_records, n));
 
-			g_clientids[n] = clientids[tid];
+				if (mask == 0) {
+					continue;
+				}
 
-			/* write task_id */
-			if (write_uint64(fd, n) < 0) {
-				message(ERR "unable to write task ID\n");
-				return -1;
-			}
-		}
+				#pragma omp critical(pass)
+				while (mask != 0) {
+					uint64_t m = n + ctzu64(mask);
 
-		free(clientids);
-	} else if (strcmp(msg, "RET") == 0) {
-		/* returning assignment */
-		uint64_t n;
-		uint64_t task_size = 0;
-		uint64_t overflow_counter = 0;
-		uint64_t user_time = 0;
-		uint64_t checksum = 0;
-		uint64_t clid = 0;
-		uint64_t mxoffset = 0;
-		uint64_t cycleoff = 0;
+					printf("- resetting the assignment %" PRIu64 " due to %s\n", m, reason);
 
-		if (read_uint64(fd, &n) < 0) {
-			return -1;
-		}
+					SET_UNASSIGNED(m);
+					SET_INCOMPLETE(m);
 
-		if (read_uint64(fd, &task_size) < 0) {
-			message(ERR "unable to read task size, update the client!\n");
-			return -1;
-		}
+					count++;
 
-		if (task_size != TASK_SIZE) {
-			message(ERR "TASK_SIZE mismatch! (client sent %" PRIu64 ")\n", task_size);
-			return -1;
+					mask &= mask - 1;
+				}
+			}
 		}
 
-		if (read_uint64(fd, &overflow_counter) < 0) {
-			message(ERR "client does not send the overflow counter!\n");
-			return -1;
+		if (fd >= 0) {
+			close(fd);
 		}
 
-		if (read_uint64(fd, &user_time) < 0) {
-			message(ERR "client does not send the user time!\n");
-			return -1;
-		}
+		report_pass_progress(reason, &done, total);
+	}
 
-		if (read_uint64(fd, &checksum) < 0) {
-			message(ERR "client does not send the check sum!\n");
-			return -1;
-		}
+	return count;
+}
 
-		if (read_uint64(fd, &clid) < 0) {
-			message(ERR "client does not send client ID\n");
-			return -1;
-		}
+/* recomputes the aggregates of all present superblocks, or of those touched by the log */
+void rebuild_aggregates(int all)
+{
+	uint64_t c;
+	uint64_t done = 0;
+	uint64_t total = 0;
 
-		if (protocol_version > 0) {
-			if (read_uint64(fd, &mxoffset) < 0) {
-				message(ERR "client does not send maximum value offset\n");
-				return -1;
-			}
-		}
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		/* the absent superblocks are merely cleared */
+		if (all && !records_present(&g_records, c)) {
+			struct aggregate a;
 
-		if (protocol_version > 1) {
-			if (read_uint64(fd, &cycleoff) < 0) {
-				message(ERR "client does not send maximum cycle offset\n");
-				return -1;
-			}
-		}
+			memset(&a, 0, sizeof(struct aggregate));
 
-		if (g_clientids[n] != clid) {
-			message(WARN "assignment %" PRIu64 " was assigned to another client, ignoring the result! (done in %" PRIu64 " secs)\n", n, user_time);
-			/* this can however be part of MUL request, so do not return -1 */
-			return 0;
+			aggregates_set(&g_aggregates, c, &a);
+			continue;
 		}
 
-		if (clid == 42) {
-			message(WARN "client ID is 42 :(\n");
-		}
+		total += all || aggregates_dirty(&g_aggregates, c);
+	}
 
-		if (user_time == 0 && checksum == 0) {
-			message(ERR "broken client, discarting the result!\n");
-			return -1;
-		}
+	if (total == 0) {
+		return;
+	}
 
-		if (checksum == 0) {
-			message(ERR "zero checksum is invalid! (assignment %" PRIu64 ")\n", n);
-			return -1;
-		}
+	message(INFO "rebuilding the aggregates of %" PRIu64 " superblocks...\n", total);
 
-		if ((checksum>>23) != 196126 &&
-		    (checksum>>24) != 0xa0ed &&
-		    (checksum>>24) != 0x4cfe &&
-		    (checksum>>24) != 0x3354 &&
-		    (checksum>>28) != 0x83b  &&
-		    (checksum>>24) != 0x2a27 &&
-		    (checksum>>24) != 0x5ae2 &&
-		    (checksum>>24) != 0x5ae1 &&
-		    (checksum>>24) != 0x3c96 &&
-		    (checksum>>28) != 0x1ac  && /* 2^34 h-e-sieve 3^2 */
-		    (checksum>>24) != 0x3238 && /* 2^24 h-e-sieve 3^1 */
-		    (checksum>>24) != 0x1785 && /* 2^34 h2-e-sieve 3^2 */
-		    (checksum>>24) != 0x2e0e && /* 2^24 h2-e-sieve 3^1 */
-		    (checksum>>24) != 0x2e0f && /* 2^24 h2-e-sieve 3^1 */
-		    (checksum>>24) != 0x27d8 &&
-		    (checksum>>24) != 0x2134) {
-			message(ERR "suspicious checksum (%" PRIu64 ", 0x%" PRIx64 "), done in %" PRIu64 " secs, rejecting the result! (assignment %" PRIu64 ")\n",
-				checksum, checksum, user_time, n);
-			unset_assignment(n);
-			goto end_of_ret;
+	#pragma omp parallel for schedule(dynamic)
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		struct aggregate a;
+
+		if (all ? !records_present(&g_records, c) : !aggregates_dirty(&g_aggregates, c)) {
+			continue;
 		}
 
-		message(INFO "assignment returned: %" PRIu64 " (%" PRIu64 " overflows, time %" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ", checksum 0x%016" PRIx64 ")\n",
-			n, overflow_counter, user_time/60/60, user_time/60%60, user_time%60, checksum);
+		records_aggregate(&g_records, c, &a);
 
-		if (set_complete(n) < 0) {
-			message(ERR "result rejected!\n");
-			/* this can however be part of MUL request, so do not return -1 */
-			return 0;
-		}
+		aggregates_set(&g_aggregates, c, &a);
 
-		if (g_checksums[n] != 0 && g_checksums[n] != checksum) {
-			message(ERR "checksums do not match! (the other checksum was %" PRIu64 ", 0x%016" PRIx64 ")\n", g_checksums[n], g_checksums[n]);
-		}
+		report_pass_progress("rebuilding the aggregates", &done, total);
+	}
+}
 
-		g_checksums[n] = checksum;
+/*
+ * complete ==> checksum, after an unclean shutdown. The maps and the records
+ * are mmapped, their pages reach the disk on their own, so the complete bit
+ * can survive a crash while the record (and the log record) did not. Such
+ * results are lost, the tasks are reset to be handed out again.
+ */
+uint64_t reset_lost_results(void)
+{
+	uint64_t c;
+	uint64_t done = 0;
+	uint64_t count = 0;
+
+	#pragma omp parallel for schedule(dynamic) reduction(+:count)
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
+		int present = records_present(&g_records, c);
+		uint64_t n;
 
-		g_usertimes[n] = user_time;
+		for (n = c << RECORDS_CHUNK_LOG2; n < end; n += 64) {
+			uint64_t mask = g_index_complete.words[0][n >> 6];
+			int i;
 
-		g_overflows[n] = overflow_counter;
+			if (mask == 0) {
+				continue;
+			}
 
-		if (g_mxoffsets[n] != 0 && g_mxoffsets[n] != mxoffset) {
-			message(ERR "mxoffsets do not match! (the other mxoffset was +%" PRIu64 ")\n", g_mxoffsets[n]);
-		}
+			if (present) {
+				const struct record *r = records_get(&g_records, n);
 
-		g_mxoffsets[n] = mxoffset;
+				for (i = 0; i < 64; ++i) {
+					mask &= ~((uint64_t)(r[i].checksum != 0) << i);
+				}
+			}
 
-		g_clientids[n] = 0;
+			#pragma omp critical(pass)
+			while (mask != 0) {
+				uint64_t m = n + ctzu64(mask);
 
-		end_of_ret: ;
-	} else if (strcmp(msg, "req") == 0) {
-		/* requested lowest incomplete assignment */
-		uint64_t n;
-		uint64_t clid = 0;
+				printf("- resetting the assignment %" PRIu64 " due to lost result\n", m);
 
-		n = get_missed_assignment(thread_id);
+				SET_UNASSIGNED(m);
+				SET_INCOMPLETE(m);
 
-		message(INFO "assignment requested: %" PRIu64 " (lowest incomplete +%i)\n", n, thread_id);
+				count++;
 
-		if (write_uint64(fd, n) < 0) {
-			return -1;
+				mask &= mask - 1;
+			}
 		}
 
-		if (write_uint64(fd, TASK_SIZE) < 0) {
-			message(ERR "unable to write task size, update the client!\n");
-			return -1;
-		}
+		report_pass_progress("checking the results", &done, RECORDS_CHUNKS);
+	}
 
-		if (read_uint64(fd, &clid) < 0) {
-			message(ERR "client does not send client ID\n");
-			return -1;
-		}
+	return count;
+}
 
-		if (g_clientids[n] != 0) {
-			message(WARN "re-assigning the assignment\n");
-		}
+/* complete ==> assigned, complete ==> zero clid, not assigned ==> no clid */
+void fix_inconsistent_records(uint64_t *c0, uint64_t *c1, uint64_t *c2)
+{
+	uint64_t c;
+	uint64_t done = 0;
+	uint64_t r0 = 0, r1 = 0, r2 = 0;
 
-		g_clientids[n] = clid;
-	} else if (strcmp(msg, "INT") == 0) {
-		/* interrupted or unable to solve, unreserve the assignment */
+	#pragma omp parallel for schedule(dynamic) reduction(+:r0,r1,r2)
+	for (c = 0; c < RECORDS_CHUNKS; ++c) {
+		uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
 		uint64_t n;
-		uint64_t task_size = 0;
-		uint64_t clid = 0;
+		int fd;
 
-		if (read_uint64(fd, &n) < 0) {
-			return -1;
-		}
+		for (n = c << RECORDS_CHUNK_LOG2; n < end; n += 64) {
+			uint64_t mask = g_index_complete.words[0][n >> 6] & ~g_index_assigned.words[0][n >> 6];
 
-		if (read_uint64(fd, &task_size) < 0) {
-			message(ERR "unable to read task size, update the client!\n");
-			return -1;
-		}
+			if (mask == 0) {
+				continue;
+			}
 
-		if (read_uint64(fd, &clid) < 0) {
-			message(ERR "client does not send client ID\n");
-			return -1;
-		}
+			r0 += popcountu64(mask);
 
-		if (g_clientids[n] != clid) {
-			message(WARN "invalid request, assignment was assigned to another client, ignoring the request!\n");
-			/* this can be part of MUL request, so do not return -1 */
-			return 0;
-		}
+			#pragma omp critical(pass)
+			while (mask != 0) {
+				SET_ASSIGNED(n + ctzu64(mask));
 
-		if (task_size != TASK_SIZE) {
-			message(ERR "TASK_SIZE mismatch!\n");
-			return -1;
+				mask &= mask - 1;
+			}
 		}
 
-		message(INFO "assignment interrupted: %" PRIu64 "\n", n);
+		if (records_present(&g_records, c)) {
+			fd = records_chunk_fd(&g_records, c);
+			n = c << RECORDS_CHUNK_LOG2;
 
-		unset_assignment(n);
+			while ((n = records_seek(fd, c, n, SEEK_DATA)) < end) {
+				uint64_t e = records_seek(fd, c, n, SEEK_HOLE);
 
-		g_clientids[n] = 0;
-	} else if (strcmp(msg, "LOI") == 0) {
-		if (write_uint64(fd, g_lowest_incomplete) < 0) {
-			return -1;
-		}
+				for (; n < e; n += 64) {
+					const struct record *r = records_get(&g_records, n);
+					uint64_t complete = g_index_complete.words[0][n >> 6];
+					uint64_t assigned = g_index_assigned.words[0][n >> 6];
+					uint64_t mask = 0;
+					int i;
 
-		if (write_uint64(fd, TASK_SIZE) < 0) {
-			return -1;
-		}
-	} else if (strcmp(msg, "HIR") == 0) {
-		if (write_uint64(fd, g_lowest_unassigned) < 0) {
-			return -1;
-		}
+					for (i = 0; i < 64; ++i) {
+						mask |= (uint64_t)(r[i].clientid != 0) << i;
+					}
 
-		if (write_uint64(fd, TASK_SIZE) < 0) {
-			return -1;
-		}
-	} else if (strcmp(msg, "PNG") == 0) {
-		if (write_uint64(fd, 0) < 0) {
-			return -1;
+					if ((mask & (complete | ~assigned)) == 0) {
+						continue;
+					}
+
+					r1 += popcountu64(mask & complete);
+					r2 += popcountu64(mask & ~complete & ~assigned);
+
+					for (mask &= complete | ~assigned; mask != 0; mask &= mask - 1) {
+						records_at(&g_records, n + ctzu64(mask))->clientid = 0;
+					}
+				}
+			}
+
+			if (fd >= 0) {
+				close(fd);
+			}
 		}
-	} else {
-		message(ERR "%s: unknown client message!\n", msg);
-		return -1;
+
+		report_pass_progress("fixing the records", &done, RECORDS_CHUNKS);
 	}
 
-	return 0;
+	*c0 = r0;
+	*c1 = r1;
+	*c2 = r2;
 }
 
-void set_incomplete_superblock(uint64_t sb)
+/* parses the -s argument, first_task:end_task */
+int parse_shard(const char *arg)
 {
-	uint64_t n;
-	uint64_t c = 0;
+	char *end;
 
-	for (n = 0; n < (sb + 1) << 20; ++n) {
-		uint64_t checksum;
+	g_shard_lo = (uint64_t)strtoul(arg, &end, 10);
 
-		assert(n < ASSIGNMENTS_NO);
+	if (*end != ':') {
+		return -1;
+	}
 
-		checksum = g_checksums[n];
+	g_shard_hi = (uint64_t)strtoul(end + 1, &end, 10);
 
-		if (!checksum) {
-#if 0
-			printf("- resetting the assignment %" PRIu64 " due to user request\n", n);
-#endif
-#if 1
-			SET_UNASSIGNED(n);
-			SET_INCOMPLETE(n);
-#endif
-			c++;
-		}
+	if (*end != 0 || g_shard_lo >= g_shard_hi || g_shard_hi > ASSIGNMENTS_NO) {
+		return -1;
 	}
 
-	message(WARN "reset %" PRIu64 " assignments (superblock %" PRIu64 ")\n", c, sb);
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -703,7 +1911,9 @@ int main(int argc, char *argv[])
 	struct sockaddr_in server_addr;
 	int reuse = 1;
 	struct rlimit rlim;
-	struct timeval timeout;
+	int epfd;
+	time_t last_expiry;
+	time_t last_checkpoint;
 	int opt;
 	int clear_incomplete_assigned = 0;
 	int fix_records = 0;
@@ -711,11 +1921,13 @@ int main(int argc, char *argv[])
 	int invalidate_new = 0;
 	int reset_sb = 0;
 	int invalidate_max_assignments = 0;
-	uint64_t sb;
+	uint64_t sb = 0;
+	int aggregates_state;
+	int rebuild_all_aggregates = 0;
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
 
-	while ((opt = getopt(argc, argv, "cfizr:m")) != -1) {
+	while ((opt = getopt(argc, argv, "cfizr:mAL:p:s:")) != -1) {
 		switch (opt) {
 			case 'c':
 				clear_incomplete_assigned = 1;
@@ -736,12 +1948,31 @@ int main(int argc, char *argv[])
 			case 'm':
 				invalidate_max_assignments = 1;
 				break;
+			case 'A':
+				rebuild_all_aggregates = 1;
+				break;
+			case 'L':
+				g_lease_time = atou64(optarg);
+				break;
+			case 'p':
+				serverport = (uint16_t)atoul(optarg);
+				break;
+			case 's':
+				if (parse_shard(optarg) < 0) {
+					message(ERR "invalid shard %s, expected first_task:end_task\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
 			default:
-				message(ERR "Usage: %s [-c] [-f] [-i] [-z] [-r]\n", argv[0]);
+				message(ERR "Usage: %s [-c] [-f] [-i] [-z] [-r] [-A] [-L lease_seconds] [-p port] [-s first_task:end_task]\n", argv[0]);
 				return EXIT_FAILURE;
 		}
 	}
 
+	if (g_shard_lo != 0 || g_shard_hi != ASSIGNMENTS_NO) {
+		message(INFO "shard of the tasks %" PRIu64 " to %" PRIu64 " (exclusive), port %u\n", g_shard_lo, g_shard_hi, (unsigned)serverport);
+	}
+
 	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0) {
 		/* errno is set appropriately. */
 		perror("getrlimit");
@@ -753,17 +1984,87 @@ int main(int argc, char *argv[])
 
 	message(INFO "starting server...\n");
 
+	metrics_init(&g_metrics, (uint64_t)time(NULL));
+
 	g_map_assigned = open_map("assigned.map");
 	g_map_complete = open_map("complete.map");
-	g_checksums = open_records("checksums.dat");
-	g_usertimes = open_records("usertimes.dat");
-	g_overflows = open_records("overflows.dat");
-	g_clientids = open_records("clientids.dat");
-	g_mxoffsets = open_records("mxoffsets.dat");
+
+	if (bitindex_init(&g_index_assigned, g_map_assigned, ASSIGNMENTS_NO) < 0 || bitindex_init(&g_index_complete, g_map_complete, ASSIGNMENTS_NO) < 0) {
+		message(ERR "unable to build the map index\n");
+		abort();
+	}
+
+	if (access("records", F_OK) < 0 && access("checksums.dat", F_OK) == 0) {
+		if (records_open(&g_records, "records", 1) < 0) {
+			abort();
+		}
+
+		message(WARN "importing the legacy *.dat files into records/...\n");
+
+		if (records_import_legacy(&g_records) < 0) {
+			message(ERR "unable to import the legacy records!\n");
+			abort();
+		}
+
+		message(WARN "legacy records imported (superblocks below %" PRIu64 "), the *.dat files can be removed now\n", records_end(&g_records) >> RECORDS_CHUNK_LOG2);
+	} else if (records_open(&g_records, "records", 1) < 0) {
+		abort();
+	}
+
+	aggregates_state = aggregates_open(&g_aggregates, "aggregates.dat", RECORDS_CHUNKS, 1);
+
+	if (aggregates_state < 0) {
+		message(ERR "unable to open the aggregates!\n");
+		abort();
+	}
+
+	if (1) {
+		int64_t count;
+
+		if (wal_open(&g_wal, "server.wal") < 0) {
+			perror("open");
+			abort();
+		}
+
+		count = wal_replay(&g_wal, apply_wal_record);
+
+		if (count < 0) {
+			message(ERR "unable to read the log!\n");
+			abort();
+		}
+
+		message(INFO "replayed %" PRIi64 " log records\n", count);
+	}
+
+	if (aggregates_state == AGGREGATES_NEW) {
+		message(WARN "no valid aggregates found, rebuilding them from the records...\n");
+	}
+
+	if (aggregates_state == AGGREGATES_UNCLEAN) {
+		uint64_t c;
+
+		message(WARN "the server was not shut down cleanly, checking the results...\n");
+
+		c = reset_lost_results();
+
+		if (c != 0) {
+			message(WARN "reset %" PRIu64 " assignments whose results were lost\n", c);
+		}
+
+		message(WARN "the aggregates were not closed, rebuilding them from the records...\n");
+	}
+
+	/*
+	 * After an unclean shutdown, the mmapped aggregates can be ahead of the
+	 * log (their pages reach the disk on their own), so all of them are
+	 * rebuilt, not only the superblocks touched by the replay.
+	 */
+	rebuild_aggregates(aggregates_state != AGGREGATES_OK || rebuild_all_aggregates);
 
 	if (invalidate_max_assignments) {
 		FILE *stream;
 		uint64_t n;
+		uint64_t c = 0;
 
 		stream = fopen("max-assignments.txt", "r");
 
@@ -773,112 +2074,54 @@ int main(int argc, char *argv[])
 		}
 
 		while (1 == fscanf(stream, "%" SCNu64, &n)) {
+			if (n >= ASSIGNMENTS_NO) {
+				message(ERR "invalid assignment %" PRIu64 " (-m argument)\n", n);
+				continue;
+			}
+
 			printf("- invalidating the assignment %" PRIu64 " due to -m argument\n", n);
 
 			SET_UNASSIGNED(n);
 			SET_INCOMPLETE(n);
+
+			c++;
 		}
 
 		fclose(stream);
 
+		message(WARN "invalidated %" PRIu64 " assignments (-m argument)\n", c);
+
 		invalidated: ;
 	}
 
 	if (invalidate_overflows) {
-		uint64_t n;
+		uint64_t c;
 
 		message(WARN "Invalidating overflows...\n");
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t overflow = g_overflows[n];
+		c = invalidate_records("overflow", select_overflow);
 
-			if (overflow != 0) {
-				printf("- resetting the assignment %" PRIu64 " due to overflow\n", n);
-
-				SET_UNASSIGNED(n);
-				SET_INCOMPLETE(n);
-			}
-		}
+		message(WARN "invalidated %" PRIu64 " results\n", c);
 	}
 
 	if (invalidate_new) {
-		uint64_t n;
 		uint64_t c = 0;
 
 		message(WARN "Invalidating new/buggy/outdated/incomplete/obsolete checksums...\n");
 
-#if 0
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t checksum = g_checksums[n];
-
-			if ((checksum >> 24) == 0x2134) {
-				printf("- resetting the assignment %" PRIu64 " due to buggy/obsolete checksum\n", n);
-
-				SET_UNASSIGNED(n);
-				SET_INCOMPLETE(n);
-			}
-		}
-#endif
-
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t checksum = g_checksums[n];
-			uint64_t usertime = g_usertimes[n];
-			uint64_t mxoffset = g_mxoffsets[n];
-
-			if (checksum) {
-				if (!usertime || !mxoffset) {
-					printf("- resetting the assignment %" PRIu64 " due to incomplete record\n", n);
-
-					SET_UNASSIGNED(n);
-					SET_INCOMPLETE(n);
-
-					c++;
-				}
-			}
-		}
-
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			uint64_t usertime = g_usertimes[n];
-
-			if (usertime > 60 * 60) {
-				printf("- resetting the assignment %" PRIu64 " due to invalid time\n", n);
-#if 1
-				SET_UNASSIGNED(n);
-				SET_INCOMPLETE(n);
-#endif
-				c++;
-			}
-		}
+		c += invalidate_records("incomplete record", select_incomplete_record);
+		c += invalidate_records("invalid time", select_invalid_time);
 
 		message(WARN "invalidated %" PRIu64 " results\n", c);
 	}
 
-	/* fix records the *.map and *.dat */
+	/* fix records the *.map and records/ */
 	if (fix_records) {
-		uint64_t n;
-		uint64_t c0 = 0, c1 = 0, c2 = 0;
+		uint64_t c0, c1, c2;
 
 		message(WARN "Processing the records...\n");
 
-		for (n = 0; n < ASSIGNMENTS_NO; ++n) {
-			/* complete ==> assigned */
-			if (IS_COMPLETE(n) && !IS_ASSIGNED(n)) {
-				SET_ASSIGNED(n);
-				c0++;
-			}
-
-			/* complete ==> zero clid */
-			if (IS_COMPLETE(n) && g_clientids[n] != 0) {
-				g_clientids[n] = 0;
-				c1++;
-			}
-
-			/* not assigned ==> no clid */
-			if (!IS_ASSIGNED(n) && g_clientids[n] != 0) {
-				g_clientids[n] = 0;
-				c2++;
-			}
-		}
+		fix_inconsistent_records(&c0, &c1, &c2);
 
 		message(WARN "These corrections have been made: %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", c0, c1, c2);
 	}
@@ -887,11 +2130,9 @@ int main(int argc, char *argv[])
 		set_incomplete_superblock(sb);
 	}
 
-	for (g_lowest_unassigned = 0; IS_ASSIGNED(g_lowest_unassigned); ++g_lowest_unassigned)
-		;
+	g_lowest_unassigned = bitindex_find_zero(&g_index_assigned, g_shard_lo);
 
-	for (g_lowest_incomplete = 0; IS_COMPLETE(g_lowest_incomplete); ++g_lowest_incomplete)
-		;
+	g_lowest_incomplete = bitindex_find_zero(&g_index_complete, g_shard_lo);
 
 	if (clear_incomplete_assigned) {
 		message(WARN "incomplete assignments will be cleared...\n");
@@ -906,11 +2147,25 @@ int main(int argc, char *argv[])
 		message(WARN "incomplete assignments have been cleared!\n");
 	}
 
+	if (g_lease_time != 0) {
+		load_leases();
+	}
+
+	g_metrics.active = count_active_assignments();
+
+	/* the replayed log and the corrections above */
+	checkpoint();
+
+	last_checkpoint = time(NULL);
+
 	message(INFO "lowest unassigned = %" PRIu64 "\n", g_lowest_unassigned);
 	message(INFO "lowest incomplete = %" PRIu64 "\n", g_lowest_incomplete);
 
-	message(INFO "*** all numbers below %" PRIu64 " * 2^%" PRIu64 " are convergent (blocks) ***\n", g_lowest_incomplete, TASK_SIZE);
-	message(INFO "*** all numbers below %" PRIu64 " * 2^%" PRIu64 " are convergent (superblocks) ***\n", g_lowest_incomplete >> 20, TASK_SIZE + 20);
+	/* a shard knows nothing about the tasks below it */
+	if (g_shard_lo == 0) {
+		message(INFO "*** all numbers below %" PRIu64 " * 2^%" PRIu64 " are convergent (blocks) ***\n", g_lowest_incomplete, TASK_SIZE);
+		message(INFO "*** all numbers below %" PRIu64 " * 2^%" PRIu64 " are convergent (superblocks) ***\n", g_lowest_incomplete >> 20, TASK_SIZE + 20);
+	}
 
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
@@ -931,15 +2186,9 @@ int main(int argc, char *argv[])
 		abort();
 	}
 
-	timeout.tv_sec = 10;
-	timeout.tv_usec = 0;
-
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void *)&timeout, sizeof(timeout)) < 0) {
-		perror("setsockopt failed\n");
-	}
-
-	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&timeout, sizeof(timeout)) < 0) {
-		perror("setsockopt failed\n");
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		abort();
 	}
 
 	init_sockaddr(&server_addr, serverport);
@@ -956,52 +2205,107 @@ int main(int argc, char *argv[])
 
 	message(INFO "listening...\n");
 
-	while (1) {
-		struct sockaddr_in sockaddr_in;
-		socklen_t sockaddr_len = sizeof sockaddr_in;
-		int cl_fd = accept(fd, &sockaddr_in, &sockaddr_len);
-		const char *ipv4 = "(unknown)";
+	epfd = epoll_create(1);
 
-		if (-1 == cl_fd) {
-			if (quit)
-				break;
+	if (epfd < 0) {
+		perror("epoll_create");
+		abort();
+	}
+
+	if (1) {
+		struct epoll_event ev;
 
-			message(ERR "cannot accept a connection on a socket!\n");
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("epoll_ctl");
+			abort();
 		}
+	}
 
-		if (sockaddr_len >= sizeof sockaddr_in && sockaddr_in.sin_family == AF_INET) {
-			ipv4 = inet_ntoa(sockaddr_in.sin_addr);
+	last_expiry = time(NULL);
+
+	while (!quit) {
+		struct epoll_event events[256];
+		int i;
+		int nfds = epoll_wait(epfd, events, 256, g_wal.pending > 0 ? WAL_COMMIT_MSECS : 1000);
+		time_t now;
+
+		if (nfds < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < nfds; ++i) {
+			struct conn *c = events[i].data.ptr;
+			int r;
+
+			if (c == NULL) {
+				accept_connections(epfd);
+				continue;
+			}
+
+			r = conn_handle(c, events[i].events);
+
+			if (r < 0) {
+				message(ERR "client <--> server communication failure!\n");
+				conn_close(c);
+			} else if (r > 0) {
+				conn_close(c);
+			} else if (conn_update_events(epfd, c) < 0) {
+				conn_close(c);
+			}
+		}
+
+		now = time(NULL);
+
+		if (now != last_expiry) {
+			expire_connections(now);
+			expire_leases((uint64_t)now);
+			last_expiry = now;
 		}
 
-		if (read_message(cl_fd, 0, ipv4) < 0) {
-			message(ERR "client <--> server communication failure!\n");
+		if (wal_commit_if_due(&g_wal) < 0) {
+			message(ERR "unable to commit the log!\n");
 		}
 
-		close(cl_fd);
+		if (now - last_checkpoint >= CHECKPOINT_INTERVAL) {
+			checkpoint();
+			last_checkpoint = now;
+		}
+	}
 
-		if (quit)
-			break;
+	while (g_conns != NULL) {
+		conn_close(g_conns);
 	}
 
+	close(epfd);
+
 	message(INFO "closing server socket...\n");
 
 	close(fd);
 
-	msync(g_map_assigned, MAP_SIZE, MS_SYNC);
-	msync(g_map_complete, MAP_SIZE, MS_SYNC);
-	msync(g_checksums, RECORDS_SIZE, MS_SYNC);
-	msync(g_usertimes, RECORDS_SIZE, MS_SYNC);
-	msync(g_overflows, RECORDS_SIZE, MS_SYNC);
-	msync(g_clientids, RECORDS_SIZE, MS_SYNC);
-	msync(g_mxoffsets, RECORDS_SIZE, MS_SYNC);
+	checkpoint();
+
+	aggregates_close(&g_aggregates);
+
+	wal_close(&g_wal);
+
+	bitindex_free(&g_index_assigned);
+	bitindex_free(&g_index_complete);
+
+	metrics_free(&g_metrics);
 
 	munmap(g_map_assigned, MAP_SIZE);
 	munmap(g_map_complete, MAP_SIZE);
-	munmap(g_checksums, RECORDS_SIZE);
-	munmap(g_usertimes, RECORDS_SIZE);
-	munmap(g_overflows, RECORDS_SIZE);
-	munmap(g_clientids, RECORDS_SIZE);
-	munmap(g_mxoffsets, RECORDS_SIZE);
+	records_close(&g_records);
+
+	leases_free(&g_leases);
 
 	return 0;
 }
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Runs the server as N shards, each of them in its own directory
+# (shard.0, shard.1, ...) on its own port. The task space is split into
+# N ranges of whole superblocks. The clients are pointed to the shards by
+# the SERVER_SHARDS variable printed below.
+#
+# usage: shards.sh N [first_port] [server options...]
+
+set -e
+set -u
+
+N=${1:?usage: $0 N [first_port] [server options...]}
+PORT=${2:-5006}
+shift
+shift || true
+
+SERVER=$(readlink -f "${SERVER:-$(dirname "$0")/server}")
+
+# 2^32 tasks = 4096 superblocks of 2^20 tasks
+SUPERBLOCKS=4096
+
+if test "${N}" -lt 1 -o "${N}" -gt "${SUPERBLOCKS}"; then
+	echo "invalid number of shards ${N}"
+	exit 1
+fi
+
+PIDS=()
+SHARDS=
+
+function stop() {
+	kill -s SIGINT "${PIDS[@]}" 2> /dev/null || true
+	wait
+}
+
+trap stop INT TERM
+
+for ((i = 0; i < N; ++i)); do
+	LO=$(( (i * SUPERBLOCKS / N) << 20 ))
+	HI=$(( ((i + 1) * SUPERBLOCKS / N) << 20 ))
+	P=$(( PORT + i ))
+
+	mkdir -p -- "shard.${i}"
+	(cd -- "shard.${i}" && exec "${SERVER}" -p "${P}" -s "${LO}:${HI}" "$@" >> server.log 2>&1) &
+	PIDS+=($!)
+
+	SHARDS=${SHARDS:+${SHARDS},}localhost:${P}
+done
+
+echo "export SERVER_SHARDS=${SHARDS}"
+
+wait
@@ -0,0 +1 @@
+../common/uint256.h
\ No newline at end of file
@@ -1,161 +1,605 @@
 /**
  * the question whether the gpuworker works correctly arises
+ *
+ * Without -k, the records of a single task are printed. With -k, the
+ * results of the fleet are audited: k completed tasks are sampled (at
+ * random, or k per client with -c), and each of them is spot-checked in
+ * parallel. The maximum at the recorded mxoffset must not be exceeded by
+ * any number of a random sub-range of the task (2^r numbers, see -r), and
+ * if a worker command is given (-w), the whole task is recomputed and its
+ * checksum and mxoffset are compared with the records. The agreement rate
+ * is reported per client.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
-#ifdef _USE_GMP
-#	include <gmp.h>
-#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
 #include "wideint.h"
 #include "compat.h"
+#include "uint256.h"
+#include "records.h"
 
 #define TASK_SIZE 40
 
 #define ASSIGNMENTS_NO (UINT64_C(1) << 32)
 
-#define RECORDS_SIZE (ASSIGNMENTS_NO * 8)
+struct records g_records;
 
-const uint64_t *open_records(const char *path)
+/* the default size of the sub-range (log2) */
+#define SUBRANGE_LOG2 20
+
+/* a sampled task */
+struct sample {
+	uint64_t task_id;
+	uint64_t clid; /* the client of the result */
+	uint64_t offset; /* of the sub-range within the task */
+	int agree; /* 1 if the result agrees, 0 if not, -1 if it cannot be verified */
+};
+
+/* xorshift64* */
+uint64_t g_rand_state = UINT64_C(88172645463325252);
+
+uint64_t rand64(void)
 {
-	int fd = open(path, O_RDONLY, 0600);
-	const void *ptr;
+	g_rand_state ^= g_rand_state >> 12;
+	g_rand_state ^= g_rand_state << 25;
+	g_rand_state ^= g_rand_state >> 27;
 
-	if (fd < 0) {
-		perror("open");
-		abort();
+	return g_rand_state * UINT64_C(2685821657736338717);
+}
+
+uint64_t rand_below(uint64_t n)
+{
+	return rand64() % n;
+}
+
+int is_done(uint64_t n)
+{
+	return records_get(&g_records, n)->checksum != 0;
+}
+
+/*
+ * A random completed task of the superblock, r is a random rank below its
+ * number of the completed tasks. Returns ASSIGNMENTS_NO if there is none
+ * (the counts are behind the records).
+ */
+uint64_t pick_in_superblock(uint64_t sb, uint64_t r)
+{
+	uint64_t lo = sb << RECORDS_CHUNK_LOG2;
+	uint64_t end = lo + RECORDS_CHUNK_NO;
+	uint64_t last = ASSIGNMENTS_NO;
+	uint64_t n = lo;
+	uint64_t i;
+	int fd;
+
+	if (!records_present(&g_records, sb)) {
+		return ASSIGNMENTS_NO;
+	}
+
+	for (i = 0; i < 64; ++i) {
+		n = lo + rand_below(RECORDS_CHUNK_NO);
+
+		if (is_done(n)) {
+			return n;
+		}
+	}
+
+	/* the superblock is sparse, the task of the rank r is looked up */
+	fd = records_chunk_fd(&g_records, sb);
+
+	for (n = lo; (n = records_seek(fd, sb, n, SEEK_DATA)) < end; ) {
+		uint64_t e = records_seek(fd, sb, n, SEEK_HOLE);
+
+		for (; n < e; ++n) {
+			if (is_done(n)) {
+				if (r-- == 0) {
+					goto found;
+				}
+
+				last = n;
+			}
+		}
 	}
 
-	ptr = mmap(NULL, (size_t)RECORDS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	/* the counts are behind the records */
+	n = last;
+
+found:
+	if (fd >= 0) {
+		close(fd);
+	}
 
-	if (ptr == MAP_FAILED) {
-		perror("mmap");
+	return n;
+}
+
+/* k completed tasks uniformly at random (without repetition), returns their number */
+size_t sample_uniform(struct sample *samples, size_t k)
+{
+	struct aggregates aggregates;
+	uint64_t *counts = calloc((size_t)RECORDS_CHUNKS, sizeof(uint64_t));
+	uint64_t total = 0;
+	uint64_t sb;
+	size_t count = 0;
+	size_t attempts;
+
+	if (counts == NULL) {
+		perror("calloc");
 		abort();
 	}
 
-	close(fd);
+	/* the completed tasks per superblock, from the aggregates if possible */
+	if (aggregates_open(&aggregates, "aggregates.dat", RECORDS_CHUNKS, 0) == AGGREGATES_OK) {
+		for (sb = 0; sb < RECORDS_CHUNKS; ++sb) {
+			counts[sb] = aggregates.sbs[sb].complete;
+		}
+
+		aggregates_close(&aggregates);
+	} else {
+		#pragma omp parallel for schedule(dynamic)
+		for (sb = 0; sb < g_records.end; ++sb) {
+			struct aggregate a;
 
-	return (const uint64_t *)ptr;
+			records_aggregate(&g_records, sb, &a);
+
+			counts[sb] = a.complete;
+		}
+	}
+
+	for (sb = 0; sb < RECORDS_CHUNKS; ++sb) {
+		total += counts[sb];
+	}
+
+	if (k > total) {
+		k = (size_t)total;
+	}
+
+	for (attempts = 0; count < k && attempts < 16 * k; ++attempts) {
+		uint64_t r = rand_below(total);
+		uint64_t n;
+		size_t i;
+
+		for (sb = 0; r >= counts[sb]; ++sb) {
+			r -= counts[sb];
+		}
+
+		n = pick_in_superblock(sb, r);
+
+		if (n == ASSIGNMENTS_NO) {
+			continue;
+		}
+
+		for (i = 0; i < count && samples[i].task_id != n; ++i)
+			;
+
+		if (i < count) {
+			continue;
+		}
+
+		samples[count].task_id = n;
+		samples[count].clid = records_get(&g_records, n)->doneby;
+		count++;
+	}
+
+	free(counts);
+
+	return count;
 }
 
-const uint64_t *g_checksums = 0;
-const uint64_t *g_mxoffsets = 0;
-const uint64_t *g_usertimes = 0;
+/* the tasks of a client, a reservoir of k of them */
+struct stratum {
+	uint64_t clid;
+	uint64_t seen;
+	uint64_t *tasks;
+};
 
-#define LUT_SIZE64 41
+struct strata {
+	struct stratum *slots;
+	size_t cap; /* a power of two */
+	size_t n;
+};
 
-uint64_t g_lut64[LUT_SIZE64];
+uint64_t hash_clid(uint64_t clid)
+{
+	return clid * UINT64_C(11400714819323198485);
+}
 
-void init_lut()
+struct stratum *strata_get(struct strata *strata, uint64_t clid, size_t k)
 {
-	int a;
+	size_t i;
+
+	/* at most half full */
+	if (2 * (strata->n + 1) > strata->cap) {
+		struct strata bigger;
+		size_t j;
+
+		bigger.cap = strata->cap ? 2 * strata->cap : 64;
+		bigger.n = strata->n;
+		bigger.slots = calloc(bigger.cap, sizeof(struct stratum));
+
+		if (bigger.slots == NULL) {
+			perror("calloc");
+			abort();
+		}
+
+		for (j = 0; j < strata->cap; ++j) {
+			const struct stratum *s = &strata->slots[j];
+
+			if (s->tasks != NULL) {
+				for (i = (size_t)hash_clid(s->clid) & (bigger.cap - 1); bigger.slots[i].tasks != NULL; i = (i + 1) & (bigger.cap - 1))
+					;
+
+				bigger.slots[i] = *s;
+			}
+		}
 
-	for (a = 0; a < LUT_SIZE64; ++a) {
-		g_lut64[a] = pow3u64((uint64_t)a);
+		free(strata->slots);
+		*strata = bigger;
 	}
+
+	for (i = (size_t)hash_clid(clid) & (strata->cap - 1); strata->slots[i].tasks != NULL; i = (i + 1) & (strata->cap - 1)) {
+		if (strata->slots[i].clid == clid) {
+			return &strata->slots[i];
+		}
+	}
+
+	strata->slots[i].clid = clid;
+	strata->slots[i].seen = 0;
+	strata->slots[i].tasks = malloc(sizeof(uint64_t) * k);
+
+	if (strata->slots[i].tasks == NULL) {
+		perror("malloc");
+		abort();
+	}
+
+	strata->n++;
+
+	return &strata->slots[i];
 }
 
-#ifdef _USE_GMP
-static void mpz_init_set_u128(mpz_t rop, uint128_t op)
+/* k completed tasks of each client (or all of them), returns their number */
+size_t sample_by_client(struct sample **psamples, size_t k)
 {
-	uint64_t nh = (uint64_t)(op>>64);
-	uint64_t nl = (uint64_t)(op);
+	struct strata strata = { NULL, 0, 0 };
+	struct sample *samples;
+	size_t count = 0;
+	uint64_t c;
+	size_t i;
+
+	for (c = 0; c < g_records.end; ++c) {
+		uint64_t end = (c + 1) << RECORDS_CHUNK_LOG2;
+		uint64_t n = c << RECORDS_CHUNK_LOG2;
+		int fd;
+
+		if (!records_present(&g_records, c)) {
+			continue;
+		}
 
-	assert(sizeof(unsigned long) == sizeof(uint64_t));
+		fd = records_chunk_fd(&g_records, c);
 
-	mpz_init_set_ui(rop, (unsigned long)nh);
-	mpz_mul_2exp(rop, rop, (mp_bitcnt_t)64);
-	mpz_add_ui(rop, rop, (unsigned long)nl);
+		while ((n = records_seek(fd, c, n, SEEK_DATA)) < end) {
+			uint64_t e = records_seek(fd, c, n, SEEK_HOLE);
+
+			for (; n < e; ++n) {
+				const struct record *r = records_get(&g_records, n);
+				struct stratum *s;
+
+				if (r->checksum == 0) {
+					continue;
+				}
+
+				s = strata_get(&strata, r->doneby, k);
+
+				s->seen++;
+
+				if (s->seen <= k) {
+					s->tasks[s->seen - 1] = n;
+				} else {
+					uint64_t j = rand_below(s->seen);
+
+					if (j < k) {
+						s->tasks[j] = n;
+					}
+				}
+			}
+		}
+
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	samples = malloc(sizeof(struct sample) * (strata.n * k + 1));
+
+	if (samples == NULL) {
+		perror("malloc");
+		abort();
+	}
+
+	for (i = 0; i < strata.cap; ++i) {
+		struct stratum *s = &strata.slots[i];
+		uint64_t j;
+
+		if (s->tasks == NULL) {
+			continue;
+		}
+
+		for (j = 0; j < s->seen && j < k; ++j) {
+			samples[count].task_id = s->tasks[j];
+			samples[count].clid = s->clid;
+			count++;
+		}
+
+		free(s->tasks);
+	}
+
+	free(strata.slots);
+
+	*psamples = samples;
+
+	return count;
 }
-#endif
 
-uint128_t get_max(uint128_t n0)
+/* runs the worker command on the task, returns 0 if it has reported the checksum and the mxoffset */
+int run_worker(const char *worker, uint64_t task_id, uint64_t *checksum, uint64_t *mxoffset)
 {
-	int alpha, beta;
-	uint128_t max_n = 0;
-	uint128_t n = n0;
+	char command[4096];
+	char line[4096];
+	FILE *stream;
+	int found = 0;
 
-	assert(n0 != UINT128_MAX);
+	sprintf(command, "%.4000s %" PRIu64, worker, task_id);
 
-	do {
-		n++;
+	stream = popen(command, "r");
 
-		do {
-			alpha = ctzu64(n);
-			if (alpha >= LUT_SIZE64) {
-				alpha = LUT_SIZE64 - 1;
-			}
-			n >>= alpha;
-			if (n > UINT128_MAX >> 2*alpha) {
-				return 0;
+	if (stream == NULL) {
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), stream) != NULL) {
+		if (sscanf(line, "CHECKSUM %" SCNu64, checksum) == 1) {
+			found |= 1;
+		}
+
+		if (sscanf(line, "MAXIMUM_OFFSET %" SCNu64, mxoffset) == 1) {
+			found |= 2;
+		}
+	}
+
+	if (pclose(stream) != 0) {
+		return -1;
+	}
+
+	return found == 3 ? 0 : -1;
+}
+
+void verify_sample(struct sample *s, int log2_subrange, const char *worker)
+{
+	const struct record *r = records_get(&g_records, s->task_id);
+	uint128_t base = (uint128_t)s->task_id << TASK_SIZE;
+	struct uint256 max0;
+
+	s->agree = 1;
+
+	if (r->mxoffset >= (UINT64_C(1) << TASK_SIZE)) {
+		#pragma omp critical
+		printf("- task %" PRIu64 " (client 0x%016" PRIx64 "): mxoffset %" PRIu64 " out of the task\n", s->task_id, s->clid, r->mxoffset);
+		s->agree = 0;
+		return;
+	}
+
+	/* the maximum at the mxoffset is the maximum of the task */
+	if (r->mxoffset != 0 && log2_subrange > 0) {
+		uint128_t n;
+		uint128_t lo = base + s->offset;
+		uint128_t hi = lo + (UINT64_C(1) << log2_subrange);
+
+		/* in 256 bits, the maxima of the records exceed 128 bits */
+		uint256_get_maximum(&max0, base + r->mxoffset);
+
+		/* n of the form 4n+3 */
+		for (n = lo + 3; n < hi; n += 4) {
+			struct uint256 max;
+
+			uint256_get_maximum(&max, n);
+
+			if (uint256_cmp(&max, &max0) > 0) {
+				#pragma omp critical
+				printf("- task %" PRIu64 " (client 0x%016" PRIx64 "): offset %" PRIu64 " exceeds the maximum at the mxoffset %" PRIu64 "\n",
+					s->task_id, s->clid, (uint64_t)(n - base), r->mxoffset);
+				s->agree = 0;
+				return;
 			}
-			n *= g_lut64[alpha];
-		} while (!(n & 1));
+		}
+	} else if (worker == NULL) {
+		/* nothing to compare with */
+		s->agree = -1;
+	}
+
+	if (worker != NULL) {
+		uint64_t checksum = 0;
+		uint64_t mxoffset = 0;
+
+		if (run_worker(worker, s->task_id, &checksum, &mxoffset) < 0) {
+			#pragma omp critical
+			printf("- task %" PRIu64 ": the worker failed\n", s->task_id);
+			s->agree = -1;
+			return;
+		}
 
-		n--;
+		if (checksum != r->checksum || (r->mxoffset != 0 && mxoffset != r->mxoffset)) {
+			#pragma omp critical
+			printf("- task %" PRIu64 " (client 0x%016" PRIx64 "): checksum %" PRIu64 ", mxoffset %" PRIu64 " recomputed, %" PRIu64 ", %" PRIu64 " recorded\n",
+				s->task_id, s->clid, checksum, mxoffset, r->checksum, r->mxoffset);
+			s->agree = 0;
+		}
+	}
+}
 
-		if (n > max_n) {
-			max_n = n;
+int compare_samples(const void *l, const void *r)
+{
+	const struct sample *a = l;
+	const struct sample *b = r;
+
+	if (a->clid != b->clid) {
+		return a->clid < b->clid ? -1 : +1;
+	}
+
+	return a->task_id < b->task_id ? -1 : a->task_id > b->task_id;
+}
+
+void report_client(uint64_t clid, uint64_t agree, uint64_t disagree, uint64_t unknown)
+{
+	printf("client 0x%016" PRIx64 ": %" PRIu64 "/%" PRIu64 " agree (%.1f%%), %" PRIu64 " not verifiable\n",
+		clid, agree, agree + disagree, agree + disagree ? 100. * (double)agree / (double)(agree + disagree) : 100., unknown);
+}
+
+int audit(size_t k, int by_client, int log2_subrange, const char *worker)
+{
+	struct sample *samples;
+	size_t count;
+	int64_t i;
+	uint64_t agree = 0, disagree = 0, unknown = 0;
+	uint64_t total_agree = 0, total_disagree = 0;
+
+	if (by_client) {
+		count = sample_by_client(&samples, k);
+	} else {
+		samples = malloc(sizeof(struct sample) * (k + 1));
+
+		if (samples == NULL) {
+			perror("malloc");
+			abort();
 		}
 
-		do {
-			beta = ctzu64(n);
-			n >>= beta;
-		} while (!(n & 1));
+		count = sample_uniform(samples, k);
+	}
+
+	/* the sub-ranges are drawn here, the verification runs in parallel */
+	for (i = 0; i < (int64_t)count; ++i) {
+		samples[i].offset = log2_subrange > 0 ? rand_below(UINT64_C(1) << (TASK_SIZE - log2_subrange)) << log2_subrange : 0;
+		samples[i].agree = -1;
+	}
+
+	printf("auditing %lu tasks...\n", (unsigned long)count);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < (int64_t)count; ++i) {
+		verify_sample(&samples[i], log2_subrange, worker);
+	}
 
-		if (n < n0) {
-			return max_n;
+	qsort(samples, count, sizeof(struct sample), compare_samples);
+
+	for (i = 0; i < (int64_t)count; ++i) {
+		switch (samples[i].agree) {
+			case 1: agree++; break;
+			case 0: disagree++; break;
+			default: unknown++;
 		}
-	} while (1);
+
+		if (i + 1 == (int64_t)count || samples[i + 1].clid != samples[i].clid) {
+			report_client(samples[i].clid, agree, disagree, unknown);
+
+			total_agree += agree;
+			total_disagree += disagree;
+			agree = disagree = unknown = 0;
+		}
+	}
+
+	printf("total: %" PRIu64 "/%" PRIu64 " agree\n", total_agree, total_agree + total_disagree);
+
+	free(samples);
+
+	return total_disagree == 0 ? 0 : -1;
 }
 
+/*
+ * usage: verify-result [task_id]
+ *        verify-result -k samples [-c] [-r log2_subrange] [-w worker_command] [-s seed]
+ */
 int main(int argc, char *argv[])
 {
-	uint64_t task_id = (argc > 1) ? atou64(argv[1]) : 0;
+	uint64_t task_id;
 	uint64_t task_size = TASK_SIZE;
+	size_t samples = 0;
+	int by_client = 0;
+	int log2_subrange = SUBRANGE_LOG2;
+	const char *worker = NULL;
+	int opt;
 	uint64_t checksum;
 	uint64_t mxoffset;
 	uint64_t usertime;
-#ifdef _USE_GMP
-	uint128_t mxoffset_n0;
-	uint128_t maximum;
-	mpz_t mpz_max_n0;
-	mpz_t mpz_maximum;
-#endif
 
-	init_lut();
+	while ((opt = getopt(argc, argv, "k:cr:w:s:")) != -1) {
+		switch (opt) {
+			case 'k':
+				samples = (size_t)atou64(optarg);
+				break;
+			case 'c':
+				by_client = 1;
+				break;
+			case 'r':
+				log2_subrange = atoi(optarg);
+				break;
+			case 'w':
+				worker = optarg;
+				break;
+			case 's':
+				g_rand_state = atou64(optarg) | 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [task_id] | -k samples [-c] [-r log2_subrange] [-w worker_command] [-s seed]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (log2_subrange < 0 || log2_subrange > TASK_SIZE) {
+		fprintf(stderr, "invalid sub-range size 2^%i\n", log2_subrange);
+		return EXIT_FAILURE;
+	}
+
+	task_id = (optind < argc) ? atou64(argv[optind]) : 0;
+
+	if (samples > 0) {
+		if (records_open(&g_records, "records", 0) < 0) {
+			abort();
+		}
+
+		return audit(samples, by_client, log2_subrange, worker) < 0 ? EXIT_FAILURE : 0;
+	}
 
 	printf("TASK_SIZE %" PRIu64 "\n", task_size);
 	printf("TASK_ID %" PRIu64 "\n", task_id);
 
-	g_checksums = open_records("checksums.dat");
-	g_mxoffsets = open_records("mxoffsets.dat");
-	g_usertimes = open_records("usertimes.dat");
+	if (records_open(&g_records, "records", 0) < 0) {
+		abort();
+	}
 
-	checksum = g_checksums[task_id];
+	checksum = records_get(&g_records, task_id)->checksum;
 
 	printf("CHECKSUM %" PRIu64 "\n", checksum);
 	printf("PREFIX 0x%" PRIx64 "\n", checksum >> 24);
 
-	mxoffset = g_mxoffsets[task_id];
+	mxoffset = records_get(&g_records, task_id)->mxoffset;
 
 	if (mxoffset != 0) {
-#ifdef _USE_GMP
-		mxoffset_n0 = mxoffset + ((uint128_t)(task_id + 0) << task_size);
-		maximum = get_max(mxoffset_n0);
-		mpz_init_set_u128(mpz_max_n0, mxoffset_n0);
-		mpz_init_set_u128(mpz_maximum, maximum);
+		struct uint256 n0, maximum;
+		char str[79];
+
+		uint256_set_u128(&n0, mxoffset + ((uint128_t)(task_id + 0) << task_size));
+		uint256_get_maximum(&maximum, uint256_get_u128(&n0));
+
+		/* the value after the (3n+1)/2 step */
+		uint256_shr(&maximum, 1);
 
-		gmp_printf("MAXIMUM_N0 %Zi\n", mpz_max_n0);
-		gmp_printf("MAXIMUM %Zi\n", mpz_maximum);
-#endif
+		printf("MAXIMUM_N0 %s\n", uint256_to_str(&n0, str));
+		printf("MAXIMUM %s\n", uint256_to_str(&maximum, str));
 	}
 
 	assert((uint128_t)task_id <= (UINT128_MAX >> task_size));
@@ -167,7 +611,7 @@ int main(int argc, char *argv[])
 		(uint64_t)(((uint128_t)(task_id + 1) << task_size)    )
 	);
 
-	usertime = g_usertimes[task_id];
+	usertime = records_get(&g_records, task_id)->usertime;
 
 	printf("TIME %" PRIu64 " (%" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ")\n",
 			usertime,
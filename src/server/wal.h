@@ -0,0 +1,236 @@
+/**
+ * Write-ahead log of the server state.
+ *
+ * Every change of the maps and records is appended to the log before it is
+ * applied to the mmapped files. A change that spans several fields (e.g., a
+ * returned result) is a single record, so it is replayed entirely or not at
+ * all. The records are written immediately (so the
+ * log survives a crash of the server itself), while fdatasync is issued in
+ * groups (so the loss after a crash of the machine is bounded by a few
+ * records or milliseconds). A checkpoint flushes the mmapped files and
+ * empties the log. At startup, the log is replayed up to the first torn or
+ * corrupted record.
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "compat.h"
+
+#define WAL_SET_ASSIGNED   1
+#define WAL_SET_UNASSIGNED 2
+#define WAL_SET_COMPLETE   3
+#define WAL_SET_INCOMPLETE 4
+#define WAL_SET_CLIENTID   5 /* a = client ID */
+#define WAL_SET_RESULT     6 /* a = checksum, b = user time, c = overflows, d = mxoffset, e = client ID; also completes the task */
+#define WAL_SET_DEADLINE   7 /* a = lease deadline */
+#define WAL_SET_RANGE      8 /* n..n+a-1 assigned, b = client ID, c = lease deadline */
+
+/* group commit */
+#define WAL_COMMIT_RECORDS 256
+#define WAL_COMMIT_MSECS 100
+
+struct wal_record {
+	uint32_t type;
+	uint32_t sum; /* of the record with this field set to zero */
+	uint64_t n;
+	uint64_t a, b, c, d, e;
+};
+
+struct wal {
+	int fd;
+	uint64_t records; /* since the last checkpoint */
+	uint64_t pending; /* since the last commit */
+	uint64_t last_commit; /* in milliseconds */
+};
+
+UNUSED
+static uint64_t wal_get_msecs(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		return 0;
+	}
+
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a */
+UNUSED
+static uint32_t wal_sum(const struct wal_record *record)
+{
+	struct wal_record copy = *record;
+	const unsigned char *p = (const unsigned char *)&copy;
+	uint32_t hash = UINT32_C(2166136261);
+	size_t i;
+
+	copy.sum = 0;
+
+	for (i = 0; i < sizeof(struct wal_record); ++i) {
+		hash ^= p[i];
+		hash *= UINT32_C(16777619);
+	}
+
+	return hash;
+}
+
+UNUSED
+static int wal_open(struct wal *wal, const char *path)
+{
+	wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+	wal->records = 0;
+	wal->pending = 0;
+	wal->last_commit = wal_get_msecs();
+
+	return wal->fd < 0 ? -1 : 0;
+}
+
+/* returns the number of the records applied, or -1 on error */
+UNUSED
+static int64_t wal_replay(struct wal *wal, void (*apply)(const struct wal_record *))
+{
+	struct wal_record record;
+	int64_t count = 0;
+
+	if (lseek(wal->fd, 0, SEEK_SET) < 0) {
+		return -1;
+	}
+
+	while (1) {
+		ssize_t t = read(wal->fd, &record, sizeof(struct wal_record));
+
+		if (t < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (t < 0) {
+			return -1;
+		}
+
+		/* a torn record at the end is the consequence of the crash */
+		if ((size_t)t != sizeof(struct wal_record) || wal_sum(&record) != record.sum) {
+			break;
+		}
+
+		apply(&record);
+
+		count++;
+	}
+
+	return count;
+}
+
+UNUSED
+static int wal_commit(struct wal *wal)
+{
+	if (wal->fd < 0) {
+		return 0;
+	}
+
+	if (wal->pending > 0 && fdatasync(wal->fd) < 0) {
+		return -1;
+	}
+
+	wal->pending = 0;
+	wal->last_commit = wal_get_msecs();
+
+	return 0;
+}
+
+/* commits the pending records if there are enough of them, or they are too old */
+UNUSED
+static int wal_commit_if_due(struct wal *wal)
+{
+	if (wal->pending == 0) {
+		return 0;
+	}
+
+	if (wal->pending >= WAL_COMMIT_RECORDS || wal_get_msecs() - wal->last_commit >= WAL_COMMIT_MSECS) {
+		return wal_commit(wal);
+	}
+
+	return 0;
+}
+
+UNUSED
+static int wal_append(struct wal *wal, uint32_t type, uint64_t n, uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e)
+{
+	struct wal_record record;
+	size_t written = 0;
+
+	if (wal->fd < 0) {
+		return 0;
+	}
+
+	memset(&record, 0, sizeof(struct wal_record));
+
+	record.type = type;
+	record.n = n;
+	record.a = a;
+	record.b = b;
+	record.c = c;
+	record.d = d;
+	record.e = e;
+	record.sum = wal_sum(&record);
+
+	while (written < sizeof(struct wal_record)) {
+		ssize_t t = write(wal->fd, (char *)&record + written, sizeof(struct wal_record) - written);
+
+		if (t < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (t <= 0) {
+			return -1;
+		}
+
+		written += (size_t)t;
+	}
+
+	wal->records++;
+	wal->pending++;
+
+	if (wal->pending >= WAL_COMMIT_RECORDS) {
+		return wal_commit(wal);
+	}
+
+	return 0;
+}
+
+/* call once the mmapped files are synchronized */
+UNUSED
+static int wal_truncate(struct wal *wal)
+{
+	if (ftruncate(wal->fd, 0) < 0) {
+		return -1;
+	}
+
+	if (fsync(wal->fd) < 0) {
+		return -1;
+	}
+
+	wal->records = 0;
+	wal->pending = 0;
+	wal->last_commit = wal_get_msecs();
+
+	return 0;
+}
+
+UNUSED
+static void wal_close(struct wal *wal)
+{
+	if (wal->fd >= 0) {
+		close(wal->fd);
+	}
+
+	wal->fd = -1;
+}
+
+#endif /* WAL_H_ */
@@ -11,8 +11,14 @@
 
 #include "wideint.h"
 #include "compat.h"
+#include "search.h"
+#include "memo.h"
 
 #define REACH_ONE 1
+
+/* the step counts of the odd n below 2^MEMO_LOG2 are memoized in MEMO_FILE (0 disables) */
+#define MEMO_LOG2 26
+#define MEMO_FILE "memo.dat"
 #define START_VALUE 1
 #define INCREMENT 1
 
@@ -20,6 +26,8 @@
 
 uint64_t g_lut64[LUT_SIZE64];
 
+struct memo g_memo;
+
 void init_lut()
 {
 	int a;
@@ -31,9 +39,7 @@ void init_lut()
 
 double check(uint128_t n)
 {
-#if (REACH_ONE == 0)
 	uint128_t n0 = n;
-#endif
 	uint64_t odd_steps = 0, even_steps = 0;
 	int alpha, beta;
 
@@ -67,28 +73,68 @@ double check(uint128_t n)
 		even_steps += beta;
 
 		n >>= beta;
+
+#if (REACH_ONE == 1)
+		if (memo_lookup(&g_memo, n, &odd_steps, &even_steps)) {
+			break;
+		}
+#endif
 	}
 
+#if (REACH_ONE == 1)
+	memo_store(&g_memo, n0, odd_steps, even_steps);
+#endif
+
 	return odd_steps / (double)even_steps;
 }
 
-int main()
+void check_value(uint128_t n, void *value)
 {
-	uint128_t n = START_VALUE;
-	double C, max_C = 0.;
+	*(double *)value = check(n);
+}
 
-	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+int is_record(const void *value, const void *max)
+{
+	double v = *(const double *)value;
 
-	init_lut();
+	/* NaN is never a record */
+	return v == v && (max == NULL || v > *(const double *)max);
+}
+
+void print_record(uint128_t n, const void *value)
+{
+	printf("%" PRIu64 " (%f), ", (uint64_t)n, *(const double *)value);
+}
 
-	for (;; n += INCREMENT) {
-		C = check(n);
+void print_value(FILE *stream, const void *value)
+{
+	fprintf(stream, "%.17g", *(const double *)value);
+}
 
-		if (C == C && (C > max_C || n == START_VALUE)) {
-			max_C = C;
-			printf("%" PRIu64 " (%f), ", (uint64_t)n, max_C);
-		}
+int scan_value(const char *str, void *value)
+{
+	return sscanf(str, "%lf", (double *)value) == 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct search s;
+
+	s.start = START_VALUE;
+	s.increment = INCREMENT;
+	s.check = check_value;
+	s.is_record = is_record;
+	s.print_record = print_record;
+	s.print_value = print_value;
+	s.scan_value = scan_value;
+
+	init_lut();
+
+#if (MEMO_LOG2 > 0)
+	if (memo_open(&g_memo, MEMO_FILE, MEMO_LOG2) < 0) {
+		return EXIT_FAILURE;
 	}
+#endif
 
-	return 0;
+	return search_main(argc, argv, &s);
 }
@@ -12,6 +12,7 @@
 
 #include "wideint.h"
 #include "compat.h"
+#include "search.h"
 
 #define REACH_ONE 0
 #define SUM_ODD_STEPS 1
@@ -77,23 +78,46 @@ uint64_t check(uint128_t n)
 	return steps;
 }
 
-int main()
+void check_value(uint128_t n, void *value)
 {
-	uint128_t n = 1;
-	uint64_t steps, max_steps = 0;
+	*(uint64_t *)value = check(n);
+}
 
-	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+int is_record(const void *value, const void *max)
+{
+	return max == NULL || *(const uint64_t *)value > *(const uint64_t *)max;
+}
 
-	init_lut();
+void print_record(uint128_t n, const void *value)
+{
+	(void)value;
 
-	for (;; ++n) {
-		steps = check(n);
+	printf("%" PRIu64 ", ", (uint64_t)n);
+}
 
-		if (steps > max_steps || n == 1) {
-			max_steps = steps;
-			printf("%" PRIu64 ", ", (uint64_t)n);
-		}
-	}
+void print_value(FILE *stream, const void *value)
+{
+	fprintf(stream, "%" PRIu64, *(const uint64_t *)value);
+}
+
+int scan_value(const char *str, void *value)
+{
+	return sscanf(str, "%" SCNu64, (uint64_t *)value) == 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct search s;
+
+	s.start = 1;
+	s.increment = 1;
+	s.check = check_value;
+	s.is_record = is_record;
+	s.print_record = print_record;
+	s.print_value = print_value;
+	s.scan_value = scan_value;
+
+	init_lut();
 
-	return 0;
+	return search_main(argc, argv, &s);
 }
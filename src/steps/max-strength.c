@@ -11,13 +11,21 @@
 
 #include "wideint.h"
 #include "compat.h"
+#include "search.h"
+#include "memo.h"
 
 #define REACH_ONE 1
 
+/* the step counts of the odd n below 2^MEMO_LOG2 are memoized in MEMO_FILE (0 disables) */
+#define MEMO_LOG2 26
+#define MEMO_FILE "memo.dat"
+
 #define LUT_SIZE64 41
 
 uint64_t g_lut64[LUT_SIZE64];
 
+struct memo g_memo;
+
 void init_lut()
 {
 	int a;
@@ -29,9 +37,7 @@ void init_lut()
 
 int64_t check(uint128_t n)
 {
-#if (REACH_ONE == 0)
 	uint128_t n0 = n;
-#endif
 	uint64_t steps_alpha = 0, steps_beta = 0;
 	int alpha, beta;
 
@@ -65,28 +71,67 @@ int64_t check(uint128_t n)
 		steps_beta += beta;
 
 		n >>= beta;
+
+#if (REACH_ONE == 1)
+		if (memo_lookup(&g_memo, n, &steps_alpha, &steps_beta)) {
+			break;
+		}
+#endif
 	}
 
+#if (REACH_ONE == 1)
+	memo_store(&g_memo, n0, steps_alpha, steps_beta);
+#endif
+
 	return 2 * steps_alpha - 3 * steps_beta;
 }
 
-int main()
+void check_value(uint128_t n, void *value)
 {
-	uint128_t n = 1;
-	int64_t strength, max_strength = 0;
+	*(int64_t *)value = check(n);
+}
 
-	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+int is_record(const void *value, const void *max)
+{
+	return max == NULL || *(const int64_t *)value > *(const int64_t *)max;
+}
 
-	init_lut();
+void print_record(uint128_t n, const void *value)
+{
+	(void)value;
 
-	for (;; ++n) {
-		strength = check(n);
+	printf("%" PRIu64 ", ", (uint64_t)n);
+}
 
-		if (strength > max_strength || n == 1) {
-			max_strength = strength;
-			printf("%" PRIu64 ", ", (uint64_t)n);
-		}
+void print_value(FILE *stream, const void *value)
+{
+	fprintf(stream, "%" PRId64, *(const int64_t *)value);
+}
+
+int scan_value(const char *str, void *value)
+{
+	return sscanf(str, "%" SCNd64, (int64_t *)value) == 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct search s;
+
+	s.start = 1;
+	s.increment = 1;
+	s.check = check_value;
+	s.is_record = is_record;
+	s.print_record = print_record;
+	s.print_value = print_value;
+	s.scan_value = scan_value;
+
+	init_lut();
+
+#if (MEMO_LOG2 > 0)
+	if (memo_open(&g_memo, MEMO_FILE, MEMO_LOG2) < 0) {
+		return EXIT_FAILURE;
 	}
+#endif
 
-	return 0;
+	return search_main(argc, argv, &s);
 }
@@ -0,0 +1,153 @@
+/**
+ * Memoized step counts of the trajectories.
+ *
+ * For the odd n below 2^MEMO_LOG2, the table holds the numbers of the odd
+ * and even steps of the trajectory of n until it reaches 1 (packed into 32
+ * bits, zero if not known yet). Once a trajectory drops below the bound,
+ * the rest of the steps is taken from the table instead of iterated. The
+ * table is filled as the numbers are checked.
+ *
+ * The table is mapped from a file, so it is shared between the runs (and
+ * the tools, all of them count the same steps). Only the odd n are held,
+ * n at the index n/2, so the file can be grown or shrunk to another bound
+ * and the entries stay valid. The entries are written without locking,
+ * a 32-bit store is atomic and a missing entry is only slower.
+ */
+
+#ifndef MEMO_MEMO_H_
+#define MEMO_MEMO_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "wideint.h"
+#include "compat.h"
+
+#define MEMO_MAGIC UINT64_C(0x4f4d454d) /* "MEMO" */
+#define MEMO_VERSION 1
+
+struct memo_header {
+	uint64_t magic;
+	uint64_t version;
+};
+
+struct memo {
+	uint128_t bound;
+	size_t size;
+	struct memo_header *header;
+	volatile uint32_t *table;
+};
+
+#define MEMO_SIZE(log2) (sizeof(struct memo_header) + ((size_t)1 << ((log2) - 1)) * sizeof(uint32_t))
+
+/* maps (or creates) the table of the odd n below 2^log2, returns -1 on failure */
+UNUSED
+static int memo_open(struct memo *memo, const char *path, int log2)
+{
+	size_t size = MEMO_SIZE(log2);
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	memo->bound = (uint128_t)1 << log2;
+	memo->size = size;
+	memo->header = NULL;
+	memo->table = NULL;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	/* the entries stay valid, the new ones are zero */
+	if ((size_t)st.st_size != size && ftruncate(fd, (off_t)size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (ptr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	memo->header = ptr;
+	memo->table = (volatile uint32_t *)(memo->header + 1);
+
+	if (st.st_size == 0) {
+		memo->header->magic = MEMO_MAGIC;
+		memo->header->version = MEMO_VERSION;
+	}
+
+	if (memo->header->magic != MEMO_MAGIC || memo->header->version != MEMO_VERSION) {
+		fprintf(stderr, "%s is not a memo table\n", path);
+		munmap(ptr, size);
+		memo->header = NULL;
+		memo->table = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+UNUSED
+static void memo_close(struct memo *memo)
+{
+	if (memo->header != NULL) {
+		munmap(memo->header, memo->size);
+		memo->header = NULL;
+		memo->table = NULL;
+	}
+}
+
+/* adds the remaining steps of the odd n, returns 1 if they are known */
+UNUSED
+static int memo_lookup(const struct memo *memo, uint128_t n, uint64_t *odd_steps, uint64_t *even_steps)
+{
+	uint32_t entry;
+
+	if (memo->table == NULL || n >= memo->bound) {
+		return 0;
+	}
+
+	entry = memo->table[(size_t)(n >> 1)];
+
+	if (entry == 0) {
+		return 0;
+	}
+
+	*odd_steps += entry & 0xffff;
+	*even_steps += entry >> 16;
+
+	return 1;
+}
+
+/* all steps of the trajectory of n */
+UNUSED
+static void memo_store(struct memo *memo, uint128_t n, uint64_t odd_steps, uint64_t even_steps)
+{
+	if (memo->table == NULL || n >= memo->bound || !(n & 1) || odd_steps > 0xffff || even_steps > 0xffff) {
+		return;
+	}
+
+	memo->table[(size_t)(n >> 1)] = (uint32_t)(odd_steps | (even_steps << 16));
+}
+
+#endif /* MEMO_MEMO_H_ */
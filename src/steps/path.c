@@ -1,58 +1,366 @@
+/*
+ * The trajectory of n0 until it reaches 1, in the compressed form of
+ * steps.c: alpha odd steps (3n+1)/2 followed by beta even steps n/2. The
+ * numbers are held in uint128_t, in GMP only while they exceed 128 bits
+ * (without GMP, such a trajectory is an error).
+ *
+ * usage: path [-b | -t] n0
+ *
+ * By default, the statistics of the trajectory are printed. With -b, the
+ * (alpha, beta) pairs are written to stdout as unsigned LEB128 varints.
+ * With -t, the number after each pair is printed.
+ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
 #ifdef _USE_GMP
 #	include <gmp.h>
 #endif
 
-int main(int argc, char *argv[])
+#include "wideint.h"
+#include "compat.h"
+
+#define LUT_SIZE64 41
+
+uint64_t g_lut64[LUT_SIZE64];
+
+void init_lut()
 {
+	int a;
+
+	for (a = 0; a < LUT_SIZE64; ++a) {
+		g_lut64[a] = pow3u64((uint64_t)a);
+	}
+}
+
+#define MODE_SUMMARY 0
+#define MODE_BINARY 1
+#define MODE_TEXT 2
+
+int g_mode = MODE_SUMMARY;
+
+/* the statistics */
+uint64_t g_steps_alpha = 0;
+uint64_t g_steps_beta = 0;
+uint64_t g_pairs = 0;
+int g_max_alpha = 0;
+int g_max_beta = 0;
+uint64_t g_max_step = 0; /* the steps before the maximum */
+uint128_t g_max = 0;
+
 #ifdef _USE_GMP
-	mpz_t n0, n, max;
-	unsigned step = 0;
+/* the maximum, if it exceeds 128 bits */
+mpz_t g_max_wide;
+int g_max_is_wide = 0;
+#endif
 
-	if (argc < 2) {
-		printf("[ERROR] argument expected\n");
-		return EXIT_FAILURE;
+/* the decimal representation, the buffer must hold 39 characters + 1 */
+char *u128_to_str(uint128_t n, char *buff)
+{
+	char digits[40];
+	int len = 0;
+	int i;
+
+	do {
+		digits[len++] = (char)('0' + (int)(n % 10));
+		n /= 10;
+	} while (n != 0);
+
+	for (i = 0; i < len; ++i) {
+		buff[i] = digits[len - 1 - i];
 	}
 
-	mpz_init(n0);
+	buff[len] = 0;
+
+	return buff;
+}
+
+/* returns -1 if the number does not fit */
+int str_to_u128(const char *str, uint128_t *n)
+{
+	*n = 0;
+
+	for (; *str >= '0' && *str <= '9'; ++str) {
+		int d = *str - '0';
+
+		if (*n > (UINT128_MAX - (uint128_t)d) / 10) {
+			return -1;
+		}
+
+		*n = *n * 10 + (uint128_t)d;
+	}
+
+	/* n + 1 must fit */
+	return *n == UINT128_MAX ? -1 : 0;
+}
+
+int bitsize_u128(uint128_t n)
+{
+	int bits = 0;
+
+	for (; n != 0; n >>= 1) {
+		bits++;
+	}
+
+	return bits;
+}
+
+void put_varint(uint64_t v)
+{
+	while (v >= 0x80) {
+		putchar((int)(v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+
+	putchar((int)v);
+}
+
+/* the number n after a pair */
+void add_pair(int alpha, int beta)
+{
+	g_steps_alpha += (uint64_t)alpha;
+	g_steps_beta += (uint64_t)beta;
+	g_pairs++;
+
+	if (alpha > g_max_alpha) {
+		g_max_alpha = alpha;
+	}
+
+	if (beta > g_max_beta) {
+		g_max_beta = beta;
+	}
+
+	if (g_mode == MODE_BINARY) {
+		put_varint((uint64_t)alpha);
+		put_varint((uint64_t)beta);
+	}
+}
+
+/* the maximum is reached after the odd steps of a pair */
+void add_maximum(uint128_t n, int alpha)
+{
+	if (
+#ifdef _USE_GMP
+		!g_max_is_wide &&
+#endif
+		n > g_max) {
+		g_max = n;
+		g_max_step = g_steps_alpha + (uint64_t)alpha + g_steps_beta;
+	}
+}
+
+#ifdef _USE_GMP
+void mpz_set_u128(mpz_t rop, uint128_t op)
+{
+	mpz_set_ui(rop, (unsigned long)(uint64_t)(op >> 64));
+	mpz_mul_2exp(rop, rop, (mp_bitcnt_t)64);
+	mpz_add_ui(rop, rop, (unsigned long)(uint64_t)op);
+}
+
+uint128_t mpz_get_u128(const mpz_t op)
+{
+	mpz_t t;
+	uint128_t n;
+
+	mpz_init(t);
+	mpz_fdiv_q_2exp(t, op, (mp_bitcnt_t)64);
+	n = (uint128_t)mpz_get_ui(t) << 64;
+	mpz_fdiv_r_2exp(t, op, (mp_bitcnt_t)64);
+	n |= (uint128_t)mpz_get_ui(t);
+	mpz_clear(t);
+
+	return n;
+}
+
+/* at least one pair in GMP, until the number fits 126 bits again */
+void trace_wide(mpz_t n)
+{
+	mpz_t pow3;
+
+	mpz_init(pow3);
+
+	do {
+		int alpha, beta;
 
-	gmp_sscanf(argv[1], "%Zd", n0);
+		mpz_add_ui(n, n, 1UL);
+		alpha = (int)mpz_scan1(n, 0);
+		mpz_fdiv_q_2exp(n, n, (mp_bitcnt_t)alpha);
+		mpz_ui_pow_ui(pow3, 3UL, (unsigned long)alpha);
+		mpz_mul(n, n, pow3);
+		mpz_sub_ui(n, n, 1UL);
 
-	mpz_init_set(n, n0); /* n = n0 */
-	mpz_init_set(max, n); /* max = n */
+		if (!g_max_is_wide || mpz_cmp(n, g_max_wide) > 0) {
+			if (mpz_sizeinbase(n, 2) > 128) {
+				mpz_set(g_max_wide, n);
+				g_max_is_wide = 1;
+				g_max_step = g_steps_alpha + (uint64_t)alpha + g_steps_beta;
+			} else {
+				add_maximum(mpz_get_u128(n), alpha);
+			}
+		}
 
-	gmp_printf("step=%u n=%Zd\n", step, n);
+		beta = (int)mpz_scan1(n, 0);
+		mpz_fdiv_q_2exp(n, n, (mp_bitcnt_t)beta);
 
-	while (mpz_cmp_ui(n, 1UL) != 0) {
-		/* next step */
-		if (mpz_congruent_ui_p(n, 1UL, 2UL)) {
-			/* odd step */
-			mpz_mul_ui(n, n, 3UL);
-			mpz_add_ui(n, n, 1UL);
+		add_pair(alpha, beta);
 
-			mpz_fdiv_q_ui(n, n, 2UL);
-		} else {
-			/* even step */
-			mpz_fdiv_q_ui(n, n, 2UL);
+		if (g_mode == MODE_TEXT) {
+			gmp_printf("pair=%" PRIu64 " step=%" PRIu64 " n=%Zd\n", g_pairs, g_steps_alpha + g_steps_beta, n);
 		}
-		step++;
+	} while (mpz_sizeinbase(n, 2) > 126);
 
-		if (mpz_cmp(n, max) > 0) {
-			mpz_set(max, n);
+	mpz_clear(pow3);
+}
+#endif
+
+/* returns -1 if the trajectory exceeds 128 bits without GMP */
+int trace(uint128_t n)
+{
+	while (n != 1) {
+		int alpha, beta;
+
+		n++;
+
+		alpha = ctzu64((uint64_t)n);
+
+		/* the low word can be zero, or the power of three out of the table */
+		if (alpha >= LUT_SIZE64) {
+			alpha = LUT_SIZE64 - 1;
+		}
+
+		n >>= alpha;
+
+		if (n > UINT128_MAX >> 2*alpha) {
+#ifdef _USE_GMP
+			mpz_t t;
+
+			/* the number before this pair */
+			n = (n << alpha) - 1;
+
+			mpz_init(t);
+			mpz_set_u128(t, n);
+			trace_wide(t);
+			n = mpz_get_u128(t);
+			mpz_clear(t);
+
+			continue;
+#else
+			return -1;
+#endif
 		}
 
-		gmp_printf("step=%u n=%Zd\n", step, n);
+		n *= g_lut64[alpha];
+
+		n--;
+
+		add_maximum(n, alpha);
+
+		/* the low word can be zero, the rest follows as (0, beta) pairs */
+		beta = ctzu64((uint64_t)n);
+
+		n >>= beta;
+
+		add_pair(alpha, beta);
+
+		if (g_mode == MODE_TEXT) {
+			char n_str[40];
+
+			printf("pair=%" PRIu64 " step=%" PRIu64 " n=%s\n", g_pairs, g_steps_alpha + g_steps_beta, u128_to_str(n, n_str));
+		}
 	}
 
-	gmp_printf("maximum=%Zd (%lu)\n", max, (unsigned long)mpz_sizeinbase(max, 2));
+	return 0;
+}
+
+void print_summary(void)
+{
+	char n_str[40];
+
+	printf("STEPS ODD=%" PRIu64 " EVEN=%" PRIu64 " TOTAL=%" PRIu64 "\n", g_steps_alpha, g_steps_beta, g_steps_alpha + g_steps_beta);
+	printf("PAIRS %" PRIu64 " MAX_ALPHA=%i MAX_BETA=%i\n", g_pairs, g_max_alpha, g_max_beta);
+
+#ifdef _USE_GMP
+	if (g_max_is_wide) {
+		gmp_printf("MAXIMUM %Zd (%lu bits) STEP %" PRIu64 "\n", g_max_wide, (unsigned long)mpz_sizeinbase(g_max_wide, 2), g_max_step);
+		return;
+	}
+#endif
 
-	mpz_clear(max);
-	mpz_clear(n);
-	mpz_clear(n0);
+	printf("MAXIMUM %s (%i bits) STEP %" PRIu64 "\n", u128_to_str(g_max, n_str), bitsize_u128(g_max), g_max_step);
+}
+
+int main(int argc, char *argv[])
+{
+	uint128_t n0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bt")) != -1) {
+		switch (opt) {
+			case 'b':
+				g_mode = MODE_BINARY;
+				break;
+			case 't':
+				g_mode = MODE_TEXT;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-b | -t] n0\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		printf("[ERROR] argument expected\n");
+		return EXIT_FAILURE;
+	}
+
+	init_lut();
+
+	if (g_mode == MODE_SUMMARY) {
+		printf("NUMBER %s\n", argv[optind]);
+	}
+
+#ifdef _USE_GMP
+	mpz_init(g_max_wide);
+#endif
+
+	if (str_to_u128(argv[optind], &n0) < 0) {
+#ifdef _USE_GMP
+		mpz_t n;
+
+		/* the starting value itself exceeds 128 bits */
+		mpz_init_set_str(n, argv[optind], 10);
+		mpz_set(g_max_wide, n);
+		g_max_is_wide = 1;
+		trace_wide(n);
+		n0 = mpz_get_u128(n);
+		mpz_clear(n);
 #else
-	(void)argc;
-	(void)argv;
+		printf("[ERROR] the number exceeds 128 bits, GMP is required\n");
+		return EXIT_FAILURE;
+#endif
+	} else {
+		g_max = n0;
+	}
+
+	if (n0 == 0) {
+		printf("[ERROR] positive number expected\n");
+		return EXIT_FAILURE;
+	}
+
+	if (trace(n0) < 0) {
+		printf("[ERROR] the trajectory exceeds 128 bits, GMP is required\n");
+		return EXIT_FAILURE;
+	}
+
+	if (g_mode == MODE_SUMMARY) {
+		print_summary();
+	}
+
+#ifdef _USE_GMP
+	mpz_clear(g_max_wide);
 #endif
 
 	return 0;
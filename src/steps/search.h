@@ -0,0 +1,199 @@
+/**
+ * Parallel search for the records of a metric.
+ *
+ * The numbers are processed in rounds of SEARCH_ROUND_CHUNKS chunks, the
+ * chunks of a round in parallel. A record must exceed all of the preceding
+ * values in its chunk, so only these candidates are kept, and then they
+ * are compared with the current maximum in the order of the chunks. The
+ * printed records are the same as those of the serial search.
+ *
+ * The search can be resumed from the number n with the maximum m (-s n
+ * -m m), these are reported on stderr after every SEARCH_PROGRESS_ROUNDS
+ * rounds.
+ */
+
+#ifndef SEARCH_SEARCH_H_
+#define SEARCH_SEARCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "wideint.h"
+#include "compat.h"
+
+/* the numbers processed by a thread at once */
+#define SEARCH_CHUNK_SIZE (1UL << 14)
+
+/* the chunks of a round */
+#define SEARCH_ROUND_CHUNKS 1024
+
+#define SEARCH_PROGRESS_ROUNDS 256
+
+/* the value of the metric is held in an opaque buffer */
+#define SEARCH_VALUE_MAX 16
+
+struct search {
+	uint128_t start; /* the first number */
+	uint128_t increment;
+	/* the value of the metric for n */
+	void (*check)(uint128_t n, void *value);
+	/* the value is a record over the maximum (with NULL, the value is valid) */
+	int (*is_record)(const void *value, const void *max);
+	/* prints a record */
+	void (*print_record)(uint128_t n, const void *value);
+	/* the maximum, to resume the search */
+	void (*print_value)(FILE *stream, const void *value);
+	int (*scan_value)(const char *str, void *value);
+};
+
+/* a candidate within a chunk */
+struct search_candidate {
+	uint128_t n;
+	unsigned char value[SEARCH_VALUE_MAX];
+};
+
+struct search_chunk {
+	struct search_candidate *candidates;
+	size_t count;
+	size_t cap;
+};
+
+UNUSED
+static void search_push(struct search_chunk *chunk, uint128_t n, const void *value)
+{
+	if (chunk->count == chunk->cap) {
+		size_t cap = chunk->cap ? 2 * chunk->cap : 16;
+		struct search_candidate *p = realloc(chunk->candidates, sizeof(struct search_candidate) * cap);
+
+		if (p == NULL) {
+			perror("realloc");
+			abort();
+		}
+
+		chunk->candidates = p;
+		chunk->cap = cap;
+	}
+
+	chunk->candidates[chunk->count].n = n;
+	memcpy(chunk->candidates[chunk->count].value, value, SEARCH_VALUE_MAX);
+	chunk->count++;
+}
+
+/*
+ * The first number of the search is a record if its value is valid, the
+ * maximum is zero before.
+ */
+UNUSED
+static int search_is_record(const struct search *s, uint128_t n, const void *value, const void *max, int first)
+{
+	if (first && n == s->start) {
+		return s->is_record(value, NULL);
+	}
+
+	return s->is_record(value, max);
+}
+
+/* processes the round starting at n, the maximum is updated */
+UNUSED
+static void search_round(const struct search *s, uint128_t n, void *max, int first)
+{
+	struct search_chunk chunks[SEARCH_ROUND_CHUNKS];
+	int c;
+
+	memset(chunks, 0, sizeof(chunks));
+
+	#pragma omp parallel for schedule(dynamic)
+	for (c = 0; c < SEARCH_ROUND_CHUNKS; ++c) {
+		uint128_t m = n + (uint128_t)c * SEARCH_CHUNK_SIZE * s->increment;
+		unsigned char value[SEARCH_VALUE_MAX];
+		unsigned char local_max[SEARCH_VALUE_MAX];
+		unsigned long i;
+
+		/* the maximum can only grow */
+		memcpy(local_max, max, SEARCH_VALUE_MAX);
+
+		for (i = 0; i < SEARCH_CHUNK_SIZE; ++i, m += s->increment) {
+			memset(value, 0, SEARCH_VALUE_MAX);
+
+			s->check(m, value);
+
+			if (search_is_record(s, m, value, local_max, first)) {
+				memcpy(local_max, value, SEARCH_VALUE_MAX);
+				search_push(&chunks[c], m, value);
+			}
+		}
+	}
+
+	for (c = 0; c < SEARCH_ROUND_CHUNKS; ++c) {
+		size_t i;
+
+		for (i = 0; i < chunks[c].count; ++i) {
+			const struct search_candidate *candidate = &chunks[c].candidates[i];
+
+			if (search_is_record(s, candidate->n, candidate->value, max, first)) {
+				memcpy(max, candidate->value, SEARCH_VALUE_MAX);
+				s->print_record(candidate->n, candidate->value);
+			}
+		}
+
+		free(chunks[c].candidates);
+	}
+}
+
+/* usage: program [-s start -m maximum] */
+UNUSED
+static int search_main(int argc, char *argv[], const struct search *s)
+{
+	uint128_t n = s->start;
+	unsigned char max[SEARCH_VALUE_MAX];
+	int resume = 0;
+	unsigned long round;
+	int opt;
+
+	memset(max, 0, SEARCH_VALUE_MAX);
+
+	while ((opt = getopt(argc, argv, "s:m:")) != -1) {
+		switch (opt) {
+			case 's':
+				n = (uint128_t)atou64(optarg);
+				resume |= 1;
+				break;
+			case 'm':
+				if (s->scan_value(optarg, max) < 0) {
+					fprintf(stderr, "invalid maximum %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				resume |= 2;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s start -m maximum]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (resume == 1) {
+		fprintf(stderr, "the maximum must be given to resume the search\n");
+		return EXIT_FAILURE;
+	}
+
+	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+
+	for (round = 1;; ++round) {
+		search_round(s, n, max, round == 1 && !resume);
+
+		n += (uint128_t)SEARCH_ROUND_CHUNKS * SEARCH_CHUNK_SIZE * s->increment;
+
+		if (round % SEARCH_PROGRESS_ROUNDS == 0) {
+			fprintf(stderr, "\nto resume: -s %" PRIu64 " -m ", (uint64_t)n);
+			s->print_value(stderr, max);
+			fprintf(stderr, "\n");
+		}
+	}
+
+	return 0;
+}
+
+#endif /* SEARCH_SEARCH_H_ */